@@ -30,6 +30,7 @@
 #include "IOSCSIPrimaryCommandsDevice.h"
 #include "SCSITaskDefinition.h"
 #include "SCSIPrimaryCommands.h"
+#include "SCSICommandDescriptorBlockLayout.h"
 #include <IOKit/pwr_mgt/IOPMpowerState.h>
 #include <IOKit/IOCommand.h>
 
@@ -228,7 +229,7 @@ IOSCSIPrimaryCommandsDevice::CHANGE_DEFINITION (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	__Require_noErr ( scsiRequest, ErrorExit );
 	__Require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -265,7 +266,7 @@ IOSCSIPrimaryCommandsDevice::COMPARE (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	__Require_noErr ( scsiRequest, ErrorExit );
 	__Require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -301,7 +302,7 @@ IOSCSIPrimaryCommandsDevice::COPY (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	__Require_noErr ( scsiRequest, ErrorExit );
 	__Require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -338,7 +339,7 @@ IOSCSIPrimaryCommandsDevice::COPY_AND_VERIFY (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	__Require_noErr ( scsiRequest, ErrorExit );
 	__Require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -374,7 +375,7 @@ IOSCSIPrimaryCommandsDevice::EXTENDED_COPY (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	__Require_noErr ( scsiRequest, ErrorExit );
 	__Require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -408,21 +409,36 @@ IOSCSIPrimaryCommandsDevice::INQUIRY (
 						SCSICmdField1Byte			CONTROL )
 {	
 	
-	SCSITask *	scsiRequest	= NULL;
-	bool		status 		= false;
+	SCSITask *							scsiRequest	= NULL;
+	bool								status 		= false;
+	SCSICDBBuilder < SCSICDB_INQUIRY >	cdb;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	__Require_noErr ( scsiRequest, ErrorExit );
 	__Require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
-	status = GetSCSIPrimaryCommandObject ( )->INQUIRY (
-											scsiRequest,
-											dataBuffer,
-											CMDDT,
-											EVPD,
-											PAGE_OR_OPERATION_CODE,
-											ALLOCATION_LENGTH,
-											CONTROL );
+	cdb.Set < SCSICDB_INQUIRY::CMDDT > ( CMDDT );
+	cdb.Set < SCSICDB_INQUIRY::EVPD > ( EVPD );
+	cdb.Set < SCSICDB_INQUIRY::PAGE_OR_OPERATION_CODE > ( PAGE_OR_OPERATION_CODE );
+	cdb.Set < SCSICDB_INQUIRY::ALLOCATION_LENGTH > ( ALLOCATION_LENGTH );
+	cdb.Set < SCSICDB_INQUIRY::CONTROL > ( CONTROL );
+	__Require ( cdb.IsValid ( ), ErrorExit );
+	__Require ( IsMemoryDescriptorValid ( dataBuffer, ALLOCATION_LENGTH ), ErrorExit );
+	
+	// A page or operation code is only valid with exactly one of the CMDDT
+	// and EVPD bits set.
+	if ( PAGE_OR_OPERATION_CODE != 0 )
+	{
+		__Require ( ( CMDDT != EVPD ), ErrorExit );
+	}
+	
+	scsiRequest->SetCommandDescriptorBlock ( cdb.GetCommandDescriptorBlock ( ), cdb.GetSize ( ) );
+	scsiRequest->SetTimeoutDuration ( 0 );
+	scsiRequest->SetDataTransferDirection ( kSCSIDataTransfer_FromTargetToInitiator );
+	scsiRequest->SetDataBuffer ( dataBuffer );
+	scsiRequest->SetRequestedDataTransferCount ( ALLOCATION_LENGTH );
+	
+	status = true;
 	
 	
 ErrorExit:
@@ -451,7 +467,7 @@ IOSCSIPrimaryCommandsDevice::LOG_SELECT (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	__Require_noErr ( scsiRequest, ErrorExit );
 	__Require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -493,7 +509,7 @@ IOSCSIPrimaryCommandsDevice::LOG_SENSE (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	__Require_noErr ( scsiRequest, ErrorExit );
 	__Require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -534,7 +550,7 @@ IOSCSIPrimaryCommandsDevice::MODE_SELECT_6 (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	__Require_noErr ( scsiRequest, ErrorExit );
 	__Require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -572,7 +588,7 @@ IOSCSIPrimaryCommandsDevice::MODE_SELECT_10 (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	__Require_noErr ( scsiRequest, ErrorExit );
 	__Require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -611,7 +627,7 @@ IOSCSIPrimaryCommandsDevice::MODE_SENSE_6 (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	__Require_noErr ( scsiRequest, ErrorExit );
 	__Require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -652,7 +668,7 @@ IOSCSIPrimaryCommandsDevice::MODE_SENSE_10 (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	__Require_noErr ( scsiRequest, ErrorExit );
 	__Require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -692,7 +708,7 @@ IOSCSIPrimaryCommandsDevice::PERSISTENT_RESERVE_IN (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	__Require_noErr ( scsiRequest, ErrorExit );
 	__Require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -730,7 +746,7 @@ IOSCSIPrimaryCommandsDevice::PERSISTENT_RESERVE_OUT (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	__Require_noErr ( scsiRequest, ErrorExit );
 	__Require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -766,7 +782,7 @@ IOSCSIPrimaryCommandsDevice::PREVENT_ALLOW_MEDIUM_REMOVAL (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	__Require_noErr ( scsiRequest, ErrorExit );
 	__Require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -802,7 +818,7 @@ IOSCSIPrimaryCommandsDevice::READ_BUFFER (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	__Require_noErr ( scsiRequest, ErrorExit );
 	__Require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -839,7 +855,7 @@ IOSCSIPrimaryCommandsDevice::RECEIVE (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	__Require_noErr ( scsiRequest, ErrorExit );
 	__Require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -876,7 +892,7 @@ IOSCSIPrimaryCommandsDevice::RECEIVE_DIAGNOSTICS_RESULTS (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	__Require_noErr ( scsiRequest, ErrorExit );
 	__Require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -910,7 +926,7 @@ IOSCSIPrimaryCommandsDevice::RELEASE_6 (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	__Require_noErr ( scsiRequest, ErrorExit );
 	__Require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -943,7 +959,7 @@ IOSCSIPrimaryCommandsDevice::RELEASE_6 (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	__Require_noErr ( scsiRequest, ErrorExit );
 	__Require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -980,7 +996,7 @@ IOSCSIPrimaryCommandsDevice::RELEASE_10 (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	__Require_noErr ( scsiRequest, ErrorExit );
 	__Require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -1022,7 +1038,7 @@ IOSCSIPrimaryCommandsDevice::RELEASE_10 (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	__Require_noErr ( scsiRequest, ErrorExit );
 	__Require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -1062,7 +1078,7 @@ IOSCSIPrimaryCommandsDevice::REPORT_DEVICE_IDENTIFIER (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	__Require_noErr ( scsiRequest, ErrorExit );
 	__Require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -1096,7 +1112,7 @@ IOSCSIPrimaryCommandsDevice::REPORT_LUNS (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	__Require_noErr ( scsiRequest, ErrorExit );
 	__Require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -1130,7 +1146,7 @@ IOSCSIPrimaryCommandsDevice::REQUEST_SENSE (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	__Require_noErr ( scsiRequest, ErrorExit );
 	__Require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -1163,7 +1179,7 @@ IOSCSIPrimaryCommandsDevice::RESERVE_6 (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	__Require_noErr ( scsiRequest, ErrorExit );
 	__Require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -1197,7 +1213,7 @@ IOSCSIPrimaryCommandsDevice::RESERVE_6 (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	__Require_noErr ( scsiRequest, ErrorExit );
 	__Require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -1236,7 +1252,7 @@ IOSCSIPrimaryCommandsDevice::RESERVE_10 (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	__Require_noErr ( scsiRequest, ErrorExit );
 	__Require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -1278,7 +1294,7 @@ IOSCSIPrimaryCommandsDevice::RESERVE_10 (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	__Require_noErr ( scsiRequest, ErrorExit );
 	__Require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -1318,7 +1334,7 @@ IOSCSIPrimaryCommandsDevice::SEND (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	__Require_noErr ( scsiRequest, ErrorExit );
 	__Require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -1358,7 +1374,7 @@ IOSCSIPrimaryCommandsDevice::SEND_DIAGNOSTICS (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	__Require_noErr ( scsiRequest, ErrorExit );
 	__Require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -1399,7 +1415,7 @@ IOSCSIPrimaryCommandsDevice::SET_DEVICE_IDENTIFIER (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	__Require_noErr ( scsiRequest, ErrorExit );
 	__Require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -1429,16 +1445,23 @@ IOSCSIPrimaryCommandsDevice::TEST_UNIT_READY (
 						SCSICmdField1Byte			CONTROL )
 {
 	
-	SCSITask *	scsiRequest	= NULL;
-	bool		status 		= false;
+	SCSITask *									scsiRequest	= NULL;
+	bool										status 		= false;
+	SCSICDBBuilder < SCSICDB_TEST_UNIT_READY >	cdb;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	__Require_noErr ( scsiRequest, ErrorExit );
 	__Require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
-	status = GetSCSIPrimaryCommandObject ( )->TEST_UNIT_READY (
-											scsiRequest,
-											CONTROL );
+	cdb.Set < SCSICDB_TEST_UNIT_READY::CONTROL > ( CONTROL );
+	
+	scsiRequest->SetCommandDescriptorBlock ( cdb.GetCommandDescriptorBlock ( ), cdb.GetSize ( ) );
+	scsiRequest->SetTimeoutDuration ( 10 * 1000 );
+	scsiRequest->SetDataTransferDirection ( kSCSIDataTransfer_NoDataTransfer );
+	scsiRequest->SetDataBuffer ( NULL );
+	scsiRequest->SetRequestedDataTransferCount ( 0 );
+	
+	status = true;
 	
 	
 ErrorExit:
@@ -1467,7 +1490,7 @@ IOSCSIPrimaryCommandsDevice::WRITE_BUFFER (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	__Require_noErr ( scsiRequest, ErrorExit );
 	__Require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
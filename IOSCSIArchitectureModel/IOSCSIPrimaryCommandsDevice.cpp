@@ -28,6 +28,8 @@
 
 // Libkern includes
 #include <libkern/OSByteOrder.h>
+#include <libkern/OSAtomic.h>
+#include <libkern/libkern.h>
 
 // Generic IOKit related headers
 #include <IOKit/IOMessage.h>
@@ -40,6 +42,7 @@
 
 // SCSI Architecture Model Family includes
 #include <IOKit/scsi/SCSICommandOperationCodes.h>
+#include <kern/cpu_number.h>
 
 #include "IOSCSIPrimaryCommandsDevice.h"
 #include "SCSIPrimaryCommands.h"
@@ -99,12 +102,185 @@ enum
 #define kAppleKeySwitchProperty						"AppleKeyswitch"
 #define kKeySwitchProperty							"Keyswitch"
 
+// Tagged task space
+#define kSCSIDefaultTaggedTaskCount					64
+#define kSCSIMaximumTaggedTaskCount					1024
+#define kTagBitmapBitsPerWord						32
+#define kIOPropertyTaggedTaskStatisticsKey			"Tagged Task Statistics"
+#define kIOPropertyTaggedTaskQueueDepthKey			"Queue Depth"
+#define kIOPropertyTaggedTasksInUseKey				"Tags In Use"
+#define kIOPropertyTaggedTasksHighWaterKey			"Maximum Tags In Use"
+#define kIOPropertyTaggedTaskFailuresKey			"Tag Allocation Failures"
+#define kStatisticsPublishDelayMS					1000
+#define kMediaPollIntervalMS						1000
+#define kMediaPollMaximumIntervalMS					4000
+#define kMediaPollIdleBackoffCount					4
+#define kMediaPollWheelSlots						64
+#define kMediaPollWheelTickMS						250
+#define kIOPropertyMediaPollStatisticsKey			"Media Poll Statistics"
+#define kIOPropertyMediaPollCountKey				"Poll Count"
+#define kIOPropertyMediaPollTotalTimeKey			"Total Poll Time"
+#define kIOPropertyMediaPollMaximumTimeKey			"Maximum Poll Time"
+#define kIOPropertyMediaPollIntervalKey				"Poll Interval"
+#define kQuiesceTimeoutMS							10000
+#define kQuiesceAbortTimeoutMS						5000
+#define kQuiesceMaximumAborts						8
+#define kIOPropertyQuiesceStatisticsKey				"Quiesce Statistics"
+#define kIOPropertyQuiesceCountKey					"Quiesce Count"
+#define kIOPropertyQuiesceLastDrainTimeKey			"Last Drain Time"
+#define kIOPropertyQuiesceMaximumDrainTimeKey		"Maximum Drain Time"
+#define kIOPropertyQuiesceTotalDrainTimeKey			"Total Drain Time"
+#define kIOPropertyQuiesceTimeoutsKey				"Quiesce Timeouts"
+
+// Read and write latency histograms. Latencies are counted in microseconds,
+// in log-linear buckets: the first kLatencySubBuckets buckets are one
+// microsecond wide, and each later power of two is split into
+// kLatencySubBuckets buckets of equal width. The last bucket also counts
+// anything longer, from about 30 seconds up.
+#define kLatencySubBucketShift						2
+#define kLatencySubBuckets							( 1 << kLatencySubBucketShift )
+#define kLatencyBucketCount							96
+#define kLatencyHistogramShards						8
+#define kIOPropertyLatencyStatisticsKey				"Latency Statistics"
+#define kIOPropertyLatencySubBucketsKey				"Buckets Per Power Of Two"
+
+enum
+{
+	kLatencyStage_QueueWait		= 0,
+	kLatencyStage_Service		= 1,
+	kLatencyStage_Autosense		= 2,
+	kLatencyStage_Completion	= 3,
+	kLatencyStageCount			= 4
+};
+
+static const char * gLatencyStageKeys[kLatencyStageCount] =
+{
+	"Queue Wait",
+	"Service Time",
+	"Autosense Time",
+	"Completion Time"
+};
+
+// Sense data statistics and logging. At most kSenseLogBurst sense data
+// messages are logged per kSenseLogIntervalMS on each logical unit.
+#define kSenseLogBurst								4
+#define kSenseLogIntervalMS							10000
+#define kIOPropertySenseStatisticsKey				"Sense Statistics"
+#define kIOPropertySenseRecentErrorsKey				"Recent Errors"
+#define kIOPropertySenseKeyKey						"Sense Key"
+#define kIOPropertySenseASCKey						"ASC"
+#define kIOPropertySenseASCQKey						"ASCQ"
+#define kIOPropertySenseLBAKey						"LBA"
+#define kSenseASC_LogicalUnitNotReady				0x04
+#define kSenseASC_LogicalUnitNotSupported			0x25
+#define kSenseASC_MediumChanged						0x28
+#define kSenseASC_Reset								0x29
+#define kSenseASC_MediumNotPresent					0x3A
+
+static const char * gSenseCategoryKeys[kSCSISenseCategoryCount] =
+{
+	"No Sense",
+	"Recovered Error",
+	"Becoming Ready",
+	"Initializing Command Required",
+	"Not Ready",
+	"Medium Not Present",
+	"Medium Changed",
+	"Reset",
+	"Logical Unit Not Supported",
+	"Medium Error",
+	"Hardware Error",
+	"Illegal Request",
+	"Unit Attention",
+	"Data Protect",
+	"Aborted Command",
+	"Other"
+};
+
 // Reserved fields
 #define fKeySwitchNotifier							fIOSCSIPrimaryCommandsDeviceReserved->fKeySwitchNotifier
 #define fANSIVersion								fIOSCSIPrimaryCommandsDeviceReserved->fANSIVersion
 #define fCMDQUE										fIOSCSIPrimaryCommandsDeviceReserved->fCMDQUE
 #define	fTaskID										fIOSCSIPrimaryCommandsDeviceReserved->fTaskID
 #define	fTaskIDLock									fIOSCSIPrimaryCommandsDeviceReserved->fTaskIDLock
+#define fTagBitmap									fIOSCSIPrimaryCommandsDeviceReserved->fTagBitmap
+#define fTagTable									fIOSCSIPrimaryCommandsDeviceReserved->fTagTable
+#define fTagCount									fIOSCSIPrimaryCommandsDeviceReserved->fTagCount
+#define fTagsInUse									fIOSCSIPrimaryCommandsDeviceReserved->fTagsInUse
+#define fTagsInUseHighWater							fIOSCSIPrimaryCommandsDeviceReserved->fTagsInUseHighWater
+#define fTagAllocationFailures						fIOSCSIPrimaryCommandsDeviceReserved->fTagAllocationFailures
+#define fTagAbortBitmap								fIOSCSIPrimaryCommandsDeviceReserved->fTagAbortBitmap
+#define fMediaPollScheduler							fIOSCSIPrimaryCommandsDeviceReserved->fMediaPollScheduler
+#define fMediaPollThread							fIOSCSIPrimaryCommandsDeviceReserved->fMediaPollThread
+#define fNextMediaPollDevice						fIOSCSIPrimaryCommandsDeviceReserved->fNextMediaPollDevice
+#define fPreviousMediaPollDevice					fIOSCSIPrimaryCommandsDeviceReserved->fPreviousMediaPollDevice
+#define fMediaPollDeadline							fIOSCSIPrimaryCommandsDeviceReserved->fMediaPollDeadline
+#define fMediaPollInterval							fIOSCSIPrimaryCommandsDeviceReserved->fMediaPollInterval
+#define fMediaPollIdleCount							fIOSCSIPrimaryCommandsDeviceReserved->fMediaPollIdleCount
+#define fMediaPollCount								fIOSCSIPrimaryCommandsDeviceReserved->fMediaPollCount
+#define fMediaPollTotalTime							fIOSCSIPrimaryCommandsDeviceReserved->fMediaPollTotalTime
+#define fMediaPollMaximumTime						fIOSCSIPrimaryCommandsDeviceReserved->fMediaPollMaximumTime
+#define fMediaPollStatistics						fIOSCSIPrimaryCommandsDeviceReserved->fMediaPollStatistics
+#define fQuiescing									fIOSCSIPrimaryCommandsDeviceReserved->fQuiescing
+#define fQuiesceCount								fIOSCSIPrimaryCommandsDeviceReserved->fQuiesceCount
+#define fQuiesceLastDrainTime						fIOSCSIPrimaryCommandsDeviceReserved->fQuiesceLastDrainTime
+#define fQuiesceMaximumDrainTime					fIOSCSIPrimaryCommandsDeviceReserved->fQuiesceMaximumDrainTime
+#define fQuiesceTotalDrainTime						fIOSCSIPrimaryCommandsDeviceReserved->fQuiesceTotalDrainTime
+#define fQuiesceTimeouts							fIOSCSIPrimaryCommandsDeviceReserved->fQuiesceTimeouts
+#define fQuiesceStatistics							fIOSCSIPrimaryCommandsDeviceReserved->fQuiesceStatistics
+#define fLatencyHistograms							fIOSCSIPrimaryCommandsDeviceReserved->fLatencyHistograms
+#define fSenseCounts								fIOSCSIPrimaryCommandsDeviceReserved->fSenseCounts
+#define fSenseSamples								fIOSCSIPrimaryCommandsDeviceReserved->fSenseSamples
+#define fSenseSampleIndex							fIOSCSIPrimaryCommandsDeviceReserved->fSenseSampleIndex
+#define fSenseLogWindowStart						fIOSCSIPrimaryCommandsDeviceReserved->fSenseLogWindowStart
+#define fSenseLogCount								fIOSCSIPrimaryCommandsDeviceReserved->fSenseLogCount
+#define fSenseLogSuppressed							fIOSCSIPrimaryCommandsDeviceReserved->fSenseLogSuppressed
+#define fStatisticsThread							fIOSCSIPrimaryCommandsDeviceReserved->fStatisticsThread
+#define fStatisticsPending							fIOSCSIPrimaryCommandsDeviceReserved->fStatisticsPending
+
+// State of the media poll scheduler shared by every logical unit. Logical
+// units with a poll scheduled sit in a hashed timing wheel of
+// kMediaPollWheelSlots slots of kMediaPollWheelTickMS each, and a single
+// thread call wakes up for the next occupied slot. It is allocated the first
+// time a poll is scheduled and freed when its last user releases it. Every
+// logical unit holding it is a user, and so is the timer while it is armed
+// or running.
+struct SCSIMediaPollScheduler
+{
+	volatile SInt32					users;
+	IOSimpleLock *					lock;
+	thread_call_t					timer;
+	UInt64							tickInterval;
+	UInt64							lastTick;
+	UInt64							timerDeadline;
+	IOSCSIPrimaryCommandsDevice *	wheel[kMediaPollWheelSlots];
+};
+
+static SCSIMediaPollScheduler *		sMediaPollScheduler = NULL;
+
+// Serializes looking up and creating sMediaPollScheduler against freeing it.
+// The lock lives for as long as the family is loaded.
+class SCSIMediaPollSchedulerLock
+{
+	
+public:
+	
+	SCSIMediaPollSchedulerLock ( void ) { fLock = IOLockAlloc ( ); }
+	~SCSIMediaPollSchedulerLock ( void ) { if ( fLock != NULL ) IOLockFree ( fLock ); }
+	
+	IOLock *	fLock;
+	
+};
+
+static SCSIMediaPollSchedulerLock	sMediaPollSchedulerLock;
+
+// One shard of a logical unit's latency histograms. A completion adds to
+// the shard of the CPU it runs on, so CPUs seldom write to the same cache
+// line. The shard size is a multiple of the cache line size.
+struct SCSILatencyHistogram
+{
+	UInt64							buckets[kLatencyStageCount][kLatencyBucketCount];
+};
 
 #if 0
 #pragma mark -
@@ -168,6 +344,7 @@ IOSCSIPrimaryCommandsDevice::start ( IOService * provider )
 			sizeof ( IOSCSIPrimaryCommandsDeviceExpansionData ) );
 	
 	fANSIVersion = kINQUIRY_ANSI_VERSION_NoClaimedConformance;
+	fMediaPollInterval = kMediaPollIntervalMS;
 	
 	fTaskIDLock = IOSimpleLockAlloc ( );
 	__Require_noErr ( fTaskIDLock, FreeReservedMemory );
@@ -175,8 +352,18 @@ IOSCSIPrimaryCommandsDevice::start ( IOService * provider )
 	fProtocolDriver = OSDynamicCast ( IOSCSIProtocolInterface, provider );
 	__Require_noErr ( fProtocolDriver, FreeTaskIDLock );
 	
+	// Without the thread call, statistics are simply not published.
+	fStatisticsThread = thread_call_allocate (
+			( thread_call_func_t ) IOSCSIPrimaryCommandsDevice::sStatisticsTimerExpired,
+			( thread_call_param_t ) this );
+	
+	__Require ( CreateTaggedTaskTable ( ), FreeTaggedTaskTable );
+	
+	// Without the histograms, latencies are simply not recorded.
+	CreateLatencyHistograms ( );
+	
 	fDeviceCharacteristicsDictionary = OSDictionary::withCapacity ( 1 );
-	__Require_noErr ( fDeviceCharacteristicsDictionary, FreeTaskIDLock );
+	__Require_noErr ( fDeviceCharacteristicsDictionary, FreeTaggedTaskTable );
 	
 	string = ( OSString * ) GetProtocolDriver ( )->getProperty ( kIOPropertySCSIVendorIdentification );	
 	__Check ( string );
@@ -386,11 +573,30 @@ CloseProvider:
 FreeDeviceDictionary:
 	
 	
-	__Require_noErr ( fDeviceCharacteristicsDictionary, FreeTaskIDLock );
+	__Require_noErr ( fDeviceCharacteristicsDictionary, FreeTaggedTaskTable );
 	fDeviceCharacteristicsDictionary->release ( );
 	fDeviceCharacteristicsDictionary = NULL;
 	
 	
+FreeTaggedTaskTable:
+	
+	
+	FreeLatencyHistograms ( );
+	FreeTaggedTaskTable ( );
+	
+	if ( fStatisticsThread != NULL )
+	{
+		
+		// A scheduled publish holds a retain on us.
+		if ( thread_call_cancel ( fStatisticsThread ) == true )
+			release ( );
+		
+		thread_call_free ( fStatisticsThread );
+		fStatisticsThread = NULL;
+		
+	}
+	
+	
 FreeTaskIDLock:
 	
 	
@@ -472,6 +678,49 @@ IOSCSIPrimaryCommandsDevice::free ( void )
 			
 		}
 		
+		FreeTaggedTaskTable ( );
+		FreeLatencyHistograms ( );
+		
+		// Nothing can be scheduled on it any more, since a scheduled
+		// publish holds a retain on us.
+		if ( fStatisticsThread != NULL )
+		{
+			
+			thread_call_free ( fStatisticsThread );
+			fStatisticsThread = NULL;
+			
+		}
+		
+		if ( fMediaPollScheduler != NULL )
+		{
+			
+			// Polling has been stopped by now, but make sure the wheel
+			// is not left pointing at us.
+			IOSimpleLockLock ( fMediaPollScheduler->lock );
+			UnlinkMediaPoll ( );
+			IOSimpleLockUnlock ( fMediaPollScheduler->lock );
+			
+			sReleaseMediaPollScheduler ( fMediaPollScheduler );
+			fMediaPollScheduler = NULL;
+			
+		}
+		
+		if ( fMediaPollStatistics != NULL )
+		{
+			
+			fMediaPollStatistics->release ( );
+			fMediaPollStatistics = NULL;
+			
+		}
+		
+		if ( fQuiesceStatistics != NULL )
+		{
+			
+			fQuiesceStatistics->release ( );
+			fQuiesceStatistics = NULL;
+			
+		}
+		
 		IODelete ( fIOSCSIPrimaryCommandsDeviceReserved, IOSCSIPrimaryCommandsDeviceExpansionData, 1 );
 		fIOSCSIPrimaryCommandsDeviceReserved = NULL;
 		
@@ -893,120 +1142,1939 @@ void
 IOSCSIPrimaryCommandsDevice::IncrementOutstandingCommandsCount ( void )
 {
 	
-	fCommandGate->runAction ( ( IOCommandGate::Action )
-		&IOSCSIPrimaryCommandsDevice::sIncrementOutstandingCommandsCount );
+	fCommandGate->runAction ( ( IOCommandGate::Action )
+		&IOSCSIPrimaryCommandsDevice::sIncrementOutstandingCommandsCount );
+	
+}
+
+
+//
+//	 sIncrementOutstandingCommandsCount - C->C++ glue code.
+//															[STATIC][PROTECTED]
+//
+
+void
+IOSCSIPrimaryCommandsDevice::sIncrementOutstandingCommandsCount (
+									IOSCSIPrimaryCommandsDevice * self )
+{
+	
+	self->HandleIncrementOutstandingCommandsCount ( );
+	
+}
+
+
+//
+//  HandleIncrementOutstandingCommandsCount - 	Increments number of
+//												outstanding commands.
+//																	[PROTECTED]
+//
+
+void
+IOSCSIPrimaryCommandsDevice::HandleIncrementOutstandingCommandsCount ( void )
+{
+	
+	// ReleaseSCSITask decrements the count without the command gate.
+	OSIncrementAtomic ( ( volatile SInt32 * ) &fNumCommandsOutstanding );
+	
+}
+
+
+//
+//	 sWakeQuiesce - 	Wakes a quiesce in progress to recheck the
+//						outstanding command count.			  [STATIC][PRIVATE]
+//
+
+void
+IOSCSIPrimaryCommandsDevice::sWakeQuiesce ( IOSCSIPrimaryCommandsDevice * self )
+{
+	
+	if ( self->fQuiescing == true )
+	{
+		self->fCommandGate->commandWakeup ( &self->fNumCommandsOutstanding, false );
+	}
+	
+}
+
+
+#if 0
+#pragma mark -
+#pragma mark  Quiesce
+#pragma mark -
+#endif
+
+
+//
+//  QuiesceCommands - 	Waits for all outstanding tasks but the caller's own
+//						to be released.								[PROTECTED]
+//
+
+IOReturn
+IOSCSIPrimaryCommandsDevice::QuiesceCommands ( UInt32 heldTaskCount )
+{
+	
+	AbsoluteTime	deadline	= 0;
+	UInt64			startTime	= 0;
+	IOReturn		status		= kIOReturnSuccess;
+	
+	clock_get_uptime ( &startTime );
+	clock_interval_to_deadline ( kQuiesceTimeoutMS, kMillisecondScale, &deadline );
+	
+	status = fCommandGate->runAction ( ( IOCommandGate::Action )
+									   &IOSCSIPrimaryCommandsDevice::sWaitForQuiesce,
+									   ( void * ) ( uintptr_t ) heldTaskCount,
+									   &deadline );
+	
+	if ( status == kIOReturnTimeout )
+	{
+		
+		// Something is stuck in the device. Abort what we can name and give
+		// the protocol driver a little longer to complete it.
+		ERROR_LOG ( ( "%s: %ld tasks still outstanding after %d ms, aborting\n",
+					  getName ( ), fNumCommandsOutstanding - heldTaskCount,
+					  kQuiesceTimeoutMS ) );
+		
+		fQuiesceTimeouts++;
+		AbortOutstandingTasks ( );
+		
+		clock_interval_to_deadline ( kQuiesceAbortTimeoutMS, kMillisecondScale, &deadline );
+		
+		status = fCommandGate->runAction ( ( IOCommandGate::Action )
+										   &IOSCSIPrimaryCommandsDevice::sWaitForQuiesce,
+										   ( void * ) ( uintptr_t ) heldTaskCount,
+										   &deadline );
+		
+	}
+	
+	RecordQuiesce ( startTime, status );
+	
+	return status;
+	
+}
+
+
+//
+//  ResumeCommands - 	Lets I/O held back by QuiesceCommands through.
+//																	[PROTECTED]
+//
+
+void
+IOSCSIPrimaryCommandsDevice::ResumeCommands ( void )
+{
+	
+	fCommandGate->runAction ( ( IOCommandGate::Action )
+		&IOSCSIPrimaryCommandsDevice::sResumeCommands );
+	
+}
+
+
+//
+//  HandleWaitWhileQuiesced - 	Blocks while a quiesce is in progress.
+//																	[PROTECTED]
+//
+
+void
+IOSCSIPrimaryCommandsDevice::HandleWaitWhileQuiesced ( void )
+{
+	
+	// Never block the workloop thread, which has to run for the tasks being
+	// waited on to complete.
+	while ( ( fQuiescing == true ) &&
+			( isInactive ( ) == false ) &&
+			( getWorkLoop ( )->onThread ( ) == false ) )
+	{
+		
+		fCommandGate->commandSleep ( &fQuiescing, THREAD_UNINT );
+		
+	}
+	
+}
+
+
+//
+//  sWaitForQuiesce - C->C++ glue code.					  [STATIC][PRIVATE]
+//
+
+IOReturn
+IOSCSIPrimaryCommandsDevice::sWaitForQuiesce (
+									void *	object,
+									void *	heldTaskCount,
+									void *	deadline )
+{
+	
+	IOSCSIPrimaryCommandsDevice *	device = NULL;
+	
+	device = OSDynamicCast ( IOSCSIPrimaryCommandsDevice, ( OSObject * ) object );
+	
+	return device->HandleWaitForQuiesce ( ( UInt32 ) ( uintptr_t ) heldTaskCount,
+										  *( AbsoluteTime * ) deadline );
+	
+}
+
+
+//
+//  HandleWaitForQuiesce - Sleeps until only the caller's tasks are left or
+//							the deadline passes.					  [PRIVATE]
+//
+
+IOReturn
+IOSCSIPrimaryCommandsDevice::HandleWaitForQuiesce (
+									UInt32			heldTaskCount,
+									AbsoluteTime	deadline )
+{
+	
+	IOReturn	status	= kIOReturnSuccess;
+	int			result	= THREAD_AWAKENED;
+	
+	// Hold back new I/O. Each task released from now on wakes us up, so
+	// we return as soon as the last one goes. ReleaseSCSITask decrements
+	// the count before it checks fQuiescing, so setting the flag before
+	// checking the count means either we see the decrement or it sees
+	// the flag.
+	fQuiescing = true;
+	OSMemoryBarrier ( );
+	
+	while ( ( fNumCommandsOutstanding > heldTaskCount ) && ( isInactive ( ) == false ) )
+	{
+		
+		result = fCommandGate->commandSleep ( &fNumCommandsOutstanding,
+											  deadline,
+											  THREAD_UNINT );
+		
+		if ( result == THREAD_TIMED_OUT )
+		{
+			
+			if ( fNumCommandsOutstanding > heldTaskCount )
+				status = kIOReturnTimeout;
+			
+			break;
+			
+		}
+		
+	}
+	
+	return status;
+	
+}
+
+
+//
+//  sResumeCommands - C->C++ glue code.					  [STATIC][PRIVATE]
+//
+
+void
+IOSCSIPrimaryCommandsDevice::sResumeCommands ( IOSCSIPrimaryCommandsDevice * self )
+{
+	
+	self->fQuiescing = false;
+	self->fCommandGate->commandWakeup ( &self->fQuiescing, false );
+	
+}
+
+
+//
+//  ReserveOutstandingTags - 	Copies out the logical unit and tag of tasks
+//								still holding a tag, and reserves each tag
+//								so it is not handed out again until
+//								ReleaseReservedTag is called.		  [PRIVATE]
+//
+
+UInt32
+IOSCSIPrimaryCommandsDevice::ReserveOutstandingTags (
+									UInt8 *						logicalUnits,
+									SCSITaggedTaskIdentifier *	tags,
+									UInt32						maximum )
+{
+	
+	SCSITask *	task	= NULL;
+	UInt32		index	= 0;
+	UInt32		count	= 0;
+	UInt32		mask	= 0;
+	
+	require_nonzero_quiet ( fTagTable, ErrorExit );
+	
+	IOSimpleLockLock ( fTaskIDLock );
+	
+	for ( index = 0; ( index < fTagCount ) && ( count < maximum ); index++ )
+	{
+		
+		task = SCSITaskFromIdentifier ( fTagTable[index] );
+		if ( task == NULL )
+			continue;
+		
+		// Someone else is already aborting this one.
+		mask = 1U << ( index % kTagBitmapBitsPerWord );
+		if ( ( fTagAbortBitmap[index / kTagBitmapBitsPerWord] & mask ) != 0 )
+			continue;
+		
+		fTagAbortBitmap[index / kTagBitmapBitsPerWord] |= mask;
+		
+		logicalUnits[count]	= task->GetLogicalUnitNumber ( );
+		tags[count]			= index + 1;
+		count++;
+		
+	}
+	
+	IOSimpleLockUnlock ( fTaskIDLock );
+	
+	
+ErrorExit:
+	
+	
+	return count;
+	
+}
+
+
+//
+//  ReleaseReservedTag - 	Releases a tag reserved by ReserveOutstandingTags.
+//							If its task completed in the meantime, the tag
+//							is given back now.						  [PRIVATE]
+//
+
+void
+IOSCSIPrimaryCommandsDevice::ReleaseReservedTag ( SCSITaggedTaskIdentifier tag )
+{
+	
+	UInt32	index	= tag - 1;
+	UInt32	mask	= 1U << ( index % kTagBitmapBitsPerWord );
+	
+	IOSimpleLockLock ( fTaskIDLock );
+	
+	fTagAbortBitmap[index / kTagBitmapBitsPerWord] &= ~mask;
+	
+	if ( fTagTable[index] == NULL )
+	{
+		fTagBitmap[index / kTagBitmapBitsPerWord] &= ~mask;
+	}
+	
+	IOSimpleLockUnlock ( fTaskIDLock );
+	
+}
+
+
+//
+//  AbortOutstandingTasks - 	Aborts tasks that are holding up a quiesce.
+//																	  [PRIVATE]
+//
+
+void
+IOSCSIPrimaryCommandsDevice::AbortOutstandingTasks ( void )
+{
+	
+	UInt8						logicalUnits[kQuiesceMaximumAborts];
+	SCSITaggedTaskIdentifier	tags[kQuiesceMaximumAborts];
+	UInt32						count	= 0;
+	UInt32						index	= 0;
+	
+	count = ReserveOutstandingTags ( logicalUnits, tags, kQuiesceMaximumAborts );
+	
+	// Task management functions may block, so they are sent without any
+	// lock held. The tags stay reserved until then, so a task which completes
+	// in the meantime can't give its tag to a new command that the abort
+	// would then kill. Skip tags whose task has already completed. Untagged
+	// tasks can't be named by ABORT TASK and are left to their own timeouts.
+	for ( index = 0; index < count; index++ )
+	{
+		
+		if ( GetTaskForTaggedTaskIdentifier ( tags[index] ) != NULL )
+		{
+			
+			ERROR_LOG ( ( "%s: aborting task %lld on LUN %d\n",
+						  getName ( ), tags[index], logicalUnits[index] ) );
+			
+			( void ) AbortTask ( logicalUnits[index], tags[index] );
+			
+		}
+		
+		ReleaseReservedTag ( tags[index] );
+		
+	}
+	
+}
+
+
+//
+//  RecordQuiesce - Publishes how long a quiesce took.				  [PRIVATE]
+//
+
+void
+IOSCSIPrimaryCommandsDevice::RecordQuiesce ( UInt64 startTime, IOReturn status )
+{
+	
+	UInt64		now			= 0;
+	UInt64		elapsed		= 0;
+	OSNumber *	number		= NULL;
+	
+	clock_get_uptime ( &now );
+	absolutetime_to_nanoseconds ( now - startTime, &elapsed );
+	
+	// Drain times are kept in microseconds.
+	elapsed /= 1000;
+	
+	STATUS_LOG ( ( "%s: quiesced in %lld us, status = 0x%08x\n",
+				   getName ( ), elapsed, status ) );
+	
+	fQuiesceCount++;
+	fQuiesceLastDrainTime = elapsed;
+	fQuiesceTotalDrainTime += elapsed;
+	
+	if ( elapsed > fQuiesceMaximumDrainTime )
+	{
+		fQuiesceMaximumDrainTime = elapsed;
+	}
+	
+	if ( fQuiesceStatistics == NULL )
+	{
+		
+		fQuiesceStatistics = OSDictionary::withCapacity ( 5 );
+		require_nonzero ( fQuiesceStatistics, ErrorExit );
+		
+		number = OSNumber::withNumber ( fQuiesceCount, 64 );
+		require_nonzero ( number, ErrorExit );
+		fQuiesceStatistics->setObject ( kIOPropertyQuiesceCountKey, number );
+		number->release ( );
+		
+		number = OSNumber::withNumber ( fQuiesceLastDrainTime, 64 );
+		require_nonzero ( number, ErrorExit );
+		fQuiesceStatistics->setObject ( kIOPropertyQuiesceLastDrainTimeKey, number );
+		number->release ( );
+		
+		number = OSNumber::withNumber ( fQuiesceMaximumDrainTime, 64 );
+		require_nonzero ( number, ErrorExit );
+		fQuiesceStatistics->setObject ( kIOPropertyQuiesceMaximumDrainTimeKey, number );
+		number->release ( );
+		
+		number = OSNumber::withNumber ( fQuiesceTotalDrainTime, 64 );
+		require_nonzero ( number, ErrorExit );
+		fQuiesceStatistics->setObject ( kIOPropertyQuiesceTotalDrainTimeKey, number );
+		number->release ( );
+		
+		number = OSNumber::withNumber ( fQuiesceTimeouts, 64 );
+		require_nonzero ( number, ErrorExit );
+		fQuiesceStatistics->setObject ( kIOPropertyQuiesceTimeoutsKey, number );
+		number->release ( );
+		
+		setProperty ( kIOPropertyQuiesceStatisticsKey, fQuiesceStatistics );
+		goto ErrorExit;
+		
+	}
+	
+	number = OSDynamicCast ( OSNumber, fQuiesceStatistics->getObject ( kIOPropertyQuiesceCountKey ) );
+	if ( number != NULL )
+		number->setValue ( fQuiesceCount );
+	
+	number = OSDynamicCast ( OSNumber, fQuiesceStatistics->getObject ( kIOPropertyQuiesceLastDrainTimeKey ) );
+	if ( number != NULL )
+		number->setValue ( fQuiesceLastDrainTime );
+	
+	number = OSDynamicCast ( OSNumber, fQuiesceStatistics->getObject ( kIOPropertyQuiesceMaximumDrainTimeKey ) );
+	if ( number != NULL )
+		number->setValue ( fQuiesceMaximumDrainTime );
+	
+	number = OSDynamicCast ( OSNumber, fQuiesceStatistics->getObject ( kIOPropertyQuiesceTotalDrainTimeKey ) );
+	if ( number != NULL )
+		number->setValue ( fQuiesceTotalDrainTime );
+	
+	number = OSDynamicCast ( OSNumber, fQuiesceStatistics->getObject ( kIOPropertyQuiesceTimeoutsKey ) );
+	if ( number != NULL )
+		number->setValue ( fQuiesceTimeouts );
+	
+	
+ErrorExit:
+	
+	
+	return;
+	
+}
+
+
+//
+//  LatencyBucket - Returns the histogram bucket a latency, in
+//					 microseconds, is counted in.					   [STATIC]
+//
+
+static UInt32
+LatencyBucket ( UInt64 microseconds )
+{
+	
+	UInt32	power	= 0;
+	UInt32	bucket	= 0;
+	
+	if ( microseconds < kLatencySubBuckets )
+		return ( UInt32 ) microseconds;
+	
+	// The power of two selects the group of buckets, and the bits just
+	// below the leading one select the bucket within the group.
+	power	= 63 - __builtin_clzll ( microseconds );
+	bucket	= ( ( power - kLatencySubBucketShift + 1 ) << kLatencySubBucketShift ) +
+			  ( ( microseconds >> ( power - kLatencySubBucketShift ) ) & ( kLatencySubBuckets - 1 ) );
+	
+	return min ( bucket, kLatencyBucketCount - 1 );
+	
+}
+
+
+//
+//  AddLatency - Counts the time between two task timestamps.		   [STATIC]
+//
+
+static void
+AddLatency ( UInt64 * buckets, UInt64 startTime, UInt64 endTime )
+{
+	
+	UInt64	elapsed = 0;
+	
+	// A stage the task never went through has no start or end time.
+	if ( ( startTime == 0 ) || ( endTime < startTime ) )
+		return;
+	
+	absolutetime_to_nanoseconds ( endTime - startTime, &elapsed );
+	OSIncrementAtomic64 ( ( SInt64 * ) &buckets[LatencyBucket ( elapsed / 1000 )] );
+	
+}
+
+
+//
+//  CreateLatencyHistograms - Allocates the latency histograms.	  [PRIVATE]
+//
+
+void
+IOSCSIPrimaryCommandsDevice::CreateLatencyHistograms ( void )
+{
+	
+	vm_size_t	size = sizeof ( SCSILatencyHistogram ) * kLatencyHistogramShards;
+	
+	fLatencyHistograms = ( SCSILatencyHistogram * ) IOMallocAligned ( size, 64 );
+	require_nonzero ( fLatencyHistograms, ErrorExit );
+	
+	bzero ( fLatencyHistograms, size );
+	
+	
+ErrorExit:
+	
+	
+	return;
+	
+}
+
+
+//
+//  FreeLatencyHistograms - Frees the latency histograms.			  [PRIVATE]
+//
+
+void
+IOSCSIPrimaryCommandsDevice::FreeLatencyHistograms ( void )
+{
+	
+	if ( fLatencyHistograms != NULL )
+	{
+		
+		IOFreeAligned ( fLatencyHistograms,
+						sizeof ( SCSILatencyHistogram ) * kLatencyHistogramShards );
+		fLatencyHistograms = NULL;
+		
+	}
+	
+}
+
+
+//
+//  RecordTaskLatency - Adds a completed task to the latency histograms.
+//																	[PROTECTED]
+//
+
+void
+IOSCSIPrimaryCommandsDevice::RecordTaskLatency (
+							const SCSITaskTimestamps *	timestamps )
+{
+	
+	SCSILatencyHistogram *	histogram	= NULL;
+	UInt64					now			= 0;
+	
+	require_nonzero_quiet ( fLatencyHistograms, ErrorExit );
+	
+	clock_get_uptime ( &now );
+	
+	// The counts are still added atomically, since the thread can move to
+	// another CPU and there can be more CPUs than shards.
+	histogram = &fLatencyHistograms[cpu_number ( ) % kLatencyHistogramShards];
+	
+	AddLatency ( histogram->buckets[kLatencyStage_QueueWait],
+				 timestamps->time[kSCSITaskTimestamp_Queued],
+				 timestamps->time[kSCSITaskTimestamp_Sent] );
+	
+	AddLatency ( histogram->buckets[kLatencyStage_Service],
+				 timestamps->time[kSCSITaskTimestamp_Sent],
+				 timestamps->time[kSCSITaskTimestamp_Completed] );
+	
+	AddLatency ( histogram->buckets[kLatencyStage_Autosense],
+				 timestamps->time[kSCSITaskTimestamp_Completed],
+				 timestamps->time[kSCSITaskTimestamp_AutosenseCompleted] );
+	
+	AddLatency ( histogram->buckets[kLatencyStage_Completion],
+				 timestamps->time[kSCSITaskTimestamp_Notified],
+				 now );
+	
+	ScheduleStatisticsUpdate ( );
+	
+	
+ErrorExit:
+	
+	
+	return;
+	
+}
+
+
+//
+//  UpdateLatencyStatistics - Merges the latency histogram shards and
+//							   publishes the result.				  [PRIVATE]
+//
+
+void
+IOSCSIPrimaryCommandsDevice::UpdateLatencyStatistics ( void )
+{
+	
+	OSDictionary *	statistics	= NULL;
+	OSArray *		counts		= NULL;
+	OSNumber *		number		= NULL;
+	UInt64			count		= 0;
+	UInt32			stage		= 0;
+	UInt32			bucket		= 0;
+	UInt32			shard		= 0;
+	UInt32			used		= 0;
+	
+	require_nonzero_quiet ( fIOSCSIPrimaryCommandsDeviceReserved, ErrorExit );
+	require_nonzero_quiet ( fLatencyHistograms, ErrorExit );
+	
+	statistics = OSDictionary::withCapacity ( kLatencyStageCount + 1 );
+	require_nonzero ( statistics, ErrorExit );
+	
+	number = OSNumber::withNumber ( kLatencySubBuckets, 32 );
+	require_nonzero ( number, ReleaseStatistics );
+	statistics->setObject ( kIOPropertyLatencySubBucketsKey, number );
+	number->release ( );
+	
+	for ( stage = 0; stage < kLatencyStageCount; stage++ )
+	{
+		
+		// Only publish buckets up to the last one with anything in it.
+		for ( used = kLatencyBucketCount; used > 0; used-- )
+		{
+			
+			for ( shard = 0; shard < kLatencyHistogramShards; shard++ )
+			{
+				
+				if ( fLatencyHistograms[shard].buckets[stage][used - 1] != 0 )
+					break;
+				
+			}
+			
+			if ( shard < kLatencyHistogramShards )
+				break;
+			
+		}
+		
+		counts = OSArray::withCapacity ( max ( used, 1 ) );
+		require_nonzero ( counts, ReleaseStatistics );
+		
+		for ( bucket = 0; bucket < used; bucket++ )
+		{
+			
+			count = 0;
+			for ( shard = 0; shard < kLatencyHistogramShards; shard++ )
+			{
+				count += fLatencyHistograms[shard].buckets[stage][bucket];
+			}
+			
+			number = OSNumber::withNumber ( count, 64 );
+			if ( number != NULL )
+			{
+				
+				counts->setObject ( number );
+				number->release ( );
+				
+			}
+			
+		}
+		
+		statistics->setObject ( gLatencyStageKeys[stage], counts );
+		counts->release ( );
+		
+	}
+	
+	setProperty ( kIOPropertyLatencyStatisticsKey, statistics );
+	
+	
+ReleaseStatistics:
+	
+	
+	statistics->release ( );
+	
+	
+ErrorExit:
+	
+	
+	return;
+	
+}
+
+
+//
+//  ClassifySenseData - Sorts sense data into a category.	  [STATIC][PROTECTED]
+//
+
+SCSISenseCategory
+IOSCSIPrimaryCommandsDevice::ClassifySenseData ( const SCSI_Sense_Data * senseData )
+{
+	
+	UInt8	senseKey	= senseData->SENSE_KEY & kSENSE_KEY_Mask;
+	UInt8	ASC			= senseData->ADDITIONAL_SENSE_CODE;
+	UInt8	ASCQ		= senseData->ADDITIONAL_SENSE_CODE_QUALIFIER;
+	
+	// These mean the same thing whatever the sense key. Some devices which
+	// are not spun up yet report NOT READY instead of ILLEGAL REQUEST for an
+	// unsupported logical unit, for instance.
+	if ( ( ASC == kSenseASC_LogicalUnitNotSupported ) && ( ASCQ == 0x00 ) )
+		return kSCSISenseCategory_LUNotSupported;
+	
+	if ( ASC == kSenseASC_MediumNotPresent )
+		return kSCSISenseCategory_MediumNotPresent;
+	
+	if ( ( ASC == kSenseASC_MediumChanged ) && ( ASCQ == 0x00 ) )
+		return kSCSISenseCategory_MediumChanged;
+	
+	if ( ASC == kSenseASC_Reset )
+		return kSCSISenseCategory_Reset;
+	
+	switch ( senseKey )
+	{
+		
+		case kSENSE_KEY_NO_SENSE:
+			return kSCSISenseCategory_NoSense;
+		
+		case kSENSE_KEY_RECOVERED_ERROR:
+			return kSCSISenseCategory_RecoveredError;
+		
+		case kSENSE_KEY_NOT_READY:
+		{
+			
+			if ( ( ASC == kSenseASC_LogicalUnitNotReady ) && ( ASCQ == 0x01 ) )
+				return kSCSISenseCategory_BecomingReady;
+			
+			if ( ( ASC == kSenseASC_LogicalUnitNotReady ) &&
+				 ( ( ASCQ == 0x00 ) || ( ASCQ == 0x02 ) || ( ASCQ == 0x03 ) ) )
+				return kSCSISenseCategory_NeedsStart;
+			
+			return kSCSISenseCategory_NotReady;
+			
+		}
+		
+		case kSENSE_KEY_MEDIUM_ERROR:
+			return kSCSISenseCategory_MediumError;
+		
+		case kSENSE_KEY_HARDWARE_ERROR:
+			return kSCSISenseCategory_HardwareError;
+		
+		case kSENSE_KEY_ILLEGAL_REQUEST:
+			return kSCSISenseCategory_IllegalRequest;
+		
+		case kSENSE_KEY_UNIT_ATTENTION:
+			return kSCSISenseCategory_UnitAttention;
+		
+		case kSENSE_KEY_DATA_PROTECT:
+			return kSCSISenseCategory_DataProtect;
+		
+		case kSENSE_KEY_ABORTED_COMMAND:
+			return kSCSISenseCategory_AbortedCommand;
+		
+		default:
+			return kSCSISenseCategory_Other;
+		
+	}
+	
+}
+
+
+//
+//  RecordSenseData - Classifies, counts and samples sense data.	[PROTECTED]
+//
+
+SCSISenseCategory
+IOSCSIPrimaryCommandsDevice::RecordSenseData ( const SCSI_Sense_Data * senseData )
+{
+	
+	SCSISenseCategory	category	= kSCSISenseCategory_Other;
+	SCSISenseSample *	sample		= NULL;
+	UInt32				index		= 0;
+	UInt32				LBA			= 0;
+	bool				LBAValid	= false;
+	
+	category = ClassifySenseData ( senseData );
+	
+	require_nonzero_quiet ( fIOSCSIPrimaryCommandsDeviceReserved, ErrorExit );
+	
+	OSIncrementAtomic64 ( ( volatile SInt64 * ) &fSenseCounts[category] );
+	
+	// The INFORMATION field holds the first failing block when VALID is set.
+	if ( ( senseData->VALID_RESPONSE_CODE & kSENSE_DATA_VALID_Mask ) == kSENSE_DATA_VALID )
+	{
+		
+		LBA			= OSReadBigInt32 ( &senseData->INFORMATION_1, 0 );
+		LBAValid	= true;
+		
+		// A reader can see a slot half written. The samples are only a hint of
+		// where errors are, so that is tolerated rather than taking a lock.
+		index	= ( UInt32 ) OSIncrementAtomic ( ( volatile SInt32 * ) &fSenseSampleIndex );
+		sample	= &fSenseSamples[index % kSCSISenseSampleCount];
+		
+		sample->logicalBlockAddress				= LBA;
+		sample->senseKey						= senseData->SENSE_KEY & kSENSE_KEY_Mask;
+		sample->additionalSenseCode				= senseData->ADDITIONAL_SENSE_CODE;
+		sample->additionalSenseCodeQualifier	= senseData->ADDITIONAL_SENSE_CODE_QUALIFIER;
+		sample->category						= category;
+		
+	}
+	
+	ScheduleStatisticsUpdate ( );
+	
+	// Transient states the drivers recover from on their own (becoming
+	// ready, media coming and going, resets) are counted but not logged.
+	switch ( category )
+	{
+		
+		case kSCSISenseCategory_RecoveredError:
+		case kSCSISenseCategory_NotReady:
+		case kSCSISenseCategory_MediumError:
+		case kSCSISenseCategory_HardwareError:
+		case kSCSISenseCategory_IllegalRequest:
+		case kSCSISenseCategory_DataProtect:
+		case kSCSISenseCategory_AbortedCommand:
+		case kSCSISenseCategory_Other:
+		{
+			
+			require_quiet ( ShouldLogSenseData ( ), ErrorExit );
+			
+			if ( LBAValid == true )
+			{
+				
+				IOLog ( "%s: %s, SENSE_KEY = 0x%01x, ASC = 0x%02x, ASCQ = 0x%02x, LBA = 0x%08x\n",
+						getName ( ),
+						gSenseCategoryKeys[category],
+						senseData->SENSE_KEY & kSENSE_KEY_Mask,
+						senseData->ADDITIONAL_SENSE_CODE,
+						senseData->ADDITIONAL_SENSE_CODE_QUALIFIER,
+						( unsigned int ) LBA );
+				
+			}
+			
+			else
+			{
+				
+				IOLog ( "%s: %s, SENSE_KEY = 0x%01x, ASC = 0x%02x, ASCQ = 0x%02x\n",
+						getName ( ),
+						gSenseCategoryKeys[category],
+						senseData->SENSE_KEY & kSENSE_KEY_Mask,
+						senseData->ADDITIONAL_SENSE_CODE,
+						senseData->ADDITIONAL_SENSE_CODE_QUALIFIER );
+				
+			}
+			
+		}
+		break;
+		
+		default:
+			break;
+		
+	}
+	
+	
+ErrorExit:
+	
+	
+	return category;
+	
+}
+
+
+//
+//  ShouldLogSenseData - Returns whether another sense data message may be
+//						  logged in the current interval.			  [PRIVATE]
+//
+
+bool
+IOSCSIPrimaryCommandsDevice::ShouldLogSenseData ( void )
+{
+	
+	UInt64	now			= 0;
+	UInt64	windowStart	= fSenseLogWindowStart;
+	UInt64	interval	= 0;
+	UInt32	suppressed	= 0;
+	
+	clock_get_uptime ( &now );
+	clock_interval_to_absolutetime_interval ( kSenseLogIntervalMS,
+											  kMillisecondScale,
+											  &interval );
+	
+	if ( ( now - windowStart ) >= interval )
+	{
+		
+		// Whoever moves the window on starts the new burst, and reports
+		// what was held back from the last one.
+		if ( OSCompareAndSwap64 ( windowStart, now, &fSenseLogWindowStart ) == true )
+		{
+			
+			suppressed		= OSBitAndAtomic ( 0, &fSenseLogSuppressed );
+			fSenseLogCount	= 0;
+			
+			if ( suppressed != 0 )
+			{
+				
+				IOLog ( "%s: %u sense data messages suppressed\n",
+						getName ( ), ( unsigned int ) suppressed );
+				
+			}
+			
+		}
+		
+	}
+	
+	if ( OSIncrementAtomic ( &fSenseLogCount ) < kSenseLogBurst )
+		return true;
+	
+	OSIncrementAtomic ( ( volatile SInt32 * ) &fSenseLogSuppressed );
+	return false;
+	
+}
+
+
+//
+//  UpdateSenseStatistics - Publishes the sense data counts and samples.
+//																	  [PRIVATE]
+//
+
+void
+IOSCSIPrimaryCommandsDevice::UpdateSenseStatistics ( void )
+{
+	
+	OSDictionary *		statistics	= NULL;
+	OSDictionary *		entry		= NULL;
+	OSArray *			samples		= NULL;
+	OSNumber *			number		= NULL;
+	SCSISenseSample		sample;
+	UInt32				index		= 0;
+	UInt32				last		= 0;
+	
+	require_nonzero_quiet ( fIOSCSIPrimaryCommandsDeviceReserved, ErrorExit );
+	
+	statistics = OSDictionary::withCapacity ( kSCSISenseCategoryCount + 1 );
+	require_nonzero ( statistics, ErrorExit );
+	
+	for ( index = 0; index < kSCSISenseCategoryCount; index++ )
+	{
+		
+		number = OSNumber::withNumber ( fSenseCounts[index], 64 );
+		require_nonzero ( number, ReleaseStatistics );
+		statistics->setObject ( gSenseCategoryKeys[index], number );
+		number->release ( );
+		
+	}
+	
+	samples = OSArray::withCapacity ( kSCSISenseSampleCount );
+	require_nonzero ( samples, ReleaseStatistics );
+	
+	// Oldest sample first.
+	last	= fSenseSampleIndex;
+	index	= last - min ( last, kSCSISenseSampleCount );
+	for ( ; index != last; index++ )
+	{
+		
+		sample = fSenseSamples[index % kSCSISenseSampleCount];
+		
+		entry = OSDictionary::withCapacity ( 4 );
+		require_nonzero ( entry, ReleaseSamples );
+		
+		number = OSNumber::withNumber ( sample.senseKey, 8 );
+		if ( number != NULL )
+		{
+			entry->setObject ( kIOPropertySenseKeyKey, number );
+			number->release ( );
+		}
+		
+		number = OSNumber::withNumber ( sample.additionalSenseCode, 8 );
+		if ( number != NULL )
+		{
+			entry->setObject ( kIOPropertySenseASCKey, number );
+			number->release ( );
+		}
+		
+		number = OSNumber::withNumber ( sample.additionalSenseCodeQualifier, 8 );
+		if ( number != NULL )
+		{
+			entry->setObject ( kIOPropertySenseASCQKey, number );
+			number->release ( );
+		}
+		
+		number = OSNumber::withNumber ( sample.logicalBlockAddress, 64 );
+		if ( number != NULL )
+		{
+			entry->setObject ( kIOPropertySenseLBAKey, number );
+			number->release ( );
+		}
+		
+		samples->setObject ( entry );
+		entry->release ( );
+		
+	}
+	
+	statistics->setObject ( kIOPropertySenseRecentErrorsKey, samples );
+	setProperty ( kIOPropertySenseStatisticsKey, statistics );
+	
+	
+ReleaseSamples:
+	
+	
+	samples->release ( );
+	
+	
+ReleaseStatistics:
+	
+	
+	statistics->release ( );
+	
+	
+ErrorExit:
+	
+	
+	return;
+	
+}
+
+
+#if 0
+#pragma mark -
+#pragma mark SCSI Task Get and Release
+#pragma mark -
+#endif
+
+
+//
+//  GetSCSITask - 	Gets a SCSITask for use by the caller.			[PROTECTED]
+//
+
+SCSITaskIdentifier 
+IOSCSIPrimaryCommandsDevice::GetSCSITask ( void )
+{
+	
+	SCSITask *	newTask = OSTypeAlloc ( SCSITask );
+	
+	__Check ( newTask );
+	
+	newTask->SetTaskOwner ( this );
+	
+	// thread safe increment outstanding command count
+	IncrementOutstandingCommandsCount ( );
+	
+	// Make sure the object is not removed if there is a pending
+	// command.
+	retain ( );
+	
+	return ( SCSITaskIdentifier ) newTask;
+	
+}
+
+
+//
+//  ReleaseSCSITask - 	Releases a SCSITask.						[PROTECTED]
+//
+
+void 
+IOSCSIPrimaryCommandsDevice::ReleaseSCSITask ( SCSITaskIdentifier request )
+{
+	
+	__Require_noErr ( request, Exit );
+	
+	// Give back the task's tag, if it holds one.
+	FreeTaggedTaskIdentifier ( request );
+	
+	// decrement outstanding command count. The command gate is only taken
+	// when a quiesce is waiting for the count to drop.
+	OSDecrementAtomic ( ( volatile SInt32 * ) &fNumCommandsOutstanding );
+	
+	if ( fQuiescing == true )
+	{
+		
+		fCommandGate->runAction ( ( IOCommandGate::Action )
+			&IOSCSIPrimaryCommandsDevice::sWakeQuiesce );
+		
+	}
+	
+	request->release ( );
+	
+	// Since the command has been released, let go of the retain on this
+	// object.
+	release ( );
+	
+	
+Exit:
+	
+	
+	return;
+	
+}
+
+
+//
+//  GetUniqueTagID - 	Returns a unique tagged task ID.			[PROTECTED]
+//
+
+SCSITaggedTaskIdentifier 
+IOSCSIPrimaryCommandsDevice::GetUniqueTagID ( void )
+{
+	
+	SCSITaggedTaskIdentifier	taskID = kSCSIUntaggedTaskIdentifier;
+	
+	IOSimpleLockLock ( fTaskIDLock );
+	
+	taskID = ++fTaskID;
+	
+	IOSimpleLockUnlock ( fTaskIDLock );
+	
+	return taskID;
+	
+}
+
+
+//
+//  CreateTaggedTaskTable - 	Sizes and allocates this logical unit's
+//								tagged task space.					  [PRIVATE]
+//
+
+bool
+IOSCSIPrimaryCommandsDevice::CreateTaggedTaskTable ( void )
+{
+	
+	bool		result		= false;
+	bool		supported	= false;
+	UInt32		count		= 0;
+	UInt32		words		= 0;
+	
+	// Size the tag space to the queue depth the transport negotiated.
+	supported = GetProtocolDriver ( )->IsProtocolServiceSupported (
+						kSCSIProtocolFeature_MaximumTaggedTaskCount,
+						&count );
+	
+	if ( ( supported == false ) || ( count == 0 ) )
+	{
+		count = kSCSIDefaultTaggedTaskCount;
+	}
+	
+	if ( count > kSCSIMaximumTaggedTaskCount )
+	{
+		count = kSCSIMaximumTaggedTaskCount;
+	}
+	
+	fTagCount	= count;
+	words		= ( count + kTagBitmapBitsPerWord - 1 ) / kTagBitmapBitsPerWord;
+	
+	fTagBitmap = IONew ( UInt32, words );
+	require_nonzero ( fTagBitmap, ErrorExit );
+	bzero ( ( void * ) fTagBitmap, words * sizeof ( UInt32 ) );
+	
+	// Mark the bits past the end of the tag space as permanently in use,
+	// so the allocator never hands them out.
+	if ( ( count % kTagBitmapBitsPerWord ) != 0 )
+	{
+		fTagBitmap[words - 1] = ~( ( 1U << ( count % kTagBitmapBitsPerWord ) ) - 1 );
+	}
+	
+	fTagTable = IONew ( SCSITaskIdentifier, count );
+	require_nonzero ( fTagTable, ErrorExit );
+	bzero ( fTagTable, count * sizeof ( SCSITaskIdentifier ) );
+	
+	fTagAbortBitmap = IONew ( UInt32, words );
+	require_nonzero ( fTagAbortBitmap, ErrorExit );
+	bzero ( fTagAbortBitmap, words * sizeof ( UInt32 ) );
+	
+	fTagsInUse				= 0;
+	fTagsInUseHighWater		= 0;
+	fTagAllocationFailures	= 0;
+	
+	UpdateTaggedTaskStatistics ( );
+	
+	result = true;
+	
+	
+ErrorExit:
+	
+	
+	return result;
+	
+}
+
+
+//
+//  FreeTaggedTaskTable - Frees this logical unit's tagged task space.
+//																	  [PRIVATE]
+//
+
+void
+IOSCSIPrimaryCommandsDevice::FreeTaggedTaskTable ( void )
+{
+	
+	UInt32	words = 0;
+	
+	if ( fTagBitmap != NULL )
+	{
+		
+		words = ( fTagCount + kTagBitmapBitsPerWord - 1 ) / kTagBitmapBitsPerWord;
+		IODelete ( ( UInt32 * ) fTagBitmap, UInt32, words );
+		fTagBitmap = NULL;
+		
+	}
+	
+	if ( fTagAbortBitmap != NULL )
+	{
+		
+		words = ( fTagCount + kTagBitmapBitsPerWord - 1 ) / kTagBitmapBitsPerWord;
+		IODelete ( fTagAbortBitmap, UInt32, words );
+		fTagAbortBitmap = NULL;
+		
+	}
+	
+	if ( fTagTable != NULL )
+	{
+		
+		IODelete ( fTagTable, SCSITaskIdentifier, fTagCount );
+		fTagTable = NULL;
+		
+	}
+	
+	fTagCount = 0;
+	
+}
+
+
+//
+//  AllocateTaggedTaskIdentifier - 	Allocates a tag for a task from this
+//										logical unit's tag space.	[PROTECTED]
+//
+
+SCSITaggedTaskIdentifier
+IOSCSIPrimaryCommandsDevice::AllocateTaggedTaskIdentifier (
+									SCSITaskIdentifier	request )
+{
+	
+	SCSITaggedTaskIdentifier	tag			= kSCSIUntaggedTaskIdentifier;
+	UInt32						words		= 0;
+	UInt32						index		= 0;
+	UInt32						bit			= 0;
+	UInt32						inUse		= 0;
+	UInt32						highWater	= 0;
+	
+	require_nonzero ( fTagBitmap, ErrorExit );
+	
+	words = ( fTagCount + kTagBitmapBitsPerWord - 1 ) / kTagBitmapBitsPerWord;
+	
+	IOSimpleLockLock ( fTaskIDLock );
+	
+	// Claim the lowest clear bit in the first word which has one.
+	for ( index = 0; index < words; index++ )
+	{
+		
+		if ( fTagBitmap[index] != 0xFFFFFFFF )
+		{
+			
+			bit = ffs ( ~fTagBitmap[index] ) - 1;
+			fTagBitmap[index] |= ( 1U << bit );
+			
+			tag = ( index * kTagBitmapBitsPerWord ) + bit + 1;
+			fTagTable[tag - 1] = request;
+			break;
+			
+		}
+		
+	}
+	
+	IOSimpleLockUnlock ( fTaskIDLock );
+	
+	if ( tag == kSCSIUntaggedTaskIdentifier )
+	{
+		
+		// Every tag is outstanding. This is normal under load, so it is only
+		// counted, not logged.
+		OSIncrementAtomic ( ( volatile SInt32 * ) &fTagAllocationFailures );
+		ScheduleStatisticsUpdate ( );
+		
+		goto ErrorExit;
+		
+	}
+	
+	SetTaggedTaskIdentifier ( request, tag );
+	
+	inUse = OSIncrementAtomic ( &fTagsInUse ) + 1;
+	
+	// Raise the high-water mark, unless another thread beat us to a
+	// higher one.
+	do
+	{
+		highWater = fTagsInUseHighWater;
+	} while ( ( inUse > highWater ) &&
+			  ( OSCompareAndSwap ( highWater, inUse, &fTagsInUseHighWater ) == false ) );
+	
+	ScheduleStatisticsUpdate ( );
+	
+	
+ErrorExit:
+	
+	
+	return tag;
+	
+}
+
+
+//
+//  FreeTaggedTaskIdentifier - Gives a task's tag back to this logical unit's
+//								tag space.							  [PRIVATE]
+//
+
+void
+IOSCSIPrimaryCommandsDevice::FreeTaggedTaskIdentifier (
+									SCSITaskIdentifier	request )
+{
+	
+	SCSITaggedTaskIdentifier	tag		= kSCSIUntaggedTaskIdentifier;
+	UInt32						index	= 0;
+	UInt32						mask	= 0;
+	bool						owner	= false;
+	
+	require_nonzero_quiet ( fTagTable, ErrorExit );
+	
+	tag = GetTaggedTaskIdentifier ( request );
+	require_quiet ( ( tag != kSCSIUntaggedTaskIdentifier ), ErrorExit );
+	require ( ( tag <= fTagCount ), ErrorExit );
+	
+	index	= tag - 1;
+	mask	= 1U << ( index % kTagBitmapBitsPerWord );
+	
+	IOSimpleLockLock ( fTaskIDLock );
+	
+	// Only the task recorded for this tag may give it back. Anything else
+	// means the tag was not allocated by us or has already been freed.
+	owner = ( fTagTable[index] == request );
+	if ( owner == true )
+	{
+		
+		fTagTable[index] = NULL;
+		
+		// A tag an abort is being sent for is given back by
+		// ReleaseReservedTag instead.
+		if ( ( fTagAbortBitmap[index / kTagBitmapBitsPerWord] & mask ) == 0 )
+		{
+			fTagBitmap[index / kTagBitmapBitsPerWord] &= ~mask;
+		}
+		
+	}
+	
+	IOSimpleLockUnlock ( fTaskIDLock );
+	
+	require ( owner, ErrorExit );
+	
+	SetTaggedTaskIdentifier ( request, kSCSIUntaggedTaskIdentifier );
+	
+	OSDecrementAtomic ( &fTagsInUse );
+	ScheduleStatisticsUpdate ( );
+	
+	
+ErrorExit:
+	
+	
+	return;
+	
+}
+
+
+//
+//  UpdateTaggedTaskStatistics - Publishes the tagged task counters.
+//																	  [PRIVATE]
+//
+
+void
+IOSCSIPrimaryCommandsDevice::UpdateTaggedTaskStatistics ( void )
+{
+	
+	OSDictionary *	statistics	= NULL;
+	OSNumber *		number		= NULL;
+	
+	require_nonzero_quiet ( fIOSCSIPrimaryCommandsDeviceReserved, ErrorExit );
+	require_nonzero_quiet ( fTagTable, ErrorExit );
+	
+	// Publish a new dictionary each time rather than change the one
+	// already in the registry, which could be being serialized.
+	statistics = OSDictionary::withCapacity ( 4 );
+	require_nonzero ( statistics, ErrorExit );
+	
+	number = OSNumber::withNumber ( fTagCount, 32 );
+	require_nonzero ( number, ReleaseStatistics );
+	statistics->setObject ( kIOPropertyTaggedTaskQueueDepthKey, number );
+	number->release ( );
+	
+	number = OSNumber::withNumber ( ( UInt32 ) fTagsInUse, 32 );
+	require_nonzero ( number, ReleaseStatistics );
+	statistics->setObject ( kIOPropertyTaggedTasksInUseKey, number );
+	number->release ( );
+	
+	number = OSNumber::withNumber ( fTagsInUseHighWater, 32 );
+	require_nonzero ( number, ReleaseStatistics );
+	statistics->setObject ( kIOPropertyTaggedTasksHighWaterKey, number );
+	number->release ( );
+	
+	number = OSNumber::withNumber ( fTagAllocationFailures, 32 );
+	require_nonzero ( number, ReleaseStatistics );
+	statistics->setObject ( kIOPropertyTaggedTaskFailuresKey, number );
+	number->release ( );
+	
+	setProperty ( kIOPropertyTaggedTaskStatisticsKey, statistics );
+	
+	
+ReleaseStatistics:
+	
+	
+	statistics->release ( );
+	
+	
+ErrorExit:
+	
+	
+	return;
+	
+}
+
+
+//
+//  ScheduleStatisticsUpdate - 	Schedules the statistics to be published,
+//									unless they already are.		  [PRIVATE]
+//
+
+void
+IOSCSIPrimaryCommandsDevice::ScheduleStatisticsUpdate ( void )
+{
+	
+	UInt64	deadline = 0;
+	
+	require_nonzero_quiet ( fStatisticsThread, ErrorExit );
+	
+	// Once a publish is scheduled this is a single read, so it is cheap
+	// enough to call for every task.
+	require_quiet ( ( fStatisticsPending == 0 ), ErrorExit );
+	require_quiet ( OSCompareAndSwap ( 0, 1, &fStatisticsPending ), ErrorExit );
+	
+	// Hold a retain until the publish has run.
+	retain ( );
+	
+	clock_interval_to_deadline ( kStatisticsPublishDelayMS, kMillisecondScale, &deadline );
+	thread_call_enter_delayed ( fStatisticsThread, deadline );
+	
+	
+ErrorExit:
+	
+	
+	return;
+	
+}
+
+
+//
+//  sStatisticsTimerExpired - 	Called on fStatisticsThread to publish the
+//								statistics.					  [STATIC][PRIVATE]
+//
+
+void
+IOSCSIPrimaryCommandsDevice::sStatisticsTimerExpired (
+									thread_call_param_t		param0,
+									thread_call_param_t		param1 )
+{
+	
+	IOSCSIPrimaryCommandsDevice *	device = ( IOSCSIPrimaryCommandsDevice * ) param0;
+	
+	device->PublishStatistics ( );
+	device->release ( );
+	
+}
+
+
+//
+//  PublishStatistics - Publishes the statistics to the registry.	  [PRIVATE]
+//
+
+void
+IOSCSIPrimaryCommandsDevice::PublishStatistics ( void )
+{
+	
+	// Clear the flag first, so anything counted from here on schedules
+	// another publish.
+	OSCompareAndSwap ( 1, 0, &fStatisticsPending );
+	
+	UpdateTaggedTaskStatistics ( );
+	UpdateLatencyStatistics ( );
+	UpdateSenseStatistics ( );
+	
+}
+
+
+//
+//  GetTaskForTaggedTaskIdentifier - 	Returns the outstanding task holding
+//										a tag, or NULL.				[PROTECTED]
+//
+
+SCSITaskIdentifier
+IOSCSIPrimaryCommandsDevice::GetTaskForTaggedTaskIdentifier (
+									SCSITaggedTaskIdentifier	tag )
+{
+	
+	SCSITaskIdentifier	request = NULL;
+	
+	require_nonzero_quiet ( fTagTable, ErrorExit );
+	require_quiet ( ( tag != kSCSIUntaggedTaskIdentifier ), ErrorExit );
+	require_quiet ( ( tag <= fTagCount ), ErrorExit );
+	
+	IOSimpleLockLock ( fTaskIDLock );
+	request = fTagTable[tag - 1];
+	IOSimpleLockUnlock ( fTaskIDLock );
+	
+	
+ErrorExit:
+	
+	
+	return request;
+	
+}
+
+
+#if 0
+#pragma mark -
+#pragma mark  Media Poll Scheduler
+#pragma mark -
+#endif
+
+
+//
+//  ScheduleMediaPoll - 	Schedules a media poll for this logical unit on
+//							the shared media poll scheduler.		[PROTECTED]
+//
+
+bool
+IOSCSIPrimaryCommandsDevice::ScheduleMediaPoll ( thread_call_t pollThread )
+{
+	
+	SCSIMediaPollScheduler *		scheduler	= NULL;
+	IOSCSIPrimaryCommandsDevice **	slot		= NULL;
+	UInt64							deadline	= 0;
+	UInt64							due			= 0;
+	bool							result		= false;
+	
+	clock_interval_to_deadline ( fMediaPollInterval, kMillisecondScale, &deadline );
+	
+	if ( fMediaPollScheduler == NULL )
+	{
+		
+		scheduler = sRetainMediaPollScheduler ( );
+		if ( ( scheduler != NULL ) &&
+			 ( OSCompareAndSwapPtr ( NULL, scheduler, ( void * volatile * ) &fMediaPollScheduler ) == false ) )
+		{
+			sReleaseMediaPollScheduler ( scheduler );
+		}
+		
+	}
+	
+	scheduler = fMediaPollScheduler;
+	
+	// If the shared scheduler can't be created, time this logical unit's
+	// polls with its own thread call, as was done before the scheduler
+	// existed. CancelMediaPoll cancels pollThread directly in that case.
+	if ( scheduler == NULL )
+	{
+		
+		ERROR_LOG ( ( "%s: media poll scheduler unavailable, polling on own timer\n",
+					  getName ( ) ) );
+		
+		result = ( thread_call_enter_delayed ( pollThread, deadline ) == false );
+		goto ErrorExit;
+		
+	}
+	
+	// Wake up at the end of the tick rather than at the exact deadline, so
+	// every logical unit which falls due in the same tick shares one wakeup.
+	due = ( ( deadline / scheduler->tickInterval ) + 1 ) * scheduler->tickInterval;
+	
+	IOSimpleLockLock ( scheduler->lock );
+	
+	if ( fMediaPollDeadline == 0 )
+	{
+		
+		slot = &scheduler->wheel[( deadline / scheduler->tickInterval ) % kMediaPollWheelSlots];
+		
+		fMediaPollThread			= pollThread;
+		fMediaPollDeadline			= deadline;
+		fPreviousMediaPollDevice	= NULL;
+		fNextMediaPollDevice		= *slot;
+		
+		if ( *slot != NULL )
+		{
+			( *slot )->fPreviousMediaPollDevice = this;
+		}
+		
+		*slot = this;
+		
+		if ( ( scheduler->timerDeadline == 0 ) || ( due < scheduler->timerDeadline ) )
+		{
+			
+			// Moving an armed timer keeps the reference it already holds.
+			if ( scheduler->timerDeadline == 0 )
+			{
+				OSIncrementAtomic ( &scheduler->users );
+			}
+			
+			scheduler->timerDeadline = due;
+			thread_call_enter_delayed ( scheduler->timer, due );
+			
+		}
+		
+		result = true;
+		
+	}
+	
+	IOSimpleLockUnlock ( scheduler->lock );
+	
+	
+ErrorExit:
+	
+	
+	return result;
+	
+}
+
+
+//
+//  CancelMediaPoll - 	Cancels this logical unit's media poll if it has not
+//						yet run.									[PROTECTED]
+//
+
+bool
+IOSCSIPrimaryCommandsDevice::CancelMediaPoll ( thread_call_t pollThread )
+{
+	
+	SCSIMediaPollScheduler *	scheduler	= fMediaPollScheduler;
+	bool						result		= false;
+	
+	// Start over at the base interval the next time polling is enabled.
+	fMediaPollInterval	= kMediaPollIntervalMS;
+	fMediaPollIdleCount	= 0;
+	
+	if ( scheduler == NULL )
+	{
+		return thread_call_cancel ( pollThread );
+	}
+	
+	IOSimpleLockLock ( scheduler->lock );
+	
+	// The scheduler hands a due poll to pollThread with the lock held, so
+	// the poll is either still in the wheel or already on pollThread.
+	if ( fMediaPollDeadline != 0 )
+	{
+		
+		UnlinkMediaPoll ( );
+		result = true;
+		
+	}
+	
+	else
+	{
+		result = thread_call_cancel ( pollThread );
+	}
+	
+	IOSimpleLockUnlock ( scheduler->lock );
+	
+	return result;
+	
+}
+
+
+//
+//  RecordMediaPoll - 	Records the cost of a media poll and adapts the
+//						interval to the next one.					[PROTECTED]
+//
+
+void
+IOSCSIPrimaryCommandsDevice::RecordMediaPoll ( UInt64 startTime, bool idle )
+{
+	
+	UInt64		now			= 0;
+	UInt64		elapsed		= 0;
+	OSNumber *	number		= NULL;
+	
+	clock_get_uptime ( &now );
+	absolutetime_to_nanoseconds ( now - startTime, &elapsed );
+	
+	// Poll times are kept in microseconds.
+	elapsed /= 1000;
+	
+	fMediaPollCount++;
+	fMediaPollTotalTime += elapsed;
+	
+	if ( elapsed > fMediaPollMaximumTime )
+	{
+		fMediaPollMaximumTime = elapsed;
+	}
+	
+	if ( idle == true )
+	{
+		
+		// Nothing has changed for a while, so poll half as often, up to
+		// kMediaPollMaximumIntervalMS.
+		fMediaPollIdleCount++;
+		if ( ( fMediaPollIdleCount >= kMediaPollIdleBackoffCount ) &&
+			 ( fMediaPollInterval < kMediaPollMaximumIntervalMS ) )
+		{
+			
+			fMediaPollIdleCount	= 0;
+			fMediaPollInterval	= min ( fMediaPollInterval * 2, kMediaPollMaximumIntervalMS );
+			
+		}
+		
+	}
+	
+	else
+	{
+		
+		fMediaPollIdleCount	= 0;
+		fMediaPollInterval	= kMediaPollIntervalMS;
+		
+	}
+	
+	if ( fMediaPollStatistics == NULL )
+	{
+		
+		fMediaPollStatistics = OSDictionary::withCapacity ( 4 );
+		require_nonzero ( fMediaPollStatistics, ErrorExit );
+		
+		number = OSNumber::withNumber ( fMediaPollCount, 64 );
+		require_nonzero ( number, ErrorExit );
+		fMediaPollStatistics->setObject ( kIOPropertyMediaPollCountKey, number );
+		number->release ( );
+		
+		number = OSNumber::withNumber ( fMediaPollTotalTime, 64 );
+		require_nonzero ( number, ErrorExit );
+		fMediaPollStatistics->setObject ( kIOPropertyMediaPollTotalTimeKey, number );
+		number->release ( );
+		
+		number = OSNumber::withNumber ( fMediaPollMaximumTime, 64 );
+		require_nonzero ( number, ErrorExit );
+		fMediaPollStatistics->setObject ( kIOPropertyMediaPollMaximumTimeKey, number );
+		number->release ( );
+		
+		number = OSNumber::withNumber ( fMediaPollInterval, 32 );
+		require_nonzero ( number, ErrorExit );
+		fMediaPollStatistics->setObject ( kIOPropertyMediaPollIntervalKey, number );
+		number->release ( );
+		
+		setProperty ( kIOPropertyMediaPollStatisticsKey, fMediaPollStatistics );
+		goto ErrorExit;
+		
+	}
+	
+	number = OSDynamicCast ( OSNumber, fMediaPollStatistics->getObject ( kIOPropertyMediaPollCountKey ) );
+	if ( number != NULL )
+		number->setValue ( fMediaPollCount );
+	
+	number = OSDynamicCast ( OSNumber, fMediaPollStatistics->getObject ( kIOPropertyMediaPollTotalTimeKey ) );
+	if ( number != NULL )
+		number->setValue ( fMediaPollTotalTime );
+	
+	number = OSDynamicCast ( OSNumber, fMediaPollStatistics->getObject ( kIOPropertyMediaPollMaximumTimeKey ) );
+	if ( number != NULL )
+		number->setValue ( fMediaPollMaximumTime );
+	
+	number = OSDynamicCast ( OSNumber, fMediaPollStatistics->getObject ( kIOPropertyMediaPollIntervalKey ) );
+	if ( number != NULL )
+		number->setValue ( fMediaPollInterval );
+	
 	
-}
-
-
-//
-//	 sIncrementOutstandingCommandsCount - C->C++ glue code.
-//															[STATIC][PROTECTED]
-//
-
-void
-IOSCSIPrimaryCommandsDevice::sIncrementOutstandingCommandsCount (
-									IOSCSIPrimaryCommandsDevice * self )
-{
+ErrorExit:
 	
-	self->HandleIncrementOutstandingCommandsCount ( );
+	
+	return;
 	
 }
 
 
 //
-//  HandleIncrementOutstandingCommandsCount - 	Increments number of
-//												outstanding commands.
-//																	[PROTECTED]
+//  UnlinkMediaPoll - 	Removes this logical unit from the media poll
+//						scheduler's wheel. Must be called with the scheduler
+//						lock held.									  [PRIVATE]
 //
 
 void
-IOSCSIPrimaryCommandsDevice::HandleIncrementOutstandingCommandsCount ( void )
+IOSCSIPrimaryCommandsDevice::UnlinkMediaPoll ( void )
 {
 	
-	fNumCommandsOutstanding++;	
+	SCSIMediaPollScheduler *	scheduler = fMediaPollScheduler;
 	
-}
-
-
-#if 0
-#pragma mark -
-#pragma mark SCSI Task Get and Release
-#pragma mark -
-#endif
-
-
-//
-//  GetSCSITask - 	Gets a SCSITask for use by the caller.			[PROTECTED]
-//
-
-SCSITaskIdentifier 
-IOSCSIPrimaryCommandsDevice::GetSCSITask ( void )
-{
+	require_nonzero_quiet ( fMediaPollDeadline, ErrorExit );
 	
-	SCSITask *	newTask = OSTypeAlloc ( SCSITask );
+	if ( fPreviousMediaPollDevice == NULL )
+	{
+		
+		scheduler->wheel[( fMediaPollDeadline / scheduler->tickInterval ) %
+						 kMediaPollWheelSlots] = fNextMediaPollDevice;
+		
+	}
 	
-	__Check ( newTask );
+	else
+	{
+		fPreviousMediaPollDevice->fNextMediaPollDevice = fNextMediaPollDevice;
+	}
 	
-	newTask->SetTaskOwner ( this );
+	if ( fNextMediaPollDevice != NULL )
+	{
+		fNextMediaPollDevice->fPreviousMediaPollDevice = fPreviousMediaPollDevice;
+	}
 	
-	// thread safe increment outstanding command count
-	IncrementOutstandingCommandsCount ( );
+	fNextMediaPollDevice		= NULL;
+	fPreviousMediaPollDevice	= NULL;
+	fMediaPollDeadline			= 0;
 	
-	// Make sure the object is not removed if there is a pending
-	// command.
-	retain ( );
 	
-	return ( SCSITaskIdentifier ) newTask;
+ErrorExit:
+	
+	
+	return;
 	
 }
 
 
 //
-//  ReleaseSCSITask - 	Releases a SCSITask.						[PROTECTED]
+//  sRetainMediaPollScheduler - 	Returns the shared media poll scheduler,
+//									creating it if it does not exist yet, with
+//									a reference held for the caller.
+//															  [STATIC][PRIVATE]
 //
 
-void 
-IOSCSIPrimaryCommandsDevice::ReleaseSCSITask ( SCSITaskIdentifier request )
+SCSIMediaPollScheduler *
+IOSCSIPrimaryCommandsDevice::sRetainMediaPollScheduler ( void )
 {
 	
-	__Require_noErr ( request, Exit );
+	SCSIMediaPollScheduler *	scheduler	= NULL;
+	UInt64						now			= 0;
 	
-	// decrement outstanding command count
-	fNumCommandsOutstanding--;
+	require_nonzero ( sMediaPollSchedulerLock.fLock, ErrorExit );
 	
-	request->release ( );
+	IOLockLock ( sMediaPollSchedulerLock.fLock );
 	
-	// Since the command has been released, let go of the retain on this
-	// object.
-	release ( );
+	scheduler = sMediaPollScheduler;
+	if ( scheduler != NULL )
+	{
+		
+		OSIncrementAtomic ( &scheduler->users );
+		goto Unlock;
+		
+	}
 	
+	scheduler = IONew ( SCSIMediaPollScheduler, 1 );
+	require_nonzero ( scheduler, Unlock );
+	bzero ( scheduler, sizeof ( SCSIMediaPollScheduler ) );
 	
-Exit:
+	scheduler->lock = IOSimpleLockAlloc ( );
+	require_nonzero ( scheduler->lock, FreeScheduler );
 	
+	scheduler->timer = thread_call_allocate (
+			( thread_call_func_t ) IOSCSIPrimaryCommandsDevice::sMediaPollTimerExpired,
+			( thread_call_param_t ) scheduler );
+	require_nonzero ( scheduler->timer, FreeLock );
 	
-	return;
+	clock_interval_to_absolutetime_interval ( kMediaPollWheelTickMS,
+											  kMillisecondScale,
+											  &scheduler->tickInterval );
+	
+	clock_get_uptime ( &now );
+	scheduler->lastTick = now / scheduler->tickInterval;
+	
+	scheduler->users	= 1;
+	sMediaPollScheduler	= scheduler;
+	
+	goto Unlock;
+	
+	
+FreeLock:
+	
+	
+	IOSimpleLockFree ( scheduler->lock );
+	
+	
+FreeScheduler:
+	
+	
+	IODelete ( scheduler, SCSIMediaPollScheduler, 1 );
+	scheduler = NULL;
+	
+	
+Unlock:
+	
+	
+	IOLockUnlock ( sMediaPollSchedulerLock.fLock );
+	
+	
+ErrorExit:
+	
+	
+	return scheduler;
 	
 }
 
 
 //
-//  GetUniqueTagID - 	Returns a unique tagged task ID.			[PROTECTED]
+//  sReleaseMediaPollScheduler - 	Drops a reference on the shared media poll
+//									scheduler and frees it with the last one.
+//															  [STATIC][PRIVATE]
 //
 
-SCSITaggedTaskIdentifier 
-IOSCSIPrimaryCommandsDevice::GetUniqueTagID ( void )
+void
+IOSCSIPrimaryCommandsDevice::sReleaseMediaPollScheduler (
+									SCSIMediaPollScheduler * scheduler )
 {
 	
-	SCSITaggedTaskIdentifier	taskID = kSCSIUntaggedTaskIdentifier;
+	bool	last = false;
 	
-	IOSimpleLockLock ( fTaskIDLock );
+	// Drop the reference with the lock held, so sRetainMediaPollScheduler
+	// can't hand out a scheduler which is about to be freed.
+	IOLockLock ( sMediaPollSchedulerLock.fLock );
 	
-	taskID = ++fTaskID;
+	if ( OSDecrementAtomic ( &scheduler->users ) == 1 )
+	{
+		
+		last = true;
+		if ( sMediaPollScheduler == scheduler )
+		{
+			sMediaPollScheduler = NULL;
+		}
+		
+	}
 	
-	IOSimpleLockUnlock ( fTaskIDLock );
+	IOLockUnlock ( sMediaPollSchedulerLock.fLock );
 	
-	return taskID;
+	require_quiet ( last, Exit );
+	
+	// The timer holds a reference while it is armed or running, so it is
+	// idle here unless this is the last thing its callback does.
+	thread_call_free ( scheduler->timer );
+	IOSimpleLockFree ( scheduler->lock );
+	IODelete ( scheduler, SCSIMediaPollScheduler, 1 );
+	
+	
+Exit:
+	
+	
+	return;
 	
 }
 
@@ -1232,6 +3300,91 @@ ProtocolAccessDisabledError:
 }
 
 
+//
+//  InitializeReadWriteTaskTemplates - Builds the read and write task
+//										templates.					[PROTECTED]
+//
+
+void
+IOSCSIPrimaryCommandsDevice::InitializeReadWriteTaskTemplates (
+						SCSITaskCompletion 	taskCompletion )
+{
+	
+	bzero ( &fReadTaskTemplate, sizeof ( SCSITaskTemplate ) );
+	
+	fReadTaskTemplate.taskAttribute			= kSCSITask_SIMPLE;
+	fReadTaskTemplate.transferDirection		= kSCSIDataTransfer_FromTargetToInitiator;
+	fReadTaskTemplate.timeoutDuration		= fReadTimeoutDuration;
+	fReadTaskTemplate.completionCallback	= taskCompletion;
+	
+	// The same REQUEST SENSE command SendCommand sets up for autosense.
+	fReadTaskTemplate.autosenseCDB[0]		= kSCSICmd_REQUEST_SENSE;
+	fReadTaskTemplate.autosenseCDB[4]		= sizeof ( SCSI_Sense_Data );
+	fReadTaskTemplate.autosenseCDBSize		= kSCSICDBSize_6Byte;
+	
+	// Writes only differ in direction and timeout.
+	fWriteTaskTemplate						= fReadTaskTemplate;
+	fWriteTaskTemplate.transferDirection	= kSCSIDataTransfer_FromInitiatorToTarget;
+	fWriteTaskTemplate.timeoutDuration		= fWriteTimeoutDuration;
+	
+}
+
+
+//
+//  SendTemplatedCommand - Called to send a command built from a template
+//							asynchronously.							[PROTECTED]
+//
+
+void
+IOSCSIPrimaryCommandsDevice::SendTemplatedCommand (
+						SCSITaskIdentifier 			request,
+						const SCSITaskTemplate *	taskTemplate )
+{
+	
+	SCSITask *	scsiRequest;
+	
+	scsiRequest = SCSITaskFromIdentifier ( request );
+	check ( scsiRequest );
+	
+	// This sets the completion callback too, which the error path
+	// relies on.
+	scsiRequest->ApplyTemplate ( taskTemplate );
+	
+	// Tag the command if the device queues. When every tag is outstanding the
+	// command goes out untagged, and ORDERED, so the device can't move it
+	// past tagged commands it is still holding.
+	if ( ( GetCMDQUE ( ) == true ) &&
+		 ( scsiRequest->GetTaggedTaskIdentifier ( ) == kSCSIUntaggedTaskIdentifier ) )
+	{
+		
+		if ( AllocateTaggedTaskIdentifier ( request ) == kSCSIUntaggedTaskIdentifier )
+		{
+			scsiRequest->SetTaskAttribute ( kSCSITask_ORDERED );
+		}
+		
+	}
+	
+	__Require ( IsProtocolAccessEnabled ( ), ProtocolAccessDisabledError );
+	
+	GetProtocolDriver ( )->ExecuteCommand ( request );
+	
+	return;
+	
+	
+ProtocolAccessDisabledError:
+	
+	
+	SetServiceResponse ( request,
+						 kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE );
+	SetTaskStatus ( request, kSCSITaskStatus_No_Status );
+	// The task has completed, execute the callback.
+	TaskCompletedNotification ( request );
+	
+	return;
+	
+}
+
+
 //
 //  GatedWaitForTask - Called to wait for a task to complete.		  [PRIVATE]
 //
@@ -1240,7 +3393,7 @@ IOReturn
 IOSCSIPrimaryCommandsDevice::GatedWaitForTask ( SCSITaskIdentifier request )
 {
 	
-	SCSITask *		task	= OSDynamicCast ( SCSITask, request );
+	SCSITask *		task	= SCSITaskFromIdentifier ( request );
 	IOReturn		result	= kIOReturnBadArgument;
 	
 	if ( task != NULL )
@@ -1281,9 +3434,12 @@ IOSCSIPrimaryCommandsDevice::ResetForNewTask (
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	
+	// A reused task must not keep a tag from its previous command.
+	FreeTaggedTaskIdentifier ( request );
+	
 	return scsiRequest->ResetForNewTask ( );
 	
 }
@@ -1301,7 +3457,7 @@ IOSCSIPrimaryCommandsDevice::SetTaskAttribute (
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	
 	return scsiRequest->SetTaskAttribute ( newAttribute );
@@ -1319,7 +3475,7 @@ IOSCSIPrimaryCommandsDevice::GetTaskAttribute ( SCSITaskIdentifier request )
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	
 	return scsiRequest->GetTaskAttribute ( );
@@ -1339,7 +3495,7 @@ IOSCSIPrimaryCommandsDevice::SetTaggedTaskIdentifier (
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	
 	return scsiRequest->SetTaggedTaskIdentifier ( taggedTaskIdentifier );
@@ -1358,7 +3514,7 @@ IOSCSIPrimaryCommandsDevice::GetTaggedTaskIdentifier (
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	
 	return scsiRequest->GetTaggedTaskIdentifier ( );
@@ -1377,7 +3533,7 @@ IOSCSIPrimaryCommandsDevice::SetTaskState ( SCSITaskIdentifier	request,
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	
 	return scsiRequest->SetTaskState ( newTaskState );
@@ -1395,7 +3551,7 @@ IOSCSIPrimaryCommandsDevice::GetTaskState ( SCSITaskIdentifier request )
 	
 	SCSITask *	scsiRequest;
 
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	return scsiRequest->GetTaskState( );
 	
 }
@@ -1412,7 +3568,7 @@ IOSCSIPrimaryCommandsDevice::SetTaskStatus ( SCSITaskIdentifier	request,
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	
 	return scsiRequest->SetTaskStatus ( newStatus );
@@ -1430,7 +3586,7 @@ IOSCSIPrimaryCommandsDevice::GetTaskStatus ( SCSITaskIdentifier request )
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	
 	return scsiRequest->GetTaskStatus ( );
@@ -1455,7 +3611,7 @@ IOSCSIPrimaryCommandsDevice::SetCommandDescriptorBlock (
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	
 	return scsiRequest->SetCommandDescriptorBlock (
@@ -1490,7 +3646,7 @@ IOSCSIPrimaryCommandsDevice::SetCommandDescriptorBlock (
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	
 	return scsiRequest->SetCommandDescriptorBlock (
@@ -1531,7 +3687,7 @@ IOSCSIPrimaryCommandsDevice::SetCommandDescriptorBlock (
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	
 	return scsiRequest->SetCommandDescriptorBlock (
@@ -1578,7 +3734,7 @@ IOSCSIPrimaryCommandsDevice::SetCommandDescriptorBlock (
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	
 	return scsiRequest->SetCommandDescriptorBlock (
@@ -1602,6 +3758,27 @@ IOSCSIPrimaryCommandsDevice::SetCommandDescriptorBlock (
 }
 
 
+//
+//  SetCommandDescriptorBlock - Sets the CDB from a whole block.	[PROTECTED]
+//
+
+bool
+IOSCSIPrimaryCommandsDevice::SetCommandDescriptorBlock (
+									SCSITaskIdentifier 					request,
+									const SCSICommandDescriptorBlock *	cdbData,
+									UInt8								cdbSize )
+{
+	
+	SCSITask *	scsiRequest;
+	
+	scsiRequest = SCSITaskFromIdentifier ( request );
+	check ( scsiRequest );
+	
+	return scsiRequest->SetCommandDescriptorBlock ( cdbData, cdbSize );
+	
+}
+
+
 //
 //  SetDataTransferDirection - Sets the data transfer direction.	[PROTECTED]
 //
@@ -1614,7 +3791,7 @@ IOSCSIPrimaryCommandsDevice::SetDataTransferDirection (
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	return scsiRequest->SetDataTransferDirection ( newDirection );
 	
@@ -1632,7 +3809,7 @@ IOSCSIPrimaryCommandsDevice::GetDataTransferDirection (
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	
 	return scsiRequest->GetDataTransferDirection ( );
@@ -1653,7 +3830,7 @@ IOSCSIPrimaryCommandsDevice::SetRequestedDataTransferCount (
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	
 	return scsiRequest->SetRequestedDataTransferCount ( newRequestedCount );
@@ -1673,7 +3850,7 @@ IOSCSIPrimaryCommandsDevice::GetRequestedDataTransferCount (
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	
 	return scsiRequest->GetRequestedDataTransferCount ( );
@@ -1694,7 +3871,7 @@ IOSCSIPrimaryCommandsDevice::SetRealizedDataTransferCount (
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	
 	return scsiRequest->SetRealizedDataTransferCount ( newRealizedDataCount );
@@ -1714,7 +3891,7 @@ IOSCSIPrimaryCommandsDevice::GetRealizedDataTransferCount (
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	
 	return scsiRequest->GetRealizedDataTransferCount ( );
@@ -1733,7 +3910,7 @@ IOSCSIPrimaryCommandsDevice::SetDataBuffer ( SCSITaskIdentifier		request,
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	
 	return scsiRequest->SetDataBuffer ( newBuffer );
@@ -1751,7 +3928,7 @@ IOSCSIPrimaryCommandsDevice::GetDataBuffer ( SCSITaskIdentifier request )
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	
 	return scsiRequest->GetDataBuffer ( );
@@ -1772,7 +3949,7 @@ IOSCSIPrimaryCommandsDevice::SetTimeoutDuration (
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	
 	return scsiRequest->SetTimeoutDuration ( newTimeout );
@@ -1791,7 +3968,7 @@ IOSCSIPrimaryCommandsDevice::GetTimeoutDuration ( SCSITaskIdentifier request )
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	
 	return scsiRequest->GetTimeoutDuration ( );
@@ -1811,7 +3988,7 @@ IOSCSIPrimaryCommandsDevice::SetTaskCompletionCallback (
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	
 	return scsiRequest->SetTaskCompletionCallback ( newCallback );
@@ -1830,7 +4007,7 @@ IOSCSIPrimaryCommandsDevice::TaskCompletedNotification (
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	
 	return scsiRequest->TaskCompletedNotification ( );
@@ -1838,6 +4015,26 @@ IOSCSIPrimaryCommandsDevice::TaskCompletedNotification (
 }
 
 
+//
+//  GetTaskTimestamps - Gets the trace timestamps.					[PROTECTED]
+//
+
+void
+IOSCSIPrimaryCommandsDevice::GetTaskTimestamps (
+										SCSITaskIdentifier 		request,
+										SCSITaskTimestamps *	timestamps )
+{
+	
+	SCSITask *	scsiRequest;
+	
+	scsiRequest = SCSITaskFromIdentifier ( request );
+	check ( scsiRequest );
+	
+	scsiRequest->GetTimestamps ( timestamps );
+	
+}
+
+
 //
 //  SetServiceResponse - Sets the SCSIServiceResponse.				[PROTECTED]
 //
@@ -1850,7 +4047,7 @@ IOSCSIPrimaryCommandsDevice::SetServiceResponse (
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	
 	return scsiRequest->SetServiceResponse ( serviceResponse );
@@ -1869,7 +4066,7 @@ IOSCSIPrimaryCommandsDevice::GetServiceResponse (
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	
 	return scsiRequest->GetServiceResponse ( );
@@ -1894,7 +4091,7 @@ IOSCSIPrimaryCommandsDevice::SetAutosenseCommand (
 	
 	SCSITask *		scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	
 	return scsiRequest->SetAutosenseCommand ( cdbByte0, cdbByte1, cdbByte2,
@@ -1927,7 +4124,7 @@ IOSCSIPrimaryCommandsDevice::GetAutoSenseData ( SCSITaskIdentifier	request,
 	
 	SCSITask *		scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	
 	return scsiRequest->GetAutoSenseData ( senseData, senseDataSize );
@@ -1945,7 +4142,7 @@ IOSCSIPrimaryCommandsDevice::GetAutoSenseDataSize ( SCSITaskIdentifier request )
 	
 	SCSITask *		scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	
 	return scsiRequest->GetAutoSenseDataSize ( );
@@ -1966,7 +4163,7 @@ IOSCSIPrimaryCommandsDevice::SetApplicationLayerReference (
 	
 	SCSITask *		scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	
 	return scsiRequest->SetApplicationLayerReference ( newReferenceValue );
@@ -1986,7 +4183,7 @@ IOSCSIPrimaryCommandsDevice::GetApplicationLayerReference (
 	
 	SCSITask *		scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	
 	return scsiRequest->GetApplicationLayerReference ( );
@@ -2004,7 +4201,7 @@ IOSCSIPrimaryCommandsDevice::sGetOwnerForTask ( SCSITaskIdentifier request )
 	
 	SCSITask *	scsiRequest = NULL;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	check ( scsiRequest );
 	
 	return scsiRequest->GetTaskOwner ( );
@@ -2532,6 +4729,113 @@ IOSCSIPrimaryCommandsDevice::sWaitForTask (
 
 
 
+//
+//  sMediaPollTimerExpired -	Hands every logical unit whose media poll is
+//								due to its poll thread, then sleeps until the
+//								next occupied slot.			  [STATIC][PRIVATE]
+//
+
+void
+IOSCSIPrimaryCommandsDevice::sMediaPollTimerExpired (
+									thread_call_param_t		param0,
+									thread_call_param_t		param1 )
+{
+	
+	SCSIMediaPollScheduler *		scheduler	= ( SCSIMediaPollScheduler * ) param0;
+	IOSCSIPrimaryCommandsDevice *	device		= NULL;
+	IOSCSIPrimaryCommandsDevice *	next		= NULL;
+	UInt64							now			= 0;
+	UInt64							currentTick	= 0;
+	UInt64							tick		= 0;
+	UInt64							deadline	= 0;
+	UInt32							index		= 0;
+	bool							rearmed		= false;
+	
+	clock_get_uptime ( &now );
+	currentTick = now / scheduler->tickInterval;
+	
+	IOSimpleLockLock ( scheduler->lock );
+	
+	// The reference held by the armed timer now belongs to this callback.
+	scheduler->timerDeadline = 0;
+	
+	// Visit every slot passed since the last wakeup, including the last one,
+	// which may hold polls that were not yet due then.
+	tick = scheduler->lastTick;
+	if ( ( currentTick - tick ) >= kMediaPollWheelSlots )
+	{
+		tick = currentTick - kMediaPollWheelSlots + 1;
+	}
+	
+	for ( ; tick <= currentTick; tick++ )
+	{
+		
+		device = scheduler->wheel[tick % kMediaPollWheelSlots];
+		while ( device != NULL )
+		{
+			
+			next = device->fNextMediaPollDevice;
+			
+			if ( device->fMediaPollDeadline <= now )
+			{
+				
+				device->UnlinkMediaPoll ( );
+				thread_call_enter ( device->fMediaPollThread );
+				
+			}
+			
+			device = next;
+			
+		}
+		
+	}
+	
+	scheduler->lastTick = currentTick;
+	
+	// The longest poll interval is shorter than one turn of the wheel, so
+	// the first occupied slot from here holds the earliest deadline.
+	for ( index = 0; index < kMediaPollWheelSlots; index++ )
+	{
+		
+		device = scheduler->wheel[( currentTick + index ) % kMediaPollWheelSlots];
+		if ( device == NULL )
+			continue;
+		
+		deadline = device->fMediaPollDeadline;
+		for ( ; device != NULL; device = device->fNextMediaPollDevice )
+		{
+			deadline = min ( deadline, device->fMediaPollDeadline );
+		}
+		
+		deadline = ( ( deadline / scheduler->tickInterval ) + 1 ) * scheduler->tickInterval;
+		
+		// ScheduleMediaPoll may have armed the timer, with a reference of
+		// its own, since this callback started.
+		if ( ( scheduler->timerDeadline == 0 ) || ( deadline < scheduler->timerDeadline ) )
+		{
+			
+			rearmed = ( scheduler->timerDeadline == 0 );
+			scheduler->timerDeadline = deadline;
+			thread_call_enter_delayed ( scheduler->timer, deadline );
+			
+		}
+		
+		break;
+		
+	}
+	
+	IOSimpleLockUnlock ( scheduler->lock );
+	
+	// Otherwise the reference goes with the armed timer.
+	if ( rearmed == false )
+	{
+		sReleaseMediaPollScheduler ( scheduler );
+	}
+	
+}
+
+
+
 
 #if 0
 #pragma mark -
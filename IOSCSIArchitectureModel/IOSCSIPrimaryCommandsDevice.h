@@ -82,8 +82,47 @@ enum
 // plus 4 retries.
 #define kDefaultRetryCount		4
 
+// Categories sense data is sorted into by ClassifySenseData. The categories
+// named after an ASC/ASCQ take precedence over those named after a
+// SENSE_KEY.
+typedef enum SCSISenseCategory
+{
+	kSCSISenseCategory_NoSense				= 0,
+	kSCSISenseCategory_RecoveredError		= 1,
+	kSCSISenseCategory_BecomingReady		= 2,	// NOT READY, 04/01
+	kSCSISenseCategory_NeedsStart			= 3,	// NOT READY, 04/00, 04/02 or 04/03
+	kSCSISenseCategory_NotReady				= 4,
+	kSCSISenseCategory_MediumNotPresent		= 5,	// ASC 3A
+	kSCSISenseCategory_MediumChanged		= 6,	// 28/00
+	kSCSISenseCategory_Reset				= 7,	// ASC 29
+	kSCSISenseCategory_LUNotSupported		= 8,	// 25/00
+	kSCSISenseCategory_MediumError			= 9,
+	kSCSISenseCategory_HardwareError		= 10,
+	kSCSISenseCategory_IllegalRequest		= 11,
+	kSCSISenseCategory_UnitAttention		= 12,
+	kSCSISenseCategory_DataProtect			= 13,
+	kSCSISenseCategory_AbortedCommand		= 14,
+	kSCSISenseCategory_Other				= 15,
+	kSCSISenseCategoryCount					= 16
+} SCSISenseCategory;
+
+// A sense data sample kept by RecordSenseData for sense data naming a
+// logical block.
+typedef struct SCSISenseSample
+{
+	UInt64		logicalBlockAddress;
+	UInt8		senseKey;
+	UInt8		additionalSenseCode;
+	UInt8		additionalSenseCodeQualifier;
+	UInt8		category;
+} SCSISenseSample;
+
+#define kSCSISenseSampleCount	16
+
 // Forward declarations for internal use only classes
 class SCSIPrimaryCommands;
+struct SCSILatencyHistogram;
+struct SCSIMediaPollScheduler;
 
 
 //-----------------------------------------------------------------------------
@@ -119,12 +158,45 @@ private:
 											  void *		refCon,
 											  IOService *	newService );
 	
+	bool			CreateTaggedTaskTable ( void );
+	void			FreeTaggedTaskTable ( void );
+	void			FreeTaggedTaskIdentifier ( SCSITaskIdentifier request );
+	void			UpdateTaggedTaskStatistics ( void );
+	
+	void			ScheduleStatisticsUpdate ( void );
+	static void		sStatisticsTimerExpired ( thread_call_param_t param0,
+											  thread_call_param_t param1 );
+	void			PublishStatistics ( void );
+	
+	static SCSIMediaPollScheduler *	sRetainMediaPollScheduler ( void );
+	static void		sReleaseMediaPollScheduler ( SCSIMediaPollScheduler * scheduler );
+	static void		sMediaPollTimerExpired ( thread_call_param_t param0,
+											 thread_call_param_t param1 );
+	void			UnlinkMediaPoll ( void );
+	
 	static void		TaskCallback ( SCSITaskIdentifier completedTask );
 	void			TaskCompletion ( SCSITaskIdentifier completedTask );
 	
 	static IOReturn	sWaitForTask ( void * object, SCSITaskIdentifier request );
 	IOReturn		GatedWaitForTask ( SCSITaskIdentifier request );
 	
+	static void		sWakeQuiesce ( IOSCSIPrimaryCommandsDevice * self );
+	static IOReturn	sWaitForQuiesce ( void * object, void * heldTaskCount, void * deadline );
+	IOReturn		HandleWaitForQuiesce ( UInt32 heldTaskCount, AbsoluteTime deadline );
+	static void		sResumeCommands ( IOSCSIPrimaryCommandsDevice * self );
+	UInt32			ReserveOutstandingTags ( UInt8 *					logicalUnits,
+											 SCSITaggedTaskIdentifier *	tags,
+											 UInt32						maximum );
+	void			ReleaseReservedTag ( SCSITaggedTaskIdentifier tag );
+	void			AbortOutstandingTasks ( void );
+	void			RecordQuiesce ( UInt64 startTime, IOReturn status );
+	
+	void			CreateLatencyHistograms ( void );
+	void			FreeLatencyHistograms ( void );
+	void			UpdateLatencyStatistics ( void );
+	bool			ShouldLogSenseData ( void );
+	void			UpdateSenseStatistics ( void );
+	
 protected:
 	
 	// Reserve space for future expansion.
@@ -141,11 +213,83 @@ protected:
         UInt32                      fNumCommandsExecuting;
         int                         fMaxPollRetries;
         int                         fPollDebounceRetriesLeft;
+		
+		// Per-LUN tagged task space. A set bit in fTagBitmap means the tag
+		// (bit index + 1) is in use by the task stored in fTagTable. A set
+		// bit in fTagAbortBitmap means an abort naming the tag is being sent,
+		// and the tag is not handed out again until it has been, even if its
+		// task completes. All three are protected by fTaskIDLock. The
+		// counters are only changed atomically.
+		volatile UInt32 *			fTagBitmap;
+		SCSITaskIdentifier *		fTagTable;
+		UInt32						fTagCount;
+		volatile SInt32				fTagsInUse;
+		volatile UInt32				fTagsInUseHighWater;
+		volatile UInt32				fTagAllocationFailures;
+		UInt32 *					fTagAbortBitmap;
+		
+		// Membership in the shared media poll scheduler. fMediaPollDeadline
+		// is zero when this logical unit does not have a poll scheduled.
+		// fMediaPollScheduler holds a reference on the scheduler from the
+		// first poll scheduled until we are freed.
+		SCSIMediaPollScheduler *		fMediaPollScheduler;
+		thread_call_t					fMediaPollThread;
+		IOSCSIPrimaryCommandsDevice *	fNextMediaPollDevice;
+		IOSCSIPrimaryCommandsDevice *	fPreviousMediaPollDevice;
+		UInt64							fMediaPollDeadline;
+		UInt32							fMediaPollInterval;
+		UInt32							fMediaPollIdleCount;
+		UInt64							fMediaPollCount;
+		UInt64							fMediaPollTotalTime;
+		UInt64							fMediaPollMaximumTime;
+		OSDictionary *					fMediaPollStatistics;
+		
+		// Quiesce before power transitions. While fQuiescing is set, I/O
+		// arriving through CheckPowerState is held back and every task
+		// released wakes the quiescing thread. Otherwise releasing a task
+		// does not take the command gate.
+		bool							fQuiescing;
+		UInt64							fQuiesceCount;
+		UInt64							fQuiesceLastDrainTime;
+		UInt64							fQuiesceMaximumDrainTime;
+		UInt64							fQuiesceTotalDrainTime;
+		UInt64							fQuiesceTimeouts;
+		OSDictionary *					fQuiesceStatistics;
+		
+		// Templates every asynchronous read and write task is started from.
+		// See InitializeReadWriteTaskTemplates.
+		SCSITaskTemplate				fReadTaskTemplate;
+		SCSITaskTemplate				fWriteTaskTemplate;
+		
+		// Read and write latency histograms, one shard per CPU. See
+		// RecordTaskLatency.
+		SCSILatencyHistogram *			fLatencyHistograms;
+		
+		// Sense data counts by SCSISenseCategory, and a ring of the most
+		// recent sense data which named a logical block. Both are updated
+		// without a lock. See RecordSenseData.
+		volatile UInt64					fSenseCounts[kSCSISenseCategoryCount];
+		SCSISenseSample					fSenseSamples[kSCSISenseSampleCount];
+		volatile UInt32					fSenseSampleIndex;
+		
+		// Sense data logging is limited to a burst of messages per
+		// interval. Anything beyond that is only counted.
+		volatile UInt64					fSenseLogWindowStart;
+		volatile SInt32					fSenseLogCount;
+		volatile UInt32					fSenseLogSuppressed;
+		
+		// Statistics are published to the registry by fStatisticsThread a
+		// little while after they change, never from the I/O path.
+		// fStatisticsPending is set while a publish is scheduled.
+		thread_call_t					fStatisticsThread;
+		volatile UInt32					fStatisticsPending;
 	};
 	IOSCSIPrimaryCommandsDeviceExpansionData * fIOSCSIPrimaryCommandsDeviceReserved;
 	
 	#define	fReadTimeoutDuration		fIOSCSIPrimaryCommandsDeviceReserved->fReadTimeoutDuration
 	#define	fWriteTimeoutDuration		fIOSCSIPrimaryCommandsDeviceReserved->fWriteTimeoutDuration
+	#define	fReadTaskTemplate			fIOSCSIPrimaryCommandsDeviceReserved->fReadTaskTemplate
+	#define	fWriteTaskTemplate			fIOSCSIPrimaryCommandsDeviceReserved->fWriteTaskTemplate
 	#define	fRetryCount					fIOSCSIPrimaryCommandsDeviceReserved->fRetryCount
     #define	fNumCommandsExecuting       fIOSCSIPrimaryCommandsDeviceReserved->fNumCommandsExecuting
     #define fMaxPollRetries             fIOSCSIPrimaryCommandsDeviceReserved->fMaxPollRetries
@@ -187,9 +331,36 @@ protected:
 	// This will release a SCSITask (eventually return it to a pool)
 	virtual void					ReleaseSCSITask ( SCSITaskIdentifier request );
 	
-	// This will return a unique value for the tagged task identifier
+	// This will return a unique value for the tagged task identifier.
+	// DEPRECATED, use AllocateTaggedTaskIdentifier() instead.
 	SCSITaggedTaskIdentifier		GetUniqueTagID ( void );
 	
+	// Allocates a free tag from this logical unit's tag space, assigns it
+	// to the task and records the task so it can be found by its tag. Returns
+	// kSCSIUntaggedTaskIdentifier if every tag is outstanding. The tag is
+	// given back when the task is reset or released. SendTemplatedCommand
+	// calls this for devices which support command queuing.
+	SCSITaggedTaskIdentifier		AllocateTaggedTaskIdentifier (
+										SCSITaskIdentifier		request );
+	
+	// Returns the outstanding task holding a tag, or NULL.
+	SCSITaskIdentifier				GetTaskForTaggedTaskIdentifier (
+										SCSITaggedTaskIdentifier	tag );
+	
+	// Media polls for every logical unit are timed by one shared scheduler.
+	// ScheduleMediaPoll enters pollThread once this logical unit's poll
+	// interval has passed, and returns false if a poll is already scheduled.
+	// If the scheduler can't be created, pollThread is armed directly.
+	// CancelMediaPoll returns true if a scheduled poll was cancelled before
+	// it ran.
+	bool							ScheduleMediaPoll ( thread_call_t pollThread );
+	bool							CancelMediaPoll ( thread_call_t pollThread );
+	
+	// Records the cost of a poll which started at startTime (absolute time).
+	// Idle polls, which found an empty slot still empty, back the poll
+	// interval off. Any other poll resets it.
+	void							RecordMediaPoll ( UInt64 startTime, bool idle );
+	
 	// Call for executing the command synchronously	
 	SCSIServiceResponse 			SendCommand ( 	
 										SCSITaskIdentifier 	request,
@@ -201,6 +372,44 @@ protected:
 										UInt32 				timeoutDuration,
 										SCSITaskCompletion 	taskCompletion );
 	
+	// Builds fReadTaskTemplate and fWriteTaskTemplate from the read and
+	// write timeouts. Subclasses call this from StartDeviceSupport, before
+	// any I/O can arrive.
+	void							InitializeReadWriteTaskTemplates (
+										SCSITaskCompletion 	taskCompletion );
+	
+	// Call for executing a command asynchronously when the CDB, data buffer,
+	// transfer count and tag are already set. Every other field is taken
+	// from the template.
+	void							SendTemplatedCommand (
+										SCSITaskIdentifier 			request,
+										const SCSITaskTemplate *	taskTemplate );
+	
+	// Copies the trace timestamps out of a completed task, so they can still
+	// be recorded with RecordTaskLatency after the task has been released.
+	void							GetTaskTimestamps (
+										SCSITaskIdentifier 		request,
+										SCSITaskTimestamps *	timestamps );
+	
+	// Adds a completed read or write to this logical unit's queue wait,
+	// service, autosense and completion time histograms. The completion
+	// routine is taken to have finished when this is called, so call it
+	// after the client has been completed.
+	void							RecordTaskLatency (
+										const SCSITaskTimestamps *	timestamps );
+	
+	// Sorts sense data into a SCSISenseCategory.
+	static SCSISenseCategory		ClassifySenseData (
+										const SCSI_Sense_Data *		senseData );
+	
+	// Classifies sense data and counts it against this logical unit. Sense
+	// data naming a logical block is also kept in a ring of samples.
+	// Recovered errors and hard failures are logged, but only a few times
+	// in each interval, so a failing device cannot flood the log. The counts
+	// and samples are published in the "Sense Statistics" property.
+	SCSISenseCategory				RecordSenseData (
+										const SCSI_Sense_Data *		senseData );
+	
 	
 	virtual bool 					InitializeDeviceSupport ( void ) = 0;
 	virtual void 					StartDeviceSupport ( void ) = 0;
@@ -300,6 +509,12 @@ protected:
 										UInt8					cdbByte13,
 										UInt8					cdbByte14,
 										UInt8					cdbByte15 );
+	
+	// Populate the Command Descriptor Block from a whole block
+	bool 							SetCommandDescriptorBlock ( 
+										SCSITaskIdentifier 					request,
+										const SCSICommandDescriptorBlock *	cdbData,
+										UInt8								cdbSize );
 										
 	bool							SetDataTransferDirection ( 
 										SCSITaskIdentifier 		request, 
@@ -366,6 +581,18 @@ protected:
 										IOSCSIPrimaryCommandsDevice * self );
 	virtual void					HandleIncrementOutstandingCommandsCount ( void );	
 	
+	// Waits for every task except the heldTaskCount tasks the caller owns
+	// to be released, without sending new I/O to the device meanwhile.
+	// Tasks still outstanding after a bounded wait are aborted. Returns
+	// kIOReturnTimeout if some are left even then. Every QuiesceCommands
+	// must be followed by a ResumeCommands.
+	IOReturn						QuiesceCommands ( UInt32 heldTaskCount );
+	void							ResumeCommands ( void );
+	
+	// Blocks while a quiesce is in progress. Must be called on the safe
+	// side of the command gate, from HandleCheckPowerState.
+	void							HandleWaitWhileQuiesced ( void );
+	
 
 	// This static member routine provides a mechanism for retrieving a pointer to
 	// the object that is claimed as the owner of the specified SCSITask.
@@ -248,6 +248,26 @@ IOSCSIProtocolInterface::SetUserClientExclusivityState (
 	
 }
 
+
+//
+//  IsUserClientExclusiveOwner - Call to see if a user client holds
+//								  exclusive access.					   [PUBLIC]
+//
+
+bool
+IOSCSIProtocolInterface::IsUserClientExclusiveOwner ( IOService * userClient )
+{
+	
+	bool	owner = false;
+	
+	fCommandGate->runAction ( ( IOCommandGate::Action )
+					&IOSCSIProtocolInterface::sIsUserClientExclusiveOwner,
+					( void * ) userClient,
+					( void * ) &owner );
+	return owner;
+	
+}
+
 #include <IOKit/pwr_mgt/IOPM.h>
 #include <IOKit/pci/IOPCIBridge.h>
 
@@ -698,6 +718,23 @@ IOSCSIProtocolInterface::sSetUserClientExclusivityState (
 }
 
 
+//
+//  sIsUserClientExclusiveOwner - C->C++ glue.			[STATIC][PROTECTED]
+//
+
+void
+IOSCSIProtocolInterface::sIsUserClientExclusiveOwner (
+								IOSCSIProtocolInterface *	self,
+								IOService *					userClient,
+								bool *						owner )
+{
+	
+	*owner = ( self->fUserClientExclusiveControlled &&
+			   ( self->fUserClient == userClient ) );
+	
+}
+
+
 #if 0
 #pragma mark -
 #pragma mark  Static Debugging Assertion Method
@@ -356,7 +356,17 @@ enum
 	This is used to support multiple paths to a logical unit
 	by creating a IOSCSIMultipathedLogicalUnit object.
 	*/
-	kSCSIProtocolFeature_MultiPathing						= 16
+	kSCSIProtocolFeature_MultiPathing						= 16,
+	
+	/*!
+	kSCSIProtocolFeature_MaximumTaggedTaskCount:
+	If the SCSI Protocol Services Driver supports tagged command queueing
+	and has negotiated a maximum queue depth with the device, it will
+	return true to this query and return the maximum number of tagged
+	tasks that may be outstanding at once in the UInt32 pointer that is
+	passed in as the serviceValue. This sizes each logical unit's tag space.
+	*/
+	kSCSIProtocolFeature_MaximumTaggedTaskCount				= 17
 	
 };
 
@@ -461,6 +471,18 @@ public:
 	*/
 	virtual IOReturn	SetUserClientExclusivityState ( IOService * userClient, bool state );
 	
+	/*!
+	@function IsUserClientExclusiveOwner
+	@abstract Determines whether a user client holds exclusive access.
+	@discussion The IsUserClientExclusiveOwner() method is called by the SCSITaskUserClient
+	to check that it is the user client holding exclusive access. Unlike a call to
+	GetUserClientExclusivityState() followed by a call to SetUserClientExclusivityState(),
+	it never changes the exclusivity state.
+	@param userClient The instance of SCSITaskUserClient to check.
+	@result <code>true</code> if userClient is in exclusive control of the device, <code>false</code> otherwise.
+	*/
+	bool				IsUserClientExclusiveOwner ( IOService * userClient );
+	
 	
 	/*!
 	@function initialPowerStateForDomainState
@@ -774,6 +796,18 @@ protected:
 	@param state A bool indicating the desired state to set.
 	*/
 	static void		sSetUserClientExclusivityState ( IOSCSIProtocolInterface * self, IOReturn * result, IOService * userClient, bool state );
+	
+	/*!
+	@function sIsUserClientExclusiveOwner
+	@abstract The sIsUserClientExclusiveOwner method is a static function used as C->C++ glue
+	for going behind the command gate.
+	@discussion The sIsUserClientExclusiveOwner method is a static function used as C->C++ glue
+	for going behind the command gate.
+	@param self The 'this' pointer for the class.
+	@param userClient The instance of SCSITaskUserClient to check.
+	@param owner A pointer to a bool in which the result should be set.
+	*/
+	static void		sIsUserClientExclusiveOwner ( IOSCSIProtocolInterface * self, IOService * userClient, bool * owner );
 
 	/*!
 	@function HandleGetUserClientExclusivityState
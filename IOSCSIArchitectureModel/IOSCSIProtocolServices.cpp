@@ -44,6 +44,13 @@
 #define fSemaphore						fIOSCSIProtocolServicesReserved->fSemaphore
 #define fRequiresAutosenseDescriptor	fIOSCSIProtocolServicesReserved->fRequiresAutosenseDescriptor
 #define fCompletionRoutine				fIOSCSIProtocolServicesReserved->fCompletionRoutine
+#define fSCSITaskQueueTail				fIOSCSIProtocolServicesReserved->fSCSITaskQueueTail
+#define fTimeoutWheel					fIOSCSIProtocolServicesReserved->fTimeoutWheel
+#define fTimeoutWheelInterval			fIOSCSIProtocolServicesReserved->fTimeoutWheelInterval
+#define fTimeoutWheelLastTick			fIOSCSIProtocolServicesReserved->fTimeoutWheelLastTick
+#define fTimeoutWheelCount				fIOSCSIProtocolServicesReserved->fTimeoutWheelCount
+#define fTimeoutWheelScheduled			fIOSCSIProtocolServicesReserved->fTimeoutWheelScheduled
+#define fTimeoutWheelThread				fIOSCSIProtocolServicesReserved->fTimeoutWheelThread
 
 //
 //	Macros
@@ -110,6 +117,21 @@ enum
 	kSCSITaskQueueCompletionMask	= ( 1 << kSCSITaskQueueCompletionBit )
 };
 
+// The timeout wheel has kSCSITaskTimeoutWheelSlots slots, each covering
+// kSCSITaskTimeoutWheelIntervalMS of time. Deadlines further out than one
+// revolution simply stay in their slot until the wheel comes around again.
+#define kSCSITaskTimeoutWheelSlots				64
+#define kSCSITaskTimeoutWheelIntervalMS			250
+
+// Once a task has been sent to the device, the protocol driver is responsible
+// for timing it out. The wheel only escalates to ABORT TASK if the task is still
+// outstanding this long after the protocol driver should have completed it.
+#define kSCSITaskAbortTaskGracePeriodMS			5000
+
+// Maximum number of ABORT TASK requests issued per pass of the timeout wheel.
+// Any others stay in the wheel and are handled on the next pass.
+#define kSCSITaskMaximumAbortsPerPass			8
+
 
 #if 0
 #pragma mark -
@@ -150,6 +172,25 @@ IOSCSIProtocolServices::start ( IOService * provider )
 	fQueueLock = IOSimpleLockAlloc ( );
 	__Require_noErr ( fQueueLock, FreeReserved );
 	
+	fSCSITaskQueueTail = NULL;
+	
+	// Allocate the timeout wheel. It shares fQueueLock with the SCSI Task Queue
+	// so a task can be moved between the two atomically.
+	fTimeoutWheel = IONew ( SCSITask *, kSCSITaskTimeoutWheelSlots );
+	require_nonzero ( fTimeoutWheel, FreeQueueLock );
+	bzero ( fTimeoutWheel, kSCSITaskTimeoutWheelSlots * sizeof ( SCSITask * ) );
+	
+	fTimeoutWheelThread = thread_call_allocate (
+			( thread_call_func_t ) IOSCSIProtocolServices::sProcessTimeoutWheel,
+			( thread_call_param_t ) this );
+	require_nonzero ( fTimeoutWheelThread, FreeTimeoutWheel );
+	
+	clock_interval_to_absolutetime_interval ( kSCSITaskTimeoutWheelIntervalMS,
+											  kMillisecondScale,
+											  &fTimeoutWheelInterval );
+	clock_get_uptime ( &fTimeoutWheelLastTick );
+	fTimeoutWheelLastTick /= fTimeoutWheelInterval;
+	
 	// If the provider has a Protocol Characteristics dictionary, copy
 	// it to the Protocol Services object.
 	dict = OSDynamicCast ( OSDictionary, provider->getProperty ( kIOPropertyProtocolCharacteristicsKey ) );
@@ -191,6 +232,20 @@ IOSCSIProtocolServices::start ( IOService * provider )
 	return result;
 	
 	
+FreeTimeoutWheel:
+	
+	
+	IODelete ( fTimeoutWheel, SCSITask *, kSCSITaskTimeoutWheelSlots );
+	fTimeoutWheel = NULL;
+	
+	
+FreeQueueLock:
+	
+	
+	IOSimpleLockFree ( fQueueLock );
+	fQueueLock = NULL;
+	
+	
 FreeReserved:
 	
 	
@@ -227,6 +282,23 @@ IOSCSIProtocolServices::free ( void )
 	if ( fIOSCSIProtocolServicesReserved != NULL )
 	{
 		
+		if ( fTimeoutWheelThread != NULL )
+		{
+			
+			thread_call_cancel ( fTimeoutWheelThread );
+			thread_call_free ( fTimeoutWheelThread );
+			fTimeoutWheelThread = NULL;
+			
+		}
+		
+		if ( fTimeoutWheel != NULL )
+		{
+			
+			IODelete ( fTimeoutWheel, SCSITask *, kSCSITaskTimeoutWheelSlots );
+			fTimeoutWheel = NULL;
+			
+		}
+		
 		IODelete ( fIOSCSIProtocolServicesReserved, IOSCSIProtocolServicesExpansionData, 1 );
 		fIOSCSIProtocolServicesReserved = NULL;
 		
@@ -457,7 +529,7 @@ IOSCSIProtocolServices::GetTaskAttribute ( SCSITaskIdentifier request )
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	return scsiRequest->GetTaskAttribute ( );
 	
 }
@@ -474,7 +546,7 @@ IOSCSIProtocolServices::SetTaskState ( SCSITaskIdentifier	request,
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	return scsiRequest->SetTaskState ( newTaskState );
 	
 }
@@ -490,7 +562,7 @@ IOSCSIProtocolServices::GetTaskState ( SCSITaskIdentifier request )
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	return scsiRequest->GetTaskState ( );
 	
 }
@@ -505,7 +577,7 @@ IOSCSIProtocolServices::GetLogicalUnitNumber ( SCSITaskIdentifier request )
 {
 	SCSITask *	scsiRequest;
 	
-    scsiRequest = OSDynamicCast ( SCSITask, request );
+    scsiRequest = SCSITaskFromIdentifier ( request );
 	return scsiRequest->GetLogicalUnitNumber();
 }
 
@@ -522,7 +594,7 @@ IOSCSIProtocolServices::GetCommandDescriptorBlockSize (
 	SCSITask *	scsiRequest;
 	UInt8		size;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	
 	// Check to see what the current execution mode is  
 	if ( scsiRequest->GetTaskExecutionMode ( ) == kSCSITaskMode_CommandExecution )
@@ -553,7 +625,7 @@ IOSCSIProtocolServices::GetCommandDescriptorBlock (
 	SCSITask *	scsiRequest;
 	bool		result = false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	
 	// Check to see what the current execution mode is  
 	if ( scsiRequest->GetTaskExecutionMode ( ) == kSCSITaskMode_CommandExecution )
@@ -583,7 +655,7 @@ IOSCSIProtocolServices::GetDataTransferDirection (
 	SCSITask *	scsiRequest;
 	UInt8		direction;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	
 	// Check to see what the current execution mode is  
 	if ( scsiRequest->GetTaskExecutionMode ( ) == kSCSITaskMode_CommandExecution )
@@ -614,7 +686,7 @@ IOSCSIProtocolServices::GetRequestedDataTransferCount (
 	SCSITask *	scsiRequest;
 	UInt64		amount;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	
 	// Check to see what the current execution mode is  
 	if ( scsiRequest->GetTaskExecutionMode ( ) == kSCSITaskMode_CommandExecution )
@@ -646,7 +718,7 @@ IOSCSIProtocolServices::SetRealizedDataTransferCount (
 	SCSITask *	scsiRequest;
 	bool		result;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	
 	// Check to see what the current execution mode is  
 	if ( scsiRequest->GetTaskExecutionMode ( ) == kSCSITaskMode_CommandExecution )
@@ -677,7 +749,7 @@ IOSCSIProtocolServices::GetRealizedDataTransferCount (
 	SCSITask *	scsiRequest;
 	UInt64		amount;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	
 	// Check to see what the current execution mode is  
 	if ( scsiRequest->GetTaskExecutionMode ( ) == kSCSITaskMode_CommandExecution )
@@ -707,7 +779,7 @@ IOSCSIProtocolServices::GetDataBuffer ( SCSITaskIdentifier request )
 	SCSITask *				scsiRequest;
 	IOMemoryDescriptor *	buffer;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	if ( scsiRequest->GetTaskExecutionMode ( ) == kSCSITaskMode_CommandExecution )
 	{
 		buffer = scsiRequest->GetDataBuffer ( );
@@ -733,7 +805,7 @@ IOSCSIProtocolServices::GetDataBufferOffset ( SCSITaskIdentifier request )
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	return scsiRequest->GetDataBufferOffset ( );
 	
 }
@@ -750,7 +822,7 @@ IOSCSIProtocolServices::GetTimeoutDuration ( SCSITaskIdentifier request )
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	return scsiRequest->GetTimeoutDuration ( );
 
 }
@@ -769,7 +841,7 @@ IOSCSIProtocolServices::GetAutosenseRequestedDataTransferCount (
 	
 	SCSITask *	scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	return scsiRequest->GetAutosenseRequestedDataTransferCount ( );
 	
 }
@@ -805,7 +877,7 @@ IOSCSIProtocolServices::SetAutoSenseData (
 	
 	SCSITask *		scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	return scsiRequest->SetAutoSenseData ( senseData, senseDataSize );
 	
 }
@@ -824,7 +896,7 @@ IOSCSIProtocolServices::SetProtocolLayerReference (
 	
 	SCSITask *		scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	return scsiRequest->SetProtocolLayerReference ( newReferenceValue );
 	
 }
@@ -841,7 +913,7 @@ IOSCSIProtocolServices::GetProtocolLayerReference ( SCSITaskIdentifier request )
 	
 	SCSITask *		scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	return scsiRequest->GetProtocolLayerReference ( );
 	
 }
@@ -859,7 +931,7 @@ IOSCSIProtocolServices::SetTaskExecutionMode (
 	
 	SCSITask *		scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	return scsiRequest->SetTaskExecutionMode ( newTaskMode );
 	
 }
@@ -875,7 +947,7 @@ IOSCSIProtocolServices::GetTaskExecutionMode ( SCSITaskIdentifier request )
 	
 	SCSITask *		scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	return scsiRequest->GetTaskExecutionMode ( );
 	
 }
@@ -892,7 +964,7 @@ IOSCSIProtocolServices::EnsureAutosenseDescriptorExists ( SCSITaskIdentifier req
 	
 	SCSITask *		scsiRequest;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	return scsiRequest->EnsureAutosenseDescriptorExists ( );
 	
 }
@@ -919,15 +991,29 @@ IOSCSIProtocolServices::AddSCSITaskToQueue ( SCSITaskIdentifier request )
 {
 	
 	SCSITask *	scsiRequest;
+	UInt64		deadline	= 0;
+	bool		schedule	= false;
 	
 	STATUS_LOG ( ( "%s: AddSCSITaskToQueue called.\n", getName ( ) ) );
 	
-	IOSimpleLockLock ( fQueueLock );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	// A timeout duration of zero means the task should be given as long as
+	// possible to complete, so it is never put in the timeout wheel.
+	if ( scsiRequest->GetTimeoutDuration ( ) != 0 )
+	{
+		
+		clock_interval_to_deadline ( scsiRequest->GetTimeoutDuration ( ),
+									 kMillisecondScale,
+									 &deadline );
+		
+	}
+	
+	IOSimpleLockLock ( fQueueLock );
 	
 	// Make sure that the new request does not have a following task.
 	scsiRequest->EnqueueFollowingSCSITask ( NULL );
+	scsiRequest->EnqueuePrecedingSCSITask ( fSCSITaskQueueTail );
 	
 	// Check to see if there are any tasks currently queued.
 	if ( fSCSITaskQueueHead == NULL )
@@ -944,20 +1030,24 @@ IOSCSIProtocolServices::AddSCSITaskToQueue ( SCSITaskIdentifier request )
 		
 		// There is at least one task currently in the queue,
 		// Add the current one to the end.
-		SCSITask *	currentElement;
-		
-		currentElement = fSCSITaskQueueHead;
-		while ( currentElement->GetFollowingSCSITask ( ) != NULL )
-		{
-			currentElement = currentElement->GetFollowingSCSITask ( );
-		}
-		
-		currentElement->EnqueueFollowingSCSITask ( scsiRequest );
+		fSCSITaskQueueTail->EnqueueFollowingSCSITask ( scsiRequest );
 		
 	}
 	
+	fSCSITaskQueueTail = scsiRequest;
+	
+	if ( deadline != 0 )
+	{
+		schedule = AddSCSITaskToTimeoutWheel ( scsiRequest, deadline );
+	}
+	
 	IOSimpleLockUnlock ( fQueueLock );
 	
+	if ( schedule == true )
+	{
+		ScheduleTimeoutWheel ( );
+	}
+	
 }
 
 
@@ -981,8 +1071,10 @@ IOSCSIProtocolServices::AddSCSITaskToHeadOfQueue ( SCSITask * request )
 	{
 		
 		// Make sure that the new request does not have a following task.
-		request->EnqueueFollowingSCSITask ( fSCSITaskQueueHead );
+		request->EnqueueFollowingSCSITask ( NULL );
+		request->EnqueuePrecedingSCSITask ( NULL );
 		fSCSITaskQueueHead = request;
+		fSCSITaskQueueTail = request;
 		
 	}
 	
@@ -994,8 +1086,10 @@ IOSCSIProtocolServices::AddSCSITaskToHeadOfQueue ( SCSITask * request )
 		 ( fSCSITaskQueueHead->GetTaskExecutionMode ( ) != kSCSITaskMode_Autosense ) )
 	{
 		
-		// Make sure that the new request does not have a following task.
+		// Make sure that the new request does not have a preceding task.
 		request->EnqueueFollowingSCSITask ( fSCSITaskQueueHead );
+		request->EnqueuePrecedingSCSITask ( NULL );
+		fSCSITaskQueueHead->EnqueuePrecedingSCSITask ( request );
 		fSCSITaskQueueHead = request;
 		
 	}
@@ -1016,16 +1110,12 @@ IOSCSIProtocolServices::AddSCSITaskToHeadOfQueue ( SCSITask * request )
 		
 		// However, there's no guarantee next is non-NULL. We must first
 		// test it, otherwise, we're done and can simply set the chains.
-		if ( next != NULL )
+		while ( ( next != NULL ) &&
+				( next->GetTaskExecutionMode ( ) == kSCSITaskMode_Autosense ) )
 		{
 			
-			while ( next->GetTaskExecutionMode ( ) == kSCSITaskMode_Autosense )
-			{
-				
-				prev = next;
-				next = prev->GetFollowingSCSITask ( );
-				
-			}
+			prev = next;
+			next = prev->GetFollowingSCSITask ( );
 			
 		}
 		
@@ -1033,8 +1123,19 @@ IOSCSIProtocolServices::AddSCSITaskToHeadOfQueue ( SCSITask * request )
 		// request (or NULL). prev points to either the queue head, or the last
 		// autosense command at the head of the queue.
 		request->EnqueueFollowingSCSITask ( next );
+		request->EnqueuePrecedingSCSITask ( prev );
 		prev->EnqueueFollowingSCSITask ( request );
 		
+		if ( next != NULL )
+		{
+			next->EnqueuePrecedingSCSITask ( request );
+		}
+		
+		else
+		{
+			fSCSITaskQueueTail = request;
+		}
+		
 	}
 	
 	IOSimpleLockUnlock ( fQueueLock );
@@ -1069,15 +1170,10 @@ IOSCSIProtocolServices::RetrieveNextSCSITaskFromQueue ( void )
 		
 		// There is at least one task currently in the queue,
 		
-		// Grab the head task
+		// Grab the head task and unlink it. If there are no more tasks,
+		// the head pointer will be set to NULL.
 		selectedTask = fSCSITaskQueueHead;
-		
-		// Set the head pointer to the next task in the queue.  If there
-		// is no more tasks, this head pointer will be set to NULL.
-		fSCSITaskQueueHead = selectedTask->GetFollowingSCSITask ( );
-		
-		// Make sure that the new request does not have a following task.
-		selectedTask->EnqueueFollowingSCSITask ( NULL );
+		RemoveSCSITaskFromQueue ( selectedTask );
 		
 	}
 	
@@ -1089,10 +1185,9 @@ IOSCSIProtocolServices::RetrieveNextSCSITaskFromQueue ( void )
 
 
 //
-//	 AbortSCSITaskFromQueue -	Check to see if the SCSI Task resides and
-//								abort it if it does. This currently does
-//								nothing since the ABORT TASK and ABORT TASK SET
-//								management functions are not supported.
+//	 AbortSCSITaskFromQueue -	Check to see if the SCSI Task resides in the
+//								queue and remove it if it does. The caller is
+//								responsible for completing the task.
 //																	[PROTECTED]
 //
 
@@ -1100,13 +1195,25 @@ bool
 IOSCSIProtocolServices::AbortSCSITaskFromQueue ( SCSITask *request )
 {
 	
+	bool	result = false;
+	
 	// If the indicated SCSI Task currently resides in the Queue, the SCSI Task
 	// will be removed and no further processing shall occur on that Task.  This
 	// method will then return true.
 	
 	// If the SCSI Task does not currently reside in the queue, this method will
 	// return false.
-	return false;
+	IOSimpleLockLock ( fQueueLock );
+	
+	result = RemoveSCSITaskFromQueue ( request );
+	if ( result == true )
+	{
+		RemoveSCSITaskFromTimeoutWheel ( request );
+	}
+	
+	IOSimpleLockUnlock ( fQueueLock );
+	
+	return result;
 	
 }
 
@@ -1144,6 +1251,7 @@ IOSCSIProtocolServices::SendSCSITasksFromQueue ( void )
 			SCSIServiceResponse 	serviceResponse;
 			SCSITaskStatus			taskStatus;
 			SCSITask *				nextVictim	= NULL;
+			SCSITask *				expiredTasks = NULL;
 			bool					cmdAccepted = false;
 			
 			// We're sending a command down, so clear the completion bit so
@@ -1151,7 +1259,12 @@ IOSCSIProtocolServices::SendSCSITasksFromQueue ( void )
 			OSBitAndAtomic ( ~kSCSITaskQueueCompletionMask, &fSemaphore );
 			
 			// Get the next command from the request queue
-			nextVictim = RetrieveNextSCSITaskFromQueue ( );
+			nextVictim = DequeueSCSITaskForDispatch ( &expiredTasks );
+			
+			// Any tasks which timed out while they were waiting in the queue
+			// are completed here instead of being sent to the device.
+			CompleteTimedOutTasks ( expiredTasks );
+			
 			if ( nextVictim == NULL )
 			{
 				
@@ -1162,6 +1275,11 @@ IOSCSIProtocolServices::SendSCSITasksFromQueue ( void )
 				
 			}
 			
+			if ( nextVictim->GetTaskExecutionMode ( ) == kSCSITaskMode_CommandExecution )
+			{
+				nextVictim->SetTimestamp ( kSCSITaskTimestamp_Sent );
+			}
+			
 			cmdAccepted = SendSCSICommand ( nextVictim, &serviceResponse, &taskStatus );
 			if ( cmdAccepted == false )
 			{
@@ -1177,6 +1295,7 @@ IOSCSIProtocolServices::SendSCSITasksFromQueue ( void )
 			{
 				
 				// The command was sent and completed, send next Task based on its Attribute.
+				DisarmSCSITaskTimeout ( nextVictim );
 				nextVictim->SetServiceResponse ( serviceResponse );
 				nextVictim->SetTaskStatus ( taskStatus );
 				nextVictim->SetTaskState ( kSCSITaskState_ENDED );
@@ -1248,11 +1367,35 @@ IOSCSIProtocolServices::ProcessCompletedTask (
 	
 	STATUS_LOG ( ( "%s: ProcessCompletedTask called.\n", getName ( ) ) );
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
+	
+	IOSimpleLockLock ( fQueueLock );
+	
+	if ( scsiRequest->IsAbortPending ( ) == true )
+	{
+		
+		// An ABORT TASK naming this task is being sent. Finish the completion
+		// once it has been, since completing the task gives its tag back.
+		scsiRequest->DeferCompletion ( serviceResponse, taskStatus );
+		IOSimpleLockUnlock ( fQueueLock );
+		return;
+		
+	}
+	
+	// Once the task is completing it can't be picked for ABORT TASK. Its state
+	// stays ENABLED until the results are stored, since a synchronous waiter
+	// takes ENDED to mean the task is finished with. If autosense is needed
+	// below, the task is made abortable again before it is queued.
+	RemoveSCSITaskFromTimeoutWheel ( scsiRequest );
+	scsiRequest->SetCompleting ( true );
+	
+	IOSimpleLockUnlock ( fQueueLock );
 	
 	if ( scsiRequest->GetTaskExecutionMode ( ) == kSCSITaskMode_CommandExecution )
 	{
 		
+		scsiRequest->SetTimestamp ( kSCSITaskTimestamp_Completed );
+		
 		// The task is currently in Command Execution mode, update the service
 		// response and  
 		scsiRequest->SetServiceResponse ( serviceResponse );
@@ -1281,6 +1424,10 @@ IOSCSIProtocolServices::ProcessCompletedTask (
 						
 						// Put the task into Autosense mode and
 						// add to the head of the queue.
+						IOSimpleLockLock ( fQueueLock );
+						scsiRequest->SetCompleting ( false );
+						IOSimpleLockUnlock ( fQueueLock );
+						
 						scsiRequest->SetTaskExecutionMode ( kSCSITaskMode_Autosense );
 						AddSCSITaskToHeadOfQueue ( scsiRequest );
 						
@@ -1302,6 +1449,8 @@ IOSCSIProtocolServices::ProcessCompletedTask (
 	else
 	{
 		
+		scsiRequest->SetTimestamp ( kSCSITaskTimestamp_AutosenseCompleted );
+		
 		// the task is in Autosense mode, check to see if the autosense
 		// command completed successfully.
 		if ( ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE ) &&
@@ -1319,6 +1468,8 @@ IOSCSIProtocolServices::ProcessCompletedTask (
 	// The command is complete, release the retain for this command.
 	release ( );	
 	
+	scsiRequest->SetTimestamp ( kSCSITaskTimestamp_Notified );
+	
 	// The task has completed, execute the callback. If a particular driver
 	// has registered a callback routine (e.g. IOSCSITargetDevice), completion
 	// chain to it so it can do its thing. It is responsible for completing
@@ -1354,13 +1505,514 @@ IOSCSIProtocolServices::RejectTask ( SCSITaskIdentifier request )
 	
 	STATUS_LOG ( ( "%s: RejectTask called.\n", getName ( ) ) );
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	
-	scsiRequest->SetTaskState ( kSCSITaskState_ENDED );
-	scsiRequest->SetServiceResponse ( kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE );
+	DisarmSCSITaskTimeout ( scsiRequest );
+	CompleteAbortedTask ( scsiRequest, kSCSITaskStatus_No_Status );
+	
+}
+
+
+#if 0
+#pragma mark -
+#pragma mark  SCSI Task Timeout Wheel
+#pragma mark -
+#endif
+
+// Tasks with a timeout duration are kept in a hashed timing wheel from the time
+// they are queued until they complete. A task which expires while still queued
+// is removed from the queue and completed without ever reaching the device. A
+// task which has been sent is given until its timeout plus a grace period, since
+// the protocol driver times it out itself, and is then escalated to ABORT TASK.
+// The wheel and the SCSI Task queue are both protected by fQueueLock.
+
+//
+//	 RemoveSCSITaskFromQueue -	Unlinks the SCSI Task from the queue if it is
+//								queued. Must be called with fQueueLock held.
+//																	  [PRIVATE]
+//
+
+bool
+IOSCSIProtocolServices::RemoveSCSITaskFromQueue ( SCSITask * request )
+{
+	
+	SCSITask *	prev = request->GetPrecedingSCSITask ( );
+	SCSITask *	next = request->GetFollowingSCSITask ( );
+	
+	// A task without a predecessor is only queued if it is the head.
+	if ( ( prev == NULL ) && ( fSCSITaskQueueHead != request ) )
+	{
+		return false;
+	}
+	
+	if ( prev == NULL )
+	{
+		fSCSITaskQueueHead = next;
+	}
+	
+	else
+	{
+		prev->EnqueueFollowingSCSITask ( next );
+	}
+	
+	if ( next == NULL )
+	{
+		fSCSITaskQueueTail = prev;
+	}
+	
+	else
+	{
+		next->EnqueuePrecedingSCSITask ( prev );
+	}
+	
+	request->EnqueueFollowingSCSITask ( NULL );
+	request->EnqueuePrecedingSCSITask ( NULL );
+	
+	return true;
+	
+}
+
+
+//
+//	 AddSCSITaskToTimeoutWheel -	Adds the SCSI Task to the timeout wheel
+//									slot for its deadline. Returns true if the
+//									wheel needs to be started. Must be called
+//									with fQueueLock held.			  [PRIVATE]
+//
+
+bool
+IOSCSIProtocolServices::AddSCSITaskToTimeoutWheel ( SCSITask * request,
+													UInt64		deadline )
+{
+	
+	SCSITask **	slot		= NULL;
+	bool		schedule	= false;
+	
+	// A task is only ever in one slot.
+	RemoveSCSITaskFromTimeoutWheel ( request );
+	
+	slot = &fTimeoutWheel[( deadline / fTimeoutWheelInterval ) % kSCSITaskTimeoutWheelSlots];
+	
+	request->SetTimeoutDeadline ( deadline );
+	request->SetPrecedingTimedSCSITask ( NULL );
+	request->SetFollowingTimedSCSITask ( *slot );
+	
+	if ( *slot != NULL )
+	{
+		( *slot )->SetPrecedingTimedSCSITask ( request );
+	}
+	
+	*slot = request;
+	fTimeoutWheelCount++;
+	
+	// The wheel only turns while there is something in it.
+	if ( fTimeoutWheelScheduled == false )
+	{
+		
+		fTimeoutWheelScheduled	= true;
+		schedule				= true;
+		
+	}
+	
+	return schedule;
+	
+}
+
+
+//
+//	 RemoveSCSITaskFromTimeoutWheel -	Removes the SCSI Task from the timeout
+//										wheel if it is in it. Must be called
+//										with fQueueLock held.		  [PRIVATE]
+//
+
+void
+IOSCSIProtocolServices::RemoveSCSITaskFromTimeoutWheel ( SCSITask * request )
+{
+	
+	SCSITask *	prev		= NULL;
+	SCSITask *	next		= NULL;
+	UInt64		deadline	= 0;
+	
+	deadline = request->GetTimeoutDeadline ( );
+	require_nonzero_quiet ( deadline, Exit );
+	
+	prev = request->GetPrecedingTimedSCSITask ( );
+	next = request->GetFollowingTimedSCSITask ( );
+	
+	if ( prev == NULL )
+	{
+		fTimeoutWheel[( deadline / fTimeoutWheelInterval ) % kSCSITaskTimeoutWheelSlots] = next;
+	}
+	
+	else
+	{
+		prev->SetFollowingTimedSCSITask ( next );
+	}
+	
+	if ( next != NULL )
+	{
+		next->SetPrecedingTimedSCSITask ( prev );
+	}
+	
+	request->SetFollowingTimedSCSITask ( NULL );
+	request->SetPrecedingTimedSCSITask ( NULL );
+	request->SetTimeoutDeadline ( 0 );
+	fTimeoutWheelCount--;
+	
+	
+Exit:
+	
+	
+	return;
+	
+}
+
+
+//
+//	 MarkSCSITaskForAbort -	Marks a tagged SCSI Task which has been sent to
+//								the device and has not completed as having
+//								an ABORT TASK pending, and takes it out of
+//								the timeout wheel. Returns false if the task
+//								can't be aborted. Must be called with
+//								fQueueLock held.					  [PRIVATE]
+//
+
+bool
+IOSCSIProtocolServices::MarkSCSITaskForAbort ( SCSITask * request )
+{
+	
+	bool	result = false;
+	
+	require_quiet ( ( request->GetTaskState ( ) == kSCSITaskState_ENABLED ), Exit );
+	require_quiet ( ( request->IsAbortPending ( ) == false ), Exit );
+	require_quiet ( ( request->IsCompleting ( ) == false ), Exit );
+	require_quiet ( ( request->GetTaggedTaskIdentifier ( ) != kSCSIUntaggedTaskIdentifier ), Exit );
+	
+	// A task without a predecessor is only queued if it is the head.
+	require_quiet ( ( request->GetPrecedingSCSITask ( ) == NULL ), Exit );
+	require_quiet ( ( fSCSITaskQueueHead != request ), Exit );
+	
+	RemoveSCSITaskFromTimeoutWheel ( request );
+	request->SetAbortPending ( true );
+	result = true;
+	
+	
+Exit:
+	
+	
+	return result;
+	
+}
+
+
+//
+//	 DequeueSCSITaskForDispatch -	Removes the next SCSI Task which has not
+//									yet expired from the queue and returns it.
+//									Tasks which expired while queued are
+//									returned in expiredTasks.		  [PRIVATE]
+//
+
+SCSITask *
+IOSCSIProtocolServices::DequeueSCSITaskForDispatch ( SCSITask ** expiredTasks )
+{
+	
+	SCSITask *	selectedTask	= NULL;
+	UInt64		now				= 0;
+	UInt64		gracePeriod		= 0;
+	bool		schedule		= false;
+	
+	clock_get_uptime ( &now );
+	
+	IOSimpleLockLock ( fQueueLock );
+	
+	while ( fSCSITaskQueueHead != NULL )
+	{
+		
+		UInt64	deadline = 0;
+		
+		selectedTask = fSCSITaskQueueHead;
+		RemoveSCSITaskFromQueue ( selectedTask );
+		
+		deadline = selectedTask->GetTimeoutDeadline ( );
+		if ( deadline == 0 )
+		{
+			
+			// No timeout, send it.
+			break;
+			
+		}
+		
+		if ( deadline <= now )
+		{
+			
+			// The task timed out before it could be sent. Hand it back to
+			// the caller to complete and look at the next one.
+			RemoveSCSITaskFromTimeoutWheel ( selectedTask );
+			selectedTask->EnqueueFollowingSCSITask ( *expiredTasks );
+			*expiredTasks = selectedTask;
+			selectedTask = NULL;
+			continue;
+			
+		}
+		
+		// From here on the protocol driver times the task out itself. Only
+		// escalate to ABORT TASK if it fails to do so within the grace period.
+		clock_interval_to_absolutetime_interval (
+				selectedTask->GetTimeoutDuration ( ) + kSCSITaskAbortTaskGracePeriodMS,
+				kMillisecondScale,
+				&gracePeriod );
+		
+		schedule = AddSCSITaskToTimeoutWheel ( selectedTask, now + gracePeriod );
+		break;
+		
+	}
+	
+	IOSimpleLockUnlock ( fQueueLock );
+	
+	if ( schedule == true )
+	{
+		ScheduleTimeoutWheel ( );
+	}
+	
+	return selectedTask;
+	
+}
+
+
+//
+//	 DisarmSCSITaskTimeout - Removes the SCSI Task from the timeout wheel.
+//															  		  [PRIVATE]
+//
+
+void
+IOSCSIProtocolServices::DisarmSCSITaskTimeout ( SCSITask * request )
+{
+	
+	// A task which is not in the wheel can not be added to it while it is
+	// being completed, so the common case does not need the lock.
+	require_nonzero_quiet ( request->GetTimeoutDeadline ( ), Exit );
+	
+	IOSimpleLockLock ( fQueueLock );
+	RemoveSCSITaskFromTimeoutWheel ( request );
+	IOSimpleLockUnlock ( fQueueLock );
+	
+	
+Exit:
+	
+	
+	return;
+	
+}
+
+
+//
+//	 ScheduleTimeoutWheel - Starts the timeout wheel. The wheel holds a
+//							 retain on the object while it is turning.
+//															  		  [PRIVATE]
+//
+
+void
+IOSCSIProtocolServices::ScheduleTimeoutWheel ( void )
+{
+	
+	UInt64	deadline = 0;
+	
+	retain ( );
+	
+	clock_interval_to_deadline ( kSCSITaskTimeoutWheelIntervalMS, kMillisecondScale, &deadline );
+	( void ) thread_call_enter_delayed ( fTimeoutWheelThread, deadline );
+	
+}
+
+
+//
+//	 ProcessTimeoutWheel - Handles expired tasks in every slot the wheel has
+//							passed since it last ran.				  [PRIVATE]
+//
+
+void
+IOSCSIProtocolServices::ProcessTimeoutWheel ( void )
+{
+	
+	SCSITask *					expiredTasks	= NULL;
+	SCSITask *					abortTasks[kSCSITaskMaximumAbortsPerPass];
+	UInt32						abortCount		= 0;
+	UInt32						index			= 0;
+	UInt64						now				= 0;
+	UInt64						currentTick		= 0;
+	UInt64						tick			= 0;
+	UInt64						deadline		= 0;
+	bool						reschedule		= false;
+	
+	clock_get_uptime ( &now );
+	currentTick = now / fTimeoutWheelInterval;
+	
+	IOSimpleLockLock ( fQueueLock );
+	
+	// Revisit the last slot, since tasks which were not yet due when it was
+	// last processed may be due now, but never visit a slot twice.
+	tick = fTimeoutWheelLastTick;
+	if ( ( currentTick - tick ) >= kSCSITaskTimeoutWheelSlots )
+	{
+		tick = currentTick - kSCSITaskTimeoutWheelSlots + 1;
+	}
+	
+	for ( ; tick <= currentTick; tick++ )
+	{
+		
+		SCSITask *	task = fTimeoutWheel[tick % kSCSITaskTimeoutWheelSlots];
+		
+		while ( task != NULL )
+		{
+			
+			SCSITask *	next = task->GetFollowingTimedSCSITask ( );
+			
+			// Slots are shared by deadlines one or more revolutions apart.
+			if ( task->GetTimeoutDeadline ( ) > now )
+			{
+				
+				task = next;
+				continue;
+				
+			}
+			
+			if ( RemoveSCSITaskFromQueue ( task ) == true )
+			{
+				
+				// The task never reached the device. Complete it below.
+				RemoveSCSITaskFromTimeoutWheel ( task );
+				task->EnqueueFollowingSCSITask ( expiredTasks );
+				expiredTasks = task;
+				
+			}
+			
+			else if ( task->GetTaggedTaskIdentifier ( ) == kSCSIUntaggedTaskIdentifier )
+			{
+				
+				// An untagged task can not be named by ABORT TASK. Leave it
+				// to the protocol driver.
+				RemoveSCSITaskFromTimeoutWheel ( task );
+				
+			}
+			
+			else if ( abortCount == kSCSITaskMaximumAbortsPerPass )
+			{
+				
+				// Enough aborts for one pass. Look at this task again on the
+				// next tick rather than a full revolution from now.
+				( void ) AddSCSITaskToTimeoutWheel ( task, ( currentTick + 1 ) * fTimeoutWheelInterval );
+				
+			}
+			
+			else if ( MarkSCSITaskForAbort ( task ) == true )
+			{
+				
+				// The task is hung in the device. It can't complete until
+				// the abort has been sent, so it is safe to use after the
+				// lock is dropped.
+				abortTasks[abortCount] = task;
+				abortCount++;
+				
+			}
+			
+			else
+			{
+				
+				// The task is already on its way out.
+				RemoveSCSITaskFromTimeoutWheel ( task );
+				
+			}
+			
+			task = next;
+			
+		}
+		
+	}
+	
+	fTimeoutWheelLastTick = currentTick;
+	
+	if ( fTimeoutWheelCount == 0 )
+	{
+		fTimeoutWheelScheduled = false;
+	}
+	
+	reschedule = fTimeoutWheelScheduled;
+	
+	IOSimpleLockUnlock ( fQueueLock );
+	
+	CompleteTimedOutTasks ( expiredTasks );
+	
+	for ( index = 0; index < abortCount; index++ )
+	{
+		
+		ERROR_LOG ( ( "%s: task with tag %qd on LUN %d timed out, aborting\n",
+					  getName ( ),
+					  abortTasks[index]->GetTaggedTaskIdentifier ( ),
+					  abortTasks[index]->GetLogicalUnitNumber ( ) ) );
+		
+		( void ) SendAbortForSCSITask ( abortTasks[index] );
+		
+	}
+	
+	if ( reschedule == true )
+	{
+		
+		// Keep the retain taken when the wheel was started.
+		clock_interval_to_deadline ( kSCSITaskTimeoutWheelIntervalMS, kMillisecondScale, &deadline );
+		( void ) thread_call_enter_delayed ( fTimeoutWheelThread, deadline );
+		
+	}
+	
+	else
+	{
+		
+		// The wheel has stopped, drop the retain it held.
+		release ( );
+		
+	}
+	
+}
+
+
+//
+//	 CompleteTimedOutTasks -	Completes a list of tasks which timed out
+//								before they were sent.				  [PRIVATE]
+//
+
+void
+IOSCSIProtocolServices::CompleteTimedOutTasks ( SCSITask * expiredTasks )
+{
+	
+	while ( expiredTasks != NULL )
+	{
+		
+		SCSITask *	task = expiredTasks;
+		
+		expiredTasks = task->DequeueFollowingSCSITask ( );
+		
+		ERROR_LOG ( ( "%s: task timed out before it was sent\n", getName ( ) ) );
+		CompleteAbortedTask ( task, kSCSITaskStatus_TaskTimeoutOccurred );
+		
+	}
+	
+}
+
+
+//
+//	 CompleteAbortedTask - Completes a task which was never sent, or will
+//							not be completed by the device.			  [PRIVATE]
+//
+
+void
+IOSCSIProtocolServices::CompleteAbortedTask ( SCSITask *		request,
+											  SCSITaskStatus	taskStatus )
+{
+	
+	request->SetTaskState ( kSCSITaskState_ENDED );
+	request->SetServiceResponse ( kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE );
 	
 	// Save that status into the Task object.
-	scsiRequest->SetTaskStatus ( kSCSITaskStatus_No_Status );
+	request->SetTaskStatus ( taskStatus );
 	
 	// The command is complete, release the retain for this command.
 	release ( );
@@ -1373,7 +2025,7 @@ IOSCSIProtocolServices::RejectTask ( SCSITaskIdentifier request )
 	{
 		
 		// Call the completion routine.
-		fCompletionRoutine ( scsiRequest );
+		fCompletionRoutine ( request );
 		
 	}
 	
@@ -1381,13 +2033,68 @@ IOSCSIProtocolServices::RejectTask ( SCSITaskIdentifier request )
 	{
 		
 		// Call the internal completion routine for the task.
-		scsiRequest->TaskCompletedNotification ( );
+		request->TaskCompletedNotification ( );
 		
 	}
 	
 }
 
 
+//
+//	 SendAbortForSCSITask -	Sends ABORT TASK for a task marked by
+//								MarkSCSITaskForAbort, then finishes the task's
+//								completion if it arrived in the meantime.
+//																	  [PRIVATE]
+//
+
+SCSIServiceResponse
+IOSCSIProtocolServices::SendAbortForSCSITask ( SCSITask * request )
+{
+	
+	SCSIServiceResponse	serviceResponse		= kSCSIServiceResponse_FUNCTION_REJECTED;
+	SCSIServiceResponse	deferredResponse	= kSCSIServiceResponse_Request_In_Process;
+	SCSITaskStatus		deferredStatus		= kSCSITaskStatus_No_Status;
+	bool				deferred			= false;
+	
+	// The task still holds its tag, because its completion is held back
+	// while the abort is pending.
+	serviceResponse = HandleAbortTask ( request->GetLogicalUnitNumber ( ),
+										request->GetTaggedTaskIdentifier ( ) );
+	
+	IOSimpleLockLock ( fQueueLock );
+	request->SetAbortPending ( false );
+	deferred = request->GetDeferredCompletion ( &deferredResponse, &deferredStatus );
+	IOSimpleLockUnlock ( fQueueLock );
+	
+	if ( deferred == true )
+	{
+		ProcessCompletedTask ( request, deferredResponse, deferredStatus );
+	}
+	
+	return serviceResponse;
+	
+}
+
+
+//
+//  sProcessTimeoutWheel - C->C++ glue.						[STATIC][PRIVATE]
+//
+
+void
+IOSCSIProtocolServices::sProcessTimeoutWheel ( thread_call_param_t whichDevice )
+{
+	
+	IOSCSIProtocolServices *	self;
+	
+	self = ( IOSCSIProtocolServices * ) whichDevice;
+	if ( self != NULL )
+	{
+		self->ProcessTimeoutWheel ( );
+	}
+	
+}
+
+
 #if 0
 #pragma mark -
 #pragma mark  Provided Services to the SCSI Protocol Layer Subclasses
@@ -1477,6 +2184,10 @@ IOSCSIProtocolServices::ExecuteCommand ( SCSITaskIdentifier request )
 	
 	STATUS_LOG ( ( "%s::%s called.\n", getName ( ), __FUNCTION__ ) );
 	
+	// This is the only place the identifier's type is checked. Everything
+	// downstream uses SCSITaskFromIdentifier() and trusts it.
+	require_nonzero ( OSDynamicCast ( SCSITask, request ), ErrorExit );
+	
 	// Make sure that the protocol driver does not go away 
 	// if there are outstanding commands.
 	retain ( );
@@ -1492,8 +2203,11 @@ IOSCSIProtocolServices::ExecuteCommand ( SCSITaskIdentifier request )
 		
 	}
 	
-	// Set the task state to ENABLED
+	// Set the task state to ENABLED. A task which is sent again without being
+	// reset may still be marked as completing from its last run.
 	SetTaskState ( request, kSCSITaskState_ENABLED );
+	SCSITaskFromIdentifier ( request )->SetCompleting ( false );
+	SCSITaskFromIdentifier ( request )->SetTimestamp ( kSCSITaskTimestamp_Queued );
 	
 	// Set the execution mode to indicate standard command execution.
 	SetTaskExecutionMode ( request, kSCSITaskMode_CommandExecution );
@@ -1508,6 +2222,18 @@ IOSCSIProtocolServices::ExecuteCommand ( SCSITaskIdentifier request )
 	AddSCSITaskToQueue ( request );
 	
 	SendSCSITasksFromQueue ( );
+	return;
+	
+	
+ErrorExit:
+	
+	
+	// A caller that hands in anything else has corrupted the task. Debug
+	// builds stop here. Otherwise there is no completion that could be
+	// delivered for it, so it is logged and dropped.
+	PANIC_NOW ( ( "%s::%s request is not a SCSITask\n", getName ( ), __FUNCTION__ ) );
+	IOLog ( "%s::%s request is not a SCSITask, dropped\n", getName ( ), __FUNCTION__ );
+	return;
 	
 }
 
@@ -1679,15 +2405,63 @@ IOSCSIProtocolServices::HandleTargetReset ( void )
 
 //
 //  AbortCommand -	The AbortCommand method is replaced by the AbortTask
-//					Management function and should no longer be called.
-//														  			[PROTECTED]
+//					Management function and should no longer be called. A task
+//					which is still queued is removed and completed here, a
+//					tagged task which has been sent to the device is passed to
+//					HandleAbortTask.					  			[PROTECTED]
 // [OBSOLETE - DO NOT USE]
 //
 
 SCSIServiceResponse
 IOSCSIProtocolServices::AbortCommand ( SCSITaskIdentifier request )
 {
-	return kSCSIServiceResponse_FUNCTION_REJECTED;
+	
+	SCSITask *			scsiRequest		= NULL;
+	SCSIServiceResponse	serviceResponse	= kSCSIServiceResponse_FUNCTION_REJECTED;
+	bool				queued			= false;
+	bool				marked			= false;
+	
+	scsiRequest = OSDynamicCast ( SCSITask, request );
+	require_nonzero ( scsiRequest, ErrorExit );
+	
+	// Decide under the lock, so the task can't complete and give its tag
+	// to another command before the abort is sent.
+	IOSimpleLockLock ( fQueueLock );
+	
+	queued = RemoveSCSITaskFromQueue ( scsiRequest );
+	if ( queued == true )
+	{
+		RemoveSCSITaskFromTimeoutWheel ( scsiRequest );
+	}
+	
+	else
+	{
+		marked = MarkSCSITaskForAbort ( scsiRequest );
+	}
+	
+	IOSimpleLockUnlock ( fQueueLock );
+	
+	if ( queued == true )
+	{
+		
+		// The task never reached the device, so it can be completed
+		// right away.
+		CompleteAbortedTask ( scsiRequest, kSCSITaskStatus_No_Status );
+		serviceResponse = kSCSIServiceResponse_FUNCTION_COMPLETE;
+		
+	}
+	
+	else if ( marked == true )
+	{
+		serviceResponse = SendAbortForSCSITask ( scsiRequest );
+	}
+	
+	
+ErrorExit:
+	
+	
+	return serviceResponse;
+	
 }
 
 
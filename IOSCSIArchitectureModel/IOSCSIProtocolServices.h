@@ -106,6 +106,13 @@ protected:
 		SCSITaskCompletion	fCompletionRoutine;
 		queue_head_t		fTaskQueueHead;
 		queue_head_t		fAutoSenseQueueHead;
+		SCSITask *			fSCSITaskQueueTail;
+		SCSITask **			fTimeoutWheel;
+		UInt64				fTimeoutWheelInterval;
+		UInt64				fTimeoutWheelLastTick;
+		UInt32				fTimeoutWheelCount;
+		bool				fTimeoutWheelScheduled;
+		thread_call_t		fTimeoutWheelThread;
 	};
 	IOSCSIProtocolServicesExpansionData * fIOSCSIProtocolServicesReserved;
 			
@@ -418,8 +425,12 @@ protected:
 	
 	/*!
 	@function AbortSCSITaskFromQueue
-	@abstract Deprecated internal method.
-	@discussion Deprecated internal method.
+	@abstract Internal method called to remove a SCSITask from the processing queue.
+	@discussion Internal method called to remove a SCSITask from the processing queue
+	before it is sent to the device. The removal takes constant time. The caller is
+	responsible for completing the SCSITask if it was removed.
+	@param request A valid SCSITask pointer.
+	@result True if the SCSITask was queued and has been removed, otherwise false.
 	*/
 	bool 	AbortSCSITaskFromQueue ( SCSITask * request );
 	
@@ -765,6 +776,23 @@ protected:
 	
 private:
 	
+	// -- SCSI Task Timeout Wheel Methods --
+	// Must call below functions with fQueueLock held.
+	bool	RemoveSCSITaskFromQueue ( SCSITask * request );
+	bool	AddSCSITaskToTimeoutWheel ( SCSITask * request, UInt64 deadline );
+	void	RemoveSCSITaskFromTimeoutWheel ( SCSITask * request );
+	bool	MarkSCSITaskForAbort ( SCSITask * request );
+	
+	// Must call below functions without fQueueLock held.
+	SCSITask *	DequeueSCSITaskForDispatch ( SCSITask ** expiredTasks );
+	void		DisarmSCSITaskTimeout ( SCSITask * request );
+	void		ScheduleTimeoutWheel ( void );
+	void		ProcessTimeoutWheel ( void );
+	void		CompleteTimedOutTasks ( SCSITask * expiredTasks );
+	void		CompleteAbortedTask ( SCSITask * request, SCSITaskStatus taskStatus );
+	SCSIServiceResponse	SendAbortForSCSITask ( SCSITask * request );
+	
+	static void		sProcessTimeoutWheel ( thread_call_param_t whichDevice );
 	
 #if !TARGET_OS_EMBEDDED
 	// Space reserved for future expansion.
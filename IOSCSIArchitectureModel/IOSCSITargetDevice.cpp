@@ -1925,9 +1925,8 @@ IOSCSITargetDevice::VerifyLogicalUnitPresence (
 				// Check the sense data to see if the TUR was sent to an invalid LUN and if so,
 				// abort trying to access this Logical Unit. We used to check the sense key for
 				// ILLEGAL_REQUEST, but some devices which aren't spun up yet will set NOT_READY
-				// for the SENSE_KEY. Might as well not use it...
-				if ( ( senseBuffer.ADDITIONAL_SENSE_CODE == 0x25 ) &&
-					 ( senseBuffer.ADDITIONAL_SENSE_CODE_QUALIFIER == 0x00 ) )
+				// for the SENSE_KEY. ClassifySenseData doesn't use it for this case either.
+				if ( ClassifySenseData ( &senseBuffer ) == kSCSISenseCategory_LUNotSupported )
 				{
 					
 					ERROR_LOG ( ( "Logical unit = %lld not valid\n", logicalUnit ) );
@@ -97,13 +97,11 @@ bool
 IOSCSITargetDeviceHashTable::IsProviderPathToExistingTarget (
 									IOSCSITargetDevice *		newTarget,
 									IOSCSIProtocolServices *	provider,
-									UInt32						hashValue )
+									UInt64						hashValue )
 {
 	
 	bool						isNewPath		= false;
 	__OSHashEntry *				newEntry		= NULL;
-	__OSHashEntryBucket *		bucket			= NULL;
-	__OSHashEntry *				existingEntry	= NULL;
 	IOSCSITargetDevice *		existingTarget	= NULL;
 	
 	STATUS_LOG ( ( "+IOSCSITargetDeviceHashTable::IsProviderPathToExistingTarget\n" ) );
@@ -118,68 +116,34 @@ IOSCSITargetDeviceHashTable::IsProviderPathToExistingTarget (
 	newEntry->next			= NULL;
 	newEntry->prev			= NULL;
 	newEntry->object		= newTarget;
-	hashValue 				= hashValue % fSize;
+	newEntry->bucket		= NULL;
 	
-	STATUS_LOG ( ( "hashValue = 0x%08x\n", ( unsigned int ) hashValue ) );
+	STATUS_LOG ( ( "hashValue = 0x%016llx\n", hashValue ) );
 	
 	// Get the table lock.
 	Lock ( );
 	
-	// Find the hash bucket.
-	bucket			= &fTable[hashValue];
-	existingEntry	= bucket->firstEntry;
+	// Check if any entries match our entry. If so, add a path to the existing
+	// entry and bail. Else, we insert the new entry into the table and associate
+	// the hash entry with the target device. While the table is being resized,
+	// the entry may still live in the old table.
+	existingTarget = FindTarget ( GetChain ( hashValue ), newTarget, hashValue );
+	if ( existingTarget == NULL )
+	{
+		existingTarget = FindTarget ( GetOldChain ( hashValue ), newTarget, hashValue );
+	}
 	
-	// Walk the list of hash entries in this bucket (if any). Check if any entries
-	// match our entry. If so, add a path to the existing entry and bail. Else,
-	// we insert the new entry into the table and associate the hash entry with the
-	// target device.
-	if ( existingEntry != NULL )
+	if ( existingTarget != NULL )
 	{
 		
-		// Get the object for this entry.
-		existingTarget = ( IOSCSITargetDevice * ) existingEntry->object;
-		
-		// Check the target object for existence.
-		while ( existingTarget != NULL )
-		{
-			
-			STATUS_LOG ( ( "Looking for target device\n" ) );
-			
-			OSObject *	id1 = NULL;
-			OSObject *	id2 = NULL;
-			
-			id1 = existingTarget->GetNodeUniqueIdentifier ( );
-			id2 = newTarget->GetNodeUniqueIdentifier ( );
-			
-			// See if the node unique identifiers are the same. We make the assumption that any
-			// path to the same target device should get the same INQUIRY page 83h and page 80h
-			// information from that target. So, the node unique identifiers would be equal for
-			// any two paths to the same node.
-			if ( ( id1 != NULL ) && ( id2 != NULL ) && ( id1->isEqualTo ( id2 ) ) )
-			{
-				
-				// They match. Add the path.
-				STATUS_LOG ( ( "Adding path to target\n" ) );
-				existingTarget->AddPath ( provider );
-				isNewPath = true;
-				break;
-				
-			}
-			
-			// They didn't match. See if we should keep traversing this bucket.
-			if ( existingEntry->next == NULL )
-				break;
-			
-			// Advance to next entry.
-			existingEntry 	= existingEntry->next;
-			existingTarget	= ( IOSCSITargetDevice * ) existingEntry->object;
-			
-		}
+		// They match. Add the path.
+		STATUS_LOG ( ( "Adding path to target\n" ) );
+		existingTarget->AddPath ( provider );
+		isNewPath = true;
 		
 	}
 	
-	// Is this a new target device?
-	if ( isNewPath == false )
+	else
 	{
 		
 		// Yes, this is a new target device. Insert it into the table.
@@ -201,6 +165,14 @@ IOSCSITargetDeviceHashTable::IsProviderPathToExistingTarget (
 		
 	}
 	
+	else
+	{
+		
+		// Grow the table if this insert pushed it over its load factor.
+		Rehash ( );
+		
+	}
+	
 	
 ErrorExit:
 	
@@ -212,6 +184,55 @@ ErrorExit:
 }
 
 
+//
+//	FindTarget - Walks a hash chain looking for a target device with the same
+//	node unique identifier as newTarget. The stored digests are compared first
+//	so isEqualTo() only runs on entries that are very likely to match.
+//	NB: This method must be called with the table lock held.		  [PRIVATE]
+//
+
+IOSCSITargetDevice *
+IOSCSITargetDeviceHashTable::FindTarget ( __OSHashEntry *		entry,
+										  IOSCSITargetDevice *	newTarget,
+										  UInt64				hashValue ) const
+{
+	
+	IOSCSITargetDevice *	existingTarget	= NULL;
+	OSObject *				id1				= NULL;
+	OSObject *				id2				= NULL;
+	
+	id2 = newTarget->GetNodeUniqueIdentifier ( );
+	require_nonzero ( id2, ErrorExit );
+	
+	for ( ; entry != NULL; entry = entry->next )
+	{
+		
+		if ( entry->hashValue != hashValue )
+			continue;
+		
+		STATUS_LOG ( ( "Digest match, comparing node unique identifiers\n" ) );
+		
+		existingTarget = ( IOSCSITargetDevice * ) entry->object;
+		id1 = existingTarget->GetNodeUniqueIdentifier ( );
+		
+		// See if the node unique identifiers are the same. We make the assumption that any
+		// path to the same target device should get the same INQUIRY page 83h and page 80h
+		// information from that target. So, the node unique identifiers would be equal for
+		// any two paths to the same node.
+		if ( ( id1 != NULL ) && ( id1->isEqualTo ( id2 ) ) )
+			return existingTarget;
+		
+	}
+	
+	
+ErrorExit:
+	
+	
+	return NULL;
+	
+}
+
+
 //
 //	DestroyHashReference -  Removes a hash entry from the table when a target
 //					  		device is freed.						   [PUBLIC]
@@ -223,9 +244,15 @@ IOSCSITargetDeviceHashTable::DestroyHashReference ( void * oldEntry )
 	
 	STATUS_LOG ( ( "+IOSCSITargetDeviceHashTable::DestroyHashReference\n" ) );
 	
+	Lock ( );
 	super::RemoveHashEntry ( ( __OSHashEntry * ) oldEntry );
+	Unlock ( );
+	
 	IODelete ( oldEntry, __OSHashEntry, 1 );
 	
+	// Shrink the table if this removal dropped it below its load factor.
+	Rehash ( );
+	
 	STATUS_LOG ( ( "-IOSCSITargetDeviceHashTable::DestroyHashReference\n" ) );
 	
 }
@@ -47,10 +47,16 @@ public:
 	bool	IsProviderPathToExistingTarget (
 						IOSCSITargetDevice *		newTarget,
 						IOSCSIProtocolServices *	provider,
-						UInt32						hashValue );
+						UInt64						hashValue );
 	
 	void 	DestroyHashReference ( void * oldEntry );
 	
+private:
+	
+	IOSCSITargetDevice *	FindTarget ( __OSHashEntry *		entry,
+										 IOSCSITargetDevice *	newTarget,
+										 UInt64					hashValue ) const;
+	
 };
 
 #endif	/* defined(KERNEL) && defined(__cplusplus) */
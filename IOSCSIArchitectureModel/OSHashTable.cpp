@@ -30,6 +30,7 @@
 #include <libkern/c++/OSData.h>
 #include <libkern/c++/OSString.h>
 #include <IOKit/IOLib.h>
+#include <libkern/libkern.h>
 
 
 //
@@ -66,12 +67,32 @@
 #endif
 
 
-// FNV (Fowler/Noll/Vo) Prime (32-bit) constant
-#define kFNV_32_PRIME ((UInt32) 0x01000193UL)
+// FNV (Fowler/Noll/Vo) 64-bit constants
+#define kFNV_64_OFFSET_BASIS	( ( UInt64 ) 0xCBF29CE484222325ULL )
+#define kFNV_64_PRIME			( ( UInt64 ) 0x00000100000001B3ULL )
 
 
 //
-//	Hash - Does FNV hash on passed in OSData bytes.					   [PUBLIC]
+//	FinalizeHash - Folds the high bits of an FNV-1a digest into the low 32
+//	bits. Bucket selection only uses the low bits of the digest, and FNV-1a
+//	alone leaves them poorly mixed for short keys.					   [STATIC]
+//
+
+static inline UInt32
+FinalizeHash ( UInt64 hash )
+{
+	
+	hash ^= hash >> 33;
+	hash *= 0xFF51AFD7ED558CCDULL;
+	hash ^= hash >> 33;
+	
+	return ( UInt32 ) ( hash ^ ( hash >> 32 ) );
+	
+}
+
+
+//
+//	Hash - Does seeded FNV-1a hash on passed in OSData bytes.		   [PUBLIC]
 //
 
 UInt32
@@ -79,25 +100,22 @@ __OSHashTable::Hash ( OSData * data ) const
 {
 	
 	const UInt8 *	bytes 	= NULL;
-	UInt32			hash	= 0;
+	UInt64			hash	= kFNV_64_OFFSET_BASIS ^ fSeed;
 	UInt32			length	= 0;
 	
 	STATUS_LOG ( ( "+__OSHashTable::Hash(data)\n" ) );
 	
-	//require_nonzero ( data, ErrorExit );
-	
 	bytes = ( const UInt8 * ) data->getBytesNoCopy ( );
-	//require_nonzero ( bytes, ErrorExit );
+	require_nonzero_quiet ( bytes, ErrorExit );
 	
 	length = data->getLength ( );
-	//require_nonzero ( length, ErrorExit );
 	
 	// Perform hash
 	while ( length != 0 )
 	{
 		
-		hash *= kFNV_32_PRIME;
 		hash ^= *bytes++;
+		hash *= kFNV_64_PRIME;
 		
 		length--;
 		
@@ -109,13 +127,13 @@ ErrorExit:
 	
 	STATUS_LOG ( ( "-__OSHashTable::Hash(data)\n" ) );
 	
-	return hash;
+	return FinalizeHash ( hash );
 	
 }
 
 
 //
-//	Hash - Does FNV hash on passed in OSString.						   [PUBLIC]
+//	Hash - Does seeded FNV-1a hash on passed in OSString.			   [PUBLIC]
 //
 
 UInt32
@@ -123,23 +141,21 @@ __OSHashTable::Hash ( OSString * string ) const
 {
 	
 	const UInt8 *	bytes 	= NULL;
-	UInt32			hash	= 0;
+	UInt64			hash	= kFNV_64_OFFSET_BASIS ^ fSeed;
 	UInt32			c		= 0;
 	
 	STATUS_LOG ( ( "+__OSHashTable::Hash(string)\n" ) );
 	
-	//require_nonzero ( string, ErrorExit );
-	
 	bytes = ( const UInt8 * ) string->getCStringNoCopy ( );
-	//require_nonzero ( bytes, ErrorExit );
+	require_nonzero_quiet ( bytes, ErrorExit );
 	
 	// Perform hash
 	c = *bytes;
 	while ( c != 0 )
 	{
 		
-		hash *= kFNV_32_PRIME;
 		hash ^= c;
+		hash *= kFNV_64_PRIME;
 		
 		bytes++;
 		c = *bytes;
@@ -152,7 +168,7 @@ ErrorExit:
 	
 	STATUS_LOG ( ( "-__OSHashTable::Hash(string)\n" ) );
 	
-	return hash;
+	return FinalizeHash ( hash );
 	
 }
 
@@ -166,11 +182,17 @@ __OSHashTable::__OSHashTable ( void )
 	
 	STATUS_LOG ( ( "+__OSHashTable::__OSHashTable(void)\n" ) );
 	
-	fTableLock = IORecursiveLockAlloc ( );
+	fTableLock = IORWLockAlloc ( );
+	
+	// Seed the hash per boot so identifiers can't be crafted to collide.
+	fSeed = ( ( ( UInt64 ) random ( ) ) << 32 ) | ( UInt64 ) random ( );
 	
 	fSize 			= kDefaultStartSize;
 	fEntries		= 0;
 	fMaxChainDepth	= 0;
+	fOldTable		= NULL;
+	fOldSize		= 0;
+	fRehashIndex	= 0;
 	
 	fTable = IONew ( __OSHashEntryBucket, fSize );
 	bzero ( fTable, fSize * sizeof ( __OSHashEntryBucket ) );
@@ -189,11 +211,17 @@ __OSHashTable::__OSHashTable ( UInt32 startSize )
 	
 	STATUS_LOG ( ( "+__OSHashTable::__OSHashTable(UInt32)\n" ) );
 	
-	fTableLock = IORecursiveLockAlloc ( );
-		
+	fTableLock = IORWLockAlloc ( );
+	
+	// Seed the hash per boot so identifiers can't be crafted to collide.
+	fSeed = ( ( ( UInt64 ) random ( ) ) << 32 ) | ( UInt64 ) random ( );
+	
 	fSize 			= startSize;
 	fEntries		= 0;
 	fMaxChainDepth	= 0;
+	fOldTable		= NULL;
+	fOldSize		= 0;
+	fRehashIndex	= 0;
 	
 	fTable = IONew ( __OSHashEntryBucket, fSize );
 	bzero ( fTable, fSize * sizeof ( __OSHashEntryBucket ) );
@@ -215,11 +243,19 @@ __OSHashTable::~__OSHashTable ( void )
 	if ( fTableLock != NULL )
 	{
 		
-		IORecursiveLockFree ( fTableLock );
+		IORWLockFree ( fTableLock );
 		fTableLock = NULL;
 		
 	}
 	
+	if ( fOldTable != NULL )
+	{
+		
+		IODelete ( fOldTable, __OSHashEntryBucket, fOldSize );
+		fOldTable = NULL;
+		
+	}
+	
 	if ( fTable != NULL )
 	{
 		
@@ -233,9 +269,70 @@ __OSHashTable::~__OSHashTable ( void )
 }
 
 
+//
+//	GetChain - Returns the chain in the current table for a hash value.
+//	NB: This method must be called with fTableLock held.			[PROTECTED]
+//
+
+__OSHashEntry *
+__OSHashTable::GetChain ( UInt64 hashValue ) const
+{
+	return fTable[hashValue % fSize].firstEntry;
+}
+
+
+//
+//	GetOldChain - Returns the chain in the table being drained for a hash
+//	value, or NULL if no resize is in progress or that bucket has already
+//	been migrated.
+//	NB: This method must be called with fTableLock held.			[PROTECTED]
+//
+
+__OSHashEntry *
+__OSHashTable::GetOldChain ( UInt64 hashValue ) const
+{
+	
+	UInt32	index = 0;
+	
+	if ( fOldTable == NULL )
+		return NULL;
+	
+	index = hashValue % fOldSize;
+	if ( index < fRehashIndex )
+		return NULL;
+	
+	return fOldTable[index].firstEntry;
+	
+}
+
+
+//
+//	LinkEntry - Pushes an entry onto the front of a bucket's chain.
+//																	   [STATIC]
+//
+
+void
+__OSHashTable::LinkEntry ( __OSHashEntryBucket * bucket, __OSHashEntry * entry )
+{
+	
+	entry->next = bucket->firstEntry;
+	entry->prev = NULL;
+	
+	if ( bucket->firstEntry != NULL )
+	{
+		bucket->firstEntry->prev = entry;
+	}
+	bucket->firstEntry = entry;
+	bucket->chainDepth++;
+	
+	entry->bucket = bucket;
+	
+}
+
+
 //
 //	InsertHashEntry - Called to insert an entry into the hash table.
-//																	[PROTECTED]
+//	NB: This method must be called with fTableLock held exclusive.	[PROTECTED]
 //
 
 void
@@ -243,39 +340,29 @@ __OSHashTable::InsertHashEntry ( __OSHashEntry * newEntry )
 {
 	
 	__OSHashEntryBucket * 	header		= NULL;
-	UInt32					hashValue	= 0;
-	
-	Lock ( );
 	
-	hashValue = newEntry->hashValue % fSize;
-	header = &fTable[hashValue];
+	// Do a little of any outstanding resize work first, so the new entry
+	// always lands in the current table.
+	MigrateBuckets ( kRehashBucketsPerOp );
 	
-	newEntry->next = header->firstEntry;
-	newEntry->prev = NULL;
+	header = &fTable[newEntry->hashValue % fSize];
+	LinkEntry ( header, newEntry );
 	
-	if ( header->firstEntry != NULL )
+	if ( header->chainDepth > fMaxChainDepth )
 	{
-		header->firstEntry->prev = newEntry;
+		fMaxChainDepth = header->chainDepth;
 	}
-	header->firstEntry = newEntry;
-	header->chainDepth++;
 	
-	STATUS_LOG ( ( "__OSHashTable::InsertHashEntry, bucket = %ld, chainDepth = %ld\n", hashValue, header->chainDepth ) );
+	STATUS_LOG ( ( "__OSHashTable::InsertHashEntry, chainDepth = %ld\n", header->chainDepth ) );
 	
 	fEntries++;
-	if ( fEntries > ( fSize / 2 ) )
-	{
-		STATUS_LOG ( ( "Should grow hash table\n" ) );
-	}
-	
-	Unlock ( );
 	
 }
 
 
 //
 //	RemoveHashEntry - Called to remove an entry from the hash table.
-//																	[PROTECTED]
+//	NB: This method must be called with fTableLock held exclusive.	[PROTECTED]
 //
 
 void
@@ -285,12 +372,25 @@ __OSHashTable::RemoveHashEntry ( __OSHashEntry * oldEntry )
 	__OSHashEntry *			next 		= NULL;
 	__OSHashEntry *			prev 		= NULL;
 	__OSHashEntryBucket * 	header		= NULL;
-	UInt32					hashValue	= 0;
 	
-	Lock ( );
-
-	hashValue = oldEntry->hashValue % fSize;	
-	header = &fTable[hashValue];
+	// An entry inserted during a resize goes into the current table even when
+	// its hash value maps to a bucket of the old table which has not been
+	// drained yet, so the bucket can't be worked out from the hash value.
+	header = oldEntry->bucket;
+	
+#if DEBUG
+	
+	for ( next = header->firstEntry; next != NULL; next = next->next )
+	{
+		
+		if ( next == oldEntry )
+			break;
+		
+	}
+	
+	check ( next == oldEntry );
+	
+#endif	/* DEBUG */
 	
 	prev = oldEntry->prev;
 	next = oldEntry->next;
@@ -311,87 +411,96 @@ __OSHashTable::RemoveHashEntry ( __OSHashEntry * oldEntry )
 	}
 	header->chainDepth--;
 	
-	STATUS_LOG ( ( "__OSHashTable::RemoveHashEntry, bucket = %ld, chainDepth = %ld\n", hashValue, header->chainDepth ) );
+	oldEntry->next		= NULL;
+	oldEntry->prev		= NULL;
+	oldEntry->bucket	= NULL;
+	
+	STATUS_LOG ( ( "__OSHashTable::RemoveHashEntry, chainDepth = %ld\n", header->chainDepth ) );
 	
 	fEntries--;
-	if ( fEntries < ( fSize / 8 ) )
-	{
-		STATUS_LOG ( ( "Should shrink hash table\n" ) );
-	}
 	
-	Unlock ( );
+	MigrateBuckets ( kRehashBucketsPerOp );
 	
 }
 
 
 //
-//	Rehash - Called to grow or shrink the hash table and balance it out.
-//																	[PROTECTED]
+//	Rehash - Called to grow or shrink the hash table. Installs a new bucket
+//	array and leaves the old one to be drained incrementally by subsequent
+//	inserts and removes.											[PROTECTED]
 //
 
 void
 __OSHashTable::Rehash ( void )
 {
 	
-	__OSHashEntry *				listHead			= NULL;
 	__OSHashEntryBucket *		newTable			= NULL;
-	__OSHashEntryBucket *		oldTable			= NULL;
 	UInt32						newSize				= 0;
-	UInt32						oldSize				= 0;
 	
-	// The Rehash() method does the following:
-	//  Allocate new memory associated with the table of pointers to buckets.
-	//  Make everything into a single doubly-linked list by making
-	//	 the tail of each bucket point at the head of the next bucket over.
-	//  Rehash each entry and drop it in its proper bucket.
-	//  Delete the memory associated with the old table of pointers to buckets.
+	// Take a quick look at the load factor without the lock held exclusive.
+	// We'll recheck once we hold it, since we must allocate before that.
+	LockShared ( );
 	
-	// Easy check to find out if we're growing or shrinking.
-	if ( fEntries < ( fSize / 8 ) )
+	if ( fOldTable != NULL )
 	{
-		newSize = fSize / kScaleFactor;
+		
+		// A resize is already in progress.
+		newSize = 0;
+		
 	}
 	
-	else
+	else if ( fEntries > ( fSize / 2 ) )
 	{
 		newSize = fSize * kScaleFactor;
 	}
 	
+	else if ( ( fEntries < ( fSize / 8 ) ) && ( fSize > kDefaultStartSize ) )
+	{
+		newSize = fSize / kScaleFactor;
+	}
+	
+	Unlock ( );
+	
+	require_nonzero_quiet ( newSize, Exit );
+	
 	// We now know the new table size. Attempt to allocate memory for new table of
-	// pointers.
+	// pointers. Don't allocate while holding the table lock, as allocations may block.
 	newTable = IONew ( __OSHashEntryBucket, newSize );
-	__Require_noErr ( newTable, ErrorExit );
+	require_nonzero ( newTable, Exit );
 	
 	bzero ( newTable, newSize * sizeof ( __OSHashEntryBucket ) );
 	
-	// Must hold the table lock to go further.
 	Lock ( );
 	
-	// Rearrange in single list. Keep track of list head.
-	listHead = SingleList ( );
-	__Require_noErr_Action ( listHead,
-							 ErrorExit,
-							 Unlock ( );
-							 IODelete ( newTable, __OSHashEntryBucket, newSize ) );
+	// Someone may have beaten us to it, or the load may have changed.
+	if ( ( fOldTable != NULL ) ||
+		 ( ( newSize > fSize ) && ( fEntries <= ( fSize / 2 ) ) ) ||
+		 ( ( newSize < fSize ) && ( fEntries >= ( fSize / 8 ) ) ) )
+	{
+		
+		Unlock ( );
+		IODelete ( newTable, __OSHashEntryBucket, newSize );
+		goto Exit;
+		
+	}
+	
+	STATUS_LOG ( ( "__OSHashTable::Rehash, %ld -> %ld buckets\n", fSize, newSize ) );
 	
-	// Switch the tables.
-	oldTable 	= fTable;
-	oldSize 	= fSize;
-	fTable 		= newTable;
-	fSize 		= newSize;
-	fEntries	= 0;
+	// Switch the tables. The old table is drained by MigrateBuckets().
+	fOldTable		= fTable;
+	fOldSize		= fSize;
+	fRehashIndex	= 0;
+	fTable 			= newTable;
+	fSize 			= newSize;
+	fMaxChainDepth	= 0;
 	
-	// Put all the items in the new table.
-	RehashList ( listHead );
+	// Move a first batch right away.
+	MigrateBuckets ( kRehashBucketsPerOp );
 	
-	// Drop the lock now, we don't need it anymore.
 	Unlock ( );
 	
-	// Delete memory associated with old table.
-	IODelete ( oldTable, __OSHashEntryBucket, oldSize );
 	
-	
-ErrorExit:
+Exit:
 	
 	
 	return;
@@ -400,151 +509,74 @@ ErrorExit:
 
 
 //
-//	SingleList - Arranges items into a single doubly-linked list.
-//	NB: This method must be called with fTableLock held.			  [PRIVATE]
+//	MigrateBuckets - Moves up to count buckets from the old table into the
+//	current one and frees the old table once it is empty.
+//	NB: This method must be called with fTableLock held exclusive.	  [PRIVATE]
 //
 
-__OSHashEntry *
-__OSHashTable::SingleList ( void ) const
+void
+__OSHashTable::MigrateBuckets ( UInt32 count )
 {
 	
-	__OSHashEntryBucket	* 		bucket				= NULL;
-	__OSHashEntry *				firstBucket			= NULL;
-	__OSHashEntry *				lastEntryInBucket	= NULL;
-	UInt32						index				= 0;
-	UInt32						bucketIndex			= 0;
+	__OSHashEntryBucket *	oldBucket	= NULL;
+	__OSHashEntryBucket *	newBucket	= NULL;
+	__OSHashEntry *			entry		= NULL;
+	__OSHashEntry *			next		= NULL;
+	__OSHashEntryBucket *	oldTable	= NULL;
+	UInt32					oldSize		= 0;
 	
-	// Find the first bucket with objects in it.
-	index = FindFirstBucketWithEntries ( );
-	__Require ( ( index < fSize ), Exit );
+	require_nonzero_quiet ( fOldTable, Exit );
 	
-	bucket = &fTable[index];
-	firstBucket = bucket->firstEntry;
-	__Require_noErr ( firstBucket, Exit );
-	
-	// Loop over all buckets to connect the hash entries into one giant linked-list.
-	for ( ; index < ( fSize - 1 ); index++ )
+	while ( ( count != 0 ) && ( fRehashIndex < fOldSize ) )
 	{
 		
-		// Get the current bucket.
-		bucket = &fTable[index];
-		if ( bucket->chainDepth == 0 )
-			continue;
+		oldBucket = &fOldTable[fRehashIndex];
+		entry = oldBucket->firstEntry;
 		
-		lastEntryInBucket = bucket->firstEntry;
-		for ( bucketIndex = 0; bucketIndex < ( bucket->chainDepth - 1 ); bucketIndex++ )
+		while ( entry != NULL )
 		{
 			
-			lastEntryInBucket = lastEntryInBucket->next;
-	//		check ( lastEntryInBucket );
+			next = entry->next;
+			
+			newBucket = &fTable[entry->hashValue % fSize];
+			LinkEntry ( newBucket, entry );
+			
+			if ( newBucket->chainDepth > fMaxChainDepth )
+			{
+				fMaxChainDepth = newBucket->chainDepth;
+			}
+			
+			entry = next;
 			
 		}
 		
-		// Get pointer to next bucket
-		bucketIndex = FindNextBucketWithEntries ( &bucket, index + 1 );
-	__Require ( ( bucketIndex < fSize ), Exit );
-	__Require_noErr ( bucket, Exit );
+		oldBucket->firstEntry = NULL;
+		oldBucket->chainDepth = 0;
 		
-		lastEntryInBucket->next = bucket->firstEntry;
-		bucket->firstEntry->prev = lastEntryInBucket;
+		fRehashIndex++;
+		count--;
 		
 	}
 	
-	
-Exit:
-	
-	
-	return firstBucket;
-	
-}
-
-
-//
-//	RehashList - Drops the list of items into table via InsertHashEntry().
-//	NB: This method must be called with fTableLock held.			  [PRIVATE]
-//
-
-void
-__OSHashTable::RehashList ( __OSHashEntry * listHead )
-{
-	
-	__OSHashEntry	*	next	= NULL;
-	__OSHashEntry	*	prev	= NULL;
-	
-	prev = listHead;
-	next = prev->next;
-	InsertHashEntry ( prev );
-	
-	while ( next != NULL )
+	if ( fRehashIndex == fOldSize )
 	{
 		
-		prev = next;
-		next = prev->next;
-		InsertHashEntry ( prev );
+		// Done draining. IODelete() doesn't block, so it is safe to free the
+		// old table here with the lock held.
+		oldTable		= fOldTable;
+		oldSize			= fOldSize;
+		fOldTable		= NULL;
+		fOldSize		= 0;
+		fRehashIndex	= 0;
 		
-	}
-	
-}
-
-
-//
-//	FindFirstBucketWithEntries - Finds first bucket with entries.	  [PRIVATE]
-//
-
-UInt32
-__OSHashTable::FindFirstBucketWithEntries ( void ) const
-{
-	
-	UInt32 					index 	= 0;
-	__OSHashEntryBucket *	bucket	= NULL;
-	
-	for ( index = 0; index < fSize; index++ )
-	{
-		
-		bucket = &fTable[index];
-		if ( bucket->chainDepth != 0 )
-		{
-			
-			break;
-			
-		}
+		IODelete ( oldTable, __OSHashEntryBucket, oldSize );
 		
 	}
 	
-	return index;
-	
-}
-
-
-//
-//	FindNextBucketWithEntries - Finds next bucket with entries.		  [PRIVATE]
-//
-
-UInt32
-__OSHashTable::FindNextBucketWithEntries (
-					__OSHashEntryBucket ** 	bucket,
-					UInt32					startLocation ) const
-{
 	
-	UInt32 					index 		= 0;
-	__OSHashEntryBucket *	localBucket = NULL;
-	
-	*bucket	= NULL;
+Exit:
 	
-	for ( index = startLocation; index < fSize; index++ )
-	{
-		
-		localBucket = &fTable[index];
-		if ( localBucket->chainDepth != 0 )
-		{
-			
-			*bucket = localBucket;
-			break;
-			
-		}
-		
-	}
 	
-	return index;
+	return;
 	
 }
@@ -38,19 +38,26 @@
 //	Structs
 //
 
+typedef struct __OSHashEntryBucket __OSHashEntryBucket;
+
 typedef struct __OSHashEntry
 {
-	__OSHashEntry *	next;
-	__OSHashEntry *	prev;
-	UInt32			hashValue;
-	void *			object;
+	__OSHashEntry *			next;
+	__OSHashEntry *			prev;
+	UInt64					hashValue;
+	void *					object;
+	
+	// The bucket the entry is linked into. While the table is being resized
+	// this may be in either bucket array, so it is recorded rather than
+	// worked out from the hash value.
+	__OSHashEntryBucket *	bucket;
 } __OSHashEntry;
 
-typedef struct __OSHashEntryBucket
+struct __OSHashEntryBucket
 {
 	__OSHashEntry *	firstEntry;
 	UInt32			chainDepth;
-} __OSHashEntryBucket;
+};
 
 
 //
@@ -60,12 +67,17 @@ typedef struct __OSHashEntryBucket
 // 
 // This class handles all hash table generic stuff such as inserting/removing
 // items, growing or shrinking the table dynamically based on the number of
-// entries and/or chain depth. It currently uses the Fowler/Noll/Vo (FNV) hash
-// algorithm.
+// entries. It uses a seeded 64-bit Fowler/Noll/Vo (FNV-1a) hash, folded to 32
+// bits, and stores the hash value in each entry, so subclasses can reject
+// mismatches cheaply before doing any expensive object comparison.
 // 
-// In the future, we might want to use a different hash algorithm more explictly
-// tailored to the 8 bytes of EUI-64/Node World Wide Name, but that
-// behavior can be overriden in the IOSCSITargetDeviceHashTable subclass anyway.
+// Resizing is incremental. When the load factor crosses a threshold, a new
+// bucket array is installed and the old one is drained a few buckets at a
+// time by each subsequent insert or remove, so no single caller pays for
+// re-inserting every entry. The table lock is a reader/writer lock: a pure
+// lookup may take it shared with LockShared, but a lookup that may be followed
+// by an insert (as in IOSCSITargetDeviceHashTable) must take it exclusive so
+// the two are atomic.
 //
 
 class __OSHashTable
@@ -73,6 +85,7 @@ class __OSHashTable
 	
 	static const UInt32	kDefaultStartSize 	= 8;
 	static const UInt32 kScaleFactor		= 2;
+	static const UInt32	kRehashBucketsPerOp	= 4;
 	
 public:
 	
@@ -80,30 +93,51 @@ public:
 	__OSHashTable ( const UInt32 startSize );
 	virtual ~__OSHashTable ( void );
 	
+	// These keep their original 32-bit signatures so subclasses built
+	// against earlier versions of this header still match the vtable. The
+	// 64-bit digest is folded down, and widened again where it is stored.
 	virtual UInt32	Hash ( OSData * data ) const;
 	virtual UInt32	Hash ( OSString * string ) const;
 	
 protected:
 	
+	// Must call below functions with the lock held exclusive.
 	void		InsertHashEntry ( __OSHashEntry * entry );
 	void		RemoveHashEntry ( __OSHashEntry * entry );
+	
+	// Grows or shrinks the table if the load factor calls for it. Must be
+	// called without the lock held, since it may allocate.
 	void		Rehash ( void );
 	
-	// Table lock/unlock.
-	inline void	Lock ( void ) { IORecursiveLockLock ( fTableLock ); }
-	inline void	Unlock ( void ) { IORecursiveLockUnlock ( fTableLock ); }
+	// Must call with the lock held (shared or exclusive). Returns the first
+	// entry of the chain hashValue maps to in the current table, and in the
+	// table being drained, if a resize is in progress.
+	__OSHashEntry *	GetChain ( UInt64 hashValue ) const;
+	__OSHashEntry *	GetOldChain ( UInt64 hashValue ) const;
+	
+	// Table lock/unlock. LockShared is only for lookups which do not modify
+	// the table or act on what they find.
+	inline void	LockShared ( void ) { IORWLockRead ( fTableLock ); }
+	inline void	Lock ( void ) { IORWLockWrite ( fTableLock ); }
+	inline void	Unlock ( void ) { IORWLockUnlock ( fTableLock ); }
 	
 private:
 	
-	// Must call below functions with lock held.
-	__OSHashEntry *	SingleList ( void ) const;
-	void RehashList ( __OSHashEntry * listHead );
+	// Must call below functions with lock held exclusive.
+	void					MigrateBuckets ( UInt32 count );
+	
+	static void				LinkEntry ( __OSHashEntryBucket *	bucket,
+										__OSHashEntry *			entry );
+	
+	IORWLock *						fTableLock;
 	
-	UInt32	FindFirstBucketWithEntries ( void ) const;
-	UInt32	FindNextBucketWithEntries ( __OSHashEntryBucket ** 	bucket,
-										UInt32					startLocation ) const;
+	UInt64							fSeed;
 	
-	IORecursiveLock *				fTableLock;
+	// Bucket array being drained by an incremental resize, or NULL. Buckets
+	// below fRehashIndex have already been moved to fTable.
+	__OSHashEntryBucket *			fOldTable;
+	UInt32							fOldSize;
+	UInt32							fRehashIndex;
 	
 protected:
 	
@@ -0,0 +1,222 @@
+/*
+ * Copyright (c) 2004 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#ifndef __SCSI_COMMAND_DESCRIPTOR_BLOCK_LAYOUT_H__
+#define __SCSI_COMMAND_DESCRIPTOR_BLOCK_LAYOUT_H__
+
+//
+//	Includes
+//
+
+#include <IOKit/IOLib.h>
+
+// SCSI Architecture Model Family includes
+#include <IOKit/scsi/SCSITask.h>
+#include <IOKit/scsi/SCSICommandOperationCodes.h>
+
+
+//
+// Command layouts describe a CDB once per operation code, as a field type
+// for each parameter giving its byte offset, bit shift and width. The
+// builders pack a CDB from these in one pass into a local block and hand
+// the whole block to the task.
+// 
+// Field placement is checked at compile time. So is any value whose type
+// is no wider than its field, which covers the addresses, lengths and
+// CONTROL bytes; only the narrow bit fields are range checked at runtime.
+//
+
+// A field of a CDB. Fields of eight bits or fewer lie within the byte at
+// Offset, starting at bit Shift. Wider fields are big-endian whole bytes.
+template < UInt8 Offset, UInt8 Shift, UInt8 Bits >
+struct SCSICDBField
+{
+	
+	static_assert ( ( Bits > 0 ) && ( Bits <= 64 ), "Bad CDB field width" );
+	static_assert ( ( Bits <= 8 ) ? ( ( Shift + Bits ) <= 8 ) : ( ( Shift == 0 ) && ( ( Bits % 8 ) == 0 ) ),
+					"CDB fields wider than a byte must be whole bytes" );
+	
+	static constexpr UInt8	kOffset	= Offset;
+	static constexpr UInt8	kEnd	= Offset + ( ( Bits + 7 ) / 8 );
+	
+	// True if value fits the field. Constant when T is no wider than it.
+	template < typename T >
+	static constexpr bool IsValid ( T value )
+	{
+		return ( ( sizeof ( T ) * 8 ) <= Bits ) || ( ( ( ( UInt64 ) value >> ( Bits - 1 ) ) >> 1 ) == 0 );
+	}
+	
+	// Packs value into a zeroed CDB.
+	template < typename T >
+	static inline void Pack ( UInt8 * cdb, T value )
+	{
+		
+		if ( Bits <= 8 )
+		{
+			cdb[Offset] |= ( UInt8 ) ( value << Shift );
+		}
+		
+		else
+		{
+			
+			for ( UInt8 index = 0; index < ( Bits / 8 ); index++ )
+			{
+				cdb[Offset + index] = ( UInt8 ) ( ( UInt64 ) value >> ( Bits - 8 - ( index * 8 ) ) );
+			}
+			
+		}
+		
+	}
+	
+};
+
+
+// The operation code and size of a CDB. Each command's layout derives
+// from this and adds its own fields.
+template < UInt8 OperationCode, UInt8 Size >
+struct SCSICDBLayout
+{
+	
+	static_assert ( ( Size == kSCSICDBSize_6Byte ) || ( Size == kSCSICDBSize_10Byte ) ||
+					( Size == kSCSICDBSize_12Byte ) || ( Size == kSCSICDBSize_16Byte ),
+					"Bad CDB size" );
+	
+	static constexpr UInt8	kOperationCode	= OperationCode;
+	static constexpr UInt8	kSize			= Size;
+	
+	// CONTROL is always the last byte.
+	typedef SCSICDBField < Size - 1, 0, 8 >		CONTROL;
+	
+};
+
+
+// Packs a CDB with the given layout. Set ( ) may be called for the fields
+// in any order; IsValid ( ) then says whether every value fit its field.
+template < class Layout >
+class SCSICDBBuilder
+{
+	
+public:
+	
+	inline SCSICDBBuilder ( void ) : fValid ( true )
+	{
+		
+		bzero ( fCDB, sizeof ( fCDB ) );
+		fCDB[0] = Layout::kOperationCode;
+		
+	}
+	
+	template < class Field, typename T >
+	inline void Set ( T value )
+	{
+		
+		static_assert ( Field::kOffset > 0, "CDB field overlaps the operation code" );
+		static_assert ( Field::kEnd <= Layout::kSize, "CDB field lies outside the CDB" );
+		
+		fValid &= Field::IsValid ( value );
+		Field::Pack ( fCDB, value );
+		
+	}
+	
+	inline bool IsValid ( void ) const { return fValid; }
+	inline UInt8 GetSize ( void ) const { return Layout::kSize; }
+	inline const SCSICommandDescriptorBlock * GetCommandDescriptorBlock ( void ) const { return &fCDB; }
+	
+private:
+	
+	SCSICommandDescriptorBlock	fCDB;
+	bool						fValid;
+	
+};
+
+
+//
+//	Primary command layouts
+//
+
+// TEST UNIT READY as defined in SPC.
+typedef SCSICDBLayout < kSCSICmd_TEST_UNIT_READY, kSCSICDBSize_6Byte > SCSICDB_TEST_UNIT_READY;
+
+// INQUIRY as defined in SPC.
+struct SCSICDB_INQUIRY : SCSICDBLayout < kSCSICmd_INQUIRY, kSCSICDBSize_6Byte >
+{
+	typedef SCSICDBField < 1, 1, 1 >	CMDDT;
+	typedef SCSICDBField < 1, 0, 1 >	EVPD;
+	typedef SCSICDBField < 2, 0, 8 >	PAGE_OR_OPERATION_CODE;
+	typedef SCSICDBField < 4, 0, 8 >	ALLOCATION_LENGTH;
+};
+
+
+//
+//	Block command layouts
+//
+
+// READ and WRITE (10) as defined in SBC-2. PROTECT is RDPROTECT or
+// WRPROTECT. RELADR is the obsolete SBC-1 bit MMC still uses.
+template < UInt8 OperationCode >
+struct SCSICDBLayoutReadWrite10 : SCSICDBLayout < OperationCode, kSCSICDBSize_10Byte >
+{
+	typedef SCSICDBField < 1, 5, 3 >	PROTECT;
+	typedef SCSICDBField < 1, 4, 1 >	DPO;
+	typedef SCSICDBField < 1, 3, 1 >	FUA;
+	typedef SCSICDBField < 1, 1, 1 >	FUA_NV;
+	typedef SCSICDBField < 1, 0, 1 >	RELADR;
+	typedef SCSICDBField < 2, 0, 32 >	LOGICAL_BLOCK_ADDRESS;
+	typedef SCSICDBField < 6, 0, 5 >	GROUP_NUMBER;
+	typedef SCSICDBField < 7, 0, 16 >	TRANSFER_LENGTH;
+};
+
+// READ and WRITE (12) as defined in SBC-2.
+template < UInt8 OperationCode >
+struct SCSICDBLayoutReadWrite12 : SCSICDBLayout < OperationCode, kSCSICDBSize_12Byte >
+{
+	typedef SCSICDBField < 1, 5, 3 >	PROTECT;
+	typedef SCSICDBField < 1, 4, 1 >	DPO;
+	typedef SCSICDBField < 1, 3, 1 >	FUA;
+	typedef SCSICDBField < 1, 1, 1 >	FUA_NV;
+	typedef SCSICDBField < 2, 0, 32 >	LOGICAL_BLOCK_ADDRESS;
+	typedef SCSICDBField < 6, 0, 32 >	TRANSFER_LENGTH;
+	typedef SCSICDBField < 10, 0, 5 >	GROUP_NUMBER;
+};
+
+// READ and WRITE (16) as defined in SBC-2.
+template < UInt8 OperationCode >
+struct SCSICDBLayoutReadWrite16 : SCSICDBLayout < OperationCode, kSCSICDBSize_16Byte >
+{
+	typedef SCSICDBField < 1, 5, 3 >	PROTECT;
+	typedef SCSICDBField < 1, 4, 1 >	DPO;
+	typedef SCSICDBField < 1, 3, 1 >	FUA;
+	typedef SCSICDBField < 1, 1, 1 >	FUA_NV;
+	typedef SCSICDBField < 2, 0, 64 >	LOGICAL_BLOCK_ADDRESS;
+	typedef SCSICDBField < 10, 0, 32 >	TRANSFER_LENGTH;
+	typedef SCSICDBField < 14, 0, 5 >	GROUP_NUMBER;
+};
+
+typedef SCSICDBLayoutReadWrite10 < kSCSICmd_READ_10 >	SCSICDB_READ_10;
+typedef SCSICDBLayoutReadWrite10 < kSCSICmd_WRITE_10 >	SCSICDB_WRITE_10;
+typedef SCSICDBLayoutReadWrite12 < kSCSICmd_READ_12 >	SCSICDB_READ_12;
+typedef SCSICDBLayoutReadWrite12 < kSCSICmd_WRITE_12 >	SCSICDB_WRITE_12;
+typedef SCSICDBLayoutReadWrite16 < kSCSICmd_READ_16 >	SCSICDB_READ_16;
+typedef SCSICDBLayoutReadWrite16 < kSCSICmd_WRITE_16 >	SCSICDB_WRITE_16;
+
+#endif	/* __SCSI_COMMAND_DESCRIPTOR_BLOCK_LAYOUT_H__ */
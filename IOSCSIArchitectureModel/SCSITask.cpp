@@ -135,14 +135,6 @@ SCSITask::free ( void )
 		
 	}
 	
-	if ( ( fAutosenseTaskMap == kernel_task ) && ( fAutoSenseData != NULL ) )
-	{
-		
-		IOFree ( fAutoSenseData, fAutoSenseDataSize );
-		fAutoSenseData = NULL;
-		
-	}
-	
 	super::free ( );
 	
 }
@@ -160,7 +152,6 @@ SCSITask::ResetForNewTask ( void )
 {
 	
 	bool				result = false;
-	SCSI_Sense_Data *	buffer = NULL;
 	
 	// If this is a pending task, do not allow it to be reset until
 	// it has completed.
@@ -187,10 +178,21 @@ SCSITask::ResetForNewTask ( void )
 	fServiceResponse				= kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
 	
 	fNextTaskInQueue				= NULL;
+	fPreviousTaskInQueue			= NULL;
+	
+	fNextTaskInTimeoutWheel			= NULL;
+	fPreviousTaskInTimeoutWheel		= NULL;
+	fTimeoutDeadline				= 0;
+	
+	fAbortPending					= false;
+	fCompletionDeferred				= false;
+	fCompleting						= false;
 	
 	fProtocolLayerReference			= NULL;
 	fApplicationLayerReference		= NULL;
 	
+	bzero ( &fTimestamps, sizeof ( fTimestamps ) );
+	
 	// Autosense member variables
    	fAutosenseDataRequested			= false;
 	fAutosenseCDBSize				= 0;
@@ -201,11 +203,9 @@ SCSITask::ResetForNewTask ( void )
 	if ( fAutoSenseData == NULL )
 	{
 		
-		fAutoSenseDataSize = sizeof ( SCSI_Sense_Data );
-		buffer = ( SCSI_Sense_Data * ) IOMalloc ( fAutoSenseDataSize );
-		__Require_noErr ( buffer, ErrorExit );
-		bzero ( buffer, fAutoSenseDataSize );
-		result = SetAutoSenseDataBuffer ( buffer, fAutoSenseDataSize, kernel_task );
+		result = SetAutoSenseDataBuffer ( &fInlineAutoSenseData,
+										  sizeof ( fInlineAutoSenseData ),
+										  kernel_task );
 		__Require ( result, ErrorExit );
 		
 	}
@@ -222,6 +222,40 @@ ErrorExit:
 }
 
 
+//
+//	 ApplyTemplate - Utility method to set every field described by a
+//					  SCSITaskTemplate in a single step. This method will
+//					  return false if the task is active.			   [PUBLIC]
+//
+
+bool
+SCSITask::ApplyTemplate ( const SCSITaskTemplate * taskTemplate )
+{
+	
+	bool	result = false;
+	
+	__Require ( ( IsTaskActive ( ) == false ), ErrorExit );
+	
+	fTaskAttribute				= taskTemplate->taskAttribute;
+	fTransferDirection			= taskTemplate->transferDirection;
+	fTimeoutDuration			= taskTemplate->timeoutDuration;
+	fCompletionCallback			= taskTemplate->completionCallback;
+	
+	bcopy ( taskTemplate->autosenseCDB, fAutosenseCDB, kSCSICDBSize_Maximum );
+	fAutosenseCDBSize			= taskTemplate->autosenseCDBSize;
+	fAutosenseDataRequested		= true;
+	
+	result = true;
+	
+	
+ErrorExit:
+	
+	
+	return result;
+	
+}
+
+
 //
 //	 SetTaskOwner - Utility method for setting the OSObject that owns
 //					 the instantiation of the SCSI Task				   [PUBLIC]
@@ -592,6 +626,35 @@ SCSITask::SetCommandDescriptorBlock (
 }
 
 
+//
+//	 SetCommandDescriptorBlock - Populate the Command Descriptor Block from
+//								  a whole block.				 	   [PUBLIC]
+//
+
+bool 
+SCSITask::SetCommandDescriptorBlock ( 
+							const SCSICommandDescriptorBlock *	cdbData,
+							UInt8								cdbSize )
+{
+	
+	if ( ( cdbSize != kSCSICDBSize_6Byte ) &&
+		 ( cdbSize != kSCSICDBSize_10Byte ) &&
+		 ( cdbSize != kSCSICDBSize_12Byte ) &&
+		 ( cdbSize != kSCSICDBSize_16Byte ) )
+	{
+		return false;
+	}
+	
+	bcopy ( cdbData,
+			fCommandDescriptorBlock,
+			sizeof ( SCSICommandDescriptorBlock ) );
+	
+	fCommandSize = cdbSize;
+	return true;
+	
+}
+
+
 //
 //	 GetCommandDescriptorBlockSize - Gets the Command Descriptor Block size.
 //																 	   [PUBLIC]
@@ -842,7 +905,8 @@ SCSITask::SetAutoSenseDataBuffer ( SCSI_Sense_Data * 	senseData,
 								   task_t				task )
 {
 	
-	// Release any old memory descriptors
+	// Release any old memory descriptors. The old memory itself is either
+	// fInlineAutoSenseData or belongs to the client which supplied it.
 	if ( fAutosenseDescriptor != NULL )
 	{
 		
@@ -851,16 +915,6 @@ SCSITask::SetAutoSenseDataBuffer ( SCSI_Sense_Data * 	senseData,
 		
 	}
 	
-	// Release any old memory
-	if ( ( fAutosenseTaskMap == kernel_task ) && ( fAutoSenseData != NULL ) )
-	{
-		
-		IOFree ( fAutoSenseData, fAutoSenseDataSize );
-		fAutoSenseData = NULL;
-		fAutoSenseDataSize = 0;
-		
-	}
-	
 	// Set the new memory
 	fAutoSenseData			= senseData;
 	fAutoSenseDataSize		= senseDataSize;
@@ -979,10 +1033,17 @@ void
 SCSITask::EnsureAutosenseDescriptorExists ( void )
 {
 	
-	if ( fAutosenseDescriptor == NULL )
+	// The descriptor describes the current sense buffer and is reused by
+	// every command until SetAutoSenseDataBuffer replaces that buffer.
+	if ( ( fAutosenseDescriptor == NULL ) && ( fAutoSenseData != NULL ) )
 	{
 		
-		//fAutosenseDescriptor = IOMemoryDescriptor::withAddressRange(vm_address_t addr64_t, mach_vm_size_t long, IOOptionBits options, task_t task)
+		fAutosenseDescriptor = IOMemoryDescriptor::withAddressRange (
+									( mach_vm_address_t ) fAutoSenseData,
+									fAutoSenseDataSize,
+									kIODirectionIn,
+									fAutosenseTaskMap );
+		__Check ( fAutosenseDescriptor );
 		
 	}
 	
@@ -1384,3 +1445,225 @@ SCSITask::ReplaceFollowingSCSITask ( SCSITask * newFollowingTask )
 	return returnTask;
 	
 }
+
+
+//
+//	 EnqueuePrecedingSCSITask - Records the specified Task as the one queued
+//								 before this one.					   [PUBLIC]
+//
+
+void
+SCSITask::EnqueuePrecedingSCSITask ( SCSITask * precedingTask )
+{
+	fPreviousTaskInQueue = precedingTask;
+}
+
+
+//
+//	 GetPrecedingSCSITask - Returns the pointer to the SCSI Task that is
+//							 queued before this one. Returns NULL if this Task
+//							 is at the head of the queue or is not currently
+//							 queued.						 		   [PUBLIC]
+//
+
+SCSITask *
+SCSITask::GetPrecedingSCSITask ( void )
+{
+	
+	return fPreviousTaskInQueue;
+	
+}
+
+
+#if 0
+#pragma mark -
+#pragma mark  SCSI Task Timeout Wheel Methods
+#pragma mark -
+#endif
+
+// These are the methods used by the SCSI Protocol Layer to link the SCSI Task
+// object into its timeout wheel. They should not be used by any other layer.
+
+//
+//	 SetTimeoutDeadline - Sets the absolute time at which the task expires.
+//															 		   [PUBLIC]
+//
+
+void
+SCSITask::SetTimeoutDeadline ( UInt64 deadline )
+{
+	fTimeoutDeadline = deadline;
+}
+
+
+//
+//	 GetTimeoutDeadline - Gets the absolute time at which the task expires.
+//						   Returns zero if the task is not in a timeout wheel.
+//															 		   [PUBLIC]
+//
+
+UInt64
+SCSITask::GetTimeoutDeadline ( void )
+{
+	return fTimeoutDeadline;
+}
+
+
+//
+//	 SetFollowingTimedSCSITask - Sets the next task in the timeout wheel slot.
+//															 		   [PUBLIC]
+//
+
+void
+SCSITask::SetFollowingTimedSCSITask ( SCSITask * followingTask )
+{
+	fNextTaskInTimeoutWheel = followingTask;
+}
+
+
+//
+//	 GetFollowingTimedSCSITask - Gets the next task in the timeout wheel slot.
+//															 		   [PUBLIC]
+//
+
+SCSITask *
+SCSITask::GetFollowingTimedSCSITask ( void )
+{
+	return fNextTaskInTimeoutWheel;
+}
+
+
+//
+//	 SetPrecedingTimedSCSITask - Sets the previous task in the timeout wheel
+//								  slot.								   [PUBLIC]
+//
+
+void
+SCSITask::SetPrecedingTimedSCSITask ( SCSITask * precedingTask )
+{
+	fPreviousTaskInTimeoutWheel = precedingTask;
+}
+
+
+//
+//	 GetPrecedingTimedSCSITask - Gets the previous task in the timeout wheel
+//								  slot.								   [PUBLIC]
+//
+
+SCSITask *
+SCSITask::GetPrecedingTimedSCSITask ( void )
+{
+	return fPreviousTaskInTimeoutWheel;
+}
+
+
+//
+//	 SetAbortPending - Marks whether an ABORT TASK for this task is being
+//						sent.										   [PUBLIC]
+//
+
+void
+SCSITask::SetAbortPending ( bool abortPending )
+{
+	fAbortPending = abortPending;
+}
+
+
+//
+//	 IsAbortPending - Returns true while an ABORT TASK for this task is
+//					   being sent.									   [PUBLIC]
+//
+
+bool
+SCSITask::IsAbortPending ( void )
+{
+	return fAbortPending;
+}
+
+
+//
+//	 DeferCompletion - Saves a completion which arrived while an ABORT TASK
+//						was being sent.								   [PUBLIC]
+//
+
+void
+SCSITask::DeferCompletion ( SCSIServiceResponse	serviceResponse,
+							SCSITaskStatus		taskStatus )
+{
+	
+	fDeferredServiceResponse	= serviceResponse;
+	fDeferredTaskStatus			= taskStatus;
+	fCompletionDeferred			= true;
+	
+}
+
+
+//
+//	 GetDeferredCompletion - Returns and clears a completion saved by
+//							  DeferCompletion. Returns false if there is
+//							  none.									   [PUBLIC]
+//
+
+bool
+SCSITask::GetDeferredCompletion ( SCSIServiceResponse *	serviceResponse,
+								  SCSITaskStatus *		taskStatus )
+{
+	
+	bool	result = fCompletionDeferred;
+	
+	if ( result == true )
+	{
+		
+		*serviceResponse	= fDeferredServiceResponse;
+		*taskStatus			= fDeferredTaskStatus;
+		fCompletionDeferred	= false;
+		
+	}
+	
+	return result;
+	
+}
+
+
+//
+//	 SetCompleting - Marks whether the task is being completed.	   [PUBLIC]
+//
+
+void
+SCSITask::SetCompleting ( bool completing )
+{
+	fCompleting = completing;
+}
+
+
+//
+//	 IsCompleting - Returns true while the task is being completed.   [PUBLIC]
+//
+
+bool
+SCSITask::IsCompleting ( void )
+{
+	return fCompleting;
+}
+
+
+//
+//	 SetTimestamp - Records the current time for a trace point.	   [PUBLIC]
+//
+
+void
+SCSITask::SetTimestamp ( SCSITaskTimestamp point )
+{
+	clock_get_uptime ( &fTimestamps.time[point] );
+}
+
+
+//
+//	 GetTimestamps - Copies out the task's trace timestamps.		   [PUBLIC]
+//
+
+void
+SCSITask::GetTimestamps ( SCSITaskTimestamps * timestamps )
+{
+	bcopy ( &fTimestamps, timestamps, sizeof ( SCSITaskTimestamps ) );
+}
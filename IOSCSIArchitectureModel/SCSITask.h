@@ -460,6 +460,68 @@ typedef OSObject *	SCSITaskIdentifier;
 typedef void ( *SCSITaskCompletion )( SCSITaskIdentifier completedTask );
 
 
+/*!
+	@typedef SCSITaskTemplate
+	@discussion The fields of a task which are the same for every read
+	(or every write) a device issues. A device builds a template once and
+	applies it to each new task, so only the CDB, data buffer, transfer
+	count and tag need to be set per I/O.
+	@field taskAttribute The SCSITaskAttribute of the task.
+	@field transferDirection The data transfer direction of the task.
+	@field timeoutDuration The task timeout in milliseconds.
+	@field completionCallback The task completion routine.
+	@field autosenseCDB The CDB used to retrieve autosense data.
+	@field autosenseCDBSize The size of autosenseCDB.
+*/
+typedef struct SCSITaskTemplate
+{
+	SCSITaskAttribute			taskAttribute;
+	UInt8						transferDirection;
+	UInt32						timeoutDuration;
+	SCSITaskCompletion			completionCallback;
+	SCSICommandDescriptorBlock	autosenseCDB;
+	UInt8						autosenseCDBSize;
+} SCSITaskTemplate;
+
+
+/*!
+	@enum SCSITaskTimestamp
+	@discussion Points at which a task is timestamped on its way through
+	the SCSI Protocol Layer. A timestamp of zero means the task never
+	reached that point.
+	@constant kSCSITaskTimestamp_Queued The task was accepted by
+	ExecuteCommand().
+	@constant kSCSITaskTimestamp_Sent The task was last handed to the
+	protocol driver's SendSCSICommand().
+	@constant kSCSITaskTimestamp_Completed The protocol driver completed
+	the command.
+	@constant kSCSITaskTimestamp_AutosenseCompleted The protocol driver
+	completed the REQUEST SENSE issued for the command.
+	@constant kSCSITaskTimestamp_Notified The task's completion routine
+	was called.
+*/
+typedef enum SCSITaskTimestamp
+{
+	kSCSITaskTimestamp_Queued				= 0,
+	kSCSITaskTimestamp_Sent					= 1,
+	kSCSITaskTimestamp_Completed			= 2,
+	kSCSITaskTimestamp_AutosenseCompleted	= 3,
+	kSCSITaskTimestamp_Notified				= 4,
+	kSCSITaskTimestamp_Count				= 5
+} SCSITaskTimestamp;
+
+
+/*!
+	@typedef SCSITaskTimestamps
+	@discussion The timestamps of a task, in absolute time, indexed by
+	SCSITaskTimestamp.
+*/
+typedef struct SCSITaskTimestamps
+{
+	UInt64						time[kSCSITaskTimestamp_Count];
+} SCSITaskTimestamps;
+
+
 #endif	/* defined(KERNEL) && defined(__cplusplus) */
 
 #endif /* _IOKIT_SCSI_TASK_H_ */
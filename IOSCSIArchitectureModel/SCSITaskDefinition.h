@@ -36,6 +36,7 @@
 #include <IOKit/IOCommand.h>
 #include <IOKit/IOReturn.h>
 #include <IOKit/IOMemoryDescriptor.h>
+#include <IOKit/IOLib.h>
 
 // SCSI Architecture Model Family includes
 #include <IOKit/scsi/SCSICmds_REQUEST_SENSE_Defs.h>
@@ -100,6 +101,13 @@ private:
 	IOMemoryDescriptor *		fAutosenseDescriptor;
 	task_t						fAutosenseTaskMap;
 	
+	// Sense data is stored here unless a client supplies its own buffer
+	// with SetAutoSenseDataBuffer.
+	SCSI_Sense_Data				fInlineAutoSenseData;
+	
+	// When the task crossed each layer boundary. See SetTimestamp.
+	SCSITaskTimestamps			fTimestamps;
+	
     // Reference members for each layer.  Since these may contain a memory address, they
     // are declared as void * so that they will scale to a 64-bit system.
     void *						fProtocolLayerReference;
@@ -111,6 +119,31 @@ private:
     // Protocol Layer
     SCSITask *					fNextTaskInQueue;
 	
+	// Pointer to the previous SCSI Task in the queue. Together with fNextTaskInQueue
+	// this allows the SCSI Protocol Layer to remove a specific task from the queue
+	// without walking it.
+	SCSITask *					fPreviousTaskInQueue;
+	
+	// Membership in the SCSI Protocol Layer's timeout wheel. The deadline is in
+	// absolute time units and is zero when the task is not in the wheel.
+	SCSITask *					fNextTaskInTimeoutWheel;
+	SCSITask *					fPreviousTaskInTimeoutWheel;
+	UInt64						fTimeoutDeadline;
+	
+	// Set by the SCSI Protocol Layer while an ABORT TASK naming this task is
+	// being sent. A completion which arrives in the meantime is saved here and
+	// finished once the abort has been sent, so the task's tag can not be
+	// given back and reused by another command underneath the abort.
+	bool						fAbortPending;
+	bool						fCompletionDeferred;
+	SCSIServiceResponse			fDeferredServiceResponse;
+	SCSITaskStatus				fDeferredTaskStatus;
+	
+	// Set by the SCSI Protocol Layer once it has started completing the task,
+	// so it can no longer be picked for ABORT TASK. The task state only moves
+	// to ENDED once the results are stored, right before the client is told.
+	bool						fCompleting;
+	
 	// The Task Execution mode is only used by the SCSI Protocol Layer for 
 	// indicating whether the command currently being executed is the client's
 	// command or the AutoSense RequestSense command.
@@ -131,6 +164,11 @@ public:
 	// and false if it failed because it represents an active task.
 	bool				ResetForNewTask ( void );
 	
+	// Utility method to set every field described by a SCSITaskTemplate
+	// in a single step. This method will return false if the task is
+	// active.
+	bool				ApplyTemplate ( const SCSITaskTemplate * taskTemplate );
+	
 	// Utility method to check if this task represents an active.
 	bool				IsTaskActive ( void );
 	
@@ -225,6 +263,12 @@ public:
 							UInt8			cdbByte14,
 							UInt8			cdbByte15 );
 	
+	// Populate the Command Descriptor Block from a whole block, such as one
+	// packed by SCSICDBBuilder. Bytes past cdbSize must be zero.
+	bool 	SetCommandDescriptorBlock ( 
+							const SCSICommandDescriptorBlock *	cdbData,
+							UInt8								cdbSize );
+	
 	UInt8	GetCommandDescriptorBlockSize ( void );
 	
 	// This will always return a 16 Byte CDB.  If the Protocol Layer driver
@@ -373,7 +417,65 @@ public:
 	// task.
 	SCSITask * ReplaceFollowingSCSITask ( SCSITask * newFollowingTask );
 	
+	// This method records the specified Task as the one queued before this one
+	void	EnqueuePrecedingSCSITask ( SCSITask * precedingTask );
+	
+	// Returns the pointer to the SCSI Task that is queued before
+	// this one.  Returns NULL if this Task is at the head of the queue
+	// or is not currently queued.
+	SCSITask * GetPrecedingSCSITask ( void );
+	
+	// These are the methods used by the SCSI Protocol Layer to keep the
+	// Task in its timeout wheel. They should not be used by any other layer.
+	void		SetTimeoutDeadline ( UInt64 deadline );
+	UInt64		GetTimeoutDeadline ( void );
+	void		SetFollowingTimedSCSITask ( SCSITask * followingTask );
+	SCSITask *	GetFollowingTimedSCSITask ( void );
+	void		SetPrecedingTimedSCSITask ( SCSITask * precedingTask );
+	SCSITask *	GetPrecedingTimedSCSITask ( void );
+	
+	// These are the methods used by the SCSI Protocol Layer to hold back the
+	// completion of a task while an ABORT TASK for it is being sent. They
+	// should not be used by any other layer.
+	void		SetAbortPending ( bool abortPending );
+	bool		IsAbortPending ( void );
+	void		DeferCompletion ( SCSIServiceResponse	serviceResponse,
+								  SCSITaskStatus		taskStatus );
+	bool		GetDeferredCompletion ( SCSIServiceResponse *	serviceResponse,
+										SCSITaskStatus *		taskStatus );
+	void		SetCompleting ( bool completing );
+	bool		IsCompleting ( void );
+	
+	// Latency tracing. The SCSI Protocol Layer stamps the task with the
+	// current absolute time as it passes each SCSITaskTimestamp point, and
+	// the task's owner reads the stamps back once it has completed.
+	void		SetTimestamp ( SCSITaskTimestamp point );
+	void		GetTimestamps ( SCSITaskTimestamps * timestamps );
+	
 };
 
 
+//
+//	SCSITaskFromIdentifier - Converts an identifier into its task without a
+//	runtime type check. IOSCSIProtocolServices::ExecuteCommand() verifies the
+//	type once when a task is submitted, so the accessors used while the task
+//	is in flight cast directly. NULL is passed through unchanged.
+//
+
+inline SCSITask *
+SCSITaskFromIdentifier ( SCSITaskIdentifier request )
+{
+	
+#if DEBUG
+	if ( ( request != NULL ) && ( OSDynamicCast ( SCSITask, request ) == NULL ) )
+	{
+		IOPanic ( "SCSITaskFromIdentifier: identifier is not a SCSITask\n" );
+	}
+#endif	/* DEBUG */
+	
+	return ( SCSITask * ) request;
+	
+}
+
+
 #endif /* _IOKIT_SCSI_TASK_DEFINITION_H_ */
@@ -30,6 +30,7 @@
 #include <IOKit/scsi/SCSICommandDefinitions.h>
 #include "IOSCSIBlockCommandsDevice.h"
 #include "SCSIBlockCommands.h"
+#include "SCSICommandDescriptorBlockLayout.h"
 #include "SCSICommandOperationCodes.h"
 
 //
@@ -71,7 +72,7 @@ IOSCSIBlockCommandsDevice::ERASE_10 (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -109,7 +110,7 @@ IOSCSIBlockCommandsDevice::ERASE_12 (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -150,7 +151,7 @@ IOSCSIBlockCommandsDevice::FORMAT_UNIT(
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 
@@ -278,7 +279,7 @@ IOSCSIBlockCommandsDevice::LOCK_UNLOCK_CACHE (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 
@@ -426,7 +427,7 @@ IOSCSIBlockCommandsDevice::MEDIUM_SCAN (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -468,7 +469,7 @@ IOSCSIBlockCommandsDevice::PREFETCH (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -618,7 +619,7 @@ IOSCSIBlockCommandsDevice::READ_6 (
 	bool		status 				= false;
 	UInt32 		requestedByteCount	= 0;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -677,7 +678,7 @@ IOSCSIBlockCommandsDevice::READ_10 (
 	bool		status 				= false;
 	UInt64		requestedByteCount	= 0;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -728,6 +729,7 @@ IOSCSIBlockCommandsDevice::READ_10 (
 
 	bool		status 				= false;
 	UInt64		requestedByteCount	= 0;
+	SCSICDBBuilder < SCSICDB_READ_10 >	cdb;
 	
 	require_nonzero ( request, ErrorExit );
 	require ( ResetForNewTask ( request ), ErrorExit );
@@ -737,29 +739,20 @@ IOSCSIBlockCommandsDevice::READ_10 (
 	
 	requestedByteCount = TRANSFER_LENGTH * blockSize;
 	
-	// Do the pre-flight check on the passed in parameters
-	require ( IsParameterValid ( RDPROTECT, kSCSICmdFieldMask3Bit ), ErrorExit );
-	require ( IsParameterValid ( DPO, kSCSICmdFieldMask1Bit ), ErrorExit );
-	require ( IsParameterValid ( FUA, kSCSICmdFieldMask1Bit ), ErrorExit );
-	require ( IsParameterValid ( FUA_NV, kSCSICmdFieldMask1Bit ), ErrorExit );
-	require ( IsParameterValid ( LOGICAL_BLOCK_ADDRESS, kSCSICmdFieldMask4Byte ), ErrorExit );
-	require ( IsParameterValid ( GROUP_NUMBER, kSCSICmdFieldMask5Bit ), ErrorExit );
-	require ( IsParameterValid ( TRANSFER_LENGTH, kSCSICmdFieldMask2Byte ), ErrorExit );
-	require ( IsParameterValid ( CONTROL, kSCSICmdFieldMask1Byte ), ErrorExit );
-	require ( IsMemoryDescriptorValid ( dataBuffer, requestedByteCount  ), ErrorExit );
+	// Pack the CDB. Only the bit fields can be out of range; the rest
+	// are checked at compile time.
+	cdb.Set < SCSICDB_READ_10::PROTECT > ( RDPROTECT );
+	cdb.Set < SCSICDB_READ_10::DPO > ( DPO );
+	cdb.Set < SCSICDB_READ_10::FUA > ( FUA );
+	cdb.Set < SCSICDB_READ_10::FUA_NV > ( FUA_NV );
+	cdb.Set < SCSICDB_READ_10::LOGICAL_BLOCK_ADDRESS > ( LOGICAL_BLOCK_ADDRESS );
+	cdb.Set < SCSICDB_READ_10::GROUP_NUMBER > ( GROUP_NUMBER );
+	cdb.Set < SCSICDB_READ_10::TRANSFER_LENGTH > ( TRANSFER_LENGTH );
+	cdb.Set < SCSICDB_READ_10::CONTROL > ( CONTROL );
+	require ( cdb.IsValid ( ), ErrorExit );
+	require ( IsMemoryDescriptorValid ( dataBuffer, requestedByteCount ), ErrorExit );
 	
-	// This is a 10-Byte command, fill out the cdb appropriately  
-	SetCommandDescriptorBlock (	request,
-								kSCSICmd_READ_10,
-								( RDPROTECT << 5 ) | ( DPO << 4 ) | ( FUA << 3 ) | ( FUA_NV << 1 ),
-								( LOGICAL_BLOCK_ADDRESS >> 24 ) & 0xFF,
-								( LOGICAL_BLOCK_ADDRESS >> 16 ) & 0xFF,
-								( LOGICAL_BLOCK_ADDRESS >> 8  ) & 0xFF,
-								  LOGICAL_BLOCK_ADDRESS			& 0xFF,
-								GROUP_NUMBER,
-								( TRANSFER_LENGTH >> 8 ) & 0xFF,
-								  TRANSFER_LENGTH		 & 0xFF,
-								CONTROL );
+	SetCommandDescriptorBlock ( request, cdb.GetCommandDescriptorBlock ( ), cdb.GetSize ( ) );
 	
 	SetDataTransferDirection ( 	request, kSCSIDataTransfer_FromTargetToInitiator );
 	SetTimeoutDuration ( request, 0 );
@@ -798,7 +791,7 @@ IOSCSIBlockCommandsDevice::READ_12 (
 	bool		status 				= false;
 	UInt64 		requestedByteCount	= 0;
 
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -849,6 +842,7 @@ IOSCSIBlockCommandsDevice::READ_12 (
 	
 	bool		status 				= false;
 	UInt64 		requestedByteCount	= 0;
+	SCSICDBBuilder < SCSICDB_READ_12 >	cdb;
 
 	require_nonzero ( request, ErrorExit );
 	require ( ResetForNewTask ( request ), ErrorExit );
@@ -858,31 +852,20 @@ IOSCSIBlockCommandsDevice::READ_12 (
 	
 	requestedByteCount = TRANSFER_LENGTH * blockSize;
 
-	// Do the pre-flight check on the passed in parameters
-	require ( IsParameterValid ( RDPROTECT, kSCSICmdFieldMask3Bit ), ErrorExit );
-	require ( IsParameterValid ( DPO, kSCSICmdFieldMask1Bit ), ErrorExit );
-	require ( IsParameterValid ( FUA, kSCSICmdFieldMask1Bit ), ErrorExit );
-	require ( IsParameterValid ( FUA_NV, kSCSICmdFieldMask1Bit ), ErrorExit );
-	require ( IsParameterValid ( LOGICAL_BLOCK_ADDRESS, kSCSICmdFieldMask4Byte ), ErrorExit );
-	require ( IsParameterValid ( TRANSFER_LENGTH, kSCSICmdFieldMask4Byte ), ErrorExit );
-	require ( IsParameterValid ( GROUP_NUMBER, kSCSICmdFieldMask5Bit ), ErrorExit );
-	require ( IsParameterValid ( CONTROL, kSCSICmdFieldMask1Byte ), ErrorExit );
-	require ( IsMemoryDescriptorValid ( dataBuffer, requestedByteCount  ), ErrorExit );
+	// Pack the CDB. Only the bit fields can be out of range; the rest
+	// are checked at compile time.
+	cdb.Set < SCSICDB_READ_12::PROTECT > ( RDPROTECT );
+	cdb.Set < SCSICDB_READ_12::DPO > ( DPO );
+	cdb.Set < SCSICDB_READ_12::FUA > ( FUA );
+	cdb.Set < SCSICDB_READ_12::FUA_NV > ( FUA_NV );
+	cdb.Set < SCSICDB_READ_12::LOGICAL_BLOCK_ADDRESS > ( LOGICAL_BLOCK_ADDRESS );
+	cdb.Set < SCSICDB_READ_12::TRANSFER_LENGTH > ( TRANSFER_LENGTH );
+	cdb.Set < SCSICDB_READ_12::GROUP_NUMBER > ( GROUP_NUMBER );
+	cdb.Set < SCSICDB_READ_12::CONTROL > ( CONTROL );
+	require ( cdb.IsValid ( ), ErrorExit );
+	require ( IsMemoryDescriptorValid ( dataBuffer, requestedByteCount ), ErrorExit );
 	
-	// This is a 12-Byte command, fill out the cdb appropriately  
-	SetCommandDescriptorBlock (	request,
-								kSCSICmd_READ_12,
-								( RDPROTECT << 5 ) | ( DPO << 4 ) | ( FUA << 3 ) | ( FUA_NV << 1 ),
-								( LOGICAL_BLOCK_ADDRESS >> 24 ) & 0xFF,
-								( LOGICAL_BLOCK_ADDRESS >> 16 ) & 0xFF,
-								( LOGICAL_BLOCK_ADDRESS >> 8  ) & 0xFF,
-								  LOGICAL_BLOCK_ADDRESS			& 0xFF,
-								( TRANSFER_LENGTH >> 24 ) 		& 0xFF,
-								( TRANSFER_LENGTH >> 16 ) 		& 0xFF,
-								( TRANSFER_LENGTH >> 8  ) 		& 0xFF,
-								  TRANSFER_LENGTH				& 0xFF,
-								GROUP_NUMBER,
-								CONTROL );
+	SetCommandDescriptorBlock ( request, cdb.GetCommandDescriptorBlock ( ), cdb.GetSize ( ) );
 	
 	SetDataTransferDirection ( 	request, kSCSIDataTransfer_FromTargetToInitiator );
 	SetTimeoutDuration ( request, 0 );
@@ -921,6 +904,7 @@ IOSCSIBlockCommandsDevice::READ_16 (
 
 	bool		status = false;
 	UInt64 		requestedByteCount	= 0;
+	SCSICDBBuilder < SCSICDB_READ_16 >	cdb;
 	
 	require_nonzero ( request, ErrorExit );
 	require ( ResetForNewTask ( request ), ErrorExit );
@@ -930,35 +914,20 @@ IOSCSIBlockCommandsDevice::READ_16 (
 
 	requestedByteCount = TRANSFER_LENGTH * blockSize;
 	
-	// Do the pre-flight check on the passed in parameters
-	require ( IsParameterValid ( RDPROTECT, kSCSICmdFieldMask3Bit ), ErrorExit );
-	require ( IsParameterValid ( DPO, kSCSICmdFieldMask1Bit ), ErrorExit );
-	require ( IsParameterValid ( FUA, kSCSICmdFieldMask1Bit ), ErrorExit );
-	require ( IsParameterValid ( FUA_NV, kSCSICmdFieldMask1Bit ), ErrorExit );
-	require ( IsParameterValid ( LOGICAL_BLOCK_ADDRESS, kSCSICmdFieldMask8Byte ), ErrorExit );
-	require ( IsParameterValid ( TRANSFER_LENGTH, kSCSICmdFieldMask4Byte ), ErrorExit );
-	require ( IsParameterValid ( GROUP_NUMBER, kSCSICmdFieldMask5Bit ), ErrorExit );
-	require ( IsParameterValid ( CONTROL, kSCSICmdFieldMask1Byte ), ErrorExit );
+	// Pack the CDB. Only the bit fields can be out of range; the rest
+	// are checked at compile time.
+	cdb.Set < SCSICDB_READ_16::PROTECT > ( RDPROTECT );
+	cdb.Set < SCSICDB_READ_16::DPO > ( DPO );
+	cdb.Set < SCSICDB_READ_16::FUA > ( FUA );
+	cdb.Set < SCSICDB_READ_16::FUA_NV > ( FUA_NV );
+	cdb.Set < SCSICDB_READ_16::LOGICAL_BLOCK_ADDRESS > ( LOGICAL_BLOCK_ADDRESS );
+	cdb.Set < SCSICDB_READ_16::TRANSFER_LENGTH > ( TRANSFER_LENGTH );
+	cdb.Set < SCSICDB_READ_16::GROUP_NUMBER > ( GROUP_NUMBER );
+	cdb.Set < SCSICDB_READ_16::CONTROL > ( CONTROL );
+	require ( cdb.IsValid ( ), ErrorExit );
 	require ( IsMemoryDescriptorValid ( dataBuffer, requestedByteCount ), ErrorExit );
 	
-	// This is a 16-Byte command, fill out the cdb appropriately
-	SetCommandDescriptorBlock ( request,
-								kSCSICmd_READ_16,
-								( RDPROTECT << 5 ) | ( DPO << 4 ) | ( FUA << 3 ) | ( FUA_NV << 1 ),
-								( LOGICAL_BLOCK_ADDRESS >> 56 ) & 0xFF,
-								( LOGICAL_BLOCK_ADDRESS >> 48 ) & 0xFF,
-								( LOGICAL_BLOCK_ADDRESS >> 40 ) & 0xFF,
-								( LOGICAL_BLOCK_ADDRESS >> 32 ) & 0xFF,
-								( LOGICAL_BLOCK_ADDRESS >> 24 ) & 0xFF,
-								( LOGICAL_BLOCK_ADDRESS >> 16 ) & 0xFF,
-								( LOGICAL_BLOCK_ADDRESS >> 8 ) & 0xFF,
-								LOGICAL_BLOCK_ADDRESS & 0xFF,
-								( TRANSFER_LENGTH >> 24 ) & 0xFF,
-								( TRANSFER_LENGTH >> 16 ) & 0xFF,
-								( TRANSFER_LENGTH >> 8 ) & 0xFF,
-								TRANSFER_LENGTH & 0xFF,
-								GROUP_NUMBER,
-								CONTROL );
+	SetCommandDescriptorBlock ( request, cdb.GetCommandDescriptorBlock ( ), cdb.GetSize ( ) );
 								
 	SetDataTransferDirection ( 	request, kSCSIDataTransfer_FromTargetToInitiator );
 	SetTimeoutDuration ( request, 0 );
@@ -992,7 +961,7 @@ IOSCSIBlockCommandsDevice::READ_CAPACITY (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -1089,7 +1058,7 @@ IOSCSIBlockCommandsDevice::READ_DEFECT_DATA_10 (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -1129,7 +1098,7 @@ IOSCSIBlockCommandsDevice::READ_DEFECT_DATA_12 (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -1168,7 +1137,7 @@ IOSCSIBlockCommandsDevice::READ_GENERATION (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -1207,7 +1176,7 @@ IOSCSIBlockCommandsDevice::READ_LONG (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -1308,7 +1277,7 @@ IOSCSIBlockCommandsDevice::READ_UPDATED_BLOCK_10 (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -1347,7 +1316,7 @@ IOSCSIBlockCommandsDevice::REASSIGN_BLOCKS (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -1433,7 +1402,7 @@ IOSCSIBlockCommandsDevice::REBUILD (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -1479,7 +1448,7 @@ IOSCSIBlockCommandsDevice::REGENERATE (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -1517,7 +1486,7 @@ IOSCSIBlockCommandsDevice::REZERO_UNIT (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -1553,7 +1522,7 @@ IOSCSIBlockCommandsDevice::SEARCH_DATA_EQUAL_10 (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -1596,7 +1565,7 @@ IOSCSIBlockCommandsDevice::SEARCH_DATA_HIGH_10 (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -1639,7 +1608,7 @@ IOSCSIBlockCommandsDevice::SEARCH_DATA_LOW_10 (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -1677,7 +1646,7 @@ IOSCSIBlockCommandsDevice::SEEK_6 (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -1709,7 +1678,7 @@ IOSCSIBlockCommandsDevice::SEEK_10 (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -1744,7 +1713,7 @@ IOSCSIBlockCommandsDevice::SET_LIMITS_10 (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -1782,7 +1751,7 @@ IOSCSIBlockCommandsDevice::SET_LIMITS_12 (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -1820,7 +1789,7 @@ IOSCSIBlockCommandsDevice::START_STOP_UNIT (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -1858,7 +1827,7 @@ IOSCSIBlockCommandsDevice::SYNCHRONIZE_CACHE (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -2011,7 +1980,7 @@ IOSCSIBlockCommandsDevice::UPDATE_BLOCK (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -2051,7 +2020,7 @@ IOSCSIBlockCommandsDevice::VERIFY_10 (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -2152,7 +2121,7 @@ IOSCSIBlockCommandsDevice::VERIFY_12 (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -2316,7 +2285,7 @@ IOSCSIBlockCommandsDevice::WRITE_6 (
 	bool		status 				= false;
 	UInt32 		requestedByteCount	= 0;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -2377,7 +2346,7 @@ IOSCSIBlockCommandsDevice::WRITE_10 (
 	bool		status 				= false;
 	UInt64 		requestedByteCount	= 0;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -2429,6 +2398,7 @@ IOSCSIBlockCommandsDevice::WRITE_10 (
 
 	bool		status 				= false;
 	UInt64 		requestedByteCount	= 0;
+	SCSICDBBuilder < SCSICDB_WRITE_10 >	cdb;
 	
 	require_nonzero ( request, ErrorExit );
 	require ( ResetForNewTask ( request ), ErrorExit );
@@ -2438,29 +2408,20 @@ IOSCSIBlockCommandsDevice::WRITE_10 (
 	
 	requestedByteCount = TRANSFER_LENGTH * blockSize;
 	
-	// Do the pre-flight check on the passed in parameters
-	require ( IsParameterValid ( WRPROTECT, kSCSICmdFieldMask3Bit ), ErrorExit );
-	require ( IsParameterValid ( DPO, kSCSICmdFieldMask1Bit ), ErrorExit );
-	require ( IsParameterValid ( FUA, kSCSICmdFieldMask1Bit ), ErrorExit );
-	require ( IsParameterValid ( FUA_NV, kSCSICmdFieldMask1Bit ), ErrorExit );
-	require ( IsParameterValid ( LOGICAL_BLOCK_ADDRESS, kSCSICmdFieldMask4Byte ), ErrorExit );
-	require ( IsParameterValid ( GROUP_NUMBER, kSCSICmdFieldMask5Bit ), ErrorExit );
-	require ( IsParameterValid ( TRANSFER_LENGTH, kSCSICmdFieldMask2Byte ), ErrorExit );
-	require ( IsParameterValid ( CONTROL, kSCSICmdFieldMask1Byte ), ErrorExit );
+	// Pack the CDB. Only the bit fields can be out of range; the rest
+	// are checked at compile time.
+	cdb.Set < SCSICDB_WRITE_10::PROTECT > ( WRPROTECT );
+	cdb.Set < SCSICDB_WRITE_10::DPO > ( DPO );
+	cdb.Set < SCSICDB_WRITE_10::FUA > ( FUA );
+	cdb.Set < SCSICDB_WRITE_10::FUA_NV > ( FUA_NV );
+	cdb.Set < SCSICDB_WRITE_10::LOGICAL_BLOCK_ADDRESS > ( LOGICAL_BLOCK_ADDRESS );
+	cdb.Set < SCSICDB_WRITE_10::GROUP_NUMBER > ( GROUP_NUMBER );
+	cdb.Set < SCSICDB_WRITE_10::TRANSFER_LENGTH > ( TRANSFER_LENGTH );
+	cdb.Set < SCSICDB_WRITE_10::CONTROL > ( CONTROL );
+	require ( cdb.IsValid ( ), ErrorExit );
 	require ( IsMemoryDescriptorValid ( dataBuffer, requestedByteCount ), ErrorExit );
 	
-	// This is a 10-Byte command, fill out the cdb appropriately  
-	SetCommandDescriptorBlock (	request,
-								kSCSICmd_WRITE_10,
-								( WRPROTECT << 5 ) | ( DPO << 4 ) | ( FUA << 3 ) | ( FUA_NV << 1 ),
-								( LOGICAL_BLOCK_ADDRESS >> 24 ) & 0xFF,
-								( LOGICAL_BLOCK_ADDRESS >> 16 ) & 0xFF,
-								( LOGICAL_BLOCK_ADDRESS >> 8  ) & 0xFF,
-								  LOGICAL_BLOCK_ADDRESS			& 0xFF,
-								GROUP_NUMBER,
-								( TRANSFER_LENGTH >> 8 ) & 0xFF,
-								  TRANSFER_LENGTH		 & 0xFF,
-								CONTROL );
+	SetCommandDescriptorBlock ( request, cdb.GetCommandDescriptorBlock ( ), cdb.GetSize ( ) );
 	
 	SetDataTransferDirection ( 	request, kSCSIDataTransfer_FromInitiatorToTarget );
 	SetTimeoutDuration ( request, 0 );
@@ -2501,7 +2462,7 @@ IOSCSIBlockCommandsDevice::WRITE_12 (
 	bool		status 				= false;
 	UInt64 		requestedByteCount	= 0;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -2553,6 +2514,7 @@ IOSCSIBlockCommandsDevice::WRITE_12 (
 
 	bool		status 				= false;
 	UInt64 		requestedByteCount	= 0;
+	SCSICDBBuilder < SCSICDB_WRITE_12 >	cdb;
 	
 	require_nonzero ( request, ErrorExit );
 	require ( ResetForNewTask ( request ), ErrorExit );
@@ -2562,31 +2524,20 @@ IOSCSIBlockCommandsDevice::WRITE_12 (
 	
 	requestedByteCount = TRANSFER_LENGTH * blockSize;
 
-	// Do the pre-flight check on the passed in parameters
-	require ( IsParameterValid ( WRPROTECT, kSCSICmdFieldMask3Bit ), ErrorExit );
-	require ( IsParameterValid ( DPO, kSCSICmdFieldMask1Bit ), ErrorExit );
-	require ( IsParameterValid ( FUA, kSCSICmdFieldMask1Bit ), ErrorExit );
-	require ( IsParameterValid ( FUA_NV, kSCSICmdFieldMask1Bit ), ErrorExit );
-	require ( IsParameterValid ( LOGICAL_BLOCK_ADDRESS, kSCSICmdFieldMask4Byte ), ErrorExit );
-	require ( IsParameterValid ( TRANSFER_LENGTH, kSCSICmdFieldMask4Byte ), ErrorExit );
-	require ( IsParameterValid ( CONTROL, kSCSICmdFieldMask1Byte ), ErrorExit );
-	require ( IsParameterValid ( GROUP_NUMBER, kSCSICmdFieldMask5Bit ), ErrorExit );
+	// Pack the CDB. Only the bit fields can be out of range; the rest
+	// are checked at compile time.
+	cdb.Set < SCSICDB_WRITE_12::PROTECT > ( WRPROTECT );
+	cdb.Set < SCSICDB_WRITE_12::DPO > ( DPO );
+	cdb.Set < SCSICDB_WRITE_12::FUA > ( FUA );
+	cdb.Set < SCSICDB_WRITE_12::FUA_NV > ( FUA_NV );
+	cdb.Set < SCSICDB_WRITE_12::LOGICAL_BLOCK_ADDRESS > ( LOGICAL_BLOCK_ADDRESS );
+	cdb.Set < SCSICDB_WRITE_12::TRANSFER_LENGTH > ( TRANSFER_LENGTH );
+	cdb.Set < SCSICDB_WRITE_12::CONTROL > ( CONTROL );
+	cdb.Set < SCSICDB_WRITE_12::GROUP_NUMBER > ( GROUP_NUMBER );
+	require ( cdb.IsValid ( ), ErrorExit );
 	require ( IsMemoryDescriptorValid ( dataBuffer, requestedByteCount ), ErrorExit );
 	
-	// This is a 12-Byte command, fill out the cdb appropriately  
-	SetCommandDescriptorBlock (	request,
-								kSCSICmd_WRITE_12,
-								( WRPROTECT << 5 ) | ( DPO << 4 ) | ( FUA << 3 ) | ( FUA_NV << 1 ),
-								( LOGICAL_BLOCK_ADDRESS >> 24 ) & 0xFF,
-								( LOGICAL_BLOCK_ADDRESS >> 16 ) & 0xFF,
-								( LOGICAL_BLOCK_ADDRESS >> 8  ) & 0xFF,
-								  LOGICAL_BLOCK_ADDRESS			& 0xFF,
-								( TRANSFER_LENGTH >> 24 )		& 0xFF,
-								( TRANSFER_LENGTH >> 16 )		& 0xFF,
-								( TRANSFER_LENGTH >>  8 )		& 0xFF,
-								  TRANSFER_LENGTH				& 0xFF,
-								GROUP_NUMBER,
-								CONTROL );
+	SetCommandDescriptorBlock ( request, cdb.GetCommandDescriptorBlock ( ), cdb.GetSize ( ) );
 	
 	SetDataTransferDirection ( 	request, kSCSIDataTransfer_FromInitiatorToTarget );
 	SetTimeoutDuration ( request, 0 );
@@ -2626,6 +2577,7 @@ IOSCSIBlockCommandsDevice::WRITE_16 (
 
 	bool		status 				= false;
 	UInt64 		requestedByteCount	= 0;
+	SCSICDBBuilder < SCSICDB_WRITE_16 >	cdb;
 	
 	require_nonzero ( request, ErrorExit );
 	require ( ResetForNewTask ( request ), ErrorExit );
@@ -2635,35 +2587,20 @@ IOSCSIBlockCommandsDevice::WRITE_16 (
 	
 	requestedByteCount = TRANSFER_LENGTH * blockSize;
 
-	// Do the pre-flight check on the passed in parameters
-	require ( IsParameterValid ( WRPROTECT, kSCSICmdFieldMask3Bit ), ErrorExit );
-	require ( IsParameterValid ( DPO, kSCSICmdFieldMask1Bit ), ErrorExit );
-	require ( IsParameterValid ( FUA, kSCSICmdFieldMask1Bit ), ErrorExit );
-	require ( IsParameterValid ( FUA_NV, kSCSICmdFieldMask1Bit ), ErrorExit );
-	require ( IsParameterValid ( LOGICAL_BLOCK_ADDRESS, kSCSICmdFieldMask8Byte ), ErrorExit );
-	require ( IsParameterValid ( TRANSFER_LENGTH, kSCSICmdFieldMask4Byte ), ErrorExit );
-	require ( IsParameterValid ( GROUP_NUMBER, kSCSICmdFieldMask5Bit ), ErrorExit );
-	require ( IsParameterValid ( CONTROL, kSCSICmdFieldMask1Byte ), ErrorExit );
+	// Pack the CDB. Only the bit fields can be out of range; the rest
+	// are checked at compile time.
+	cdb.Set < SCSICDB_WRITE_16::PROTECT > ( WRPROTECT );
+	cdb.Set < SCSICDB_WRITE_16::DPO > ( DPO );
+	cdb.Set < SCSICDB_WRITE_16::FUA > ( FUA );
+	cdb.Set < SCSICDB_WRITE_16::FUA_NV > ( FUA_NV );
+	cdb.Set < SCSICDB_WRITE_16::LOGICAL_BLOCK_ADDRESS > ( LOGICAL_BLOCK_ADDRESS );
+	cdb.Set < SCSICDB_WRITE_16::TRANSFER_LENGTH > ( TRANSFER_LENGTH );
+	cdb.Set < SCSICDB_WRITE_16::GROUP_NUMBER > ( GROUP_NUMBER );
+	cdb.Set < SCSICDB_WRITE_16::CONTROL > ( CONTROL );
+	require ( cdb.IsValid ( ), ErrorExit );
 	require ( IsMemoryDescriptorValid ( dataBuffer, requestedByteCount ), ErrorExit );
 	
-	// This is a 16-Byte command, fill out the cdb appropriately
-	SetCommandDescriptorBlock ( request,
-								kSCSICmd_WRITE_16,
-								( WRPROTECT << 5 ) | ( DPO << 4 ) | ( FUA << 3 ) | ( FUA_NV << 1 ),
-								( LOGICAL_BLOCK_ADDRESS >> 56 ) & 0xFF,
-								( LOGICAL_BLOCK_ADDRESS >> 48 ) & 0xFF,
-								( LOGICAL_BLOCK_ADDRESS >> 40 ) & 0xFF,
-								( LOGICAL_BLOCK_ADDRESS >> 32 ) & 0xFF,
-								( LOGICAL_BLOCK_ADDRESS >> 24 ) & 0xFF,
-								( LOGICAL_BLOCK_ADDRESS >> 16 ) & 0xFF,
-								( LOGICAL_BLOCK_ADDRESS >> 8 ) & 0xFF,
-								LOGICAL_BLOCK_ADDRESS & 0xFF,
-								( TRANSFER_LENGTH >> 24 ) & 0xFF,
-								( TRANSFER_LENGTH >> 16 ) & 0xFF,
-								( TRANSFER_LENGTH >> 8 ) & 0xFF,
-								TRANSFER_LENGTH & 0xFF,
-								GROUP_NUMBER,
-								CONTROL );
+	SetCommandDescriptorBlock ( request, cdb.GetCommandDescriptorBlock ( ), cdb.GetSize ( ) );
 	
 	SetDataTransferDirection ( 	request, kSCSIDataTransfer_FromInitiatorToTarget );
 	SetTimeoutDuration ( request, 0 );
@@ -2702,7 +2639,7 @@ IOSCSIBlockCommandsDevice::WRITE_AND_VERIFY_10 (
 	bool		status 				= false;
 	UInt64 		requestedByteCount	= 0;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -2823,7 +2760,7 @@ IOSCSIBlockCommandsDevice::WRITE_AND_VERIFY_12 (
 	bool		status 				= false;
 	UInt64 		requestedByteCount	= 0;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -3014,7 +2951,7 @@ IOSCSIBlockCommandsDevice::WRITE_LONG (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -3116,7 +3053,7 @@ IOSCSIBlockCommandsDevice::WRITE_SAME (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -3290,7 +3227,7 @@ IOSCSIBlockCommandsDevice::XDREAD (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -3387,7 +3324,7 @@ IOSCSIBlockCommandsDevice::XDWRITE (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -3500,7 +3437,7 @@ IOSCSIBlockCommandsDevice::XDWRITE_EXTENDED (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -3612,7 +3549,7 @@ IOSCSIBlockCommandsDevice::XPWRITE (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -42,6 +42,7 @@
 // SCSI Architecture Model Family includes
 #include "IOSCSIBlockCommandsDevice.h"
 #include "SCSIBlockCommands.h"
+#include "SCSICommandDescriptorBlockLayout.h"
 
 #include <IOKit/scsi/SCSICommandDefinitions.h>
 #include <IOKit/scsi/SCSICmds_MODE_Definitions.h>
@@ -100,6 +101,16 @@ OSDefineAbstractStructors ( IOSCSIBlockCommandsDevice, IOSCSIPrimaryCommandsDevi
 #define kUSBHDIconKey						"USBHD.icns"
 #define	kDefaultMaxBlocksPerIO				65535
 
+// Readiness polling. A unit that reports it is becoming ready is polled
+// again after kReadyPollMinimumIntervalMS, and the interval doubles up to
+// kReadyPollMaximumIntervalMS, so fast units are picked up within a few
+// milliseconds while slow ones are not flooded with TEST_UNIT_READY.
+#define kReadyPollMinimumIntervalMS			10
+#define kReadyPollMaximumIntervalMS			200
+
+// How long to wait for the medium to be reported present on wake.
+#define kMediumPresenceTimeoutMS			20000
+
 
 #if 0
 #pragma mark -
@@ -734,6 +745,8 @@ void
 IOSCSIBlockCommandsDevice::StartDeviceSupport ( void )
 {
 	
+	InitializeReadWriteTaskTemplates ( &IOSCSIBlockCommandsDevice::AsyncReadWriteComplete );
+	
 	// Start polling
 	EnablePolling ( );
 	
@@ -864,6 +877,14 @@ IOSCSIBlockCommandsDevice::FreeCommandSetObjects ( void )
 	if ( fIOSCSIBlockCommandsDeviceReserved != NULL )
 	{
 		
+		if ( fResumeStatistics != NULL )
+		{
+			
+			fResumeStatistics->release ( );
+			fResumeStatistics = NULL;
+			
+		}
+		
 		IODelete ( fIOSCSIBlockCommandsDeviceReserved, IOSCSIBlockCommandsDeviceExpansionData, 1 );
 		fIOSCSIBlockCommandsDeviceReserved = NULL;
 		
@@ -915,6 +936,7 @@ IOSCSIBlockCommandsDevice::ClearNotReadyStatus ( void )
 	SCSITaskIdentifier			request			= NULL;
 	bool						driveReady 		= false;
 	bool						result 			= true;
+	UInt32						pollInterval	= kReadyPollMinimumIntervalMS;
 	
 	STATUS_LOG ( ( "%s::%s called\n", getName ( ), __FUNCTION__ ) );
 	
@@ -971,22 +993,24 @@ IOSCSIBlockCommandsDevice::ClearNotReadyStatus ( void )
 				if ( validSense == true )
 				{
 					
-					if ( ( ( senseBuffer.SENSE_KEY & kSENSE_KEY_Mask ) == kSENSE_KEY_NOT_READY ) &&
-								( senseBuffer.ADDITIONAL_SENSE_CODE == 0x04 ) &&
-							( senseBuffer.ADDITIONAL_SENSE_CODE_QUALIFIER == 0x01 ) )
+					SCSISenseCategory	category = ClassifySenseData ( &senseBuffer );
+					
+					if ( category == kSCSISenseCategory_BecomingReady )
 					{
 						
 						STATUS_LOG ( ( "%s::drive not ready\n", getName ( ) ) );
 						driveReady = false;
-						IOSleep ( 200 );
+						
+						// The unit is spinning up. Poll again as soon as it is
+						// likely to be ready rather than after a fixed delay.
+						IOSleep ( pollInterval );
+						fResumeReadyPolls++;
+						
+						pollInterval = min ( pollInterval * 2, kReadyPollMaximumIntervalMS );
 						
 					}
 					
-					else if ( ( ( senseBuffer.SENSE_KEY & kSENSE_KEY_Mask ) == kSENSE_KEY_NOT_READY  ) &&
-							( senseBuffer.ADDITIONAL_SENSE_CODE == 0x04 ) &&
-							( ( senseBuffer.ADDITIONAL_SENSE_CODE_QUALIFIER == 0x00 ) ||
-							  ( senseBuffer.ADDITIONAL_SENSE_CODE_QUALIFIER == 0x02 ) ||
-							  ( senseBuffer.ADDITIONAL_SENSE_CODE_QUALIFIER == 0x03 ) ) )
+					else if ( category == kSCSISenseCategory_NeedsStart )
 					{
 						
 						// The drive needs to be spun up. Issue a START_STOP_UNIT to it.
@@ -1050,6 +1074,50 @@ IOSCSIBlockCommandsDevice::ClearNotReadyStatus ( void )
 }
 
 
+//
+//	 WaitForMediumPresence - Waits for the medium to be reported present
+//								after a wake.						[PRIVATE]
+//
+
+bool
+IOSCSIBlockCommandsDevice::WaitForMediumPresence ( void )
+{
+	
+	UInt64		deadline		= 0;
+	UInt64		now				= 0;
+	UInt32		pollInterval	= kReadyPollMinimumIntervalMS;
+	bool		mediaPresent	= false;
+	
+	clock_interval_to_deadline ( kMediumPresenceTimeoutMS, kMillisecondScale, &deadline );
+	
+	// Give the driver some lee-way in waking up because we think media is
+	// actually there. Return as soon as the unit says so instead of sleeping
+	// a fixed interval between checks.
+	while ( isInactive ( ) == false )
+	{
+		
+		STATUS_LOG ( ( "Calling VerifyMediumPresence\n" ) );
+		
+		mediaPresent = VerifyMediumPresence ( );
+		fResumeReadyPolls++;
+		
+		if ( mediaPresent == true )
+			break;
+		
+		clock_get_uptime ( &now );
+		if ( now >= deadline )
+			break;
+		
+		IOSleep ( pollInterval );
+		pollInterval = min ( pollInterval * 2, kReadyPollMaximumIntervalMS );
+		
+	}
+	
+	return mediaPresent;
+	
+}
+
+
 //
 //	 EnablePolling - Schedules the polling thread to run			[PROTECTED]
 //
@@ -1058,8 +1126,6 @@ void
 IOSCSIBlockCommandsDevice::EnablePolling ( void )
 {		
 	
-	AbsoluteTime	time;
-	
 	// No reason to start a thread if we've been terminatated
 	require ( ( isInactive ( ) == false ), Exit );
 	require ( fPollingThread, Exit );
@@ -1070,8 +1136,15 @@ IOSCSIBlockCommandsDevice::EnablePolling ( void )
 	
 	retain ( );
 	
-	clock_interval_to_deadline ( 1000, kMillisecondScale, &time );
-	thread_call_enter_delayed ( fPollingThread, time );
+	// The shared media poll scheduler enters fPollingThread once the poll
+	// interval for this logical unit has passed.
+	if ( ScheduleMediaPoll ( fPollingThread ) == false )
+	{
+		
+		// A poll is already scheduled and holds its own retain.
+		release ( );
+		
+	}
 	
 	
 Exit:
@@ -1093,8 +1166,8 @@ IOSCSIBlockCommandsDevice::DisablePolling ( void )
 	
 	fPollingMode = kPollingMode_Suspended;
 	
-	// Cancel the thread if it is scheduled to run
-	require ( thread_call_cancel ( fPollingThread ), Exit );
+	// Cancel the poll if it is scheduled to run
+	require ( CancelMediaPoll ( fPollingThread ), Exit );
 	
 	// It was running, so we balance out the retain()
 	// with a release()
@@ -2733,6 +2806,7 @@ IOSCSIBlockCommandsDevice::PollForMediaRemoval ( void )
 			bool						validSense 	= false;
 			SCSI_Sense_Data				senseBuffer	= { 0 };
 			IOMemoryDescriptor *		bufferDesc	= NULL;
+			SCSISenseCategory			category	= kSCSISenseCategory_Other;
 			
 			validSense = GetAutoSenseData ( request, &senseBuffer );
 			if ( validSense == false )
@@ -2759,11 +2833,11 @@ IOSCSIBlockCommandsDevice::PollForMediaRemoval ( void )
 				
 			}
 			
-			// Check the sense data to see if media is no longer present ( ASC == 0x3A )
-			// or if media has changed ( ASC==0x28, ASCQ==0x00 )
-			if ( ( senseBuffer.ADDITIONAL_SENSE_CODE == 0x3A ) ||
-			   ( ( senseBuffer.ADDITIONAL_SENSE_CODE == 0x28 ) &&
-				 ( senseBuffer.ADDITIONAL_SENSE_CODE_QUALIFIER == 0x00 ) ) )
+			// Check the sense data to see if media is no longer present
+			// or if media has changed.
+			category = ClassifySenseData ( &senseBuffer );
+			if ( ( category == kSCSISenseCategory_MediumNotPresent ) ||
+				 ( category == kSCSISenseCategory_MediumChanged ) )
 			{
 				
 				ERROR_LOG ( ( "Media was removed. Tearing down the media object." ) );
@@ -2827,77 +2901,60 @@ IOSCSIBlockCommandsDevice::IssueRead (
 							void *					clientData )
 {
 	
-	IOReturn 				status		= kIOReturnNoResources;
-	SCSITaskIdentifier		request		= NULL;
-	bool					cmdStatus   = false;
+	IOReturn 				status				= kIOReturnBadArgument;
+	SCSITaskIdentifier		request				= NULL;
+	UInt64					requestedByteCount	= blockCount * fMediumBlockSize;
 	
-	request = GetSCSITask ( );
-	require_nonzero ( request, ErrorExit );
+	require_nonzero ( fMediumBlockSize, ErrorExit );
+	require ( IsMemoryDescriptorValid ( buffer, requestedByteCount ), ErrorExit );
 	
+	// The transfer length must fit the CDB, or the device would be asked
+	// for fewer blocks than the buffer is set up for.
 	if ( startBlock > kREPORT_CAPACITY_MaximumLBA )
 	{
-
-		cmdStatus = READ_16 ( request,
-					buffer,
-					fMediumBlockSize,
-					0,
-					0,
-					0,
-					0,
-					( SCSICmdField8Byte ) startBlock,
-					( SCSICmdField4Byte ) blockCount,
-					0,
-					0 );
-								
+		require ( ( blockCount <= kSCSICmdFieldMask4Byte ), ErrorExit );
 	}
 	
 	else
 	{
-
-		cmdStatus = READ_10 ( request,
-					buffer,
-					fMediumBlockSize,
-					0,
-					0,
-					0,
-					( SCSICmdField4Byte ) startBlock,
-					( SCSICmdField2Byte ) blockCount,
-					0 );
-
+		require ( ( blockCount <= kSCSICmdFieldMask2Byte ), ErrorExit );
 	}
 	
-	if ( cmdStatus == true )
+	request = GetSCSITask ( );
+	require_action ( ( request != NULL ), ErrorExit, status = kIOReturnNoResources );
+	
+	// Only the CDB, buffer, transfer count and tag change from one read to
+	// the next. Everything else comes from the read task template.
+	if ( startBlock > kREPORT_CAPACITY_MaximumLBA )
 	{
 		
-		// The command was successfully built, now send it
-		SetApplicationLayerReference ( request, clientData );
-		
-		// Tag the command if requested
-		if ( GetCMDQUE ( ) == true )
-		{
-			
-			SetTaskAttribute ( request, kSCSITask_SIMPLE );
-			SetTaggedTaskIdentifier ( request, GetUniqueTagID ( ) );
-			
-		}
-
-		SendCommand ( request,
-					  fReadTimeoutDuration,
-					  &IOSCSIBlockCommandsDevice::AsyncReadWriteComplete );
+		SCSICDBBuilder < SCSICDB_READ_16 >	cdb;
 		
-		status = kIOReturnSuccess;
+		cdb.Set < SCSICDB_READ_16::LOGICAL_BLOCK_ADDRESS > ( ( SCSICmdField8Byte ) startBlock );
+		cdb.Set < SCSICDB_READ_16::TRANSFER_LENGTH > ( ( SCSICmdField4Byte ) blockCount );
+		SetCommandDescriptorBlock ( request, cdb.GetCommandDescriptorBlock ( ), cdb.GetSize ( ) );
 		
 	}
 	
 	else
 	{
 		
-		ReleaseSCSITask ( request );
-		request	= NULL;
-		status	= kIOReturnBadArgument;
+		SCSICDBBuilder < SCSICDB_READ_10 >	cdb;
+		
+		cdb.Set < SCSICDB_READ_10::LOGICAL_BLOCK_ADDRESS > ( ( SCSICmdField4Byte ) startBlock );
+		cdb.Set < SCSICDB_READ_10::TRANSFER_LENGTH > ( ( SCSICmdField2Byte ) blockCount );
+		SetCommandDescriptorBlock ( request, cdb.GetCommandDescriptorBlock ( ), cdb.GetSize ( ) );
 		
 	}
-
+	
+	SetDataBuffer ( request, buffer );
+	SetRequestedDataTransferCount ( request, requestedByteCount );
+	SetApplicationLayerReference ( request, clientData );
+	
+	SendTemplatedCommand ( request, &fReadTaskTemplate );
+	status = kIOReturnSuccess;
+	
+	
 ErrorExit:
 	
 	
@@ -2930,77 +2987,58 @@ IOSCSIBlockCommandsDevice::IssueWrite (
 						UInt64					blockCount,
 						void *					clientData )
 {
-	IOReturn				status		= kIOReturnNoResources;
-	SCSITaskIdentifier		request		= NULL;
-	bool					cmdStatus   = false;
+	IOReturn 				status				= kIOReturnBadArgument;
+	SCSITaskIdentifier		request				= NULL;
+	UInt64					requestedByteCount	= blockCount * fMediumBlockSize;
 	
-	request = GetSCSITask ( );
-	require_nonzero ( request, ErrorExit );
+	require_nonzero ( fMediumBlockSize, ErrorExit );
+	require ( IsMemoryDescriptorValid ( buffer, requestedByteCount ), ErrorExit );
 	
+	// The transfer length must fit the CDB, or the device would be asked
+	// for fewer blocks than the buffer is set up for.
 	if ( startBlock > kREPORT_CAPACITY_MaximumLBA )
 	{
-		
-		cmdStatus = WRITE_16 ( request,
-					buffer,
-					fMediumBlockSize,
-					0,
-					0,
-					0,
-					0,
-					( SCSICmdField8Byte ) startBlock,
-					( SCSICmdField4Byte ) blockCount,
-					0,
-					0 );
-		
-	}	
+		require ( ( blockCount <= kSCSICmdFieldMask4Byte ), ErrorExit );
+	}
 	
 	else
 	{
-
-		cmdStatus = WRITE_10 ( request,
-					buffer,
-					fMediumBlockSize,
-					0,
-					0,
-					0,
-					0,
-					( SCSICmdField4Byte ) startBlock,
-					( SCSICmdField2Byte ) blockCount,
-					0 );
-
+		require ( ( blockCount <= kSCSICmdFieldMask2Byte ), ErrorExit );
 	}
 	
-	if ( cmdStatus == true )
+	request = GetSCSITask ( );
+	require_action ( ( request != NULL ), ErrorExit, status = kIOReturnNoResources );
+	
+	// Only the CDB, buffer, transfer count and tag change from one write to
+	// the next. Everything else comes from the write task template.
+	if ( startBlock > kREPORT_CAPACITY_MaximumLBA )
 	{
 		
-		// The command was successfully built, now send it
-		SetApplicationLayerReference ( request, clientData );
-		
-		// Tag the command if requested
-		if ( GetCMDQUE ( ) == true )
-		{
-			
-			SetTaskAttribute ( request, kSCSITask_SIMPLE );
-			SetTaggedTaskIdentifier ( request, GetUniqueTagID ( ) );
-			
-		}
+		SCSICDBBuilder < SCSICDB_WRITE_16 >	cdb;
 		
-		SendCommand ( request,
-					  fWriteTimeoutDuration,
-					  &IOSCSIBlockCommandsDevice::AsyncReadWriteComplete );
-		
-		status = kIOReturnSuccess;
+		cdb.Set < SCSICDB_WRITE_16::LOGICAL_BLOCK_ADDRESS > ( ( SCSICmdField8Byte ) startBlock );
+		cdb.Set < SCSICDB_WRITE_16::TRANSFER_LENGTH > ( ( SCSICmdField4Byte ) blockCount );
+		SetCommandDescriptorBlock ( request, cdb.GetCommandDescriptorBlock ( ), cdb.GetSize ( ) );
 		
 	}
 	
 	else
 	{
 		
-		ReleaseSCSITask ( request );
-		request	= NULL;
-		status	= kIOReturnBadArgument;
+		SCSICDBBuilder < SCSICDB_WRITE_10 >	cdb;
+		
+		cdb.Set < SCSICDB_WRITE_10::LOGICAL_BLOCK_ADDRESS > ( ( SCSICmdField4Byte ) startBlock );
+		cdb.Set < SCSICDB_WRITE_10::TRANSFER_LENGTH > ( ( SCSICmdField2Byte ) blockCount );
+		SetCommandDescriptorBlock ( request, cdb.GetCommandDescriptorBlock ( ), cdb.GetSize ( ) );
 		
-	}	
+	}
+	
+	SetDataBuffer ( request, buffer );
+	SetRequestedDataTransferCount ( request, requestedByteCount );
+	SetApplicationLayerReference ( request, clientData );
+	
+	SendTemplatedCommand ( request, &fWriteTaskTemplate );
+	status = kIOReturnSuccess;
 	
 	
 ErrorExit:
@@ -3021,14 +3059,17 @@ IOSCSIBlockCommandsDevice::AsyncReadWriteCompletion (
 								SCSITaskIdentifier completedTask )
 {
 	
-	IOReturn	status		= kIOReturnSuccess;
-	UInt64		actCount	= 0;
-	void *		clientData	= NULL;
+	IOReturn			status		= kIOReturnSuccess;
+	UInt64				actCount	= 0;
+	void *				clientData	= NULL;
+	SCSITaskTimestamps	timestamps;
 	
 	// Extract the client data from the SCSITaskIdentifier
 	clientData = GetApplicationLayerReference ( completedTask );
 	require_nonzero ( clientData, ErrorExit );
 	
+	GetTaskTimestamps ( completedTask, &timestamps );
+	
 	if ( ( GetServiceResponse ( completedTask ) == kSCSIServiceResponse_TASK_COMPLETE ) &&
 		 ( GetTaskStatus ( completedTask ) == kSCSITaskStatus_GOOD ) )
 	{
@@ -3058,18 +3099,15 @@ IOSCSIBlockCommandsDevice::AsyncReadWriteCompletion (
 				if ( senseIsValid )
 				{
 					
+					// Counts the error against this unit and logs it, rate limited.
+					SCSISenseCategory	category = RecordSenseData ( &senseDataBuffer );
+					
 					// Check if this is a recovered error and the amount of data transferred
 					// was the amount requested. If so, don't treat those as hard errors.
-					if ( ( ( senseDataBuffer.SENSE_KEY & kSENSE_KEY_Mask ) == kSENSE_KEY_RECOVERED_ERROR ) &&
+					if ( ( category == kSCSISenseCategory_RecoveredError ) &&
 						 ( GetRequestedDataTransferCount ( completedTask ) == GetRealizedDataTransferCount ( completedTask ) ) )
 					{
 						
-						IOLog ( "READ or WRITE succeeded, but recoverable (soft) error occurred, SENSE_KEY = 0x%01x, ASC = 0x%02x, ASCQ = 0x%02x, LBA = 0x%08x\n",
-								senseDataBuffer.SENSE_KEY & kSENSE_KEY_Mask,
-								senseDataBuffer.ADDITIONAL_SENSE_CODE,
-								senseDataBuffer.ADDITIONAL_SENSE_CODE_QUALIFIER,
-								OSReadBigInt32 ( &senseDataBuffer.INFORMATION_1, 0 ) );
-						
 						status 		= kIOReturnSuccess;
 						actCount 	= GetRealizedDataTransferCount ( completedTask );
 						
@@ -3095,6 +3133,7 @@ IOSCSIBlockCommandsDevice::AsyncReadWriteCompletion (
 	IOBlockStorageServices::AsyncReadWriteComplete ( clientData, status, actCount );
 	
 	ReleaseSCSITask ( completedTask );	
+	RecordTaskLatency ( &timestamps );
 	
 	
 ErrorExit:
@@ -3149,13 +3188,24 @@ void
 IOSCSIBlockCommandsDevice::sProcessPoll ( void * pdtDriver, void * refCon )
 {
 	
-	IOSCSIBlockCommandsDevice *	driver = NULL;
+	IOSCSIBlockCommandsDevice *	driver		= NULL;
+	UInt64						startTime	= 0;
+	UInt32						pollingMode	= kPollingMode_Suspended;
 	
 	driver = ( IOSCSIBlockCommandsDevice * ) pdtDriver;
 	require_nonzero ( driver, ErrorExit );
 	
+	clock_get_uptime ( &startTime );
+	pollingMode = driver->fPollingMode;
+	
 	driver->ProcessPoll ( );
 	
+	// A poll which was waiting for media and still found none is idle, and
+	// lets the scheduler back off.
+	driver->RecordMediaPoll ( startTime,
+							  ( pollingMode == kPollingMode_NewMedia ) &&
+							  ( driver->fPollingMode == kPollingMode_NewMedia ) );
+	
 	if ( driver->fPollingMode != kPollingMode_Suspended )
 	{
 		
@@ -94,6 +94,9 @@ private:
 												 UInt8					modePageControlValue );
 
 	static void				AsyncReadWriteComplete ( SCSITaskIdentifier	completedTask );
+	
+	bool					WaitForMediumPresence ( void );
+	void					UpdateResumeStatistics ( UInt64 resumeTime );
 
 protected:
 
@@ -116,6 +119,15 @@ protected:
         UInt8               fLBPRZ;
 		bool				fUnmapAllowed;
         bool                fUseWriteSame;
+		
+		// Wake from sleep. fResumeReadyPolls counts the TEST_UNIT_READY
+		// polls issued while waiting for the unit to become ready during
+		// the resume in progress.
+		UInt32				fResumeCount;
+		UInt32				fResumeReadyPolls;
+		UInt64				fLastResumeTime;
+		UInt64				fMaximumResumeTime;
+		OSDictionary *		fResumeStatistics;
 	};
     IOSCSIBlockCommandsDeviceExpansionData * fIOSCSIBlockCommandsDeviceReserved;
 
@@ -127,6 +139,11 @@ protected:
     #define fLBPRZ                              fIOSCSIBlockCommandsDeviceReserved->fLBPRZ
 	#define fUnmapAllowed						fIOSCSIBlockCommandsDeviceReserved->fUnmapAllowed
     #define fUseWriteSame						fIOSCSIBlockCommandsDeviceReserved->fUseWriteSame
+	#define fResumeCount						fIOSCSIBlockCommandsDeviceReserved->fResumeCount
+	#define fResumeReadyPolls					fIOSCSIBlockCommandsDeviceReserved->fResumeReadyPolls
+	#define fLastResumeTime						fIOSCSIBlockCommandsDeviceReserved->fLastResumeTime
+	#define fMaximumResumeTime					fIOSCSIBlockCommandsDeviceReserved->fMaximumResumeTime
+	#define fResumeStatistics					fIOSCSIBlockCommandsDeviceReserved->fResumeStatistics
 
 	// The fDeviceIsShared is used to indicate whether this device exists on a Physical
 	// Interconnect that allows multiple initiators to access it.  This is used mainly
@@ -92,6 +92,18 @@ static IOPMPowerState sPowerStates[kSBCNumPowerStates] =
 	{ kIOPMPowerStateVersion1, (IOPMDeviceUsable | IOPMMaxPerformance | kIOPMPreventIdleSleep), IOPMPowerOn, IOPMPowerOn, 0, 0, 0, 0, 0, 0, 0, 0 }
 };
 
+#define kIOPropertyResumeStatisticsKey		"Resume Statistics"
+
+static const char * gResumeStatisticsKeys[] =
+{
+	"Resume Count",
+	"Last Resume Time",
+	"Maximum Resume Time",
+	"Ready Polls"
+};
+
+#define kResumeStatisticsCount	( sizeof ( gResumeStatisticsKeys ) / sizeof ( char * ) )
+
 
 // Static prototypes
 static IOReturn
@@ -222,6 +234,7 @@ IOSCSIBlockCommandsDevice::HandleCheckPowerState ( void )
 	if ( IsDeviceAccessEnabled ( ) )
 	{
 		
+		HandleWaitWhileQuiesced ( );
 		super::HandleCheckPowerState ( kSBCPowerStateActive );
 		
 	}
@@ -251,6 +264,78 @@ IOSCSIBlockCommandsDevice::TicklePowerManager ( void )
 }
 
 
+//
+//	 UpdateResumeStatistics - Publishes how long the last wake took.
+//																	[PRIVATE]
+//
+
+void
+IOSCSIBlockCommandsDevice::UpdateResumeStatistics ( UInt64 resumeTime )
+{
+	
+	OSNumber *	number	= NULL;
+	UInt64		values[kResumeStatisticsCount];
+	UInt32		index	= 0;
+	
+	STATUS_LOG ( ( "%s: resumed in %lld ms, %ld ready polls\n", getName ( ),
+					resumeTime, fResumeReadyPolls ) );
+	
+	fResumeCount++;
+	fLastResumeTime = resumeTime;
+	
+	if ( resumeTime > fMaximumResumeTime )
+		fMaximumResumeTime = resumeTime;
+	
+	if ( fResumeStatistics == NULL )
+	{
+		
+		fResumeStatistics = OSDictionary::withCapacity ( kResumeStatisticsCount );
+		require_nonzero ( fResumeStatistics, ErrorExit );
+		
+		for ( index = 0; index < kResumeStatisticsCount; index++ )
+		{
+			
+			number = OSNumber::withNumber ( 0ULL, 64 );
+			if ( number != NULL )
+			{
+				
+				fResumeStatistics->setObject ( gResumeStatisticsKeys[index], number );
+				number->release ( );
+				
+			}
+			
+		}
+		
+	}
+	
+	values[0] = fResumeCount;
+	values[1] = fLastResumeTime;
+	values[2] = fMaximumResumeTime;
+	values[3] = fResumeReadyPolls;
+	
+	for ( index = 0; index < kResumeStatisticsCount; index++ )
+	{
+		
+		number = OSDynamicCast ( OSNumber, fResumeStatistics->getObject ( gResumeStatisticsKeys[index] ) );
+		if ( number != NULL )
+			number->setValue ( values[index] );
+		
+	}
+	
+	if ( getProperty ( kIOPropertyResumeStatisticsKey ) == NULL )
+	{
+		setProperty ( kIOPropertyResumeStatisticsKey, fResumeStatistics );
+	}
+	
+	
+ErrorExit:
+	
+	
+	return;
+	
+}
+
+
 //
 //  HandlePowerChange - Handles the state machine for power management
 //																	[PROTECTED]
@@ -277,12 +362,24 @@ IOSCSIBlockCommandsDevice::HandlePowerChange ( void )
 			 ( fProposedPowerState > kSBCPowerStateSleep ) )
 		{
 			
+			UInt64	startTime	= 0;
+			UInt64	endTime		= 0;
+			UInt64	resumeTime	= 0;
+			
 			STATUS_LOG ( ( "We think we're in sleep\n" ) );
 			
+			clock_get_uptime ( &startTime );
+			fResumeReadyPolls = 0;
+			
 			if ( fDeviceIsShared == false )	
 			{		
 				
-				if ( START_STOP_UNIT ( request, 0x00, 0x00, 0x00, 0x01, 0x00 ) == true )
+				// Set the IMMED bit so the unit spins up while we clear the
+				// power-on reset and wait for it to report ready, instead of
+				// holding this thread for the whole spin-up. Other logical
+				// units resume on their own power management threads, so a
+				// target with many units spins them all up together.
+				if ( START_STOP_UNIT ( request, 0x01, 0x00, 0x00, 0x01, 0x00 ) == true )
 				{
 					
 					serviceResponse = SendCommand ( request, 0 );
@@ -321,20 +418,7 @@ IOSCSIBlockCommandsDevice::HandlePowerChange ( void )
 					
 					bool	mediaPresent = false;
 					
-					// Give the driver some lee-way in waking up because we think
-					// media is actually there!
-					for ( UInt32 index = 0; index < 100; index++ )
-					{
-						
-						STATUS_LOG ( ( "Calling VerifyMediumPresence\n" ) );
-						
-						mediaPresent = VerifyMediumPresence ( );
-						if ( mediaPresent )
-							break;
-						
-						IOSleep ( 200 );
-						
-					}
+					mediaPresent = WaitForMediumPresence ( );
 					
 					if ( mediaPresent != fMediumPresent )
 					{
@@ -369,6 +453,11 @@ IOSCSIBlockCommandsDevice::HandlePowerChange ( void )
 				
 			}
 			
+			clock_get_uptime ( &endTime );
+			absolutetime_to_nanoseconds ( endTime - startTime, &resumeTime );
+			
+			UpdateResumeStatistics ( resumeTime / kMillisecondScale );
+			
 		}
 		
 		switch ( fProposedPowerState )
@@ -395,15 +484,11 @@ IOSCSIBlockCommandsDevice::HandlePowerChange ( void )
 				previousPowerState = fCurrentPowerState;
 				fCurrentPowerState = fProposedPowerState;
 				
-				while ( fNumCommandsOutstanding > 1 )
-				{
-					
-					// Sleep this thread for 1ms until all outstanding commands
-					// have completed. This prevents a sleep command from entering
-					// the queue before an I/O and causing a problem on wakeup.
-					IOSleep ( 1 );
-					
-				}
+				// Wait for all outstanding commands to complete. This prevents
+				// a sleep command from entering the queue before an I/O and
+				// causing a problem on wakeup. The task we hold is the only one
+				// allowed to remain.
+				( void ) QuiesceCommands ( 1 );
 							
 				// If the device supports the power conditions mode page, and we haven't already
 				// put it to sleep using the START_STOP_UNIT command, issue one to the drive.
@@ -450,6 +535,7 @@ IOSCSIBlockCommandsDevice::HandlePowerChange ( void )
 				}
 				
 				fCurrentPowerState = kSBCPowerStateSystemSleep;
+				ResumeCommands ( );
 				
 			}	
 			break;
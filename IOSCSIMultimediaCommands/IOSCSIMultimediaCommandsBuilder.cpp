@@ -31,6 +31,7 @@
 #include "IOSCSIMultimediaCommandsDevice.h"
 #include "SCSIMultimediaCommands.h"
 #include "SCSIBlockCommands.h"
+#include "SCSICommandDescriptorBlockLayout.h"
 
 
 //
@@ -361,7 +362,7 @@ IOSCSIMultimediaCommandsDevice::BLANK (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 
@@ -398,7 +399,7 @@ IOSCSIMultimediaCommandsDevice::CLOSE_TRACK_SESSION (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -438,7 +439,7 @@ IOSCSIMultimediaCommandsDevice::FORMAT_UNIT (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -478,7 +479,7 @@ IOSCSIMultimediaCommandsDevice::GET_CONFIGURATION (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -517,7 +518,7 @@ IOSCSIMultimediaCommandsDevice::GET_EVENT_STATUS_NOTIFICATION (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -557,7 +558,7 @@ IOSCSIMultimediaCommandsDevice::GET_PERFORMANCE (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -597,7 +598,7 @@ IOSCSIMultimediaCommandsDevice::LOAD_UNLOAD_MEDIUM (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -634,7 +635,7 @@ IOSCSIMultimediaCommandsDevice::MECHANISM_STATUS (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -667,7 +668,7 @@ IOSCSIMultimediaCommandsDevice::PAUSE_RESUME (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -701,7 +702,7 @@ IOSCSIMultimediaCommandsDevice::PLAY_AUDIO_10 (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -737,7 +738,7 @@ IOSCSIMultimediaCommandsDevice::PLAY_AUDIO_12 (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -772,7 +773,7 @@ IOSCSIMultimediaCommandsDevice::PLAY_AUDIO_MSF (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -813,7 +814,7 @@ IOSCSIMultimediaCommandsDevice::PLAY_CD (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -854,7 +855,7 @@ IOSCSIMultimediaCommandsDevice::READ_BUFFER_CAPACITY (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -890,29 +891,37 @@ IOSCSIMultimediaCommandsDevice::READ_10 (
 						SCSICmdField1Byte 			CONTROL )
 {
 	
-	bool		status 				= false;
-	SCSITask *	scsiRequest			= NULL;
-	UInt64		requestedByteCount	= 0;
+	bool								status 				= false;
+	UInt64								requestedByteCount	= 0;
+	SCSICDBBuilder < SCSICDB_READ_10 >	cdb;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
-	require_nonzero ( scsiRequest, ErrorExit );
-	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
+	require_nonzero ( request, ErrorExit );
+	require ( ResetForNewTask ( request ), ErrorExit );
 	
 	// Check the validity of the media
 	require_nonzero ( blockSize, ErrorExit );
 	
 	requestedByteCount = TRANSFER_LENGTH * blockSize;
 	
-	status = GetSCSIBlockCommandObject ( )->READ_10 (
-					scsiRequest,
-					dataBuffer,
-					requestedByteCount,
-					DPO,
-					FUA,
-					RELADR,
-					LOGICAL_BLOCK_ADDRESS,
-					TRANSFER_LENGTH,
-					CONTROL );
+	// Pack the CDB. Only the bit fields can be out of range; the rest
+	// are checked at compile time.
+	cdb.Set < SCSICDB_READ_10::DPO > ( DPO );
+	cdb.Set < SCSICDB_READ_10::FUA > ( FUA );
+	cdb.Set < SCSICDB_READ_10::RELADR > ( RELADR );
+	cdb.Set < SCSICDB_READ_10::LOGICAL_BLOCK_ADDRESS > ( LOGICAL_BLOCK_ADDRESS );
+	cdb.Set < SCSICDB_READ_10::TRANSFER_LENGTH > ( TRANSFER_LENGTH );
+	cdb.Set < SCSICDB_READ_10::CONTROL > ( CONTROL );
+	require ( cdb.IsValid ( ), ErrorExit );
+	require ( IsMemoryDescriptorValid ( dataBuffer, requestedByteCount ), ErrorExit );
+	
+	SetCommandDescriptorBlock ( request, cdb.GetCommandDescriptorBlock ( ), cdb.GetSize ( ) );
+	
+	SetDataTransferDirection ( request, kSCSIDataTransfer_FromTargetToInitiator );
+	SetTimeoutDuration ( request, 0 );
+	SetDataBuffer ( request, dataBuffer );
+	SetRequestedDataTransferCount ( request, requestedByteCount );
+	
+	status = true;
 	
 	
 ErrorExit:
@@ -947,7 +956,7 @@ IOSCSIMultimediaCommandsDevice::READ_CD (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -998,7 +1007,7 @@ IOSCSIMultimediaCommandsDevice::READ_CD_MSF (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -1042,7 +1051,7 @@ IOSCSIMultimediaCommandsDevice::READ_CAPACITY (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -1079,7 +1088,7 @@ IOSCSIMultimediaCommandsDevice::READ_DISC_INFORMATION (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -1117,7 +1126,7 @@ IOSCSIMultimediaCommandsDevice::READ_DVD_STRUCTURE (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -1156,7 +1165,7 @@ IOSCSIMultimediaCommandsDevice::READ_FORMAT_CAPACITIES (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -1192,7 +1201,7 @@ IOSCSIMultimediaCommandsDevice::READ_HEADER (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -1230,7 +1239,7 @@ IOSCSIMultimediaCommandsDevice::READ_MASTER_CUE (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -1271,7 +1280,7 @@ IOSCSIMultimediaCommandsDevice::READ_SUB_CHANNEL (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -1312,7 +1321,7 @@ IOSCSIMultimediaCommandsDevice::READ_TOC_PMA_ATIP (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -1352,7 +1361,7 @@ IOSCSIMultimediaCommandsDevice::READ_TRACK_INFORMATION (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -1387,7 +1396,7 @@ IOSCSIMultimediaCommandsDevice::REPAIR_TRACK (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -1423,7 +1432,7 @@ IOSCSIMultimediaCommandsDevice::REPORT_KEY (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -1459,7 +1468,7 @@ IOSCSIMultimediaCommandsDevice::RESERVE_TRACK (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -1494,7 +1503,7 @@ IOSCSIMultimediaCommandsDevice::SCAN (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -1530,7 +1539,7 @@ IOSCSIMultimediaCommandsDevice::SEND_CUE_SHEET (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -1565,7 +1574,7 @@ IOSCSIMultimediaCommandsDevice::SEND_DVD_STRUCTURE (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -1601,7 +1610,7 @@ IOSCSIMultimediaCommandsDevice::SEND_EVENT (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -1638,7 +1647,7 @@ IOSCSIMultimediaCommandsDevice::SEND_KEY (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -1675,7 +1684,7 @@ IOSCSIMultimediaCommandsDevice::SEND_OPC_INFORMATION (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -1710,7 +1719,7 @@ IOSCSIMultimediaCommandsDevice::SET_CD_SPEED (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -1744,7 +1753,7 @@ IOSCSIMultimediaCommandsDevice::SET_READ_AHEAD (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -1778,7 +1787,7 @@ IOSCSIMultimediaCommandsDevice::SET_STREAMING (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -1814,7 +1823,7 @@ IOSCSIMultimediaCommandsDevice::START_STOP_UNIT (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -1848,7 +1857,7 @@ IOSCSIMultimediaCommandsDevice::STOP_PLAY_SCAN (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -1882,7 +1891,7 @@ IOSCSIMultimediaCommandsDevice::SYNCHRONIZE_CACHE (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -1920,23 +1929,39 @@ IOSCSIMultimediaCommandsDevice::WRITE_10 (
 						SCSICmdField1Byte 			CONTROL )
 {
 	
-	SCSITask *	scsiRequest	= NULL;
-	bool		status 		= false;
+	bool								status 				= false;
+	UInt64								requestedByteCount	= 0;
+	SCSICDBBuilder < SCSICDB_WRITE_10 >	cdb;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
-	require_nonzero ( scsiRequest, ErrorExit );
-	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
+	require_nonzero ( request, ErrorExit );
+	require ( ResetForNewTask ( request ), ErrorExit );
 	
-	status = GetSCSIMultimediaCommandObject ( )->WRITE_10 (
-								scsiRequest,
-								dataBuffer,
-								blockSize,
-								DPO,
-								FUA,
-								RELADR,
-								LOGICAL_BLOCK_ADDRESS,
-								TRANSFER_LENGTH,
-								CONTROL );
+	// Check the validity of the media
+	require_nonzero ( blockSize, ErrorExit );
+	
+	// MMC doesn't allow DPO or RELADR on writes.
+	require ( ( DPO == 0 ), ErrorExit );
+	require ( ( RELADR == 0 ), ErrorExit );
+	
+	requestedByteCount = TRANSFER_LENGTH * blockSize;
+	
+	// Pack the CDB. Only the bit fields can be out of range; the rest
+	// are checked at compile time.
+	cdb.Set < SCSICDB_WRITE_10::FUA > ( FUA );
+	cdb.Set < SCSICDB_WRITE_10::LOGICAL_BLOCK_ADDRESS > ( LOGICAL_BLOCK_ADDRESS );
+	cdb.Set < SCSICDB_WRITE_10::TRANSFER_LENGTH > ( TRANSFER_LENGTH );
+	cdb.Set < SCSICDB_WRITE_10::CONTROL > ( CONTROL );
+	require ( cdb.IsValid ( ), ErrorExit );
+	require ( IsMemoryDescriptorValid ( dataBuffer, requestedByteCount ), ErrorExit );
+	
+	SetCommandDescriptorBlock ( request, cdb.GetCommandDescriptorBlock ( ), cdb.GetSize ( ) );
+	
+	SetDataTransferDirection ( request, kSCSIDataTransfer_FromInitiatorToTarget );
+	SetTimeoutDuration ( request, 0 );
+	SetDataBuffer ( request, dataBuffer );
+	SetRequestedDataTransferCount ( request, requestedByteCount );
+	
+	status = true;
 	
 	
 ErrorExit:
@@ -1967,7 +1992,7 @@ IOSCSIMultimediaCommandsDevice::WRITE_AND_VERIFY_10 (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
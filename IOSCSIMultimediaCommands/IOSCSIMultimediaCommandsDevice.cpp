@@ -31,6 +31,7 @@
 
 // Generic IOKit related headers
 #include <IOKit/IOBufferMemoryDescriptor.h>
+#include <IOKit/IOSubMemoryDescriptor.h>
 #include <IOKit/IOKitKeys.h>
 
 // Generic IOKit storage related headers
@@ -50,6 +51,7 @@
 #include "IOCompactDiscServices.h"
 #include "SCSIBlockCommands.h"
 #include "SCSIMultimediaCommands.h"
+#include "SCSICommandDescriptorBlockLayout.h"
 
 
 //
@@ -106,6 +108,10 @@ OSDefineAbstractStructors ( IOSCSIMultimediaCommandsDevice, IOSCSIPrimaryCommand
 #define	kProfileDataLengthFieldSize				4
 #define kProfileFeatureHeaderSize				8
 #define kProfileDescriptorSize					4
+#define kFeatureDescriptorHeaderSize			4
+#define kFeatureListSpeculativeSize				2048
+#define kFeatureListMaximumSize					0xFFF8
+#define kMechanicalCapabilitiesSpeculativeSize	0xFF
 #define kModeSense6ParameterHeaderSize			4
 #define kModeSense10ParameterHeaderSize			8
 #define kMechanicalCapabilitiesMinBufferSize	4
@@ -122,6 +128,170 @@ OSDefineAbstractStructors ( IOSCSIMultimediaCommandsDevice, IOSCSIPrimaryCommand
 #define kMechanicalCapabilitiesModePageCode		0x2A
 #define kCDAudioModePageCode					0x0E
 
+// GET EVENT STATUS NOTIFICATION
+#define kEventStatusHeaderSize					4
+#define kEventStatusBufferSize					8
+#define kEventStatusNEAMask						0x80
+#define kEventStatusClassMask					0x07
+#define kEventStatusEventCodeMask				0x0F
+#define kEventClassRequestOperationalChange		( 1 << 1 )
+#define kEventClassRequestPowerManagement		( 1 << 2 )
+#define kEventClassRequestMedia					( 1 << 4 )
+#define kEventClassRequestMask					( kEventClassRequestOperationalChange | \
+												  kEventClassRequestPowerManagement | \
+												  kEventClassRequestMedia )
+#define kMaxEventStatusReads					4
+#define kAsyncNotificationPollInterval			8
+
+// GET EVENT STATUS NOTIFICATION notification classes
+enum
+{
+	kEventClass_OperationalChange		= 1,
+	kEventClass_PowerManagement			= 2,
+	kEventClass_Media					= 4
+};
+
+// GET EVENT STATUS NOTIFICATION event codes
+enum
+{
+	kEventCode_NoChange						= 0,
+	kOperationalEventCode_StateChanged		= 2,
+	kMediaEventCode_NewMedia				= 2,
+	kMediaEventCode_MediaRemoval			= 3,
+	kMediaEventCode_MediaChanged			= 4
+};
+
+// GET EVENT STATUS NOTIFICATION media status bits
+enum
+{
+	kMediaStatus_TrayOpenMask			= 0x01,
+	kMediaStatus_MediaPresentMask		= 0x02
+};
+
+// Media metadata cache
+#define kMediaMetadataCacheEntries				16
+#define kMediaMetadataLengthFieldSize			2
+
+// Write gathering. DVD-RAM is written in 32KB ECC blocks of sixteen
+// 2048 byte sectors.
+#define kWriteGatherDVDBlockSize				2048
+#define kWriteGatherDVDClusterBlocks			16
+#define kWriteGatherFlushDelayMS				100
+
+// Streaming reads
+#define kStreamingSequentialThreshold			4
+#define kStreamingReadAheadBlocks				2048
+#define kStreamingPerformanceDescriptors		16
+#define kStreamingPerformanceTolerance			2		// 10% tolerance
+#define kStreamingDescriptorSize				28
+#define kStreamingRestoreDefaultsMask			0x04
+#define kStreamingIntervalMS					1000
+
+#define kIOPropertyStreamingStatisticsKey		"Streaming Statistics"
+#define kIOPropertyStreamingCountKey			"Stream Count"
+#define kIOPropertyStreamingNegotiatedRateKey	"Negotiated Rate"
+#define kIOPropertyStreamingAchievedRateKey		"Achieved Rate"
+
+// CD-DA extraction. Audio reads with C2 error pointers are split into
+// chunks with several in flight at once, and only the sectors the drive
+// flags are read again, one at a time and at a lower speed.
+#define kAudioSectorSize						2352
+#define kAudioExtractionChunkBlocks				27		// About 64KB with C2 pointers
+#define kAudioExtractionDepth					4
+#define kAudioExtractionRereadAttempts			3
+#define kAudioExtractionRereadSpeed				706		// 4x
+#define kAudioExtractionMaximumSpeed			0xFFFF
+#define kSubChannelQADRMask						0x0F
+#define kSubChannelQADRPosition					0x01
+#define kSubChannelQAbsoluteMinuteOffset		7
+#define kSubChannelQAbsoluteSecondOffset		8
+#define kSubChannelQAbsoluteFrameOffset			9
+#define kAudioExtractionSectorAreaMask			( kCDSectorAreaUser | kCDSectorAreaErrorFlags | \
+												  kCDSectorAreaSubChannel | kCDSectorAreaSubChannelQ )
+
+#define kIOPropertyAudioExtractionStatisticsKey	"Audio Extraction Statistics"
+
+static const char * gAudioExtractionStatisticsKeys[] =
+{
+	"Sectors Read",
+	"Sectors Flagged",
+	"Sectors Re-read",
+	"Sectors Recovered",
+	"Throughput"
+};
+
+#define kAudioExtractionStatisticsCount	( sizeof ( gAudioExtractionStatisticsKeys ) / sizeof ( char * ) )
+
+enum
+{
+	kMediaMetadata_TOC			= 1,
+	kMediaMetadata_DiscInfo		= 2,
+	kMediaMetadata_TrackInfo	= 3,
+	kMediaMetadata_ISRC			= 4,
+	kMediaMetadata_MCN			= 5
+};
+
+// An entry holds the response to one command as the drive returned it. The
+// entry is complete if the response holds everything the drive had, so it
+// can also answer requests with larger allocation lengths.
+struct SCSIMediaMetadataCacheEntry
+{
+	UInt32		generation;
+	UInt32		type;
+	UInt64		key;
+	bool		complete;
+	OSData *	data;
+};
+
+// One READ CD of an extraction. The buffer is the client's buffer, cut
+// down to the sectors of this chunk.
+struct SCSIAudioExtractionChunk
+{
+	SCSIAudioExtraction *	extraction;
+	IOMemoryDescriptor *	buffer;
+	UInt32					firstBlock;
+	UInt32					blockCount;
+};
+
+// A CD-DA request with C2 error pointers. flagged holds a bit per sector
+// to read again, missing a bit per sector whose chunk failed outright and
+// so has no data at all yet. Each chunk in flight holds a reference, as
+// does the issuer until it has sent the first ones. status latches the
+// first error which no re-read can fix.
+struct SCSIAudioExtraction
+{
+	IOMemoryDescriptor *		buffer;
+	void *						clientData;
+	UInt32						startBlock;
+	UInt32						blockCount;
+	UInt32						sectorSize;
+	UInt32						subChannelOffset;
+	UInt8						subChannel;
+	UInt32						chunkCount;
+	SCSIAudioExtractionChunk *	chunks;
+	volatile SInt32				nextChunk;
+	volatile SInt32				references;
+	volatile SInt32				flaggedCount;
+	volatile IOReturn			status;
+	UInt8 *						flagged;
+	UInt8 *						missing;
+	UInt32						bitmapSize;
+	UInt64						startTime;
+	SCSIAudioExtraction *		next;
+};
+
+// A read or write held back until gathered data it depends on has been
+// written out.
+struct SCSIWriteGatherRequest
+{
+	IOMemoryDescriptor *		buffer;
+	void *						clientData;
+	UInt64						startBlock;
+	UInt64						blockCount;
+	bool						write;
+	SCSIWriteGatherRequest *	next;
+};
+
 #define kAppleKeySwitchProperty					"AppleKeyswitch"
 #define kAppleLowPowerPollingKey				"Low Power Polling"
 
@@ -144,7 +314,8 @@ enum
 	kGetConfigurationProfile_DVDWrite					= 0x002F, /* DVD-R Write Profile */
 	kGetConfigurationProfile_DVDPlusRDoubleLayer		= 0x003B, /* DVD+R Double Layer Profile */
 	kGetConfigurationProfile_AnalogAudio				= 0x0103, /* Analog Audio Profile */
-	kGetConfigurationProfile_DVDCSS						= 0x0106  /* DVD-CSS Profile */
+	kGetConfigurationProfile_DVDCSS						= 0x0106, /* DVD-CSS Profile */
+	kGetConfigurationProfile_RealTimeStreaming			= 0x0107  /* Real Time Streaming Profile */
 };
 
 // Get Configuration Feature Numbers in Profile List
@@ -246,6 +417,77 @@ enum
 	kDVDBUFWriteMask	= (1 << kDVDBUFWriteBit)
 };
 
+// Device capabilities, one bit per feature descriptor or feature
+// descriptor flag we care about.
+enum
+{
+	kDeviceCapability_ProfileList			= ( 1 << 0 ),
+	kDeviceCapability_RandomWrite			= ( 1 << 1 ),
+	kDeviceCapability_PacketWrite			= ( 1 << 2 ),
+	kDeviceCapability_DVDPlusRW				= ( 1 << 3 ),
+	kDeviceCapability_DVDPlusR				= ( 1 << 4 ),
+	kDeviceCapability_CDTAO					= ( 1 << 5 ),
+	kDeviceCapability_CDTAOTestWrite		= ( 1 << 6 ),
+	kDeviceCapability_CDTAOBUF				= ( 1 << 7 ),
+	kDeviceCapability_CDMastering			= ( 1 << 8 ),
+	kDeviceCapability_CDMasteringCDRW		= ( 1 << 9 ),
+	kDeviceCapability_CDMasteringTestWrite	= ( 1 << 10 ),
+	kDeviceCapability_CDMasteringRawWrite	= ( 1 << 11 ),
+	kDeviceCapability_CDMasteringSAOWrite	= ( 1 << 12 ),
+	kDeviceCapability_CDMasteringBUF		= ( 1 << 13 ),
+	kDeviceCapability_DVDWrite				= ( 1 << 14 ),
+	kDeviceCapability_DVDWriteRW			= ( 1 << 15 ),
+	kDeviceCapability_DVDWriteTestWrite		= ( 1 << 16 ),
+	kDeviceCapability_DVDWriteBUF			= ( 1 << 17 ),
+	kDeviceCapability_DVDPlusRDoubleLayer	= ( 1 << 18 ),
+	kDeviceCapability_AnalogAudio			= ( 1 << 19 ),
+	kDeviceCapability_DVDCSS				= ( 1 << 20 ),
+	kDeviceCapability_RealTimeStreaming		= ( 1 << 21 )
+};
+
+// Maps a feature descriptor, or a flag in its first byte of feature
+// dependent data if mask is non-zero, to a device capability.
+struct FeatureCapabilityEntry
+{
+	UInt16		featureCode;
+	UInt8		mask;
+	UInt32		capability;
+};
+
+static const FeatureCapabilityEntry	gFeatureCapabilityTable[] =
+{
+	{ kGetConfigurationProfile_ProfileList,				0,							kDeviceCapability_ProfileList			},
+	{ kGetConfigurationProfile_RandomWrite,				0,							kDeviceCapability_RandomWrite			},
+	{ kGetConfigurationProfile_IncrementalStreamedWrite,	0,							kDeviceCapability_PacketWrite			},
+	{ kGetConfigurationProfile_DVDPlusRW,				0,							kDeviceCapability_DVDPlusRW				},
+	{ kGetConfigurationProfile_DVDPlusR,				0,							kDeviceCapability_DVDPlusR				},
+	{ kGetConfigurationProfile_CDTAO,					0,							kDeviceCapability_CDTAO					},
+	{ kGetConfigurationProfile_CDTAO,					kCDTAOTestWriteMask,		kDeviceCapability_CDTAOTestWrite		},
+	{ kGetConfigurationProfile_CDTAO,					kCDTAOBUFWriteMask,			kDeviceCapability_CDTAOBUF				},
+	{ kGetConfigurationProfile_CDMastering,				0,							kDeviceCapability_CDMastering			},
+	{ kGetConfigurationProfile_CDMastering,				kCDMasteringCDRWMask,		kDeviceCapability_CDMasteringCDRW		},
+	{ kGetConfigurationProfile_CDMastering,				kCDMasteringTestWriteMask,	kDeviceCapability_CDMasteringTestWrite	},
+	{ kGetConfigurationProfile_CDMastering,				kCDMasteringRawWriteMask,	kDeviceCapability_CDMasteringRawWrite	},
+	{ kGetConfigurationProfile_CDMastering,				kCDMasteringSAOWriteMask,	kDeviceCapability_CDMasteringSAOWrite	},
+	{ kGetConfigurationProfile_CDMastering,				kCDMasteringBUFWriteMask,	kDeviceCapability_CDMasteringBUF		},
+	{ kGetConfigurationProfile_DVDWrite,				0,							kDeviceCapability_DVDWrite				},
+	{ kGetConfigurationProfile_DVDWrite,				kDVDRWMask,					kDeviceCapability_DVDWriteRW			},
+	{ kGetConfigurationProfile_DVDWrite,				kDVDTestWriteMask,			kDeviceCapability_DVDWriteTestWrite		},
+	{ kGetConfigurationProfile_DVDWrite,				kDVDBUFWriteMask,			kDeviceCapability_DVDWriteBUF			},
+	{ kGetConfigurationProfile_DVDPlusRDoubleLayer,		0,							kDeviceCapability_DVDPlusRDoubleLayer	},
+	{ kGetConfigurationProfile_AnalogAudio,				0,							kDeviceCapability_AnalogAudio			},
+	{ kGetConfigurationProfile_DVDCSS,					0,							kDeviceCapability_DVDCSS				},
+	{ kGetConfigurationProfile_RealTimeStreaming,		0,							kDeviceCapability_RealTimeStreaming		}
+};
+
+#define kFeatureCapabilityTableEntries	( sizeof ( gFeatureCapabilityTable ) / sizeof ( FeatureCapabilityEntry ) )
+
+// GET EVENT STATUS NOTIFICATION operational change codes
+enum
+{
+	kOperationalChange_FeatureChange		= 0x0002
+};
+
 
 // Apple Features mode page code
 #define kAppleFeaturesModePageCode		0x31
@@ -351,6 +593,8 @@ IOSCSIMultimediaCommandsDevice::EjectTheMedia ( void )
 	
 	STATUS_LOG ( ( "%s::%s called\n", getName ( ), __FUNCTION__ ) );
 	
+	( void ) SynchronizeWriteGather ( );
+	
 	request = GetSCSITask ( );
 	require_nonzero ( request, ErrorExit );
 	
@@ -476,9 +720,13 @@ IOSCSIMultimediaCommandsDevice::SynchronizeCache ( void )
 	SCSIServiceResponse		serviceResponse = kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
 	SCSITaskIdentifier		request			= NULL;
 	IOReturn				status 			= kIOReturnNoResources;
+	IOReturn				gatherStatus	= kIOReturnSuccess;
 	
 	STATUS_LOG ( ( "%s::%s called\n", getName ( ), __FUNCTION__ ) );
 	
+	// Anything gathered must reach the drive before its cache is flushed.
+	gatherStatus = SynchronizeWriteGather ( );
+	
 	request = GetSCSITask ( );
 	require_nonzero ( request, ErrorExit );
 	
@@ -494,7 +742,9 @@ IOSCSIMultimediaCommandsDevice::SynchronizeCache ( void )
 		 ( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD ) )
 	{
 		
-		status = kIOReturnSuccess;
+		// A gathered write which failed is reported here, since its
+		// client was completed when the data was gathered.
+		status = gatherStatus;
 		
 	}
 	
@@ -913,6 +1163,22 @@ IOSCSIMultimediaCommandsDevice::AsyncReadCD (
 	
 	STATUS_LOG ( ( "%s::%s Attempted\n", getName ( ), __FUNCTION__ ) );
 	
+	RecordStreamingRead ( startBlock, blockCount );
+	
+	// Audio read with C2 error pointers is extracted in a pipeline, and
+	// sectors the drive flags are re-read before the request completes.
+	if ( ( sectorType == kCDSectorTypeCDDA ) &&
+		 ( ( sectorArea & ~kAudioExtractionSectorAreaMask ) == 0 ) &&
+		 ( ( sectorArea & ( kCDSectorAreaUser | kCDSectorAreaErrorFlags ) ) == ( kCDSectorAreaUser | kCDSectorAreaErrorFlags ) ) &&
+		 ( ( sectorArea & ( kCDSectorAreaSubChannel | kCDSectorAreaSubChannelQ ) ) != ( kCDSectorAreaSubChannel | kCDSectorAreaSubChannelQ ) ) &&
+		 ( fAudioRereadThread != NULL ) )
+	{
+		
+		status = ExtractAudio ( buffer, startBlock, blockCount, sectorArea, clientData );
+		goto ErrorExit;
+		
+	}
+	
 	request = GetSCSITask ( );
 	require_nonzero_action ( request, ErrorExit, status = kIOReturnNoResources );
 	
@@ -971,12 +1237,25 @@ IOSCSIMultimediaCommandsDevice::ReadISRC ( UInt8 track, CDISRC isrc )
 	SCSITaskIdentifier		request			= NULL;
 	SCSIServiceResponse		serviceResponse = kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
 	UInt8					isrcData[kSubChannelDataBufferSize];
+	UInt32					generation		= fMediaGeneration;
 	
 	STATUS_LOG ( ( "IOSCSIMultimediaCommandsDevice::ReadISRC called\n" ) );
 	
 	desc = IOMemoryDescriptor::withAddress ( isrcData, kSubChannelDataBufferSize, kIODirectionIn );
 	require_nonzero ( desc, ErrorExit );
 	
+	if ( CopyMediaMetadata ( kMediaMetadata_ISRC,
+							 track,
+							 desc,
+							 kSubChannelDataBufferSize,
+							 NULL ) == true )
+	{
+		
+		serviceResponse = kSCSIServiceResponse_TASK_COMPLETE;
+		goto ParseData;
+		
+	}
+	
 	request = GetSCSITask ( );
 	require_nonzero ( request, ReleaseDescriptor );
 	
@@ -997,6 +1276,28 @@ IOSCSIMultimediaCommandsDevice::ReadISRC ( UInt8 track, CDISRC isrc )
 		 ( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD ) )
 	{
 		
+		StoreMediaMetadata ( generation,
+							 kMediaMetadata_ISRC,
+							 track,
+							 desc,
+							 kSubChannelDataBufferSize );
+		
+	}
+	
+	else
+	{
+		serviceResponse = kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
+	}
+	
+	ReleaseSCSITask ( request );
+	
+	
+ParseData:
+	
+	
+	if ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE )
+	{
+		
 		// Check if we found good data.
 		if ( isrcData[8] & kTrackCatalogValueFieldValidMask )
 		{
@@ -1020,8 +1321,6 @@ IOSCSIMultimediaCommandsDevice::ReadISRC ( UInt8 track, CDISRC isrc )
 		status = kIOReturnNotFound;
 	}
 	
-	ReleaseSCSITask ( request );
-	
 	
 ReleaseDescriptor:
 	
@@ -1051,12 +1350,25 @@ IOSCSIMultimediaCommandsDevice::ReadMCN ( CDMCN mcn )
 	SCSITaskIdentifier		request			= NULL;
 	SCSIServiceResponse		serviceResponse = kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
 	UInt8					mcnData[kSubChannelDataBufferSize];
+	UInt32					generation		= fMediaGeneration;
 	
 	STATUS_LOG ( ( "IOSCSIMultimediaCommandsDevice::ReadMCN called\n" ) );
 	
 	desc = IOMemoryDescriptor::withAddress ( mcnData, kSubChannelDataBufferSize, kIODirectionIn );
 	require_nonzero ( desc, ErrorExit );
 	
+	if ( CopyMediaMetadata ( kMediaMetadata_MCN,
+							 0,
+							 desc,
+							 kSubChannelDataBufferSize,
+							 NULL ) == true )
+	{
+		
+		serviceResponse = kSCSIServiceResponse_TASK_COMPLETE;
+		goto ParseData;
+		
+	}
+	
 	request = GetSCSITask ( );
 	require_nonzero ( request, ReleaseDescriptor );
 	
@@ -1077,6 +1389,28 @@ IOSCSIMultimediaCommandsDevice::ReadMCN ( CDMCN mcn )
 		 ( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD ) )
 	{
 		
+		StoreMediaMetadata ( generation,
+							 kMediaMetadata_MCN,
+							 0,
+							 desc,
+							 kSubChannelDataBufferSize );
+		
+	}
+	
+	else
+	{
+		serviceResponse = kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
+	}
+	
+	ReleaseSCSITask ( request );
+	
+	
+ParseData:
+	
+	
+	if ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE )
+	{
+		
 		// Check if we found good data.
 		if ( mcnData[8] & kMediaCatalogValueFieldValidMask )
 		{
@@ -1100,8 +1434,6 @@ IOSCSIMultimediaCommandsDevice::ReadMCN ( CDMCN mcn )
 		status = kIOReturnNotFound;
 	}
 	
-	ReleaseSCSITask ( request );
-	
 	
 ReleaseDescriptor:
 	
@@ -1150,6 +1482,10 @@ IOSCSIMultimediaCommandsDevice::ReadTOC (
 	SCSIServiceResponse			serviceResponse	= kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
 	IOReturn					status			= kIOReturnError;
 	IOMemoryDescriptor *		bufferToUse		= NULL;
+	UInt32						generation		= fMediaGeneration;
+	UInt64						key				= 0;
+	
+	key = ( ( UInt64 ) trackSessionNumber << 16 ) | ( msf << 8 ) | format;
 	
 	if ( ( format == kCDTOCFormatTOC ) && ( msf == 1 ) )
 	{
@@ -1207,6 +1543,19 @@ IOSCSIMultimediaCommandsDevice::ReadTOC (
 		
 	}
 	
+	// Serve the TOC from memory if it has already been read from this medium.
+	if ( CopyMediaMetadata ( kMediaMetadata_TOC,
+							 key,
+							 buffer,
+							 bufferToUse->getLength ( ),
+							 actualByteCount ) == true )
+	{
+		
+		status = kIOReturnSuccess;
+		goto ReleaseDescriptor;
+		
+	}
+	
 	request = GetSCSITask ( );
 	require_nonzero_action ( request, ReleaseDescriptor, status = kIOReturnNoResources );
 	
@@ -1377,6 +1726,12 @@ IOSCSIMultimediaCommandsDevice::ReadTOC (
 				
 			}
 			
+			StoreMediaMetadata ( generation,
+								 kMediaMetadata_TOC,
+								 key,
+								 bufferToUse,
+								 GetRealizedDataTransferCount ( request ) );
+			
 		}
 		
 	}
@@ -1435,9 +1790,22 @@ IOSCSIMultimediaCommandsDevice::ReadDiscInfo (	IOMemoryDescriptor *	buffer,
 	IOReturn				status 			= kIOReturnIOError;
 	SCSITaskIdentifier		request			= NULL;
 	SCSIServiceResponse		serviceResponse = kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
+	UInt32					generation		= fMediaGeneration;
 	
 	STATUS_LOG ( ( "IOSCSIMultimediaCommandsDevice::ReadDiscInfo called\n" ) );
 	
+	if ( CopyMediaMetadata ( kMediaMetadata_DiscInfo,
+							 0,
+							 buffer,
+							 buffer->getLength ( ),
+							 actualByteCount ) == true )
+	{
+		
+		status = kIOReturnSuccess;
+		goto ErrorExit;
+		
+	}
+	
 	request = GetSCSITask ( );
 	require_nonzero_action ( request, ErrorExit, status = kIOReturnNoResources );
 	
@@ -1462,7 +1830,14 @@ IOSCSIMultimediaCommandsDevice::ReadDiscInfo (	IOMemoryDescriptor *	buffer,
 		
 		if ( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD )
 		{
+			
+			StoreMediaMetadata ( generation,
+								 kMediaMetadata_DiscInfo,
+								 0,
+								 buffer,
+								 GetRealizedDataTransferCount ( request ) );
 			status = kIOReturnSuccess;
+			
 		}
 		
 	}
@@ -1501,9 +1876,25 @@ IOSCSIMultimediaCommandsDevice::ReadTrackInfo (
 	IOReturn				status 			= kIOReturnIOError;
 	SCSITaskIdentifier		request			= NULL;
 	SCSIServiceResponse		serviceResponse = kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
+	UInt32					generation		= fMediaGeneration;
+	UInt64					key				= 0;
 	
 	STATUS_LOG ( ( "IOSCSIMultimediaCommandsDevice::ReadTrackInfo called\n" ) );
 	
+	key = ( ( UInt64 ) addressType << 32 ) | address;
+	
+	if ( CopyMediaMetadata ( kMediaMetadata_TrackInfo,
+							 key,
+							 buffer,
+							 buffer->getLength ( ),
+							 actualByteCount ) == true )
+	{
+		
+		status = kIOReturnSuccess;
+		goto ErrorExit;
+		
+	}
+	
 	request = GetSCSITask ( );
 	require_nonzero_action ( request, ErrorExit, status = kIOReturnNoResources );
 	
@@ -1530,7 +1921,14 @@ IOSCSIMultimediaCommandsDevice::ReadTrackInfo (
 		
 		if ( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD )
 		{
+			
+			StoreMediaMetadata ( generation,
+								 kMediaMetadata_TrackInfo,
+								 key,
+								 buffer,
+								 GetRealizedDataTransferCount ( request ) );
 			status = kIOReturnSuccess;
+			
 		}
 		
 	}
@@ -2031,6 +2429,89 @@ ErrorExit:
 }
 
 
+//
+//	 EnableStreaming - Sets the drive up to stream the given extent.  [PUBLIC]
+//
+
+IOReturn
+IOSCSIMultimediaCommandsDevice::EnableStreaming ( UInt32 startBlock,
+												  UInt32 endBlock )
+{
+	
+	UInt8			descriptor[kStreamingDescriptorSize]	= { 0 };
+	UInt32			kilobytesPerSecond						= 0;
+	IOReturn		status									= kIOReturnUnsupported;
+	
+	require_quiet ( ( fDeviceCapabilities & kDeviceCapability_RealTimeStreaming ), ErrorExit );
+	require_action ( fMediaPresent, ErrorExit, status = kIOReturnNoMedia );
+	require_action ( ( startBlock <= endBlock ), ErrorExit, status = kIOReturnBadArgument );
+	
+	// Ask for the slowest rate the drive can sustain across the extent, so
+	// the stream is predictable from one end to the other.
+	status = GetStreamingPerformance ( startBlock, endBlock, &kilobytesPerSecond );
+	require_success ( status, ErrorExit );
+	
+	OSWriteBigInt32 ( descriptor, 4, startBlock );
+	OSWriteBigInt32 ( descriptor, 8, endBlock );
+	OSWriteBigInt32 ( descriptor, 12, kilobytesPerSecond );		// Read Size
+	OSWriteBigInt32 ( descriptor, 16, kStreamingIntervalMS );	// Read Time
+	OSWriteBigInt32 ( descriptor, 20, kilobytesPerSecond );		// Write Size
+	OSWriteBigInt32 ( descriptor, 24, kStreamingIntervalMS );	// Write Time
+	
+	status = SendStreamingDescriptor ( descriptor );
+	require_success ( status, ErrorExit );
+	
+	STATUS_LOG ( ( "Streaming blocks %ld - %ld at %ld KB/s\n",
+				   startBlock, endBlock, kilobytesPerSecond ) );
+	
+	fStreamingStartBlock	= startBlock;
+	fStreamingEndBlock		= endBlock;
+	fStreamingRate			= kilobytesPerSecond;
+	fStreamByteCount		= 0;
+	fStreamingEnabled		= true;
+	fStreamingCount++;
+	clock_get_uptime ( &fStreamStartTime );
+	
+	UpdateStreamingStatistics ( );
+	
+	
+ErrorExit:
+	
+	
+	return status;
+	
+}
+
+
+//
+//	 DisableStreaming - Puts the drive back to its default speed.	   [PUBLIC]
+//
+
+IOReturn
+IOSCSIMultimediaCommandsDevice::DisableStreaming ( void )
+{
+	
+	UInt8			descriptor[kStreamingDescriptorSize]	= { 0 };
+	IOReturn		status									= kIOReturnSuccess;
+	
+	require_quiet ( fStreamingEnabled, ErrorExit );
+	
+	UpdateStreamingStatistics ( );
+	
+	fStreamingEnabled = false;
+	
+	descriptor[0] = kStreamingRestoreDefaultsMask;
+	status = SendStreamingDescriptor ( descriptor );
+	
+	
+ErrorExit:
+	
+	
+	return status;
+	
+}
+
+
 #if 0
 #pragma mark -
 #pragma mark  Protected Methods - Methods used by this class and subclasses
@@ -2068,6 +2549,19 @@ IOSCSIMultimediaCommandsDevice::InitializeDeviceSupport ( void )
 	bzero ( fIOSCSIMultimediaCommandsDeviceReserved,
 			sizeof ( IOSCSIMultimediaCommandsDeviceExpansionData ) );
 	
+	// The driver works without the cache, just more slowly.
+	( void ) CreateMediaMetadataCache ( );
+	
+	// Likewise without write gathering or streaming.
+	( void ) CreateWriteGather ( );
+	
+	fStreamingThread = thread_call_allocate (
+					( thread_call_func_t ) IOSCSIMultimediaCommandsDevice::sProgramStreaming,
+					( thread_call_param_t ) this );
+	
+	// Without it, audio is read the same way as any other READ CD.
+	( void ) CreateAudioExtraction ( );
+	
 	// Make sure the drive is ready for us!
 	require ( ClearNotReadyStatus ( ), ReleaseExpansionData );
 	
@@ -2098,6 +2592,18 @@ ReleaseExpansionData:
 	
 	
 	require_nonzero_quiet ( fIOSCSIMultimediaCommandsDeviceReserved, ErrorExit );
+	FreeMediaMetadataCache ( );
+	FreeWriteGather ( );
+	FreeAudioExtraction ( );
+	
+	if ( fStreamingThread != NULL )
+	{
+		
+		thread_call_free ( fStreamingThread );
+		fStreamingThread = NULL;
+		
+	}
+	
 	IODelete ( fIOSCSIMultimediaCommandsDeviceReserved, IOSCSIMultimediaCommandsDeviceExpansionData, 1 );
 	fIOSCSIMultimediaCommandsDeviceReserved = NULL;
 	
@@ -2118,6 +2624,8 @@ void
 IOSCSIMultimediaCommandsDevice::StartDeviceSupport ( void )
 {
 	
+	InitializeReadWriteTaskTemplates ( &IOSCSIMultimediaCommandsDevice::AsyncReadWriteComplete );
+	
 	EnablePolling ( );
 	
 	CreateStorageServiceNub ( );
@@ -2172,6 +2680,9 @@ IOSCSIMultimediaCommandsDevice::StopDeviceSupport ( void )
 	
 	DisablePolling ( );
 	
+	// Write out anything gathered while the drive can still be reached.
+	( void ) SynchronizeWriteGather ( );
+	
 }
 
 
@@ -2193,6 +2704,42 @@ IOSCSIMultimediaCommandsDevice::TerminateDeviceSupport ( void )
 		
 	}
 	
+	StopWriteGather ( );
+	
+	if ( fStreamingThread != NULL )
+	{
+		
+		// As does a scheduled update of the streaming settings. The thread
+		// call is freed with the rest of the streaming state, since an
+		// update may still be running.
+		if ( thread_call_cancel ( fStreamingThread ) == true )
+		{
+			release ( );
+		}
+		
+	}
+	
+	if ( fAudioRereadThread != NULL )
+	{
+		
+		// And a scheduled re-read, whose extractions still have clients
+		// waiting on them.
+		if ( thread_call_cancel ( fAudioRereadThread ) == true )
+		{
+			
+			SCSIAudioExtraction *	extraction = NULL;
+			
+			while ( ( extraction = DequeueAudioExtraction ( ) ) != NULL )
+			{
+				CompleteAudioExtraction ( extraction, kIOReturnNotAttached );
+			}
+			
+			release ( );
+			
+		}
+		
+	}
+	
 	// Release all memory/objects associated with the reserved fields.
 	if ( fPowerDownNotifier != NULL )
 	{
@@ -2272,6 +2819,26 @@ IOSCSIMultimediaCommandsDevice::FreeCommandSetObjects ( void )
 	if ( fIOSCSIMultimediaCommandsDeviceReserved != NULL )
 	{
 		
+		FreeMediaMetadataCache ( );
+		FreeWriteGather ( );
+		FreeAudioExtraction ( );
+		
+		if ( fStreamingThread != NULL )
+		{
+			
+			thread_call_free ( fStreamingThread );
+			fStreamingThread = NULL;
+			
+		}
+		
+		if ( fStreamingStatistics != NULL )
+		{
+			
+			fStreamingStatistics->release ( );
+			fStreamingStatistics = NULL;
+			
+		}
+		
 		IODelete ( fIOSCSIMultimediaCommandsDeviceReserved, IOSCSIMultimediaCommandsDeviceExpansionData, 1 );
 		fIOSCSIMultimediaCommandsDeviceReserved = NULL;
 		
@@ -2339,6 +2906,14 @@ IOSCSIMultimediaCommandsDevice::VerifyDeviceState ( void )
 		
 	}
 	
+	if ( fDeviceSupportsAsyncNotification == true )
+	{
+		
+		// The drive has an event for us. Read it on the next poll.
+		fMediaEventPending = true;
+		
+	}
+	
 	if ( IsPowerManagementIntialized ( ) == true )
 	{
 		
@@ -2513,8 +3088,6 @@ void
 IOSCSIMultimediaCommandsDevice::EnablePolling ( void )
 {		
 	
-	AbsoluteTime	time;
-	
 	// No reason to start a thread if we've been termintated
 	require ( ( isInactive ( ) == false ) && fPollingThread, Exit );
 	require ( ( fPollingMode != kPollingMode_Suspended ), Exit );
@@ -2525,8 +3098,15 @@ IOSCSIMultimediaCommandsDevice::EnablePolling ( void )
 	
 	retain ( );
 	
-	clock_interval_to_deadline ( 1000, kMillisecondScale, &time );
-	thread_call_enter_delayed ( fPollingThread, time );
+	// The shared media poll scheduler enters fPollingThread once the poll
+	// interval for this logical unit has passed.
+	if ( ScheduleMediaPoll ( fPollingThread ) == false )
+	{
+		
+		// A poll is already scheduled and holds its own retain.
+		release ( );
+		
+	}
 	
 	
 Exit:
@@ -2549,8 +3129,8 @@ IOSCSIMultimediaCommandsDevice::DisablePolling ( void )
 	// Change the polling mode
 	fPollingMode = kPollingMode_Suspended;
 	
-	// Cancel the thread if it is scheduled to run
-	require ( thread_call_cancel ( fPollingThread ), Exit );
+	// Cancel the poll if it is scheduled to run
+	require ( CancelMediaPoll ( fPollingThread ), Exit );
 	
 	// It was running, so we balance out the retain ( )
 	// with a release ( )
@@ -2583,6 +3163,9 @@ IOSCSIMultimediaCommandsDevice::HandleSetUserClientExclusivityState (
 	status = super::HandleSetUserClientExclusivityState ( userClient, state );
 	require_success ( status, ErrorExit );
 	
+	// An exclusive client may write to the medium behind our back.
+	InvalidateMediaMetadata ( );
+	
 	status = kIOReturnExclusiveAccess;
 	
 	if ( state == false )
@@ -2927,6 +3510,7 @@ IOSCSIMultimediaCommandsDevice::DetermineDeviceFeatures ( void )
 	CheckPowerConditionsModePage ( );
 	
 	( void ) CheckForLowPowerPollingSupport ( );
+	( void ) CheckForMediaEventNotificationSupport ( );
 	
 	// Set Supported CD & DVD features flags
 	setProperty ( kIOPropertySupportedCDFeatures, fSupportedCDFeatures, 32 );
@@ -3031,8 +3615,8 @@ ErrorExit:
 
 
 //
-//	 GetDeviceConfiguration - 	Gets the profile list returned by
-//								GET_CONFIGURATION command and parses it.
+//	 GetDeviceConfiguration - 	Gets the feature descriptors returned by
+//								GET_CONFIGURATION command and parses them.
 //																	[PROTECTED]
 //
 
@@ -3040,111 +3624,215 @@ IOReturn
 IOSCSIMultimediaCommandsDevice::GetDeviceConfiguration ( void )
 {
 	
-	IOMemoryDescriptor *	bufferDesc			= NULL;
-	SCSIServiceResponse		serviceResponse 	= kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
-	UInt8					numProfiles			= 0;
-	UInt8 *					profilePtr			= NULL;
-	SCSITaskIdentifier		request				= NULL;
-	IOReturn				status				= kIOReturnSuccess;
-	UInt32					actualProfileSize	= 0;
-	
-	status = GetDeviceConfigurationSize ( &actualProfileSize );
-	require_success ( status, ErrorExit );
-	
-	// The number of profiles is the actual size minus the feature header
-	// size minus the current profile size divided by the size of a profile
-	// descriptor
-	numProfiles = ( actualProfileSize - kProfileFeatureHeaderSize -
-					kProfileDescriptorSize ) / kProfileDescriptorSize;
-	
-	require_nonzero_action ( numProfiles,
-							 ErrorExit,
-							 status = kIOReturnIOError );
-	
-	STATUS_LOG ( ( "numProfiles = %d\n", numProfiles ) );
-	
-	// If we have at least one profile, then we have at least a 16 byte
-	// buffer. As an optimization, since the other GET_CONFIGURATION commands
-	// after the one to get the profile list only need a max of 8 bytes
-	// we use the same buffer and memory descriptor.
-	
-	profilePtr = ( UInt8 * ) IOMalloc ( actualProfileSize );
-	require_nonzero_action ( profilePtr,
-							 ErrorExit,
-							 status = kIOReturnNoResources );
-	bzero ( profilePtr, actualProfileSize );
+	IOBufferMemoryDescriptor *	bufferDesc			= NULL;
+	SCSIServiceResponse			serviceResponse 	= kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
+	SCSITaskIdentifier			request				= NULL;
+	IOReturn					status				= kIOReturnSuccess;
+	UInt32						bufferSize			= kFeatureListSpeculativeSize;
+	UInt32						featureListSize		= 0;
+	UInt32						realizedSize		= 0;
 	
-	bufferDesc = IOMemoryDescriptor::withAddress (	profilePtr,
-													actualProfileSize,
-													kIODirectionIn );
-	require_nonzero_action ( bufferDesc,
-							 ReleaseBuffer,
-							 status = kIOReturnNoResources );
+	// The capabilities don't change unless the drive tells us so.
+	require_quiet ( ( fDeviceConfigurationValid == false ), ApplyCapabilities );
 	
 	request = GetSCSITask ( );
 	require_nonzero_action ( request,
-							 ReleaseDescriptor,
+							 ErrorExit,
 							 status = kIOReturnNoResources );
 	
-	if ( GET_CONFIGURATION ( 	request,
-								bufferDesc,
-								0x02, /* Only one feature descriptor */
-								kGetConfigurationProfile_ProfileList,
-								actualProfileSize,
-								0 ) == true )
-	{
-		// The command was successfully built, now send it
-		serviceResponse = SendCommand ( request, kThirtySecondTimeoutInMS );
-	}
-	
-	if ( ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE ) &&
-		 ( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD ) )
+	// Read every feature descriptor the drive supports in one command. The
+	// buffer is large enough for nearly all drives, so it only needs to be
+	// read again with the exact size if the list didn't fit.
+	while ( true )
 	{
 		
-		// Adjust the pointer to be beyond the header and the current profile
-		// to avoid duplicates
-		status = ParseFeatureList ( numProfiles,
-									profilePtr +
-									kProfileFeatureHeaderSize +
-									kProfileDescriptorSize );
-		require_success ( status, ReleaseTask );
+		bufferDesc = IOBufferMemoryDescriptor::withCapacity ( bufferSize, kIODirectionIn );
+		require_nonzero_action ( bufferDesc,
+								 ReleaseTask,
+								 status = kIOReturnNoResources );
+		
+		bzero ( bufferDesc->getBytesNoCopy ( ), bufferSize );
+		
+		serviceResponse = kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
+		
+		if ( GET_CONFIGURATION ( 	request,
+									bufferDesc,
+									0x00, /* All feature descriptors */
+									kGetConfigurationProfile_ProfileList,
+									bufferSize,
+									0 ) == true )
+		{
+			// The command was successfully built, now send it
+			serviceResponse = SendCommand ( request, kThirtySecondTimeoutInMS );
+		}
+		
+		require_action ( ( ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE ) &&
+						   ( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD ) ),
+						 ReleaseDescriptor,
+						 status = kIOReturnIOError );
+		
+		realizedSize	= GetRealizedDataTransferCount ( request );
+		featureListSize	= OSReadBigInt32 ( bufferDesc->getBytesNoCopy ( ), 0 ) +
+						  kProfileDataLengthFieldSize;
+		
+		STATUS_LOG ( ( "featureListSize = %ld\n", featureListSize ) );
+		
+		if ( ( featureListSize <= bufferSize ) ||
+			 ( bufferSize == kFeatureListMaximumSize ) )
+		{
+			break;
+		}
+		
+		bufferSize = min ( featureListSize, kFeatureListMaximumSize );
+		bufferDesc->release ( );
+		bufferDesc = NULL;
 		
 	}
 	
-	// Check for Analog Audio Play Support	
-	if ( GET_CONFIGURATION ( 	request,
-								bufferDesc,
-								0x02, /* Only one feature descriptor */
-								kGetConfigurationProfile_AnalogAudio,
-								kProfileFeatureHeaderSize + 4,
-								0 ) == true )
-	{
-		// The command was successfully built, now send it
-		serviceResponse = SendCommand ( request, kThirtySecondTimeoutInMS );
-	}
-	
-	if ( ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE ) &&
-		 ( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD ) )
+	status = ParseFeatureDescriptors ( ( UInt8 * ) bufferDesc->getBytesNoCopy ( ),
+									   min ( min ( featureListSize, bufferSize ), realizedSize ) );
+	require_success ( status, ReleaseDescriptor );
+	
+	fDeviceConfigurationValid = true;
+	
+	
+ReleaseDescriptor:
+	
+	
+	require_nonzero_quiet ( bufferDesc, ReleaseTask );
+	bufferDesc->release ( );
+	bufferDesc = NULL;
+	
+	
+ReleaseTask:
+	
+	
+	require_nonzero_quiet ( request, ErrorExit );
+	ReleaseSCSITask ( request );
+	request = NULL;
+	
+	require_success_quiet ( status, ErrorExit );
+	
+	
+ApplyCapabilities:
+	
+	
+	ApplyDeviceCapabilities ( );
+	
+	
+ErrorExit:
+	
+	
+	return status;
+	
+}
+
+
+//
+//	 ParseFeatureDescriptors - Turns the feature descriptors returned by
+//								GET_CONFIGURATION into device capabilities.
+//																	  [PRIVATE]
+//
+
+IOReturn
+IOSCSIMultimediaCommandsDevice::ParseFeatureDescriptors ( UInt8 *	buffer,
+														  UInt32	length )
+{
+	
+	UInt8 *		descriptor			= NULL;
+	UInt8 *		end					= NULL;
+	UInt16		featureCode			= 0;
+	UInt8		additionalLength	= 0;
+	UInt32		capabilities		= 0;
+	UInt32		index				= 0;
+	IOReturn	status				= kIOReturnIOError;
+	
+	require ( ( length > kProfileFeatureHeaderSize ), ErrorExit );
+	
+	descriptor	= buffer + kProfileFeatureHeaderSize;
+	end			= buffer + length;
+	
+	while ( ( descriptor + kFeatureDescriptorHeaderSize ) <= end )
 	{
 		
-		STATUS_LOG ( ( "Device supports Analog Audio\n" ) );
-		fSupportedCDFeatures |= kCDFeaturesAnalogAudioMask;
+		featureCode			= OSReadBigInt16 ( descriptor, 0 );
+		additionalLength	= descriptor[3];
+		
+		// Ignore a descriptor which runs past the data we got.
+		if ( ( descriptor + kFeatureDescriptorHeaderSize + additionalLength ) > end )
+			break;
+		
+		if ( featureCode == kGetConfigurationProfile_ProfileList )
+		{
+			
+			status = ParseFeatureList ( additionalLength / kProfileDescriptorSize,
+										descriptor + kFeatureDescriptorHeaderSize );
+			require_success ( status, ErrorExit );
+			
+		}
+		
+		for ( index = 0; index < kFeatureCapabilityTableEntries; index++ )
+		{
+			
+			if ( gFeatureCapabilityTable[index].featureCode != featureCode )
+				continue;
+			
+			if ( gFeatureCapabilityTable[index].mask == 0 )
+			{
+				capabilities |= gFeatureCapabilityTable[index].capability;
+			}
+			
+			else if ( ( additionalLength > 0 ) &&
+					  ( descriptor[kFeatureDescriptorHeaderSize] & gFeatureCapabilityTable[index].mask ) )
+			{
+				capabilities |= gFeatureCapabilityTable[index].capability;
+			}
+			
+		}
+		
+		descriptor += kFeatureDescriptorHeaderSize + additionalLength;
 		
 	}
 	
-	if ( GET_CONFIGURATION ( request,
-							 bufferDesc,
-							 0x02, /* Only one feature descriptor */
-							 kGetConfigurationProfile_IncrementalStreamedWrite,
-							 kProfileFeatureHeaderSize + 4,
-							 0 ) == true )
+	// Without a profile list we can't tell what media the drive handles.
+	require_action ( ( capabilities & kDeviceCapability_ProfileList ),
+					 ErrorExit,
+					 status = kIOReturnIOError );
+	
+	STATUS_LOG ( ( "fDeviceCapabilities = 0x%08x\n", capabilities ) );
+	
+	fDeviceCapabilities	= capabilities;
+	status				= kIOReturnSuccess;
+	
+	
+ErrorExit:
+	
+	
+	return status;
+	
+}
+
+
+//
+//	 ApplyDeviceCapabilities - Sets the supported CD and DVD features from
+//								the device capabilities.			  [PRIVATE]
+//
+
+void
+IOSCSIMultimediaCommandsDevice::ApplyDeviceCapabilities ( void )
+{
+	
+	UInt32	capabilities = fDeviceCapabilities;
+	
+	if ( capabilities & kDeviceCapability_AnalogAudio )
 	{
-		// The command was successfully built, now send it
-		serviceResponse = SendCommand ( request, kThirtySecondTimeoutInMS );
+		
+		STATUS_LOG ( ( "Device supports Analog Audio\n" ) );
+		fSupportedCDFeatures |= kCDFeaturesAnalogAudioMask;
+		
 	}
 	
-	if ( ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE ) &&
-		 ( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD ) )
+	if ( capabilities & kDeviceCapability_PacketWrite )
 	{
 		
 		STATUS_LOG ( ( "Device supports Packet Writing\n" ) );
@@ -3152,26 +3840,13 @@ IOSCSIMultimediaCommandsDevice::GetDeviceConfiguration ( void )
 		
 	}
 	
-	// Check for CD TAO support
-	if ( GET_CONFIGURATION ( 	request,
-								bufferDesc,
-								0x02, /* Only one feature descriptor */
-								kGetConfigurationProfile_CDTAO,
-								kProfileFeatureHeaderSize + 8,
-								0 ) == true )
-	{
-		// The command was successfully built, now send it
-		serviceResponse = SendCommand ( request, kThirtySecondTimeoutInMS );
-	}
-	
-	if ( ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE ) &&
-		( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD ) )
+	if ( capabilities & kDeviceCapability_CDTAO )
 	{
 		
 		STATUS_LOG ( ( "Device supports TAO Write\n" ) );
 		fSupportedCDFeatures |= kCDFeaturesTAOWriteMask;
 		
-		if ( profilePtr[kProfileFeatureHeaderSize + 4] & kCDTAOTestWriteMask )
+		if ( capabilities & kDeviceCapability_CDTAOTestWrite )
 		{
 			
 			STATUS_LOG ( ( "Device supports TAO Test Write\n" ) );
@@ -3179,7 +3854,7 @@ IOSCSIMultimediaCommandsDevice::GetDeviceConfiguration ( void )
 			
 		}
 		
-		if ( profilePtr[kProfileFeatureHeaderSize + 4] & kCDTAOBUFWriteMask )
+		if ( capabilities & kDeviceCapability_CDTAOBUF )
 		{
 			
 			STATUS_LOG ( ( "Device supports TAO BUF\n" ) );
@@ -3189,23 +3864,10 @@ IOSCSIMultimediaCommandsDevice::GetDeviceConfiguration ( void )
 		
 	}
 	
-	// Check for CD Mastering support
-	if ( GET_CONFIGURATION ( 	request,
-								bufferDesc,
-								0x02, /* Only one feature descriptor */
-								kGetConfigurationProfile_CDMastering,
-								kProfileFeatureHeaderSize + 8,
-								0 ) == true )
-	{
-		// The command was successfully built, now send it
-		serviceResponse = SendCommand ( request, kThirtySecondTimeoutInMS );
-	}
-		
-	if ( ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE ) &&
-		 ( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD ) )
+	if ( capabilities & kDeviceCapability_CDMastering )
 	{
 		
-		if ( profilePtr[kProfileFeatureHeaderSize + 4] & kCDMasteringCDRWMask )
+		if ( capabilities & kDeviceCapability_CDMasteringCDRW )
 		{
 			
 			fSupportedCDFeatures |= kCDFeaturesReWriteableMask;
@@ -3230,7 +3892,7 @@ IOSCSIMultimediaCommandsDevice::GetDeviceConfiguration ( void )
 			
 		}
 		
-		if ( profilePtr[kProfileFeatureHeaderSize + 4] & kCDMasteringTestWriteMask )
+		if ( capabilities & kDeviceCapability_CDMasteringTestWrite )
 		{
 			
 			STATUS_LOG ( ( "Device supports CD-Mastering Test Write\n" ) );
@@ -3238,7 +3900,7 @@ IOSCSIMultimediaCommandsDevice::GetDeviceConfiguration ( void )
 			
 		}
 		
-		if ( profilePtr[kProfileFeatureHeaderSize + 4] & kCDMasteringRawWriteMask )
+		if ( capabilities & kDeviceCapability_CDMasteringRawWrite )
 		{
 			
 			STATUS_LOG ( ( "Device supports CD-Mastering Raw Write\n" ) );
@@ -3246,15 +3908,15 @@ IOSCSIMultimediaCommandsDevice::GetDeviceConfiguration ( void )
 			
 		}
 		
-		if ( profilePtr[kProfileFeatureHeaderSize + 4] & kCDMasteringSAOWriteMask )
+		if ( capabilities & kDeviceCapability_CDMasteringSAOWrite )
 		{
 			
 			STATUS_LOG ( ( "Device supports CD-Mastering SAO Write\n" ) );
 			fSupportedCDFeatures |= kCDFeaturesSAOWriteMask;
 			
 		}
-
-		if ( profilePtr[kProfileFeatureHeaderSize + 4] & kCDMasteringBUFWriteMask )
+		
+		if ( capabilities & kDeviceCapability_CDMasteringBUF )
 		{
 			
 			STATUS_LOG ( ( "Device supports CD-Mastering BUF\n" ) );
@@ -3263,130 +3925,121 @@ IOSCSIMultimediaCommandsDevice::GetDeviceConfiguration ( void )
 		}
 		
 	}
-		
+	
 	// Check for DVD-R Write support (on DVD-R, DVD-RW, or DVD-RAM drives only)
 	if ( ( fSupportedDVDFeatures & ( kDVDFeaturesWriteOnceMask |
 									 kDVDFeaturesRandomWriteableMask |
-									 kDVDFeaturesReWriteableMask ) ) )
+									 kDVDFeaturesReWriteableMask ) ) &&
+		 ( capabilities & kDeviceCapability_DVDWrite ) )
 	{
 		
-		if ( GET_CONFIGURATION ( 	request,
-									bufferDesc,
-									0x02, /* Only one feature descriptor */
-									kGetConfigurationProfile_DVDWrite,
-									kProfileFeatureHeaderSize + 8,
-									0 ) == true )
+		if ( capabilities & kDeviceCapability_DVDWriteRW )
 		{
-			// The command was successfully built, now send it
-			serviceResponse = SendCommand ( request, kThirtySecondTimeoutInMS );
+			
+			STATUS_LOG ( ( "Device supports DVD-RW Write\n" ) );
+			fSupportedDVDFeatures |= kDVDFeaturesReWriteableMask;
+			
 		}
 		
-		if ( ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE ) &&
-			 ( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD ) )
+		else
 		{
 			
-			if ( profilePtr[kProfileFeatureHeaderSize + 4] & kDVDRWMask )
-			{
-				
-				STATUS_LOG ( ( "Device supports DVD-RW Write\n" ) );
-				fSupportedDVDFeatures |= kDVDFeaturesReWriteableMask;
-				
-			}
-			
-			else
-			{
-				
-				// Check if device claimed support for DVD-RW profile
-				// but isn't really DVD-RW
-				if ( fSupportedDVDFeatures & kDVDFeaturesReWriteableMask )
-				{
-					
-					ERROR_LOG ( ( "Device claimed support for DVD-RW, but doesn't do DVD-RW\n" ) );
-					
-					// Not really DVD-RW. Get rid of the feature in the
-					// feature list.
-					fSupportedDVDFeatures &= ~kDVDFeaturesReWriteableMask;
-					
-				}
-				
-			}
-			
-			if ( profilePtr[kProfileFeatureHeaderSize + 4] & kDVDTestWriteMask )
+			// Check if device claimed support for DVD-RW profile
+			// but isn't really DVD-RW
+			if ( fSupportedDVDFeatures & kDVDFeaturesReWriteableMask )
 			{
 				
-				STATUS_LOG ( ( "Device supports DVD-R Write Test Write\n" ) );
-				fSupportedDVDFeatures |= kDVDFeaturesTestWriteMask;
-				
-			}
-			
-			if ( profilePtr[kProfileFeatureHeaderSize + 4] & kDVDBUFWriteMask )
-			{
+				ERROR_LOG ( ( "Device claimed support for DVD-RW, but doesn't do DVD-RW\n" ) );
 				
-				STATUS_LOG ( ( "Device supports DVD-R Write BUF\n" ) );
-				fSupportedDVDFeatures |= kDVDFeaturesBUFWriteMask;
+				// Not really DVD-RW. Get rid of the feature in the
+				// feature list.
+				fSupportedDVDFeatures &= ~kDVDFeaturesReWriteableMask;
 				
 			}
 			
 		}
 		
-	}
-	
-	// Check for DVD-CSS Support (on DVD-ROM drives only)
-	if ( fSupportedDVDFeatures & kDVDFeaturesReadStructuresMask )
-	{
-		
-		if ( GET_CONFIGURATION ( 	request,
-									bufferDesc,
-									0x02, /* Only one feature descriptor */
-									kGetConfigurationProfile_DVDCSS,
-									kProfileFeatureHeaderSize + 4,
-									0 ) == true )
+		if ( capabilities & kDeviceCapability_DVDWriteTestWrite )
 		{
-			// The command was successfully built, now send it
-			serviceResponse = SendCommand ( request, kThirtySecondTimeoutInMS );
+			
+			STATUS_LOG ( ( "Device supports DVD-R Write Test Write\n" ) );
+			fSupportedDVDFeatures |= kDVDFeaturesTestWriteMask;
+			
 		}
 		
-		if ( ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE ) &&
-			 ( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD ) )
+		if ( capabilities & kDeviceCapability_DVDWriteBUF )
 		{
 			
-			STATUS_LOG ( ( "Device supports DVD-CSS\n" ) );
-			fSupportedDVDFeatures |= kDVDFeaturesCSSMask;
+			STATUS_LOG ( ( "Device supports DVD-R Write BUF\n" ) );
+			fSupportedDVDFeatures |= kDVDFeaturesBUFWriteMask;
 			
 		}
 		
 	}
 	
+	// Check for DVD-CSS Support (on DVD-ROM drives only)
+	if ( ( fSupportedDVDFeatures & kDVDFeaturesReadStructuresMask ) &&
+		 ( capabilities & kDeviceCapability_DVDCSS ) )
+	{
+		
+		STATUS_LOG ( ( "Device supports DVD-CSS\n" ) );
+		fSupportedDVDFeatures |= kDVDFeaturesCSSMask;
+		
+	}
 	
-ReleaseTask:
-	
-	
-	require_nonzero_quiet ( request, ReleaseDescriptor );
-	ReleaseSCSITask ( request );
-	request = NULL;
-	
+}
+
+
+//
+//	 RefreshDeviceConfiguration - 	Reads the features again after the drive
+//									reported a feature change.		  [PRIVATE]
+//
+
+void
+IOSCSIMultimediaCommandsDevice::RefreshDeviceConfiguration ( void )
+{
 	
-ReleaseDescriptor:
+	UInt32	cdFeatures	= fSupportedCDFeatures;
+	UInt32	dvdFeatures	= fSupportedDVDFeatures;
 	
+	fDeviceConfigurationChanged	= false;
+	fDeviceConfigurationValid	= false;
 	
-	require_nonzero_quiet ( bufferDesc, ReleaseBuffer );
-	bufferDesc->release ( );
-	bufferDesc = NULL;
+	// Start over, since features may have gone away as well as come.
+	fSupportedCDFeatures	= 0;
+	fSupportedDVDFeatures	= 0;
 	
+	require_success_action_quiet ( GetDeviceConfiguration ( ),
+								   ErrorExit,
+								   fSupportedCDFeatures = cdFeatures;
+								   fSupportedDVDFeatures = dvdFeatures );
 	
-ReleaseBuffer:
+	// Some bits only come from the mechanical capabilities mode page, so
+	// read it again too, just as DetermineDeviceFeatures does.
+	if ( GetMechanicalCapabilities ( ) != kIOReturnSuccess )
+	{
+		
+		// Since it responded as a SCSI Peripheral Device Type 05
+		// it must at least be a CD-ROM...
+		fSupportedCDFeatures |= kCDFeaturesReadStructuresMask;
+		
+	}
 	
+	setProperty ( kIOPropertySupportedCDFeatures, fSupportedCDFeatures, 32 );
+	setProperty ( kIOPropertySupportedDVDFeatures, fSupportedDVDFeatures, 32 );
 	
-	require_nonzero_quiet ( profilePtr, ErrorExit );
-	require_nonzero_quiet ( actualProfileSize, ErrorExit );
-	IOFree ( profilePtr, actualProfileSize );
-	profilePtr = NULL;
+	fDeviceCharacteristicsDictionary->setObject (
+								kIOPropertySupportedCDFeatures,
+								getProperty ( kIOPropertySupportedCDFeatures ) );
+	fDeviceCharacteristicsDictionary->setObject (
+								kIOPropertySupportedDVDFeatures,
+								getProperty ( kIOPropertySupportedDVDFeatures ) );
 	
 	
 ErrorExit:
 	
 	
-	return status;
+	return;
 	
 }
 
@@ -3571,41 +4224,82 @@ IOSCSIMultimediaCommandsDevice::GetMechanicalCapabilities ( void )
 	UInt8							pageCode				= 0;
 	bool							use10Byte				= true;
 	
-	status = GetMechanicalCapabilitiesSize ( &actualSize );
-	require_success ( status, ErrorExit );
-	
+	// Ask for the page with a buffer large enough for nearly all drives,
+	// rather than asking for its size first.
 	bufferDesc = IOBufferMemoryDescriptor::withCapacity (
-												actualSize,
+												kMechanicalCapabilitiesSpeculativeSize,
 												kIODirectionIn,
 												true );
 	require_nonzero ( bufferDesc, ErrorExit );
 	
 	mechanicalCapabilities = ( UInt8 * ) bufferDesc->getBytesNoCopy ( );
-	bzero ( mechanicalCapabilities, actualSize );
+	bzero ( mechanicalCapabilities, kMechanicalCapabilitiesSpeculativeSize );
 	
 	status = GetModeSense ( bufferDesc,
 							kMechanicalCapabilitiesModePageCode,
-							actualSize,
+							kMechanicalCapabilitiesSpeculativeSize,
 							&use10Byte );
-	require_nonzero ( bufferDesc, ReleaseDescriptor );
 	
-	if ( use10Byte )
+	if ( ( status == kIOReturnSuccess ) || ( status == kIOReturnUnderrun ) )
 	{
 		
-		// We check to make sure there aren't any block descriptors. If there
-		// are, we skip over them.
-		blockDescriptorLength	= OSReadBigInt16 ( mechanicalCapabilities, 6 );
-		headerSize				= kModeSense10ParameterHeaderSize;
+		if ( use10Byte )
+		{
+			actualSize = OSReadBigInt16 ( mechanicalCapabilities, 0 ) + sizeof ( UInt16 );
+		}
+		
+		else
+		{
+			actualSize = mechanicalCapabilities[0] + sizeof ( UInt8 );
+		}
 		
 	}
 	
-	else
+	if ( ( actualSize == 0 ) || ( actualSize > kMechanicalCapabilitiesSpeculativeSize ) )
 	{
 		
-		blockDescriptorLength	= mechanicalCapabilities[3];
-		headerSize				= kModeSense6ParameterHeaderSize;
+		// The page didn't fit, or the drive didn't like the allocation
+		// length. Do it the long way.
+		bufferDesc->release ( );
+		bufferDesc = NULL;
 		
-	}
+		use10Byte = true;
+		status = GetMechanicalCapabilitiesSize ( &actualSize );
+		require_success ( status, ErrorExit );
+		
+		bufferDesc = IOBufferMemoryDescriptor::withCapacity (
+													actualSize,
+													kIODirectionIn,
+													true );
+		require_nonzero ( bufferDesc, ErrorExit );
+		
+		mechanicalCapabilities = ( UInt8 * ) bufferDesc->getBytesNoCopy ( );
+		bzero ( mechanicalCapabilities, actualSize );
+		
+		status = GetModeSense ( bufferDesc,
+								kMechanicalCapabilitiesModePageCode,
+								actualSize,
+								&use10Byte );
+		
+	}
+	
+	if ( use10Byte )
+	{
+		
+		// We check to make sure there aren't any block descriptors. If there
+		// are, we skip over them.
+		blockDescriptorLength	= OSReadBigInt16 ( mechanicalCapabilities, 6 );
+		headerSize				= kModeSense10ParameterHeaderSize;
+		
+	}
+	
+	else
+	{
+		
+		blockDescriptorLength	= mechanicalCapabilities[3];
+		headerSize				= kModeSense6ParameterHeaderSize;
+		
+	}
 	
 	// Ensure that our buffer is of the minimum correct size. We
 	// know we will inspect at least kMechanicalCapabilitiesMinBufferSize
@@ -3821,6 +4515,12 @@ IOSCSIMultimediaCommandsDevice::ResetMediaCharacteristics ( void )
 	fMediaType				= kCDMediaTypeUnknown;
 	fMediaIsWriteProtected	= true;
 	
+	// The drive forgets its streaming settings with the medium.
+	fStreamingEnabled		= false;
+	fStreamSequentialCount	= 0;
+	
+	InvalidateMediaMetadata ( );
+	
 }
 
 
@@ -3843,9 +4543,36 @@ IOSCSIMultimediaCommandsDevice::PollForMedia ( void )
 	
 	OSBoolean *					keySwitchLocked 	= NULL;
 	
+	if ( fDeviceSupportsAsyncNotification == true )
+	{
+		
+		// The drive tells us when it has an event, so there is no need to
+		// talk to it at all unless it has. Still check now and then in case a
+		// notification was lost.
+		fMediaEventPollCount++;
+		require_quiet ( ( fMediaEventPending == true ) ||
+						( ( fMediaEventPollCount % kAsyncNotificationPollInterval ) == 0 ),
+						Exit );
+		
+	}
+	
 	request = GetSCSITask ( );
 	require_nonzero ( request, ErrorExit );
 	
+	if ( ( fSupportedEventClasses & kEventClassRequestMedia ) != 0 )
+	{
+		
+		// Only go on to probe the drive for media if its events say
+		// something has changed.
+		require_quiet ( ProcessMediaEvents ( request ), ReleaseTask );
+		
+	}
+	
+	if ( fDeviceConfigurationChanged == true )
+	{
+		RefreshDeviceConfiguration ( );
+	}
+	
 	// Do a TEST_UNIT_READY to generate sense data
 	if ( TEST_UNIT_READY ( request, 0 ) == true )
 	{
@@ -4138,10 +4865,15 @@ IOSCSIMultimediaCommandsDevice::PollForMedia ( void )
 		
 	}
 	
+	// Anything read from the previous medium is stale now.
+	InvalidateMediaMetadata ( );
+	
 	DetermineMediaType ( );
 		
 	CheckWriteProtection ( );
 	
+	ConfigureWriteGather ( );
+	
 	fMediaPresent	= true;
 	fMediaChanged	= true;
 	fPollingMode 	= kPollingMode_Suspended;
@@ -4177,692 +4909,3513 @@ Exit:
 
 
 //
-//	 CheckForLowPowerPollingSupport - 	Checks for low power polling support
-//										available on some ATAPI drives.
-//																	[PROTECTED]
+//	 CreateMediaMetadataCache - Allocates the media metadata cache.  [PRIVATE]
 //
 
-IOReturn
-IOSCSIMultimediaCommandsDevice::CheckForLowPowerPollingSupport ( void )
+bool
+IOSCSIMultimediaCommandsDevice::CreateMediaMetadataCache ( void )
 {
 	
-	IOReturn					status 				= kIOReturnNoResources;
-	OSBoolean *					boolValue 			= NULL;
-	const OSSymbol * 			key					= NULL;
-	OSDictionary *				dict				= NULL;
-	OSString *					internalString 		= NULL;
-	AppleFeatures				appleFeaturesBuffer	= { 0 };
-	IOMemoryDescriptor *		bufferDesc			= NULL;
-	bool						use10Byte			= true;
+	bool	result = false;
 	
-	bufferDesc = IOMemoryDescriptor::withAddress (  &appleFeaturesBuffer,
-													sizeof ( appleFeaturesBuffer ),
-													kIODirectionIn );
-	require_nonzero ( bufferDesc, ErrorExit ); 
+	// Start at one so the zeroed entries never look valid.
+	fMediaGeneration = 1;
 	
-	status = GetModeSense ( bufferDesc,
-							kAppleFeaturesModePageCode,
-							sizeof ( appleFeaturesBuffer ),
-							&use10Byte );
-	require_success_quiet ( status, ReleaseDescriptor );
+	fMediaMetadataLock = IOSimpleLockAlloc ( );
+	require_nonzero ( fMediaMetadataLock, ErrorExit );
 	
-	// Swap to proper endian-ness since we are reading a multiple-byte field		
-	if ( ( OSReadBigInt32 ( &appleFeaturesBuffer.signature, 0 ) == '.App' ) &&
-		 ( appleFeaturesBuffer.supportsLowPowerPoll ) )
-	{
-		
-		// Device supports the Apple specific low-power polling. Make sure
-		// to flag that attribute.
-		STATUS_LOG ( ( "Device Supports Low Power Polling\n" ) );
-		fDeviceSupportsLowPowerPolling = true;
-		
-	}
+	fMediaMetadataCache = IONew ( SCSIMediaMetadataCacheEntry, kMediaMetadataCacheEntries );
+	require_nonzero ( fMediaMetadataCache, FreeLock );
 	
+	bzero ( fMediaMetadataCache, sizeof ( SCSIMediaMetadataCacheEntry ) * kMediaMetadataCacheEntries );
 	
-ReleaseDescriptor:
+	result = true;
+	goto ErrorExit;
 	
 	
-	require_nonzero ( bufferDesc, ErrorExit );
-	bufferDesc->release ( );
-	bufferDesc = NULL;
+FreeLock:
 	
-	if ( fDeviceSupportsLowPowerPolling )
-	{
-		
-		fDeviceSupportsLowPowerPolling = IsProtocolServiceSupported ( 
-												kSCSIProtocolFeature_ProtocolSpecificPolling,
-												NULL );
-		
-	}
 	
-	dict = GetProtocolCharacteristicsDictionary ( );
-	if ( dict != NULL )
+	IOSimpleLockFree ( fMediaMetadataLock );
+	fMediaMetadataLock = NULL;
+	
+	
+ErrorExit:
+	
+	
+	return result;
+	
+}
+
+
+//
+//	 FreeMediaMetadataCache - Releases the media metadata cache.	  [PRIVATE]
+//
+
+void
+IOSCSIMultimediaCommandsDevice::FreeMediaMetadataCache ( void )
+{
+	
+	UInt32	index = 0;
+	
+	if ( fMediaMetadataCache != NULL )
 	{
 		
-		key = OSSymbol::withCString ( kIOPropertyPhysicalInterconnectLocationKey );
-		if ( key != NULL )
+		for ( index = 0; index < kMediaMetadataCacheEntries; index++ )
 		{
 			
-			internalString = OSDynamicCast ( OSString, dict->getObject ( key ) );
-			key->release ( );
-			key = NULL;
+			if ( fMediaMetadataCache[index].data != NULL )
+			{
+				
+				fMediaMetadataCache[index].data->release ( );
+				fMediaMetadataCache[index].data = NULL;
+				
+			}
 			
 		}
 		
+		IODelete ( fMediaMetadataCache, SCSIMediaMetadataCacheEntry, kMediaMetadataCacheEntries );
+		fMediaMetadataCache = NULL;
+		
 	}
 	
-    if ( ( internalString == NULL ) || ( !internalString->isEqualTo ( kIOPropertyInternalKey ) ) )
+	if ( fMediaMetadataLock != NULL )
 	{
 		
-		// Not an internal drive, let's not use the power conditions mode page
-		// info or low power polling
-		fDeviceSupportsPowerConditions = false;
-		fDeviceSupportsLowPowerPolling = false;
+		IOSimpleLockFree ( fMediaMetadataLock );
+		fMediaMetadataLock = NULL;
 		
 	}
 	
-	// If the drive is not a DVD drive, we won't use power conditions,
-	// we'll either use ATA style sleep commands for ATAPI drives or just
-	// spin down the drives if they are external.
-	if ( fSupportedDVDFeatures == 0 )
-	{
-		fDeviceSupportsPowerConditions = false;
-	}
+}
+
+
+//
+//	 InvalidateMediaMetadata - Discards everything read from the medium so
+//								far. Called when the medium changes or is
+//								written to.							  [PRIVATE]
+//
+
+void
+IOSCSIMultimediaCommandsDevice::InvalidateMediaMetadata ( void )
+{
 	
-	boolValue = OSBoolean::withBoolean ( fDeviceSupportsLowPowerPolling );
-	if ( boolValue != NULL )
+	// Entries from older generations are replaced as new ones are stored.
+	OSIncrementAtomic ( ( SInt32 * ) &fMediaGeneration );
+	
+}
+
+
+//
+//	 CopyMediaMetadata - 	Copies a cached response for a command with the
+//							given allocation length into buffer. Returns
+//							false if the response isn't cached.		  [PRIVATE]
+//
+
+bool
+IOSCSIMultimediaCommandsDevice::CopyMediaMetadata (
+									UInt32					type,
+									UInt64					key,
+									IOMemoryDescriptor *	buffer,
+									UInt32					allocationLength,
+									UInt16 *				actualByteCount )
+{
+	
+	SCSIMediaMetadataCacheEntry *	entry		= NULL;
+	OSData *						data		= NULL;
+	UInt32							count		= 0;
+	UInt32							index		= 0;
+	bool							result		= false;
+	
+	require_nonzero_quiet ( fMediaMetadataCache, ErrorExit );
+	
+	IOSimpleLockLock ( fMediaMetadataLock );
+	
+	for ( index = 0; index < kMediaMetadataCacheEntries; index++ )
 	{
 		
-		fDeviceCharacteristicsDictionary->setObject ( kAppleLowPowerPollingKey, boolValue );
-		boolValue->release ( );
-		boolValue = NULL;
+		entry = &fMediaMetadataCache[index];
+		
+		if ( ( entry->data == NULL ) ||
+			 ( entry->generation != fMediaGeneration ) ||
+			 ( entry->type != type ) ||
+			 ( entry->key != key ) )
+		{
+			continue;
+		}
+		
+		// A shorter response only answers a request with a larger
+		// allocation length if it was all the drive had.
+		if ( ( entry->data->getLength ( ) >= allocationLength ) ||
+			 ( entry->complete == true ) )
+		{
+			
+			data = entry->data;
+			data->retain ( );
+			
+		}
+		
+		break;
 		
 	}
 	
+	IOSimpleLockUnlock ( fMediaMetadataLock );
+	
+	require_nonzero_quiet ( data, ErrorExit );
+	
+	// Copy outside the lock, buffer may need to be mapped.
+	count = min ( data->getLength ( ), allocationLength );
+	buffer->writeBytes ( 0, data->getBytesNoCopy ( ), min ( count, buffer->getLength ( ) ) );
+	
+	if ( actualByteCount != NULL )
+	{
+		*actualByteCount = count;
+	}
+	
+	data->release ( );
+	data = NULL;
+	
+	result = true;
+	
 	
 ErrorExit:
 	
 	
-	return status;
+	return result;
 	
 }
 
 
 //
-//	 DetermineMediaType - 	Determines the type of media in the device.
-//																	[PROTECTED]
+//	 StoreMediaMetadata - 	Caches the first count bytes of buffer as the
+//							response to a command issued while generation
+//							was current.							  [PRIVATE]
 //
 
 void
-IOSCSIMultimediaCommandsDevice::DetermineMediaType ( void )
+IOSCSIMultimediaCommandsDevice::StoreMediaMetadata (
+									UInt32					generation,
+									UInt32					type,
+									UInt64					key,
+									IOMemoryDescriptor *	buffer,
+									UInt32					count )
 {
 	
-	bool	mediaTypeFound = false;
+	SCSIMediaMetadataCacheEntry *	entry		= NULL;
+	OSData *						data		= NULL;
+	OSData *						oldData		= NULL;
+	UInt8 *							bytes		= NULL;
+	UInt32							index		= 0;
+	bool							complete	= false;
 	
-	mediaTypeFound = CheckForDVDMediaType ( );	
-	if ( mediaTypeFound == false )
+	require_nonzero_quiet ( fMediaMetadataCache, ErrorExit );
+	require_quiet ( ( generation == fMediaGeneration ), ErrorExit );
+	require_quiet ( ( count >= kMediaMetadataLengthFieldSize ), ErrorExit );
+	require_quiet ( ( count <= buffer->getLength ( ) ), ErrorExit );
+	
+	bytes = ( UInt8 * ) IOMalloc ( count );
+	require_nonzero ( bytes, ErrorExit );
+	
+	buffer->readBytes ( 0, bytes, count );
+	
+	// TOC, disc and track information responses start with the length of
+	// the data that follows, which tells us if we got all of it.
+	if ( ( type != kMediaMetadata_ISRC ) && ( type != kMediaMetadata_MCN ) )
+	{
+		complete = ( OSReadBigInt16 ( bytes, 0 ) + kMediaMetadataLengthFieldSize ) <= count;
+	}
+	
+	data = OSData::withBytes ( bytes, count );
+	IOFree ( bytes, count );
+	bytes = NULL;
+	
+	require_nonzero ( data, ErrorExit );
+	
+	IOSimpleLockLock ( fMediaMetadataLock );
+	
+	// The medium may have changed while the command was outstanding.
+	if ( generation == fMediaGeneration )
 	{
 		
-		mediaTypeFound = CheckForCDMediaType ( );
+		// Replace an older response to the same command or a stale entry,
+		// else take the next entry in turn.
+		for ( index = 0; index < kMediaMetadataCacheEntries; index++ )
+		{
+			
+			entry = &fMediaMetadataCache[index];
+			
+			if ( ( entry->data == NULL ) ||
+				 ( entry->generation != generation ) ||
+				 ( ( entry->type == type ) && ( entry->key == key ) ) )
+			{
+				break;
+			}
+			
+		}
+		
+		if ( index == kMediaMetadataCacheEntries )
+		{
+			
+			entry = &fMediaMetadataCache[fMediaMetadataCacheNext];
+			fMediaMetadataCacheNext = ( fMediaMetadataCacheNext + 1 ) % kMediaMetadataCacheEntries;
+			
+		}
+		
+		oldData				= entry->data;
+		entry->generation	= generation;
+		entry->type			= type;
+		entry->key			= key;
+		entry->complete		= complete;
+		entry->data			= data;
+		data				= NULL;
 		
 	}
 	
-	messageClients ( kIOMessageMediaAccessChange,
-					( void * ) kMessageMediaTypeDetermined );
+	IOSimpleLockUnlock ( fMediaMetadataLock );
 	
-	// Set to maximum speed
-	SetMediaAccessSpeed ( 0xFFFF );
+	if ( oldData != NULL )
+	{
+		oldData->release ( );
+	}
+	
+	if ( data != NULL )
+	{
+		data->release ( );
+	}
+	
+	
+ErrorExit:
+	
+	
+	return;
 	
 }
 
 
 //
-//	 CheckForDVDMediaType - 	Determines if the type of media is a DVD media
-//								type.								[PROTECTED]
+//	 CheckForMediaEventNotificationSupport - 	Checks which GET EVENT STATUS
+//												NOTIFICATION classes the drive
+//												supports.			  [PRIVATE]
 //
 
-bool
-IOSCSIMultimediaCommandsDevice::CheckForDVDMediaType ( void )
+IOReturn
+IOSCSIMultimediaCommandsDevice::CheckForMediaEventNotificationSupport ( void )
 {
 	
-	SCSITaskIdentifier			request				= NULL;
-	SCSIServiceResponse			serviceResponse		= kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
-	IOBufferMemoryDescriptor *	bufferDesc			= NULL;
-	bool						mediaTypeFound		= false;
-	UInt8 *						buffer				= NULL;
-	UInt32						bufferSize			= 0;
-	
-	STATUS_LOG ( ( "IOSCSIMultimediaCommandsDevice::CheckForDVDMediaType ENTER\n" ) );
-	
-	// If device supports READ_DVD_STRUCTURE, issue one to find
-	// out if the media is a DVD media type
-	require_quiet ( ( fSupportedDVDFeatures & kDVDFeaturesReadStructuresMask ), Exit );
+	IOReturn				status 			= kIOReturnNoResources;
+	SCSITaskIdentifier		request			= NULL;
+	SCSIServiceResponse		serviceResponse = kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
+	UInt8					eventHeader[kEventStatusHeaderSize] = { 0 };
+	IOMemoryDescriptor *	buffer			= NULL;
 	
-	bufferSize = max ( kDVDPhysicalFormatInfoBufferSize, kProfileFeatureHeaderSize + kProfileDescriptorSize );
-	bufferDesc = IOBufferMemoryDescriptor::withCapacity ( bufferSize, kIODirectionIn );
-	require_nonzero ( bufferDesc, Exit );
+	fSupportedEventClasses				= 0;
+	fDeviceSupportsAsyncNotification	= false;
 	
-	buffer = ( UInt8 * ) bufferDesc->getBytesNoCopy ( );
-	bzero ( buffer, bufferSize );
+	buffer = IOMemoryDescriptor::withAddress ( 	eventHeader,
+												kEventStatusHeaderSize,
+												kIODirectionIn );
+	require_nonzero ( buffer, ErrorExit );
 	
 	request = GetSCSITask ( );
 	require_nonzero ( request, ReleaseDescriptor );
 	
-	if ( READ_DVD_STRUCTURE ( 	request,
-								bufferDesc,
-								0x00,
-								0x00,
-								kDVDStructureFormatPhysicalFormatInfo,
-								kDVDPhysicalFormatInfoBufferSize,
-								0x00,
-								0x00 ) == true )
+	// A request for no classes returns just the header, which lists the
+	// classes the drive supports.
+	if ( GET_EVENT_STATUS_NOTIFICATION ( request,
+										 buffer,
+										 1,
+										 0x00,
+										 kEventStatusHeaderSize,
+										 0x00 ) == true )
 	{
-		// The command was successfully built, now send it
-		serviceResponse = SendCommand ( request, kThirtySecondTimeoutInMS );
+		serviceResponse = SendCommand ( request, kTenSecondTimeoutInMS );
 	}
 	
 	if ( ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE ) &&
 		 ( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD ) )
 	{
 		
-		DVDPhysicalFormatInfo *	physicalFormatInfo = ( DVDPhysicalFormatInfo * ) buffer;
-		
-		switch ( physicalFormatInfo->bookType )
+		// The media class is the one we need. Don't bother with the others
+		// if the drive doesn't report it.
+		if ( ( eventHeader[3] & kEventClassRequestMedia ) != 0 )
 		{
-			
-			case kDVDBookTypeROM:
-				STATUS_LOG ( ( "fMediaType = DVD-ROM\n" ) );
-				fMediaType = kDVDMediaTypeROM;
-				break;
-				
-			case kDVDBookTypeRAM:
-				STATUS_LOG ( ( "fMediaType = DVD-RAM\n" ) );
-				fMediaType = kDVDMediaTypeRAM;
-				break;
-				
-			case kDVDBookTypeR:
-				STATUS_LOG ( ( "fMediaType = DVD-R\n" ) );
-				fMediaType = kDVDMediaTypeR;
-				break;
-				
-			case kDVDBookTypeRW:
-				STATUS_LOG ( ( "fMediaType = DVD-RW\n" ) );
-				fMediaType = kDVDMediaTypeRW;
-				break;
-				
-			case kDVDBookTypePlusRW:
-				STATUS_LOG ( ( "fMediaType = DVD+RW\n" ) );
-				fMediaType = kDVDMediaTypePlusRW;
-				break;
-				
-			case kDVDBookTypePlusR:
-				STATUS_LOG ( ( "fMediaType = DVD+R\n" ) );
-				fMediaType = kDVDMediaTypePlusR;
-				break;
-			
-			case kDVDBookTypePlusRDoubleLayer:
-				STATUS_LOG ( ( "fMediaType = DVD+R\n" ) );
-				fMediaType = kDVDMediaTypePlusR;
-				break;
-				
-			default:
-				STATUS_LOG ( ( "physicalFormatInfo->bookType = %d\n", physicalFormatInfo->bookType ) );
-				STATUS_LOG ( ( "fMediaType = kCDMediaTypeUnknown\n" ) );
-				break;
-			
+			fSupportedEventClasses = eventHeader[3] & kEventClassRequestMask;
 		}
-			
+		
+		status = kIOReturnSuccess;
+		
 	}
 	
-	if ( ( fMediaType == kCDMediaTypeUnknown ) &&
-		 ( fSupportedDVDFeatures & kDVDFeaturesPlusRWMask ) )
+	else
 	{
 		
-		STATUS_LOG ( ( "Check for DVD+RW media\n" ) );
+		ERROR_LOG ( ( "GET_EVENT_STATUS_NOTIFICATION failed, using TEST_UNIT_READY to poll for media.\n" ) );
+		status = kIOReturnUnsupported;
 		
-		bzero ( buffer, bufferSize );
+	}
+	
+	STATUS_LOG ( ( "fSupportedEventClasses = 0x%02x\n", fSupportedEventClasses ) );
+	
+	if ( fSupportedEventClasses != 0 )
+	{
 		
-		if ( GET_CONFIGURATION ( 	request,
-									bufferDesc,
-									0x02, // Only one feature descriptor
-									kGetConfigurationProfile_DVDPlusRW,
-									kProfileFeatureHeaderSize + kProfileDescriptorSize,
-									0 ) == true )
+		// If the protocol driver passes on the drive's asynchronous
+		// notifications, we only need to read events when told to.
+		fDeviceSupportsAsyncNotification = IsProtocolServiceSupported (
+								kSCSIProtocolFeature_ProtocolSpecificAsyncNotification,
+								NULL );
+		
+		// Read any events left over from before we were loaded.
+		fMediaEventPending = true;
+		
+	}
+	
+	ReleaseSCSITask ( request );
+	
+	
+ReleaseDescriptor:
+	
+	
+	require_nonzero_quiet ( buffer, ErrorExit );
+	buffer->release ( );
+	buffer = NULL;
+	
+	
+ErrorExit:
+	
+	
+	return status;
+	
+}
+
+
+//
+//	 ProcessMediaEvents - 	Reads the drive's pending events and returns true
+//							if the media may have changed.			  [PRIVATE]
+//
+
+bool
+IOSCSIMultimediaCommandsDevice::ProcessMediaEvents ( SCSITaskIdentifier request )
+{
+	
+	SCSIServiceResponse		serviceResponse = kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
+	UInt8					eventBuffer[kEventStatusBufferSize] = { 0 };
+	IOMemoryDescriptor *	buffer			= NULL;
+	UInt8					classRequest	= fSupportedEventClasses;
+	UInt8					eventClass		= 0;
+	UInt8					eventCode		= 0;
+	UInt32					index			= 0;
+	bool					stateChanged	= false;
+	bool					changed			= true;
+	
+	buffer = IOMemoryDescriptor::withAddress ( 	eventBuffer,
+												kEventStatusBufferSize,
+												kIODirectionIn );
+	require_nonzero ( buffer, ErrorExit );
+	
+	fMediaEventPending = false;
+	
+	// The drive reports one event per command, from the highest priority
+	// class with an event pending, so operational change and power events
+	// may have to be read before the media event.
+	for ( index = 0; index < kMaxEventStatusReads; index++ )
+	{
 		
+		serviceResponse = kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
+		bzero ( eventBuffer, kEventStatusBufferSize );
+		
+		if ( GET_EVENT_STATUS_NOTIFICATION ( request,
+											 buffer,
+											 1,
+											 classRequest,
+											 kEventStatusBufferSize,
+											 0x00 ) == true )
 		{
-			// The command was successfully built, now send it
-			serviceResponse = SendCommand ( request, kThirtySecondTimeoutInMS );
+			serviceResponse = SendCommand ( request, kTenSecondTimeoutInMS );
 		}
 		
-		if ( ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE ) &&
-			( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD ) )
+		// If the events can't be read, fall back to TEST_UNIT_READY.
+		require_quiet ( ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE ) &&
+						( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD ), ReleaseDescriptor );
+		require_quiet ( ( eventBuffer[2] & kEventStatusNEAMask ) == 0, ReleaseDescriptor );
+		
+		eventClass	= eventBuffer[2] & kEventStatusClassMask;
+		eventCode	= eventBuffer[4] & kEventStatusEventCodeMask;
+		
+		if ( eventClass == kEventClass_Media )
 		{
 			
-			UInt8 *		profilePtr;
+			STATUS_LOG ( ( "Media event = %d, media status = 0x%02x\n", eventCode, eventBuffer[5] ) );
 			
-			profilePtr = buffer + kProfileFeatureHeaderSize;
+			// Removal needs no probe since the media was already gone
+			// for us to be polling.
+			changed = ( eventCode == kMediaEventCode_NewMedia ) ||
+					  ( eventCode == kMediaEventCode_MediaChanged ) ||
+					  ( ( eventBuffer[5] & kMediaStatus_MediaPresentMask ) != 0 ) ||
+					  ( stateChanged == true );
+			goto ReleaseDescriptor;
 			
-			if ( profilePtr[2] & 0x01 )
+		}
+		
+		if ( eventCode == kEventCode_NoChange )
+		{
+			
+			// Nothing is pending in the higher priority classes, so ask for
+			// the media class alone.
+			classRequest = kEventClassRequestMedia;
+			continue;
+			
+		}
+		
+		if ( ( eventClass == kEventClass_OperationalChange ) &&
+			 ( eventCode == kOperationalEventCode_StateChanged ) )
+		{
+			
+			// The drive's state changed underneath us, so look at it
+			// once the events have been read.
+			STATUS_LOG ( ( "Operational state changed, code = 0x%04x\n",
+						   OSReadBigInt16 ( eventBuffer, 6 ) ) );
+			stateChanged = true;
+			
+			if ( OSReadBigInt16 ( eventBuffer, 6 ) == kOperationalChange_FeatureChange )
 			{
-				
-				STATUS_LOG ( ( "fMediaType = DVD+RW\n" ) );
-				fMediaType = kDVDMediaTypePlusRW;
-				
+				fDeviceConfigurationChanged = true;
 			}
 			
 		}
 		
 	}
 	
-	if ( ( fMediaType == kCDMediaTypeUnknown ) &&
-		 ( fSupportedDVDFeatures & kDVDFeaturesPlusRMask ) )
+	// Too many events were pending. Leave the rest for the next poll.
+	fMediaEventPending	= true;
+	changed				= stateChanged;
+	
+	
+ReleaseDescriptor:
+	
+	
+	buffer->release ( );
+	buffer = NULL;
+	
+	
+ErrorExit:
+	
+	
+	return changed;
+	
+}
+
+
+//
+//	 CheckForLowPowerPollingSupport - 	Checks for low power polling support
+//										available on some ATAPI drives.
+//																	[PROTECTED]
+//
+
+IOReturn
+IOSCSIMultimediaCommandsDevice::CheckForLowPowerPollingSupport ( void )
+{
+	
+	IOReturn					status 				= kIOReturnNoResources;
+	OSBoolean *					boolValue 			= NULL;
+	const OSSymbol * 			key					= NULL;
+	OSDictionary *				dict				= NULL;
+	OSString *					internalString 		= NULL;
+	AppleFeatures				appleFeaturesBuffer	= { 0 };
+	IOMemoryDescriptor *		bufferDesc			= NULL;
+	bool						use10Byte			= true;
+	
+	bufferDesc = IOMemoryDescriptor::withAddress (  &appleFeaturesBuffer,
+													sizeof ( appleFeaturesBuffer ),
+													kIODirectionIn );
+	require_nonzero ( bufferDesc, ErrorExit ); 
+	
+	status = GetModeSense ( bufferDesc,
+							kAppleFeaturesModePageCode,
+							sizeof ( appleFeaturesBuffer ),
+							&use10Byte );
+	require_success_quiet ( status, ReleaseDescriptor );
+	
+	// Swap to proper endian-ness since we are reading a multiple-byte field		
+	if ( ( OSReadBigInt32 ( &appleFeaturesBuffer.signature, 0 ) == '.App' ) &&
+		 ( appleFeaturesBuffer.supportsLowPowerPoll ) )
 	{
 		
-		STATUS_LOG ( ( "Check for DVD+R media\n" ) );
+		// Device supports the Apple specific low-power polling. Make sure
+		// to flag that attribute.
+		STATUS_LOG ( ( "Device Supports Low Power Polling\n" ) );
+		fDeviceSupportsLowPowerPolling = true;
 		
-		bzero ( buffer, bufferSize );
+	}
+	
+	
+ReleaseDescriptor:
+	
+	
+	require_nonzero ( bufferDesc, ErrorExit );
+	bufferDesc->release ( );
+	bufferDesc = NULL;
+	
+	if ( fDeviceSupportsLowPowerPolling )
+	{
 		
-		if ( GET_CONFIGURATION ( 	request,
-									bufferDesc,
-									0x02, // Only one feature descriptor
-									kGetConfigurationProfile_DVDPlusR,
-									kProfileFeatureHeaderSize + kProfileDescriptorSize,
-									0 ) == true )
+		fDeviceSupportsLowPowerPolling = IsProtocolServiceSupported ( 
+												kSCSIProtocolFeature_ProtocolSpecificPolling,
+												NULL );
 		
-		{
-			// The command was successfully built, now send it
-			serviceResponse = SendCommand ( request, kThirtySecondTimeoutInMS );
-		}
+	}
+	
+	dict = GetProtocolCharacteristicsDictionary ( );
+	if ( dict != NULL )
+	{
 		
-		if ( ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE ) &&
-			 ( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD ) )
+		key = OSSymbol::withCString ( kIOPropertyPhysicalInterconnectLocationKey );
+		if ( key != NULL )
 		{
 			
-			UInt8 *		profilePtr;
-			
-			profilePtr = buffer + kProfileFeatureHeaderSize;
-			
-			if ( profilePtr[2] & 0x01 )
-			{
-				
-				STATUS_LOG ( ( "fMediaType = DVD+R\n" ) );
-				fMediaType = kDVDMediaTypePlusR;
-				
-			}
+			internalString = OSDynamicCast ( OSString, dict->getObject ( key ) );
+			key->release ( );
+			key = NULL;
 			
 		}
 		
 	}
 	
-	if ( ( fMediaType == kCDMediaTypeUnknown ) &&
-		 ( fSupportedDVDFeatures & kDVDFeaturesPlusRMask ) )
+    if ( ( internalString == NULL ) || ( !internalString->isEqualTo ( kIOPropertyInternalKey ) ) )
 	{
 		
-		STATUS_LOG ( ( "Check for DVD+R DL media\n" ) );
-		
-		bzero ( buffer, bufferSize );
+		// Not an internal drive, let's not use the power conditions mode page
+		// info or low power polling
+		fDeviceSupportsPowerConditions = false;
+		fDeviceSupportsLowPowerPolling = false;
 		
-		if ( GET_CONFIGURATION ( 	request,
-									bufferDesc,
-									0x02, // Only one feature descriptor
-									kGetConfigurationProfile_DVDPlusRDoubleLayer,
-									kProfileFeatureHeaderSize + kProfileDescriptorSize,
-									0 ) == true )
+	}
+	
+	// If the drive is not a DVD drive, we won't use power conditions,
+	// we'll either use ATA style sleep commands for ATAPI drives or just
+	// spin down the drives if they are external.
+	if ( fSupportedDVDFeatures == 0 )
+	{
+		fDeviceSupportsPowerConditions = false;
+	}
+	
+	boolValue = OSBoolean::withBoolean ( fDeviceSupportsLowPowerPolling );
+	if ( boolValue != NULL )
+	{
+		
+		fDeviceCharacteristicsDictionary->setObject ( kAppleLowPowerPollingKey, boolValue );
+		boolValue->release ( );
+		boolValue = NULL;
+		
+	}
+	
+	
+ErrorExit:
+	
+	
+	return status;
+	
+}
+
+
+//
+//	 DetermineMediaType - 	Determines the type of media in the device.
+//																	[PROTECTED]
+//
+
+void
+IOSCSIMultimediaCommandsDevice::DetermineMediaType ( void )
+{
+	
+	bool	mediaTypeFound = false;
+	
+	mediaTypeFound = CheckForDVDMediaType ( );	
+	if ( mediaTypeFound == false )
+	{
+		
+		mediaTypeFound = CheckForCDMediaType ( );
+		
+	}
+	
+	messageClients ( kIOMessageMediaAccessChange,
+					( void * ) kMessageMediaTypeDetermined );
+	
+	// Set to maximum speed
+	SetMediaAccessSpeed ( 0xFFFF );
+	
+}
+
+
+//
+//	 CheckForDVDMediaType - 	Determines if the type of media is a DVD media
+//								type.								[PROTECTED]
+//
+
+bool
+IOSCSIMultimediaCommandsDevice::CheckForDVDMediaType ( void )
+{
+	
+	SCSITaskIdentifier			request				= NULL;
+	SCSIServiceResponse			serviceResponse		= kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
+	IOBufferMemoryDescriptor *	bufferDesc			= NULL;
+	bool						mediaTypeFound		= false;
+	UInt8 *						buffer				= NULL;
+	UInt32						bufferSize			= 0;
+	
+	STATUS_LOG ( ( "IOSCSIMultimediaCommandsDevice::CheckForDVDMediaType ENTER\n" ) );
+	
+	// If device supports READ_DVD_STRUCTURE, issue one to find
+	// out if the media is a DVD media type
+	require_quiet ( ( fSupportedDVDFeatures & kDVDFeaturesReadStructuresMask ), Exit );
+	
+	bufferSize = max ( kDVDPhysicalFormatInfoBufferSize, kProfileFeatureHeaderSize + kProfileDescriptorSize );
+	bufferDesc = IOBufferMemoryDescriptor::withCapacity ( bufferSize, kIODirectionIn );
+	require_nonzero ( bufferDesc, Exit );
+	
+	buffer = ( UInt8 * ) bufferDesc->getBytesNoCopy ( );
+	bzero ( buffer, bufferSize );
+	
+	request = GetSCSITask ( );
+	require_nonzero ( request, ReleaseDescriptor );
+	
+	if ( READ_DVD_STRUCTURE ( 	request,
+								bufferDesc,
+								0x00,
+								0x00,
+								kDVDStructureFormatPhysicalFormatInfo,
+								kDVDPhysicalFormatInfoBufferSize,
+								0x00,
+								0x00 ) == true )
+	{
+		// The command was successfully built, now send it
+		serviceResponse = SendCommand ( request, kThirtySecondTimeoutInMS );
+	}
+	
+	if ( ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE ) &&
+		 ( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD ) )
+	{
+		
+		DVDPhysicalFormatInfo *	physicalFormatInfo = ( DVDPhysicalFormatInfo * ) buffer;
+		
+		switch ( physicalFormatInfo->bookType )
+		{
+			
+			case kDVDBookTypeROM:
+				STATUS_LOG ( ( "fMediaType = DVD-ROM\n" ) );
+				fMediaType = kDVDMediaTypeROM;
+				break;
+				
+			case kDVDBookTypeRAM:
+				STATUS_LOG ( ( "fMediaType = DVD-RAM\n" ) );
+				fMediaType = kDVDMediaTypeRAM;
+				break;
+				
+			case kDVDBookTypeR:
+				STATUS_LOG ( ( "fMediaType = DVD-R\n" ) );
+				fMediaType = kDVDMediaTypeR;
+				break;
+				
+			case kDVDBookTypeRW:
+				STATUS_LOG ( ( "fMediaType = DVD-RW\n" ) );
+				fMediaType = kDVDMediaTypeRW;
+				break;
+				
+			case kDVDBookTypePlusRW:
+				STATUS_LOG ( ( "fMediaType = DVD+RW\n" ) );
+				fMediaType = kDVDMediaTypePlusRW;
+				break;
+				
+			case kDVDBookTypePlusR:
+				STATUS_LOG ( ( "fMediaType = DVD+R\n" ) );
+				fMediaType = kDVDMediaTypePlusR;
+				break;
+			
+			case kDVDBookTypePlusRDoubleLayer:
+				STATUS_LOG ( ( "fMediaType = DVD+R\n" ) );
+				fMediaType = kDVDMediaTypePlusR;
+				break;
+				
+			default:
+				STATUS_LOG ( ( "physicalFormatInfo->bookType = %d\n", physicalFormatInfo->bookType ) );
+				STATUS_LOG ( ( "fMediaType = kCDMediaTypeUnknown\n" ) );
+				break;
+			
+		}
+			
+	}
+	
+	if ( ( fMediaType == kCDMediaTypeUnknown ) &&
+		 ( fSupportedDVDFeatures & kDVDFeaturesPlusRWMask ) )
+	{
+		
+		STATUS_LOG ( ( "Check for DVD+RW media\n" ) );
+		
+		bzero ( buffer, bufferSize );
+		
+		if ( GET_CONFIGURATION ( 	request,
+									bufferDesc,
+									0x02, // Only one feature descriptor
+									kGetConfigurationProfile_DVDPlusRW,
+									kProfileFeatureHeaderSize + kProfileDescriptorSize,
+									0 ) == true )
+		
+		{
+			// The command was successfully built, now send it
+			serviceResponse = SendCommand ( request, kThirtySecondTimeoutInMS );
+		}
+		
+		if ( ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE ) &&
+			( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD ) )
+		{
+			
+			UInt8 *		profilePtr;
+			
+			profilePtr = buffer + kProfileFeatureHeaderSize;
+			
+			if ( profilePtr[2] & 0x01 )
+			{
+				
+				STATUS_LOG ( ( "fMediaType = DVD+RW\n" ) );
+				fMediaType = kDVDMediaTypePlusRW;
+				
+			}
+			
+		}
+		
+	}
+	
+	if ( ( fMediaType == kCDMediaTypeUnknown ) &&
+		 ( fSupportedDVDFeatures & kDVDFeaturesPlusRMask ) )
+	{
+		
+		STATUS_LOG ( ( "Check for DVD+R media\n" ) );
+		
+		bzero ( buffer, bufferSize );
+		
+		if ( GET_CONFIGURATION ( 	request,
+									bufferDesc,
+									0x02, // Only one feature descriptor
+									kGetConfigurationProfile_DVDPlusR,
+									kProfileFeatureHeaderSize + kProfileDescriptorSize,
+									0 ) == true )
+		
+		{
+			// The command was successfully built, now send it
+			serviceResponse = SendCommand ( request, kThirtySecondTimeoutInMS );
+		}
+		
+		if ( ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE ) &&
+			 ( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD ) )
+		{
+			
+			UInt8 *		profilePtr;
+			
+			profilePtr = buffer + kProfileFeatureHeaderSize;
+			
+			if ( profilePtr[2] & 0x01 )
+			{
+				
+				STATUS_LOG ( ( "fMediaType = DVD+R\n" ) );
+				fMediaType = kDVDMediaTypePlusR;
+				
+			}
+			
+		}
+		
+	}
+	
+	if ( ( fMediaType == kCDMediaTypeUnknown ) &&
+		 ( fSupportedDVDFeatures & kDVDFeaturesPlusRMask ) )
+	{
+		
+		STATUS_LOG ( ( "Check for DVD+R DL media\n" ) );
+		
+		bzero ( buffer, bufferSize );
+		
+		if ( GET_CONFIGURATION ( 	request,
+									bufferDesc,
+									0x02, // Only one feature descriptor
+									kGetConfigurationProfile_DVDPlusRDoubleLayer,
+									kProfileFeatureHeaderSize + kProfileDescriptorSize,
+									0 ) == true )
+		
+		{
+			// The command was successfully built, now send it
+			serviceResponse = SendCommand ( request, kThirtySecondTimeoutInMS );
+		}
+		
+		if ( ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE ) &&
+			 ( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD ) )
+		{
+			
+			UInt8 *		profilePtr;
+			
+			profilePtr = buffer + kProfileFeatureHeaderSize;
+			
+			if ( profilePtr[2] & 0x01 )
+			{
+				
+				STATUS_LOG ( ( "fMediaType = DVD+R\n" ) );
+				fMediaType = kDVDMediaTypePlusR;
+				
+			}
+			
+		}
+		
+	}
+	
+	if ( fMediaType != kCDMediaTypeUnknown )
+	{
+		mediaTypeFound = true;
+	}
+	
+	ReleaseSCSITask ( request );
+	
+	
+ReleaseDescriptor:
+	
+	
+	require_nonzero ( bufferDesc, Exit );
+	bufferDesc->release ( );
+	bufferDesc = NULL;
+	
+	
+Exit:
+	
+	STATUS_LOG ( ( "IOSCSIMultimediaCommandsDevice::CheckForDVDMediaType EXIT\n" ) );
+	
+	return mediaTypeFound;
+	
+}
+		
+
+//
+//	 CheckForCDMediaType - Determines if the type of media is a CD media
+//							type.									[PROTECTED]
+//
+
+bool
+IOSCSIMultimediaCommandsDevice::CheckForCDMediaType ( void )
+{
+	
+	UInt8 *						buffer			= NULL;
+	IOBufferMemoryDescriptor * 	bufferDesc		= NULL;
+	SCSITaskIdentifier			request			= NULL;
+	SCSIServiceResponse			serviceResponse = kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
+	bool						mediaTypeFound	= false;
+	
+	bufferDesc = IOBufferMemoryDescriptor::withCapacity ( 4, kIODirectionIn );
+	require_nonzero ( bufferDesc, ErrorExit );
+	buffer = ( UInt8 * ) bufferDesc->getBytesNoCopy ( );
+	
+	request = GetSCSITask ( );
+	require_nonzero ( request, ReleaseDescriptor );
+	
+	// Is this a writeable drive?
+	if ( fSupportedCDFeatures & kCDFeaturesWriteOnceMask )
+	{
+		
+		// A writeable drive should support the READ_DISC_INFORMATION command.
+		// We can determine media type using it.
+		if ( READ_DISC_INFORMATION ( request,
+									 bufferDesc,
+									 bufferDesc->getLength ( ),
+									 0 ) == true )
+		{
+			// The command was successfully built, now send it
+			serviceResponse = SendCommand ( request, kThirtySecondTimeoutInMS );
+		}
+		
+		if ( ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE ) &&
+			 ( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD ) )
+		{
+			
+			switch ( buffer[kDiscStatusOffset] & kDiscStatusMask )
+			{
+				
+				case kDiscStatusEmpty:
+				{
+					
+					STATUS_LOG ( ( "Blank media\n" ) );
+					fMediaBlockCount = 0;
+					STATUS_LOG ( ( "fMediaType = CD-R\n" ) );
+					fMediaType = kCDMediaTypeR;
+					mediaTypeFound = true;
+					break;
+					
+				}
+				
+				case kDiscStatusIncomplete:
+				{
+					
+					STATUS_LOG ( ( "fMediaType = CD-R\n" ) );
+					fMediaType = kCDMediaTypeR;
+					mediaTypeFound = true;
+					break;
+					
+				}
+				
+				case kDiscStatusComplete:					
+				{
+					
+					STATUS_LOG ( ( "fMediaType = CD-ROM\n" ) );
+					fMediaType = kCDMediaTypeROM;
+					mediaTypeFound = true;
+					break;
+					
+				}
+				
+				case kDiscStatusOther:
+				default:
+				{
+					break;
+				}
+				
+			}
+			
+			// Check to see if it is erasable. If it is, it's CD-RW media
+			if ( buffer[kDiscStatusOffset] & kDiscStatusErasableMask )
+			{
+				
+				STATUS_LOG ( ( "fMediaType = CD-RW\n" ) );
+				fMediaType = kCDMediaTypeRW;
+				mediaTypeFound = true;
+				
+			}
+			
+		}
+		
+	}
+	
+	// Were we able to determine the media type yet?
+	require_quiet ( ( mediaTypeFound == false ), ReleaseTask );
+	
+	// Media type not yet determined, check for CD-ROM media.
+	// Issue a READ_TOC_PMA_ATIP to find out if the media is
+	// finalized or not.
+	if ( READ_TOC_PMA_ATIP ( 	request,
+								bufferDesc,
+								0x00,
+								0x00,
+								0x00,
+								bufferDesc->getLength ( ),
+								0 ) == true )
+	{
+		
+		// The command was successfully built, now send it
+		serviceResponse = SendCommand ( request, kThirtySecondTimeoutInMS );
+		
+	}
+	
+	if ( ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE ) &&
+		 ( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD ) )
+	{
+		
+		STATUS_LOG ( ( "fMediaType = CD-ROM\n" ) );
+		fMediaType = kCDMediaTypeROM;		
+		mediaTypeFound = true;
+		
+	}
+	
+	
+ReleaseTask:
+	
+	
+	require_nonzero_quiet ( request, ReleaseDescriptor );
+	ReleaseSCSITask ( request );
+	request = NULL;
+	
+	
+ReleaseDescriptor:
+	
+	
+	require_nonzero_quiet ( bufferDesc, ErrorExit );
+	bufferDesc->release ( );
+	bufferDesc = NULL;
+	
+	
+ErrorExit:
+	
+	
+	return mediaTypeFound;
+	
+}
+
+
+//
+//	 CheckWriteProtection - Determines write protect state of media.
+//																	[PROTECTED]
+//
+
+void
+IOSCSIMultimediaCommandsDevice::CheckWriteProtection ( void )
+{
+	
+	SCSIServiceResponse		serviceResponse = kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
+	SCSITaskIdentifier		request			= NULL;
+	IOMemoryDescriptor *	bufferDesc		= NULL;
+	UInt8					buffer[16]		= { 0 };
+	
+	// Assume it is write protected
+	fMediaIsWriteProtected = true;
+	
+	require_quiet ( ( fMediaType == kDVDMediaTypeRAM ), Exit );
+	require_quiet ( ( fSupportedDVDFeatures & kDVDFeaturesRandomWriteableMask ), Exit );
+	
+	bufferDesc = IOMemoryDescriptor::withAddress (	buffer,
+													sizeof ( buffer ),
+													kIODirectionIn );
+	require_nonzero ( bufferDesc, ErrorExit );
+	
+	request = GetSCSITask ( );
+	require_nonzero ( request, ReleaseDescriptor );
+	
+	if ( GET_CONFIGURATION ( request,
+							 bufferDesc,
+							 0x02, /* Only one feature descriptor */
+							 kGetConfigurationProfile_RandomWrite,
+							 sizeof ( buffer ),
+							 0 ) == true )
+	{
+		// The command was successfully built, now send it
+		serviceResponse = SendCommand ( request, kThirtySecondTimeoutInMS );
+	}
+	
+	if ( ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE ) &&
+		 ( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD ) )
+	{
+		
+		// The current bit in the Random Writable Descriptor
+		// tells us whether the disc is write protected. It is located
+		// at byte 2 of the Random Writable Descriptor Feature page
+		if ( buffer[kProfileFeatureHeaderSize + 2] & kRandomWritableProtectionMask )
+		{
+			
+			fMediaIsWriteProtected = false;
+			
+		}
+		
+	}
+	
+	ReleaseSCSITask ( request );
+	
+	
+ReleaseDescriptor:
+	
+	
+	require_nonzero_quiet ( bufferDesc, Exit );
+	bufferDesc->release ( );	
+	bufferDesc = NULL;
+	
+	
+ErrorExit:
+Exit:
+	
+	
+	return;
+	
+}
+
+
+//
+//	 IssueRead - DEPRECATED.										[PROTECTED]
+//
+
+IOReturn
+IOSCSIMultimediaCommandsDevice::IssueRead (
+							IOMemoryDescriptor *	buffer,
+							UInt64					startBlock,
+							UInt64					blockCount )
+{
+	return kIOReturnUnsupported;
+}
+
+
+
+//
+//	 IssueWrite - DEPRECATED.										[PROTECTED]
+//
+
+IOReturn
+IOSCSIMultimediaCommandsDevice::IssueWrite (
+							IOMemoryDescriptor *	buffer,
+							UInt64					startBlock,
+							UInt64					blockCount )
+{
+	return kIOReturnUnsupported;
+}
+
+
+
+//
+//	 IssueRead - Issues an asynchronous read request.				[PROTECTED]
+//
+
+IOReturn
+IOSCSIMultimediaCommandsDevice::IssueRead (
+							IOMemoryDescriptor *	buffer,
+							void *					clientData,
+							UInt64					startBlock,
+							UInt64					blockCount )
+{
+	
+	IOReturn 				status				= kIOReturnBadArgument;
+	SCSITaskIdentifier		request				= NULL;
+	UInt64					requestedByteCount	= blockCount * fMediaBlockSize;
+	SCSICDBBuilder < SCSICDB_READ_10 >	cdb;
+	
+	// The transfer length must fit the CDB, or the drive would be asked
+	// for fewer blocks than the buffer is set up for.
+	require ( ( blockCount <= kSCSICmdFieldMask2Byte ), ErrorExit );
+	
+	// Reads must see any data still being gathered, so one which overlaps
+	// it waits until it has been written out.
+	require_action_quiet ( ( DeferGatheredRead ( buffer, clientData, startBlock, blockCount ) == false ),
+						   ErrorExit,
+						   status = kIOReturnSuccess );
+	
+	RecordStreamingRead ( startBlock, blockCount );
+	
+	require_nonzero ( fMediaBlockSize, ErrorExit );
+	require ( IsMemoryDescriptorValid ( buffer, requestedByteCount ), ErrorExit );
+	
+	request = GetSCSITask ( );
+	require_action ( ( request != NULL ), ErrorExit, status = kIOReturnNoResources );
+	
+	// Only the CDB, buffer and transfer count change from one read to the
+	// next. Everything else comes from the read task template.
+	cdb.Set < SCSICDB_READ_10::LOGICAL_BLOCK_ADDRESS > ( ( SCSICmdField4Byte ) startBlock );
+	cdb.Set < SCSICDB_READ_10::TRANSFER_LENGTH > ( ( SCSICmdField2Byte ) blockCount );
+	SetCommandDescriptorBlock ( request, cdb.GetCommandDescriptorBlock ( ), cdb.GetSize ( ) );
+	
+	SetDataBuffer ( request, buffer );
+	SetRequestedDataTransferCount ( request, requestedByteCount );
+	SetApplicationLayerReference ( request, clientData );
+	
+	SendTemplatedCommand ( request, &fReadTaskTemplate );
+	status = kIOReturnSuccess;
+	
+	
+ErrorExit:
+	
+	
+	return status;
+	
+}
+
+
+//
+//	 IssueWrite - Issues an asynchronous write request.			[PROTECTED]
+//
+
+IOReturn
+IOSCSIMultimediaCommandsDevice::IssueWrite (
+							IOMemoryDescriptor *	buffer,
+							void *					clientData,
+							UInt64					startBlock,
+							UInt64					blockCount )
+{
+	
+	IOReturn 				status				= kIOReturnBadArgument;
+	SCSITaskIdentifier		request				= NULL;
+	UInt64					requestedByteCount	= blockCount * fMediaBlockSize;
+	SCSICDBBuilder < SCSICDB_WRITE_10 >	cdb;
+	
+	// Writing changes the disc and track information.
+	InvalidateMediaMetadata ( );
+	
+	// Writes smaller than an ECC block are gathered, and completed once
+	// their data has been copied.
+	require_action_quiet ( ( GatherWrite ( buffer, clientData, startBlock, blockCount ) == false ),
+						   ErrorExit,
+						   status = kIOReturnSuccess );
+	
+	require_nonzero ( fMediaBlockSize, WriteNotSent );
+	require ( IsMemoryDescriptorValid ( buffer, requestedByteCount ), WriteNotSent );
+	
+	// The transfer length must fit the CDB, or the drive would be asked
+	// for fewer blocks than the buffer is set up for.
+	require ( ( blockCount <= kSCSICmdFieldMask2Byte ), WriteNotSent );
+	
+	request = GetSCSITask ( );
+	require_action ( ( request != NULL ), WriteNotSent, status = kIOReturnNoResources );
+	
+	// Only the CDB, buffer and transfer count change from one write to the
+	// next. Everything else comes from the write task template.
+	cdb.Set < SCSICDB_WRITE_10::LOGICAL_BLOCK_ADDRESS > ( ( SCSICmdField4Byte ) startBlock );
+	cdb.Set < SCSICDB_WRITE_10::TRANSFER_LENGTH > ( ( SCSICmdField2Byte ) blockCount );
+	SetCommandDescriptorBlock ( request, cdb.GetCommandDescriptorBlock ( ), cdb.GetSize ( ) );
+	
+	SetDataBuffer ( request, buffer );
+	SetRequestedDataTransferCount ( request, requestedByteCount );
+	SetApplicationLayerReference ( request, clientData );
+	
+	SendTemplatedCommand ( request, &fWriteTaskTemplate );
+	status = kIOReturnSuccess;
+	goto ErrorExit;
+	
+	
+WriteNotSent:
+	
+	
+	// GatherWrite counted the write as sent, so a flush would wait for it.
+	UngatheredWriteDone ( );
+	
+	
+ErrorExit:
+	
+	
+	return status;
+	
+}
+
+
+//
+//	 CreateWriteGather - Allocates the write gathering state.		  [PRIVATE]
+//
+
+bool
+IOSCSIMultimediaCommandsDevice::CreateWriteGather ( void )
+{
+	
+	bool	result = false;
+	
+	fWriteGatherStatus = kIOReturnSuccess;
+	
+	fWriteGatherLock = IOLockAlloc ( );
+	require_nonzero ( fWriteGatherLock, ErrorExit );
+	
+	fWriteGatherThread = thread_call_allocate (
+					( thread_call_func_t ) IOSCSIMultimediaCommandsDevice::sWriteGatherTimerExpired,
+					( thread_call_param_t ) this );
+	require_nonzero ( fWriteGatherThread, FreeLock );
+	
+	result = true;
+	goto ErrorExit;
+	
+	
+FreeLock:
+	
+	
+	IOLockFree ( fWriteGatherLock );
+	fWriteGatherLock = NULL;
+	
+	
+ErrorExit:
+	
+	
+	return result;
+	
+}
+
+
+//
+//	 FreeWriteGather - Releases the write gathering state.			  [PRIVATE]
+//
+
+void
+IOSCSIMultimediaCommandsDevice::FreeWriteGather ( void )
+{
+	
+	SCSIWriteGatherRequest *	request = NULL;
+	
+	// StopWriteGather let the last flush send everything it held back.
+	while ( fWriteGatherDeferred != NULL )
+	{
+		
+		request					= fWriteGatherDeferred;
+		fWriteGatherDeferred	= request->next;
+		
+		IODelete ( request, SCSIWriteGatherRequest, 1 );
+		
+	}
+	
+	if ( fWriteGatherThread != NULL )
+	{
+		
+		thread_call_free ( fWriteGatherThread );
+		fWriteGatherThread = NULL;
+		
+	}
+	
+	if ( fWriteGatherData != NULL )
+	{
+		
+		IOFree ( fWriteGatherData, fWriteGatherBufferSize );
+		fWriteGatherData = NULL;
+		
+	}
+	
+	if ( fWriteGatherFillData != NULL )
+	{
+		
+		IOFree ( fWriteGatherFillData, fWriteGatherBufferSize );
+		fWriteGatherFillData = NULL;
+		
+	}
+	
+	if ( fWriteGatherLock != NULL )
+	{
+		
+		IOLockFree ( fWriteGatherLock );
+		fWriteGatherLock = NULL;
+		
+	}
+	
+}
+
+
+//
+//	 ConfigureWriteGather - Turns write gathering on for rewritable media
+//							 written in ECC blocks, and off otherwise.
+//																	  [PRIVATE]
+//
+
+void
+IOSCSIMultimediaCommandsDevice::ConfigureWriteGather ( void )
+{
+	
+	UInt32	clusterBlocks	= 0;
+	UInt32	bufferSize		= 0;
+	
+	require_nonzero_quiet ( fWriteGatherLock, ErrorExit );
+	
+	if ( ( fMediaType == kDVDMediaTypeRAM ) &&
+		 ( fMediaIsWriteProtected == false ) &&
+		 ( fMediaBlockSize == kWriteGatherDVDBlockSize ) )
+	{
+		clusterBlocks = kWriteGatherDVDClusterBlocks;
+	}
+	
+	bufferSize = clusterBlocks * fMediaBlockSize;
+	
+	IOLockLock ( fWriteGatherLock );
+	
+	// The buffers can't change under a flush in progress.
+	while ( fWriteGatherFlushing == true )
+	{
+		IOLockSleep ( fWriteGatherLock, &fWriteGatherFlushing, THREAD_UNINT );
+	}
+	
+	// Whatever was gathered belonged to the previous medium.
+	fWriteGatherValid	= 0;
+	fWriteGatherStatus	= kIOReturnSuccess;
+	fWriteGatherBlocks	= 0;
+	
+	if ( ( clusterBlocks != 0 ) && ( fWriteGatherBufferSize != bufferSize ) )
+	{
+		
+		if ( fWriteGatherData != NULL )
+		{
+			
+			IOFree ( fWriteGatherData, fWriteGatherBufferSize );
+			fWriteGatherData = NULL;
+			
+		}
+		
+		if ( fWriteGatherFillData != NULL )
+		{
+			
+			IOFree ( fWriteGatherFillData, fWriteGatherBufferSize );
+			fWriteGatherFillData = NULL;
+			
+		}
+		
+		fWriteGatherBufferSize	= bufferSize;
+		fWriteGatherData		= ( UInt8 * ) IOMalloc ( bufferSize );
+		fWriteGatherFillData	= ( UInt8 * ) IOMalloc ( bufferSize );
+		
+	}
+	
+	if ( ( clusterBlocks != 0 ) &&
+		 ( fWriteGatherData != NULL ) &&
+		 ( fWriteGatherFillData != NULL ) )
+	{
+		
+		STATUS_LOG ( ( "Gathering writes in %ld block clusters\n", clusterBlocks ) );
+		fWriteGatherBlocks = clusterBlocks;
+		
+	}
+	
+	IOLockUnlock ( fWriteGatherLock );
+	
+	
+ErrorExit:
+	
+	
+	return;
+	
+}
+
+
+//
+//	 GatherWrite - Gathers a write which falls inside one ECC block without
+//					covering all of it, or holds a write back until gathered
+//					data it depends on has been written out. Returns true if
+//					the write was taken, false if it should be sent as is.
+//																	  [PRIVATE]
+//
+
+bool
+IOSCSIMultimediaCommandsDevice::GatherWrite ( IOMemoryDescriptor *	buffer,
+											  void *				clientData,
+											  UInt64				startBlock,
+											  UInt64				blockCount )
+{
+	
+	UInt64		cluster			= 0;
+	UInt32		offset			= 0;
+	UInt32		fullMask		= 0;
+	UInt32		blockMask		= 0;
+	UInt32		byteCount		= 0;
+	IOReturn	status			= kIOReturnSuccess;
+	bool		complete		= false;
+	bool		taken			= false;
+	
+	require_nonzero_quiet ( fWriteGatherLock, ErrorExit );
+	
+	IOLockLock ( fWriteGatherLock );
+	
+	// While gathered data is being written out every write waits for it, so
+	// the flush only has to wait for the writes which were already sent.
+	require_quiet ( ( fWriteGatherFlushing == false ), DeferWrite );
+	
+	require_nonzero_quiet ( fWriteGatherBlocks, SendWrite );
+	require_nonzero_quiet ( blockCount, SendWrite );
+	
+	cluster	= startBlock - ( startBlock % fWriteGatherBlocks );
+	offset	= startBlock - cluster;
+	
+	if ( ( offset + blockCount ) > fWriteGatherBlocks )
+	{
+		
+		// The write crosses an ECC block boundary. Send it as it is, after
+		// anything gathered which it overlaps.
+		if ( ( fWriteGatherValid != 0 ) &&
+			 ( fWriteGatherCluster < ( startBlock + blockCount ) ) &&
+			 ( startBlock < ( fWriteGatherCluster + fWriteGatherBlocks ) ) )
+		{
+			
+			RequestWriteGatherFlush ( );
+			goto DeferWrite;
+			
+		}
+		
+		goto SendWrite;
+		
+	}
+	
+	if ( blockCount == fWriteGatherBlocks )
+	{
+		
+		// The write covers a whole ECC block, so it replaces anything
+		// gathered for the same block and is sent as it is.
+		if ( fWriteGatherCluster == cluster )
+		{
+			fWriteGatherValid = 0;
+		}
+		
+		goto SendWrite;
+		
+	}
+	
+	if ( ( fWriteGatherValid != 0 ) && ( fWriteGatherCluster != cluster ) )
+	{
+		
+		// Moving on to another ECC block. The write waits until the one
+		// gathered so far has been written out.
+		RequestWriteGatherFlush ( );
+		goto DeferWrite;
+		
+	}
+	
+	byteCount = blockCount * fMediaBlockSize;
+	require ( ( buffer->readBytes ( 0,
+									fWriteGatherData + ( offset * fMediaBlockSize ),
+									byteCount ) == byteCount ),
+			  SendWrite );
+	
+	fullMask	= ( fWriteGatherBlocks == 32 ) ? 0xFFFFFFFF : ( ( 1 << fWriteGatherBlocks ) - 1 );
+	blockMask	= ( ( blockCount == 32 ) ? 0xFFFFFFFF : ( ( 1 << blockCount ) - 1 ) ) << offset;
+	
+	fWriteGatherCluster	= cluster;
+	fWriteGatherValid  |= blockMask;
+	complete			= true;
+	taken				= true;
+	
+	if ( fWriteGatherValid == fullMask )
+	{
+		
+		// The ECC block is whole, write it out now.
+		RequestWriteGatherFlush ( );
+		
+	}
+	
+	else
+	{
+		
+		ScheduleWriteGatherFlush ( );
+		
+	}
+	
+	goto ReleaseLock;
+	
+	
+DeferWrite:
+	
+	
+	// The client is completed once the write has been sent again.
+	taken = true;
+	if ( DeferWriteGatherRequest ( buffer, clientData, startBlock, blockCount, true ) == false )
+	{
+		
+		complete	= true;
+		status		= kIOReturnNoResources;
+		
+	}
+	
+	goto ReleaseLock;
+	
+	
+SendWrite:
+	
+	
+	// The write is sent as it is. Count it until it completes, since a
+	// flush of the ECC block it may share must not pass it.
+	fWriteGatherWritesInFlight++;
+	
+	
+ReleaseLock:
+	
+	
+	IOLockUnlock ( fWriteGatherLock );
+	
+	// Complete the client outside the lock, since its completion may
+	// issue the next write.
+	if ( complete == true )
+	{
+		CompleteWriteGatherClient ( clientData, status, ( status == kIOReturnSuccess ) ? byteCount : 0 );
+	}
+	
+	
+ErrorExit:
+	
+	
+	return taken;
+	
+}
+
+
+//
+//	 DeferGatheredRead - 	Holds a read which overlaps gathered data back
+//							until that data has been written out. Returns
+//							true if the read was taken.				  [PRIVATE]
+//
+
+bool
+IOSCSIMultimediaCommandsDevice::DeferGatheredRead ( IOMemoryDescriptor *	buffer,
+													void *					clientData,
+													UInt64					startBlock,
+													UInt64					blockCount )
+{
+	
+	bool	taken	= false;
+	bool	failed	= false;
+	
+	require_nonzero_quiet ( fWriteGatherLock, ErrorExit );
+	
+	IOLockLock ( fWriteGatherLock );
+	
+	// fWriteGatherValid stays set until a flush in progress has finished.
+	if ( ( fWriteGatherValid != 0 ) &&
+		 ( fWriteGatherCluster < ( startBlock + blockCount ) ) &&
+		 ( startBlock < ( fWriteGatherCluster + fWriteGatherBlocks ) ) )
+	{
+		
+		RequestWriteGatherFlush ( );
+		
+		taken	= true;
+		failed	= ( DeferWriteGatherRequest ( buffer, clientData, startBlock, blockCount, false ) == false );
+		
+	}
+	
+	IOLockUnlock ( fWriteGatherLock );
+	
+	if ( failed == true )
+	{
+		CompleteWriteGatherClient ( clientData, kIOReturnNoResources, 0 );
+	}
+	
+	
+ErrorExit:
+	
+	
+	return taken;
+	
+}
+
+
+//
+//	 FlushWriteGather - Writes out the gathered ECC block. If only part of
+//						 it was gathered, the rest is read from the medium
+//						 first so the drive is sent the whole block. Called
+//						 from ServiceWriteGather only.				  [PRIVATE]
+//
+
+IOReturn
+IOSCSIMultimediaCommandsDevice::FlushWriteGather ( void )
+{
+	
+	SCSIServiceResponse		serviceResponse = kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
+	SCSITaskIdentifier		request			= NULL;
+	IOMemoryDescriptor *	bufferDesc		= NULL;
+	IOReturn				status			= kIOReturnSuccess;
+	UInt32					fullMask		= 0;
+	UInt32					index			= 0;
+	UInt32					runStart		= 0;
+	bool					filled			= false;
+	
+	require_quiet ( ( fWriteGatherValid != 0 ), Exit );
+	require_action ( fMediaPresent, ErrorExit, status = kIOReturnNoMedia );
+	
+	fullMask = ( fWriteGatherBlocks == 32 ) ? 0xFFFFFFFF : ( ( 1 << fWriteGatherBlocks ) - 1 );
+	
+	if ( fWriteGatherValid == fullMask )
+	{
+		
+		status = WriteGatherBlocks ( 0, fWriteGatherBlocks );
+		goto ErrorExit;
+		
+	}
+	
+	// Read the whole ECC block in one command and fill in the sectors
+	// which weren't written.
+	request = GetSCSITask ( );
+	require_nonzero ( request, WriteRuns );
+	
+	bufferDesc = IOMemoryDescriptor::withAddress ( fWriteGatherFillData,
+												   fWriteGatherBlocks * fMediaBlockSize,
+												   kIODirectionIn );
+	require_nonzero ( bufferDesc, ReleaseTask );
+	
+	if ( READ_10 ( 	request,
+					bufferDesc,
+					fMediaBlockSize,
+					0,
+					0,
+					0,
+					( SCSICmdField4Byte ) fWriteGatherCluster,
+					( SCSICmdField2Byte ) fWriteGatherBlocks,
+					0 ) == true )
+	{
+		
+		// The command was successfully built, now send it
+		serviceResponse = SendCommand ( request, fReadTimeoutDuration );
+		
+	}
+	
+	if ( ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE ) &&
+		 ( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD ) )
+	{
+		
+		for ( index = 0; index < fWriteGatherBlocks; index++ )
+		{
+			
+			if ( ( fWriteGatherValid & ( 1 << index ) ) == 0 )
+			{
+				
+				bcopy ( fWriteGatherFillData + ( index * fMediaBlockSize ),
+						fWriteGatherData + ( index * fMediaBlockSize ),
+						fMediaBlockSize );
+				
+			}
+			
+		}
+		
+		filled = true;
+		
+	}
+	
+	bufferDesc->release ( );
+	bufferDesc = NULL;
+	
+	
+ReleaseTask:
+	
+	
+	ReleaseSCSITask ( request );
+	request = NULL;
+	
+	
+WriteRuns:
+	
+	
+	if ( filled == true )
+	{
+		
+		status = WriteGatherBlocks ( 0, fWriteGatherBlocks );
+		goto ErrorExit;
+		
+	}
+	
+	// The read failed, so write each run of gathered sectors on its own
+	// and let the drive take care of the rest of the ECC block.
+	ERROR_LOG ( ( "Write gather fill failed, writing runs\n" ) );
+	
+	for ( index = 0; index <= fWriteGatherBlocks; index++ )
+	{
+		
+		if ( ( index < fWriteGatherBlocks ) && ( fWriteGatherValid & ( 1 << index ) ) )
+		{
+			
+			if ( ( index == 0 ) || ( ( fWriteGatherValid & ( 1 << ( index - 1 ) ) ) == 0 ) )
+			{
+				runStart = index;
+			}
+			
+		}
+		
+		else if ( ( index > 0 ) && ( fWriteGatherValid & ( 1 << ( index - 1 ) ) ) )
+		{
+			
+			status = WriteGatherBlocks ( runStart, index - runStart );
+			require_success ( status, ErrorExit );
+			
+		}
+		
+	}
+	
+	
+ErrorExit:
+	
+	
+	if ( status != kIOReturnSuccess )
+	{
+		ERROR_LOG ( ( "Write gather flush failed, status = 0x%08x\n", status ) );
+	}
+	
+	
+Exit:
+	
+	
+	return status;
+	
+}
+
+
+//
+//	 WriteGatherBlocks - Writes gathered sectors of the ECC block to the
+//						  medium.									  [PRIVATE]
+//
+
+IOReturn
+IOSCSIMultimediaCommandsDevice::WriteGatherBlocks ( UInt32 offset,
+													UInt32 blockCount )
+{
+	
+	SCSIServiceResponse		serviceResponse = kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
+	SCSITaskIdentifier		request			= NULL;
+	IOMemoryDescriptor *	bufferDesc		= NULL;
+	IOReturn				status			= kIOReturnNoResources;
+	
+	bufferDesc = IOMemoryDescriptor::withAddress ( fWriteGatherData + ( offset * fMediaBlockSize ),
+												   blockCount * fMediaBlockSize,
+												   kIODirectionOut );
+	require_nonzero ( bufferDesc, ErrorExit );
+	
+	request = GetSCSITask ( );
+	require_nonzero ( request, ReleaseDescriptor );
+	
+	if ( WRITE_10 ( request,
+					bufferDesc,
+					fMediaBlockSize,
+					0,
+					0,
+					0,
+					( SCSICmdField4Byte ) ( fWriteGatherCluster + offset ),
+					( SCSICmdField2Byte ) blockCount,
+					0 ) == true )
+	{
+		
+		// The command was successfully built, now send it
+		serviceResponse = SendCommand ( request, fWriteTimeoutDuration );
+		
+	}
+	
+	if ( ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE ) &&
+		 ( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD ) )
+	{
+		status = kIOReturnSuccess;
+	}
+	
+	else
+	{
+		status = kIOReturnIOError;
+	}
+	
+	ReleaseSCSITask ( request );
+	request = NULL;
+	
+	
+ReleaseDescriptor:
+	
+	
+	bufferDesc->release ( );
+	bufferDesc = NULL;
+	
+	
+ErrorExit:
+	
+	
+	return status;
+	
+}
+
+
+//
+//	 SynchronizeWriteGather - 	Waits until anything gathered has been
+//								written out and returns the first error
+//								seen since the last call.			  [PRIVATE]
+//
+
+IOReturn
+IOSCSIMultimediaCommandsDevice::SynchronizeWriteGather ( void )
+{
+	
+	IOReturn	status = kIOReturnSuccess;
+	
+	require_nonzero_quiet ( fWriteGatherLock, ErrorExit );
+	
+	IOLockLock ( fWriteGatherLock );
+	
+	while ( ( fWriteGatherValid != 0 ) || ( fWriteGatherFlushing == true ) )
+	{
+		
+		if ( fWriteGatherFlushing == false )
+		{
+			RequestWriteGatherFlush ( );
+		}
+		
+		IOLockSleep ( fWriteGatherLock, &fWriteGatherFlushing, THREAD_UNINT );
+		
+	}
+	
+	// The clients of gathered writes were completed when their data was
+	// gathered, so a failed flush is only ever reported here.
+	status				= fWriteGatherStatus;
+	fWriteGatherStatus	= kIOReturnSuccess;
+	
+	IOLockUnlock ( fWriteGatherLock );
+	
+	
+ErrorExit:
+	
+	
+	return status;
+	
+}
+
+
+//
+//	 StopWriteGather - Stops gathering writes. Anything still gathered
+//						could not be written out and is dropped.	  [PRIVATE]
+//
+
+void
+IOSCSIMultimediaCommandsDevice::StopWriteGather ( void )
+{
+	
+	require_nonzero_quiet ( fWriteGatherLock, ErrorExit );
+	
+	IOLockLock ( fWriteGatherLock );
+	
+	// Let a flush in progress finish, so the requests it held back are
+	// sent again and completed.
+	while ( fWriteGatherFlushing == true )
+	{
+		IOLockSleep ( fWriteGatherLock, &fWriteGatherFlushing, THREAD_UNINT );
+	}
+	
+	if ( fWriteGatherValid != 0 )
+	{
+		
+		ERROR_LOG ( ( "%s: dropping gathered blocks 0x%08x at LBA %lld\n",
+					  getName ( ), fWriteGatherValid, fWriteGatherCluster ) );
+		fWriteGatherValid = 0;
+		
+	}
+	
+	fWriteGatherBlocks = 0;
+	
+	IOLockUnlock ( fWriteGatherLock );
+	
+	// A scheduled flush holds a retain on us.
+	if ( thread_call_cancel ( fWriteGatherThread ) == true )
+	{
+		release ( );
+	}
+	
+	
+ErrorExit:
+	
+	
+	return;
+	
+}
+
+
+//
+//	 ScheduleWriteGatherFlush - 	Schedules a flush of a partly gathered
+//									ECC block, in case no more writes come
+//									for it. Must be called with
+//									fWriteGatherLock held.			  [PRIVATE]
+//
+
+void
+IOSCSIMultimediaCommandsDevice::ScheduleWriteGatherFlush ( void )
+{
+	
+	UInt64	deadline = 0;
+	
+	require ( ( isInactive ( ) == false ), Exit );
+	
+	// Retain ourselves so that this object doesn't go away
+	// while the flush is scheduled.
+	retain ( );
+	
+	clock_interval_to_deadline ( kWriteGatherFlushDelayMS, kMillisecondScale, &deadline );
+	if ( thread_call_enter_delayed ( fWriteGatherThread, deadline ) == true )
+	{
+		
+		// A flush was already scheduled and holds its own retain.
+		release ( );
+		
+	}
+	
+	
+Exit:
+	
+	
+	return;
+	
+}
+
+
+//
+//	 RequestWriteGatherFlush - Has the gathered ECC block written out right
+//								away. Reads and writes which depend on it are
+//								held back until then. Must be called with
+//								fWriteGatherLock held.				  [PRIVATE]
+//
+
+void
+IOSCSIMultimediaCommandsDevice::RequestWriteGatherFlush ( void )
+{
+	
+	fWriteGatherFlushing = true;
+	
+	// Retain ourselves so that this object doesn't go away
+	// while the flush is scheduled.
+	retain ( );
+	
+	if ( thread_call_enter ( fWriteGatherThread ) == true )
+	{
+		
+		// A flush was already scheduled and holds its own retain. It now
+		// runs right away.
+		release ( );
+		
+	}
+	
+}
+
+
+//
+//	 DeferWriteGatherRequest - Queues a read or write to be sent again once
+//								the gathered ECC block has been written out.
+//								Must be called with fWriteGatherLock held.
+//																	  [PRIVATE]
+//
+
+bool
+IOSCSIMultimediaCommandsDevice::DeferWriteGatherRequest (
+										IOMemoryDescriptor *	buffer,
+										void *					clientData,
+										UInt64					startBlock,
+										UInt64					blockCount,
+										bool					write )
+{
+	
+	SCSIWriteGatherRequest *	request		= NULL;
+	SCSIWriteGatherRequest **	tail		= NULL;
+	bool						result		= false;
+	
+	request = IONew ( SCSIWriteGatherRequest, 1 );
+	require_nonzero ( request, ErrorExit );
+	
+	request->buffer		= buffer;
+	request->clientData	= clientData;
+	request->startBlock	= startBlock;
+	request->blockCount	= blockCount;
+	request->write		= write;
+	request->next		= NULL;
+	
+	for ( tail = &fWriteGatherDeferred; *tail != NULL; tail = &( *tail )->next )
+		;
+	
+	*tail	= request;
+	result	= true;
+	
+	
+ErrorExit:
+	
+	
+	return result;
+	
+}
+
+
+//
+//	 ServiceWriteGather - 	Writes out the gathered ECC block and sends the
+//							requests held back for it again. Runs on
+//							fWriteGatherThread.						  [PRIVATE]
+//
+
+void
+IOSCSIMultimediaCommandsDevice::ServiceWriteGather ( void )
+{
+	
+	SCSIWriteGatherRequest *	request		= NULL;
+	SCSIWriteGatherRequest *	next		= NULL;
+	SCSIWriteGatherRequest **	tail		= NULL;
+	IOReturn					status		= kIOReturnSuccess;
+	
+	IOLockLock ( fWriteGatherLock );
+	
+	// Hold new writes back and wait for those already sent, so the fill
+	// read and the write of the ECC block reach the drive after them.
+	fWriteGatherFlushing = true;
+	
+	while ( fWriteGatherWritesInFlight != 0 )
+	{
+		IOLockSleep ( fWriteGatherLock, &fWriteGatherWritesInFlight, THREAD_UNINT );
+	}
+	
+	if ( fWriteGatherValid != 0 )
+	{
+		
+		// Nothing else touches the gathered block while fWriteGatherFlushing
+		// is set, so the lock isn't held across the commands.
+		IOLockUnlock ( fWriteGatherLock );
+		status = FlushWriteGather ( );
+		IOLockLock ( fWriteGatherLock );
+		
+		if ( ( status != kIOReturnSuccess ) && ( fWriteGatherStatus == kIOReturnSuccess ) )
+		{
+			fWriteGatherStatus = status;
+		}
+		
+		fWriteGatherValid = 0;
+		
+	}
+	
+	request					= fWriteGatherDeferred;
+	fWriteGatherDeferred	= NULL;
+	fWriteGatherFlushing	= false;
+	
+	IOLockWakeup ( fWriteGatherLock, &fWriteGatherFlushing, false );
+	IOLockUnlock ( fWriteGatherLock );
+	
+	// Send what was held back again, in order.
+	while ( request != NULL )
+	{
+		
+		IOLockLock ( fWriteGatherLock );
+		
+		if ( fWriteGatherFlushing == true )
+		{
+			
+			// A request sent again started another flush. The rest wait for
+			// that one too, ahead of anything held back since.
+			for ( tail = &request->next; *tail != NULL; tail = &( *tail )->next )
+				;
+			
+			*tail					= fWriteGatherDeferred;
+			fWriteGatherDeferred	= request;
+			
+			IOLockUnlock ( fWriteGatherLock );
+			break;
+			
+		}
+		
+		IOLockUnlock ( fWriteGatherLock );
+		
+		next = request->next;
+		
+		if ( request->write == true )
+		{
+			status = IssueWrite ( request->buffer, request->clientData, request->startBlock, request->blockCount );
+		}
+		
+		else
+		{
+			status = IssueRead ( request->buffer, request->clientData, request->startBlock, request->blockCount );
+		}
+		
+		if ( status != kIOReturnSuccess )
+		{
+			CompleteWriteGatherClient ( request->clientData, status, 0 );
+		}
+		
+		IODelete ( request, SCSIWriteGatherRequest, 1 );
+		request = next;
+		
+	}
+	
+}
+
+
+//
+//	 UngatheredWriteDone - Called when a write counted by GatherWrite as
+//							sent as it is has completed.			  [PRIVATE]
+//
+
+void
+IOSCSIMultimediaCommandsDevice::UngatheredWriteDone ( void )
+{
+	
+	require_nonzero_quiet ( fWriteGatherLock, ErrorExit );
+	
+	IOLockLock ( fWriteGatherLock );
+	
+	fWriteGatherWritesInFlight--;
+	if ( fWriteGatherWritesInFlight == 0 )
+	{
+		IOLockWakeup ( fWriteGatherLock, &fWriteGatherWritesInFlight, false );
+	}
+	
+	IOLockUnlock ( fWriteGatherLock );
+	
+	
+ErrorExit:
+	
+	
+	return;
+	
+}
+
+
+//
+//	 CompleteWriteGatherClient - Completes a read or write the write gather
+//								  took over.						  [PRIVATE]
+//
+
+void
+IOSCSIMultimediaCommandsDevice::CompleteWriteGatherClient ( void *		clientData,
+															 IOReturn	status,
+															 UInt64		byteCount )
+{
+	
+	if ( fSupportedDVDFeatures & kDVDFeaturesReadStructuresMask )
+	{
+		IODVDServices::AsyncReadWriteComplete ( clientData, status, byteCount );
+	}
+	
+	else
+	{	
+		IOCompactDiscServices::AsyncReadWriteComplete ( clientData, status, byteCount );
+	}
+	
+}
+
+
+//
+//	 GetStreamingPerformance - Gets the slowest nominal read rate the drive
+//								reports over the given blocks.		  [PRIVATE]
+//
+
+IOReturn
+IOSCSIMultimediaCommandsDevice::GetStreamingPerformance (
+									UInt32		startBlock,
+									UInt32		endBlock,
+									UInt32 *	kilobytesPerSecond )
+{
+	
+	SCSIServiceResponse			serviceResponse = kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
+	SCSITaskIdentifier			request			= NULL;
+	IOBufferMemoryDescriptor *	bufferDesc		= NULL;
+	UInt8 *						buffer			= NULL;
+	UInt8 *						descriptor		= NULL;
+	UInt32						bufferSize		= 0;
+	UInt32						dataLength		= 0;
+	UInt32						count			= 0;
+	UInt32						index			= 0;
+	UInt32						rate			= 0;
+	IOReturn					status			= kIOReturnNoResources;
+	
+	*kilobytesPerSecond = 0;
+	
+	bufferSize = PERFORMANCE_HEADER_SIZE +
+				 ( NOMINAL_PERFORMANCE_DESCRIPTOR_SIZE * kStreamingPerformanceDescriptors );
+	
+	bufferDesc = IOBufferMemoryDescriptor::withCapacity ( bufferSize, kIODirectionIn );
+	require_nonzero ( bufferDesc, ErrorExit );
+	
+	buffer = ( UInt8 * ) bufferDesc->getBytesNoCopy ( );
+	bzero ( buffer, bufferSize );
+	
+	request = GetSCSITask ( );
+	require_nonzero ( request, ReleaseDescriptor );
+	
+	if ( GET_PERFORMANCE ( request,
+						   bufferDesc,
+						   kStreamingPerformanceTolerance,
+						   0, /* Read performance */
+						   0, /* Nominal performance */
+						   startBlock,
+						   kStreamingPerformanceDescriptors,
+						   0 ) == true )
+	{
+		// The command was successfully built, now send it
+		serviceResponse = SendCommand ( request, kThirtySecondTimeoutInMS );
+	}
+	
+	require_action ( ( ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE ) &&
+					   ( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD ) ),
+					 ReleaseTask,
+					 status = kIOReturnIOError );
+	
+	require_action ( ( GetRealizedDataTransferCount ( request ) >= PERFORMANCE_HEADER_SIZE ),
+					 ReleaseTask,
+					 status = kIOReturnUnderrun );
+	
+	// The performance data length doesn't include itself.
+	dataLength = OSReadBigInt32 ( buffer, 0 ) + sizeof ( UInt32 );
+	dataLength = min ( dataLength, GetRealizedDataTransferCount ( request ) );
+	
+	if ( dataLength > PERFORMANCE_HEADER_SIZE )
+	{
+		
+		count = ( dataLength - PERFORMANCE_HEADER_SIZE ) / NOMINAL_PERFORMANCE_DESCRIPTOR_SIZE;
+		count = min ( count, kStreamingPerformanceDescriptors );
+		
+	}
+	
+	for ( index = 0; index < count; index++ )
+	{
+		
+		// Each descriptor gives the rate at the start and end of a range
+		// of blocks.
+		descriptor = buffer + PERFORMANCE_HEADER_SIZE + ( index * NOMINAL_PERFORMANCE_DESCRIPTOR_SIZE );
+		
+		if ( ( OSReadBigInt32 ( descriptor, 0 ) > endBlock ) ||
+			 ( OSReadBigInt32 ( descriptor, 8 ) < startBlock ) )
+		{
+			continue;
+		}
+		
+		rate = min ( OSReadBigInt32 ( descriptor, 4 ), OSReadBigInt32 ( descriptor, 12 ) );
+		
+		if ( ( *kilobytesPerSecond == 0 ) || ( rate < *kilobytesPerSecond ) )
+		{
+			*kilobytesPerSecond = rate;
+		}
+		
+	}
+	
+	status = ( *kilobytesPerSecond != 0 ) ? kIOReturnSuccess : kIOReturnUnsupported;
+	
+	
+ReleaseTask:
+	
+	
+	require_nonzero_quiet ( request, ReleaseDescriptor );
+	ReleaseSCSITask ( request );
+	request = NULL;
+	
+	
+ReleaseDescriptor:
+	
+	
+	require_nonzero_quiet ( bufferDesc, ErrorExit );
+	bufferDesc->release ( );
+	bufferDesc = NULL;
+	
+	
+ErrorExit:
+	
+	
+	return status;
+	
+}
+
+
+//
+//	 SendStreamingDescriptor - Sends a SET STREAMING performance descriptor.
+//																	  [PRIVATE]
+//
+
+IOReturn
+IOSCSIMultimediaCommandsDevice::SendStreamingDescriptor ( UInt8 * descriptor )
+{
+	
+	SCSIServiceResponse		serviceResponse = kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
+	SCSITaskIdentifier		request			= NULL;
+	IOMemoryDescriptor *	bufferDesc		= NULL;
+	IOReturn				status			= kIOReturnNoResources;
+	
+	bufferDesc = IOMemoryDescriptor::withAddress ( descriptor,
+												   kStreamingDescriptorSize,
+												   kIODirectionOut );
+	require_nonzero ( bufferDesc, ErrorExit );
+	
+	request = GetSCSITask ( );
+	require_nonzero ( request, ReleaseDescriptor );
+	
+	if ( SET_STREAMING ( request,
+						 bufferDesc,
+						 kStreamingDescriptorSize,
+						 0 ) == true )
+	{
+		// The command was successfully built, now send it
+		serviceResponse = SendCommand ( request, kThirtySecondTimeoutInMS );
+	}
+	
+	if ( ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE ) &&
+		 ( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD ) )
+	{
+		status = kIOReturnSuccess;
+	}
+	
+	else
+	{
+		status = kIOReturnIOError;
+	}
+	
+	ReleaseSCSITask ( request );
+	request = NULL;
+	
+	
+ReleaseDescriptor:
+	
+	
+	bufferDesc->release ( );
+	bufferDesc = NULL;
+	
+	
+ErrorExit:
+	
+	
+	return status;
+	
+}
+
+
+//
+//	 RecordStreamingRead - Watches reads for a sequential stream, and has
+//							the drive set up for it once one is seen.
+//																	  [PRIVATE]
+//
+
+void
+IOSCSIMultimediaCommandsDevice::RecordStreamingRead ( UInt64 startBlock,
+													  UInt64 blockCount )
+{
+	
+	bool	schedule = false;
+	
+	require_nonzero_quiet ( fStreamingThread, ErrorExit );
+	require_quiet ( ( fDeviceCapabilities & kDeviceCapability_RealTimeStreaming ), ErrorExit );
+	
+	// Concurrent reads may race here, which at worst delays or repeats
+	// setting up the stream.
+	if ( startBlock == fStreamNextBlock )
+	{
+		fStreamSequentialCount++;
+	}
+	
+	else
+	{
+		fStreamSequentialCount = 0;
+	}
+	
+	fStreamNextBlock = startBlock + blockCount;
+	
+	if ( fStreamSequentialCount == kStreamingSequentialThreshold )
+	{
+		
+		// A new stream.
+		fStreamReadAheadBlock = 0;
+		schedule = true;
+		
+	}
+	
+	else if ( ( fStreamSequentialCount > kStreamingSequentialThreshold ) &&
+			  ( fStreamReadAheadBlock != 0 ) &&
+			  ( fStreamNextBlock >= fStreamReadAheadBlock ) )
+	{
+		
+		// The stream has caught up with the last read ahead.
+		fStreamReadAheadBlock = 0;
+		schedule = true;
+		
+	}
+	
+	require_quiet ( schedule, ErrorExit );
+	
+	// Retain ourselves so that this object doesn't go away
+	// while the update is scheduled.
+	retain ( );
+	
+	if ( thread_call_enter ( fStreamingThread ) == true )
+	{
+		
+		// An update was already scheduled and holds its own retain.
+		release ( );
+		
+	}
+	
+	
+ErrorExit:
+	
+	
+	return;
+	
+}
+
+
+//
+//	 ProgramStreaming - 	Sets the drive up for the current stream, and
+//							asks it to read ahead of it.			  [PRIVATE]
+//
+
+void
+IOSCSIMultimediaCommandsDevice::ProgramStreaming ( void )
+{
+	
+	SCSIServiceResponse		serviceResponse = kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
+	SCSITaskIdentifier		request			= NULL;
+	UInt64					nextBlock		= fStreamNextBlock;
+	UInt64					lastBlock		= 0;
+	
+	require_quiet ( fMediaPresent, ErrorExit );
+	require_nonzero_quiet ( fMediaBlockCount, ErrorExit );
+	require_quiet ( ( nextBlock < fMediaBlockCount ), ErrorExit );
+	
+	lastBlock = fMediaBlockCount - 1;
+	
+	if ( ( fStreamingEnabled == false ) ||
+		 ( nextBlock < fStreamingStartBlock ) ||
+		 ( nextBlock > fStreamingEndBlock ) )
+	{
+		
+		// Stream from here to the end of the medium. Reads still work
+		// if the drive can't stream, so the result doesn't matter.
+		( void ) EnableStreaming ( nextBlock, lastBlock );
+		
+	}
+	
+	request = GetSCSITask ( );
+	require_nonzero ( request, ErrorExit );
+	
+	// Once the drive reads the next block of the stream, it reads ahead
+	// from the block after it.
+	if ( SET_READ_AHEAD ( request,
+						  nextBlock,
+						  min ( nextBlock + 1, lastBlock ),
+						  0 ) == true )
+	{
+		// The command was successfully built, now send it
+		serviceResponse = SendCommand ( request, kTenSecondTimeoutInMS );
+	}
+	
+	if ( ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE ) &&
+		 ( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD ) )
+	{
+		
+		// Set the trigger again further into the stream.
+		fStreamReadAheadBlock = nextBlock + ( kStreamingReadAheadBlocks / 2 );
+		
+	}
+	
+	ReleaseSCSITask ( request );
+	request = NULL;
+	
+	UpdateStreamingStatistics ( );
+	
+	
+ErrorExit:
+	
+	
+	return;
+	
+}
+
+
+//
+//	 UpdateStreamingStatistics - 	Publishes the negotiated and achieved
+//									streaming rates.				  [PRIVATE]
+//
+
+void
+IOSCSIMultimediaCommandsDevice::UpdateStreamingStatistics ( void )
+{
+	
+	OSNumber *	number			= NULL;
+	UInt64		now				= 0;
+	UInt64		elapsedTime		= 0;
+	UInt64		achievedRate	= 0;
+	
+	if ( fStreamingEnabled == true )
+	{
+		
+		clock_get_uptime ( &now );
+		absolutetime_to_nanoseconds ( now - fStreamStartTime, &elapsedTime );
+		
+		// Kilobytes per second, from bytes and milliseconds.
+		elapsedTime /= kMillisecondScale;
+		if ( elapsedTime != 0 )
+		{
+			achievedRate = ( fStreamByteCount * 1000 ) / ( elapsedTime * 1024 );
+		}
+		
+	}
+	
+	if ( fStreamingStatistics == NULL )
+	{
+		
+		fStreamingStatistics = OSDictionary::withCapacity ( 3 );
+		require_nonzero ( fStreamingStatistics, ErrorExit );
+		
+		number = OSNumber::withNumber ( fStreamingCount, 32 );
+		require_nonzero ( number, ErrorExit );
+		fStreamingStatistics->setObject ( kIOPropertyStreamingCountKey, number );
+		number->release ( );
+		
+		number = OSNumber::withNumber ( fStreamingRate, 32 );
+		require_nonzero ( number, ErrorExit );
+		fStreamingStatistics->setObject ( kIOPropertyStreamingNegotiatedRateKey, number );
+		number->release ( );
+		
+		number = OSNumber::withNumber ( achievedRate, 32 );
+		require_nonzero ( number, ErrorExit );
+		fStreamingStatistics->setObject ( kIOPropertyStreamingAchievedRateKey, number );
+		number->release ( );
+		
+		setProperty ( kIOPropertyStreamingStatisticsKey, fStreamingStatistics );
+		goto ErrorExit;
+		
+	}
+	
+	number = OSDynamicCast ( OSNumber, fStreamingStatistics->getObject ( kIOPropertyStreamingCountKey ) );
+	if ( number != NULL )
+		number->setValue ( fStreamingCount );
+	
+	number = OSDynamicCast ( OSNumber, fStreamingStatistics->getObject ( kIOPropertyStreamingNegotiatedRateKey ) );
+	if ( number != NULL )
+		number->setValue ( fStreamingRate );
+	
+	number = OSDynamicCast ( OSNumber, fStreamingStatistics->getObject ( kIOPropertyStreamingAchievedRateKey ) );
+	if ( number != NULL )
+		number->setValue ( achievedRate );
+	
+	
+ErrorExit:
+	
+	
+	return;
+	
+}
+
+
+//
+//	 CreateAudioExtraction - 	Allocates the resources used to extract
+//								audio.								  [PRIVATE]
+//
+
+bool
+IOSCSIMultimediaCommandsDevice::CreateAudioExtraction ( void )
+{
+	
+	OSNumber *	number	= NULL;
+	UInt32		index	= 0;
+	bool		result	= false;
+	
+	fAudioExtractionLock = IOSimpleLockAlloc ( );
+	require_nonzero ( fAudioExtractionLock, ErrorExit );
+	
+	fAudioExtractionStatistics = OSDictionary::withCapacity ( kAudioExtractionStatisticsCount );
+	require_nonzero ( fAudioExtractionStatistics, FreeLock );
+	
+	for ( index = 0; index < kAudioExtractionStatisticsCount; index++ )
+	{
+		
+		number = OSNumber::withNumber ( 0ULL, 64 );
+		require_nonzero ( number, ReleaseStatistics );
+		fAudioExtractionStatistics->setObject ( gAudioExtractionStatisticsKeys[index], number );
+		number->release ( );
+		
+	}
+	
+	fAudioRereadThread = thread_call_allocate (
+					( thread_call_func_t ) IOSCSIMultimediaCommandsDevice::sRereadAudioSectors,
+					( thread_call_param_t ) this );
+	require_nonzero ( fAudioRereadThread, ReleaseStatistics );
+	
+	result = true;
+	goto ErrorExit;
+	
+	
+ReleaseStatistics:
+	
+	
+	fAudioExtractionStatistics->release ( );
+	fAudioExtractionStatistics = NULL;
+	
+	
+FreeLock:
+	
+	
+	IOSimpleLockFree ( fAudioExtractionLock );
+	fAudioExtractionLock = NULL;
+	
+	
+ErrorExit:
+	
+	
+	return result;
+	
+}
+
+
+//
+//	 FreeAudioExtraction - Frees the audio extraction resources.	  [PRIVATE]
+//
+
+void
+IOSCSIMultimediaCommandsDevice::FreeAudioExtraction ( void )
+{
+	
+	if ( fAudioRereadThread != NULL )
+	{
+		
+		thread_call_free ( fAudioRereadThread );
+		fAudioRereadThread = NULL;
+		
+	}
+	
+	if ( fAudioExtractionStatistics != NULL )
+	{
+		
+		fAudioExtractionStatistics->release ( );
+		fAudioExtractionStatistics = NULL;
+		
+	}
+	
+	if ( fAudioExtractionLock != NULL )
+	{
+		
+		IOSimpleLockFree ( fAudioExtractionLock );
+		fAudioExtractionLock = NULL;
+		
+	}
+	
+}
+
+
+//
+//	 ExtractAudio - 	Reads CD-DA sectors with C2 error pointers,
+//						kAudioExtractionDepth chunks at a time. The client
+//						is completed once any flagged sectors have been
+//						read again.									  [PRIVATE]
+//
+
+IOReturn
+IOSCSIMultimediaCommandsDevice::ExtractAudio ( IOMemoryDescriptor *	buffer,
+											   UInt32				startBlock,
+											   UInt32				blockCount,
+											   CDSectorArea			sectorArea,
+											   void *				clientData )
+{
+	
+	SCSIAudioExtraction *	extraction	= NULL;
+	UInt32					index		= 0;
+	IOReturn				status		= kIOReturnBadArgument;
+	
+	require ( ( blockCount != 0 ), ErrorExit );
+	
+	extraction = IONew ( SCSIAudioExtraction, 1 );
+	require_nonzero_action ( extraction, ErrorExit, status = kIOReturnNoResources );
+	bzero ( extraction, sizeof ( SCSIAudioExtraction ) );
+	
+	// User data is followed by the C2 error pointers, then by whichever
+	// sub-channel data was asked for.
+	extraction->sectorSize = kAudioSectorSize + C2_ERROR_BLOCK_DATA_SIZE;
+	extraction->subChannelOffset = extraction->sectorSize;
+	
+	if ( sectorArea & kCDSectorAreaSubChannel )
+	{
+		
+		extraction->subChannel = 0x1;
+		extraction->sectorSize += SUBCHANNEL_DATA_SIZE;
+		
+	}
+	
+	else if ( sectorArea & kCDSectorAreaSubChannelQ )
+	{
+		
+		extraction->subChannel = 0x2;
+		extraction->sectorSize += SUBCHANNELQ_DATA_SIZE;
+		
+	}
+	
+	require ( ( buffer->getLength ( ) >= ( ( UInt64 ) blockCount * extraction->sectorSize ) ), ReleaseExtraction );
+	
+	extraction->buffer		= buffer;
+	extraction->clientData	= clientData;
+	extraction->startBlock	= startBlock;
+	extraction->blockCount	= blockCount;
+	extraction->chunkCount	= ( blockCount + kAudioExtractionChunkBlocks - 1 ) / kAudioExtractionChunkBlocks;
+	extraction->references	= 1;
+	extraction->status		= kIOReturnSuccess;
+	extraction->bitmapSize	= ( blockCount + 7 ) / 8;
+	
+	extraction->chunks = IONew ( SCSIAudioExtractionChunk, extraction->chunkCount );
+	require_nonzero_action ( extraction->chunks, ReleaseExtraction, status = kIOReturnNoResources );
+	bzero ( extraction->chunks, sizeof ( SCSIAudioExtractionChunk ) * extraction->chunkCount );
+	
+	extraction->flagged = ( UInt8 * ) IOMalloc ( extraction->bitmapSize * 2 );
+	require_nonzero_action ( extraction->flagged, ReleaseChunks, status = kIOReturnNoResources );
+	bzero ( extraction->flagged, extraction->bitmapSize * 2 );
+	extraction->missing = extraction->flagged + extraction->bitmapSize;
+	
+	for ( index = 0; index < extraction->chunkCount; index++ )
+	{
+		
+		extraction->chunks[index].extraction = extraction;
+		extraction->chunks[index].firstBlock = index * kAudioExtractionChunkBlocks;
+		extraction->chunks[index].blockCount = min ( kAudioExtractionChunkBlocks,
+													 blockCount - extraction->chunks[index].firstBlock );
+		
+	}
+	
+	clock_get_uptime ( &extraction->startTime );
+	
+	// Each completion sends the next chunk, which keeps the pipeline full.
+	for ( index = 0; index < kAudioExtractionDepth; index++ )
+	{
+		
+		if ( IssueAudioExtractionChunk ( extraction ) == false )
+			break;
+		
+	}
+	
+	// Drop the issuer's reference. If every chunk has already completed,
+	// this finishes the extraction.
+	ReleaseAudioExtraction ( extraction );
+	status = kIOReturnSuccess;
+	goto ErrorExit;
+	
+	
+ReleaseChunks:
+	
+	
+	IODelete ( extraction->chunks, SCSIAudioExtractionChunk, extraction->chunkCount );
+	
+	
+ReleaseExtraction:
+	
+	
+	IODelete ( extraction, SCSIAudioExtraction, 1 );
+	extraction = NULL;
+	
+	
+ErrorExit:
+	
+	
+	return status;
+	
+}
+
+
+//
+//	 IssueAudioExtractionChunk - 	Sends the next chunk of an extraction.
+//									A chunk which cannot be sent has all its
+//									sectors flagged, and the one after it is
+//									tried. Returns false once there are no
+//									chunks left to send, or once the
+//									extraction has failed.			  [PRIVATE]
+//
+
+bool
+IOSCSIMultimediaCommandsDevice::IssueAudioExtractionChunk (
+										SCSIAudioExtraction * extraction )
+{
+	
+	SCSIAudioExtractionChunk *	chunk	= NULL;
+	UInt32						index	= 0;
+	UInt32						block	= 0;
+	bool						result	= false;
+	
+	while ( result == false )
+	{
+		
+		if ( extraction->status != kIOReturnSuccess )
+			break;
+		
+		index = OSIncrementAtomic ( &extraction->nextChunk );
+		if ( index >= extraction->chunkCount )
+			break;
+		
+		chunk	= &extraction->chunks[index];
+		result	= SendAudioExtractionChunk ( chunk );
+		
+		if ( result == false )
+		{
+			
+			// Read its sectors one at a time later.
+			for ( block = chunk->firstBlock; block < chunk->firstBlock + chunk->blockCount; block++ )
+			{
+				
+				if ( OSTestAndSet ( block, extraction->flagged ) == false )
+				{
+					OSIncrementAtomic ( &extraction->flaggedCount );
+				}
+				
+				OSTestAndSet ( block, extraction->missing );
+				
+			}
+			
+		}
+		
+	}
+	
+	return result;
+	
+}
+
+
+//
+//	 SendAudioExtractionChunk - 	Sends the READ CD for a chunk of an
+//									extraction.						  [PRIVATE]
+//
+
+bool
+IOSCSIMultimediaCommandsDevice::SendAudioExtractionChunk (
+										SCSIAudioExtractionChunk * chunk )
+{
+	
+	SCSIAudioExtraction *	extraction	= chunk->extraction;
+	SCSITaskIdentifier		request		= NULL;
+	bool					result		= false;
+	
+	chunk->buffer = IOSubMemoryDescriptor::withSubRange ( extraction->buffer,
+														  chunk->firstBlock * extraction->sectorSize,
+														  chunk->blockCount * extraction->sectorSize,
+														  kIODirectionIn );
+	require_nonzero ( chunk->buffer, ErrorExit );
+	
+	request = GetSCSITask ( );
+	require_nonzero ( request, ReleaseBuffer );
+	
+	if ( READ_CD (	request,
+					chunk->buffer,
+					kCDSectorTypeCDDA,
+					0,
+					extraction->startBlock + chunk->firstBlock,
+					chunk->blockCount,
+					0,
+					0,
+					0x1,
+					0,
+					0x1,
+					extraction->subChannel,
+					0 ) == true )
+	{
+		
+		// The chunk holds a reference until it completes.
+		OSIncrementAtomic ( &extraction->references );
+		SetApplicationLayerReference ( request, chunk );
+		
+		// The command was successfully built, now send it
+		SendCommand ( request, fReadTimeoutDuration, &IOSCSIMultimediaCommandsDevice::AudioExtractionComplete );
+		result = true;
+		goto ErrorExit;
+		
+	}
+	
+	ReleaseSCSITask ( request );
+	request = NULL;
+	
+	
+ReleaseBuffer:
+	
+	
+	chunk->buffer->release ( );
+	chunk->buffer = NULL;
+	
+	
+ErrorExit:
+	
+	
+	return result;
+	
+}
+
+
+//
+//	 GetAudioExtractionStatus - 	Sorts the outcome of a READ CD sent for
+//									an extraction. Returns kIOReturnSuccess
+//									if the drive returned the data, even if
+//									it had to recover it, and kIOReturnIOError
+//									for a medium error, which re-reading may
+//									get past. Anything else fails the whole
+//									extraction.						  [PRIVATE]
+//
+
+IOReturn
+IOSCSIMultimediaCommandsDevice::GetAudioExtractionStatus (
+										SCSITaskIdentifier request )
+{
+	
+	SCSI_Sense_Data		senseDataBuffer;
+	SCSISenseCategory	category	= kSCSISenseCategory_Other;
+	IOReturn			status		= kIOReturnDeviceError;
+	
+	if ( GetServiceResponse ( request ) != kSCSIServiceResponse_TASK_COMPLETE )
+		goto ErrorExit;
+	
+	if ( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD )
+	{
+		
+		status = kIOReturnSuccess;
+		goto ErrorExit;
+		
+	}
+	
+	require_quiet ( ( GetTaskStatus ( request ) == kSCSITaskStatus_CHECK_CONDITION ), ErrorExit );
+	require_quiet ( GetAutoSenseData ( request, &senseDataBuffer, sizeof ( senseDataBuffer ) ), ErrorExit );
+	
+	// Counts the error against this unit and logs it, rate limited.
+	category = RecordSenseData ( &senseDataBuffer );
+	
+	ERROR_LOG ( ( "SAM Multimedia: READ CD failed, ASC = 0x%02x, ASCQ = 0x%02x\n", 
+	senseDataBuffer.ADDITIONAL_SENSE_CODE,
+	senseDataBuffer.ADDITIONAL_SENSE_CODE_QUALIFIER ) );
+	
+	switch ( category )
+	{
 		
+		case kSCSISenseCategory_RecoveredError:
 		{
-			// The command was successfully built, now send it
-			serviceResponse = SendCommand ( request, kThirtySecondTimeoutInMS );
+			status = kIOReturnSuccess;
 		}
+		break;
 		
-		if ( ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE ) &&
-			 ( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD ) )
+		case kSCSISenseCategory_MediumError:
+		{
+			status = kIOReturnIOError;
+		}
+		break;
+		
+		case kSCSISenseCategory_MediumNotPresent:
+		case kSCSISenseCategory_MediumChanged:
 		{
 			
-			UInt8 *		profilePtr;
+			// Message up the chain that we do not have media
+			messageClients ( kIOMessageMediaStateHasChanged,
+							( void * ) kIOMediaStateOffline );
 			
-			profilePtr = buffer + kProfileFeatureHeaderSize;
+			ResetMediaCharacteristics ( );
+			fPollingMode = kPollingMode_NewMedia;
+			EnablePolling ( );
 			
-			if ( profilePtr[2] & 0x01 )
+			status = kIOReturnNoMedia;
+			
+		}
+		break;
+		
+		case kSCSISenseCategory_BecomingReady:
+		case kSCSISenseCategory_NeedsStart:
+		case kSCSISenseCategory_NotReady:
+		{
+			status = kIOReturnNotReady;
+		}
+		break;
+		
+		case kSCSISenseCategory_IllegalRequest:
+		{
+			
+			if ( ( senseDataBuffer.ADDITIONAL_SENSE_CODE == 0x64 ) &&
+				 ( senseDataBuffer.ADDITIONAL_SENSE_CODE_QUALIFIER == 0x00 ) )
 			{
 				
-				STATUS_LOG ( ( "fMediaType = DVD+R\n" ) );
-				fMediaType = kDVDMediaTypePlusR;
+				// The caller is trying to read blocks for which the block type
+				// doesn't match.
+				status = kIOReturnUnsupportedMode;
+				
+			}
+			
+			else if ( ( senseDataBuffer.ADDITIONAL_SENSE_CODE == 0x6F ) &&
+					  ( ( senseDataBuffer.ADDITIONAL_SENSE_CODE_QUALIFIER == 0x01 ) ||
+						( senseDataBuffer.ADDITIONAL_SENSE_CODE_QUALIFIER == 0x02 ) ||
+						( senseDataBuffer.ADDITIONAL_SENSE_CODE_QUALIFIER == 0x03 ) ) )
+			{
+				
+				// The key is no longer present for reading these
+				// blocks->privileges error.
+				status = kIOReturnNotPrivileged;
 				
 			}
 			
 		}
+		break;
+		
+		default:
+			break;
 		
 	}
 	
-	if ( fMediaType != kCDMediaTypeUnknown )
-	{
-		mediaTypeFound = true;
-	}
-	
-	ReleaseSCSITask ( request );
-	
-	
-ReleaseDescriptor:
-	
-	
-	require_nonzero ( bufferDesc, Exit );
-	bufferDesc->release ( );
-	bufferDesc = NULL;
-	
 	
-Exit:
+ErrorExit:
 	
-	STATUS_LOG ( ( "IOSCSIMultimediaCommandsDevice::CheckForDVDMediaType EXIT\n" ) );
 	
-	return mediaTypeFound;
+	return status;
 	
 }
-		
+
 
 //
-//	 CheckForCDMediaType - Determines if the type of media is a CD media
-//							type.									[PROTECTED]
+//	 AudioExtractionCompletion - 	Completion routine for a chunk of an
+//									extraction. Flags the sectors which
+//									the drive reported C2 errors for, or
+//									the whole chunk on a medium error. Any
+//									other error fails the extraction.
+//																	  [PRIVATE]
 //
 
-bool
-IOSCSIMultimediaCommandsDevice::CheckForCDMediaType ( void )
+void
+IOSCSIMultimediaCommandsDevice::AudioExtractionCompletion (
+										SCSITaskIdentifier completedTask )
 {
 	
-	UInt8 *						buffer			= NULL;
-	IOBufferMemoryDescriptor * 	bufferDesc		= NULL;
-	SCSITaskIdentifier			request			= NULL;
-	SCSIServiceResponse			serviceResponse = kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
-	bool						mediaTypeFound	= false;
+	SCSIAudioExtractionChunk *	chunk		= NULL;
+	SCSIAudioExtraction *		extraction	= NULL;
+	UInt8						errorFlags[C2_ERROR_BLOCK_DATA_SIZE];
+	UInt32						block		= 0;
+	UInt64						offset		= 0;
+	UInt64						actCount	= 0;
+	bool						failed		= true;
+	IOReturn					status		= kIOReturnSuccess;
 	
-	bufferDesc = IOBufferMemoryDescriptor::withCapacity ( 4, kIODirectionIn );
-	require_nonzero ( bufferDesc, ErrorExit );
-	buffer = ( UInt8 * ) bufferDesc->getBytesNoCopy ( );
+	chunk = ( SCSIAudioExtractionChunk * ) GetApplicationLayerReference ( completedTask );
+	require_nonzero ( chunk, ErrorExit );
 	
-	request = GetSCSITask ( );
-	require_nonzero ( request, ReleaseDescriptor );
+	extraction	= chunk->extraction;
+	status		= GetAudioExtractionStatus ( completedTask );
 	
-	// Is this a writeable drive?
-	if ( fSupportedCDFeatures & kCDFeaturesWriteOnceMask )
+	if ( status == kIOReturnSuccess )
 	{
 		
-		// A writeable drive should support the READ_DISC_INFORMATION command.
-		// We can determine media type using it.
-		if ( READ_DISC_INFORMATION ( request,
-									 bufferDesc,
-									 bufferDesc->getLength ( ),
-									 0 ) == true )
+		actCount	= GetRealizedDataTransferCount ( completedTask );
+		failed		= ( actCount < ( ( UInt64 ) chunk->blockCount * extraction->sectorSize ) );
+		
+		OSAddAtomic64 ( chunk->blockCount, ( SInt64 * ) &fAudioSectorsRead );
+		
+		if ( fStreamingEnabled == true )
 		{
-			// The command was successfully built, now send it
-			serviceResponse = SendCommand ( request, kThirtySecondTimeoutInMS );
+			OSAddAtomic64 ( actCount, ( SInt64 * ) &fStreamByteCount );
 		}
 		
-		if ( ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE ) &&
-			 ( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD ) )
+	}
+	
+	ReleaseSCSITask ( completedTask );
+	
+	if ( ( status != kIOReturnSuccess ) && ( status != kIOReturnIOError ) )
+	{
+		
+		// Re-reading cannot help, so stop sending chunks. The first error
+		// is the one the client sees.
+		OSCompareAndSwap ( ( UInt32 ) kIOReturnSuccess, ( UInt32 ) status,
+						   ( volatile UInt32 * ) &extraction->status );
+		
+	}
+	
+	for ( block = chunk->firstBlock;
+		  ( extraction->status == kIOReturnSuccess ) && ( block < chunk->firstBlock + chunk->blockCount );
+		  block++ )
+	{
+		
+		if ( failed == false )
 		{
 			
-			switch ( buffer[kDiscStatusOffset] & kDiscStatusMask )
-			{
-				
-				case kDiscStatusEmpty:
-				{
-					
-					STATUS_LOG ( ( "Blank media\n" ) );
-					fMediaBlockCount = 0;
-					STATUS_LOG ( ( "fMediaType = CD-R\n" ) );
-					fMediaType = kCDMediaTypeR;
-					mediaTypeFound = true;
-					break;
-					
-				}
-				
-				case kDiscStatusIncomplete:
-				{
-					
-					STATUS_LOG ( ( "fMediaType = CD-R\n" ) );
-					fMediaType = kCDMediaTypeR;
-					mediaTypeFound = true;
-					break;
-					
-				}
-				
-				case kDiscStatusComplete:					
-				{
-					
-					STATUS_LOG ( ( "fMediaType = CD-ROM\n" ) );
-					fMediaType = kCDMediaTypeROM;
-					mediaTypeFound = true;
-					break;
-					
-				}
-				
-				case kDiscStatusOther:
-				default:
-				{
-					break;
-				}
-				
-			}
+			offset = ( ( UInt64 ) block * extraction->sectorSize ) + kAudioSectorSize;
 			
-			// Check to see if it is erasable. If it is, it's CD-RW media
-			if ( buffer[kDiscStatusOffset] & kDiscStatusErasableMask )
+			if ( ( extraction->buffer->readBytes ( offset, errorFlags, sizeof ( errorFlags ) ) == sizeof ( errorFlags ) ) &&
+				 ( CountAudioSectorErrors ( errorFlags ) == 0 ) )
 			{
-				
-				STATUS_LOG ( ( "fMediaType = CD-RW\n" ) );
-				fMediaType = kCDMediaTypeRW;
-				mediaTypeFound = true;
-				
+				continue;
 			}
 			
 		}
 		
-	}
-	
-	// Were we able to determine the media type yet?
-	require_quiet ( ( mediaTypeFound == false ), ReleaseTask );
-	
-	// Media type not yet determined, check for CD-ROM media.
-	// Issue a READ_TOC_PMA_ATIP to find out if the media is
-	// finalized or not.
-	if ( READ_TOC_PMA_ATIP ( 	request,
-								bufferDesc,
-								0x00,
-								0x00,
-								0x00,
-								bufferDesc->getLength ( ),
-								0 ) == true )
-	{
+		if ( OSTestAndSet ( block, extraction->flagged ) == false )
+		{
+			OSIncrementAtomic ( &extraction->flaggedCount );
+		}
 		
-		// The command was successfully built, now send it
-		serviceResponse = SendCommand ( request, kThirtySecondTimeoutInMS );
+		if ( failed == true )
+		{
+			OSTestAndSet ( block, extraction->missing );
+		}
 		
 	}
 	
-	if ( ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE ) &&
-		 ( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD ) )
+	chunk->buffer->release ( );
+	chunk->buffer = NULL;
+	
+	( void ) IssueAudioExtractionChunk ( extraction );
+	ReleaseAudioExtraction ( extraction );
+	
+	
+ErrorExit:
+	
+	
+	return;
+	
+}
+
+
+//
+//	 ReleaseAudioExtraction - 	Drops a reference on an extraction. The
+//								last one completes it, or hands it to the
+//								re-read thread if sectors were flagged and
+//								it has not failed.
+//																	  [PRIVATE]
+//
+
+void
+IOSCSIMultimediaCommandsDevice::ReleaseAudioExtraction (
+										SCSIAudioExtraction * extraction )
+{
+	
+	SCSIAudioExtraction **	tail = NULL;
+	
+	require_quiet ( ( OSDecrementAtomic ( &extraction->references ) == 1 ), ErrorExit );
+	
+	if ( ( extraction->flaggedCount == 0 ) || ( extraction->status != kIOReturnSuccess ) )
 	{
 		
-		STATUS_LOG ( ( "fMediaType = CD-ROM\n" ) );
-		fMediaType = kCDMediaTypeROM;		
-		mediaTypeFound = true;
+		CompleteAudioExtraction ( extraction, extraction->status );
+		goto ErrorExit;
 		
 	}
 	
+	OSAddAtomic64 ( extraction->flaggedCount, ( SInt64 * ) &fAudioSectorsFlagged );
 	
-ReleaseTask:
+	IOSimpleLockLock ( fAudioExtractionLock );
 	
+	for ( tail = &fAudioRereadQueue; *tail != NULL; tail = &( *tail )->next )
+		;
 	
-	require_nonzero_quiet ( request, ReleaseDescriptor );
-	ReleaseSCSITask ( request );
-	request = NULL;
+	*tail = extraction;
 	
+	IOSimpleLockUnlock ( fAudioExtractionLock );
 	
-ReleaseDescriptor:
+	// The re-read holds a retain on us until it has run.
+	retain ( );
+	if ( thread_call_enter ( fAudioRereadThread ) == true )
+	{
+		release ( );
+	}
 	
 	
-	require_nonzero_quiet ( bufferDesc, ErrorExit );
-	bufferDesc->release ( );
-	bufferDesc = NULL;
+ErrorExit:
 	
 	
-ErrorExit:
+	return;
+	
+}
+
+
+//
+//	 DequeueAudioExtraction - 	Takes the next extraction off the re-read
+//								queue.								  [PRIVATE]
+//
+
+SCSIAudioExtraction *
+IOSCSIMultimediaCommandsDevice::DequeueAudioExtraction ( void )
+{
 	
+	SCSIAudioExtraction *	extraction = NULL;
 	
-	return mediaTypeFound;
+	IOSimpleLockLock ( fAudioExtractionLock );
+	
+	extraction = fAudioRereadQueue;
+	if ( extraction != NULL )
+	{
+		
+		fAudioRereadQueue = extraction->next;
+		extraction->next = NULL;
+		
+	}
+	
+	IOSimpleLockUnlock ( fAudioExtractionLock );
+	
+	return extraction;
 	
 }
 
 
 //
-//	 CheckWriteProtection - Determines write protect state of media.
-//																	[PROTECTED]
+//	 CompleteAudioExtraction - Completes an extraction back to its client
+//								and frees it.						  [PRIVATE]
 //
 
 void
-IOSCSIMultimediaCommandsDevice::CheckWriteProtection ( void )
+IOSCSIMultimediaCommandsDevice::CompleteAudioExtraction (
+										SCSIAudioExtraction *	extraction,
+										IOReturn				status )
 {
 	
-	SCSIServiceResponse		serviceResponse = kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
-	SCSITaskIdentifier		request			= NULL;
-	IOMemoryDescriptor *	bufferDesc		= NULL;
-	UInt8					buffer[16]		= { 0 };
+	void *		clientData	= extraction->clientData;
+	UInt64		byteCount	= 0;
+	UInt64		now			= 0;
 	
-	// Assume it is write protected
-	fMediaIsWriteProtected = true;
+	if ( status == kIOReturnSuccess )
+	{
+		
+		byteCount = ( UInt64 ) extraction->blockCount * extraction->sectorSize;
+		
+		clock_get_uptime ( &now );
+		OSAddAtomic64 ( byteCount, ( SInt64 * ) &fAudioBytesExtracted );
+		OSAddAtomic64 ( now - extraction->startTime, ( SInt64 * ) &fAudioExtractionTime );
+		
+	}
 	
-	require_quiet ( ( fMediaType == kDVDMediaTypeRAM ), Exit );
-	require_quiet ( ( fSupportedDVDFeatures & kDVDFeaturesRandomWriteableMask ), Exit );
+	UpdateAudioExtractionStatistics ( );
 	
-	bufferDesc = IOMemoryDescriptor::withAddress (	buffer,
-													sizeof ( buffer ),
-													kIODirectionIn );
-	require_nonzero ( bufferDesc, ErrorExit );
+	IOFree ( extraction->flagged, extraction->bitmapSize * 2 );
+	IODelete ( extraction->chunks, SCSIAudioExtractionChunk, extraction->chunkCount );
+	IODelete ( extraction, SCSIAudioExtraction, 1 );
+	extraction = NULL;
+	
+	if ( fSupportedDVDFeatures & kDVDFeaturesReadStructuresMask )
+	{
+		IODVDServices::AsyncReadWriteComplete ( clientData, status, byteCount );
+	}
+	
+	else
+	{	
+		IOCompactDiscServices::AsyncReadWriteComplete ( clientData, status, byteCount );
+	}
+	
+}
+
+
+//
+//	 RereadAudioSectors - 	Re-reads the flagged sectors of each queued
+//							extraction with the drive slowed down.	  [PRIVATE]
+//
+
+void
+IOSCSIMultimediaCommandsDevice::RereadAudioSectors ( void )
+{
 	
-	request = GetSCSITask ( );
-	require_nonzero ( request, ReleaseDescriptor );
+	SCSIAudioExtraction *	extraction	= NULL;
+	UInt16					savedSpeed	= fCurrentDiscSpeed;
 	
-	if ( GET_CONFIGURATION ( request,
-							 bufferDesc,
-							 0x02, /* Only one feature descriptor */
-							 kGetConfigurationProfile_RandomWrite,
-							 sizeof ( buffer ),
-							 0 ) == true )
+	// Most C2 errors are gone at a lower speed.
+	( void ) SetMediaAccessSpeed ( kAudioExtractionRereadSpeed );
+	
+	while ( ( extraction = DequeueAudioExtraction ( ) ) != NULL )
 	{
-		// The command was successfully built, now send it
-		serviceResponse = SendCommand ( request, kThirtySecondTimeoutInMS );
+		CompleteAudioExtraction ( extraction, RereadAudioExtraction ( extraction ) );
 	}
 	
-	if ( ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE ) &&
-		 ( GetTaskStatus ( request ) == kSCSITaskStatus_GOOD ) )
+	// A speed of zero means nobody set one, so let the drive go flat out.
+	( void ) SetMediaAccessSpeed ( ( savedSpeed != 0 ) ? savedSpeed : kAudioExtractionMaximumSpeed );
+	fCurrentDiscSpeed = savedSpeed;
+	
+}
+
+
+//
+//	 RereadAudioExtraction - 	Re-reads each flagged sector of an
+//								extraction, keeping the copy with the
+//								fewest C2 errors. Gives up on the first
+//								error other than a medium error.	  [PRIVATE]
+//
+
+IOReturn
+IOSCSIMultimediaCommandsDevice::RereadAudioExtraction (
+										SCSIAudioExtraction * extraction )
+{
+	
+	IOBufferMemoryDescriptor *	sectorBuffer	= NULL;
+	UInt8 *						sectorData		= NULL;
+	UInt8						errorFlags[C2_ERROR_BLOCK_DATA_SIZE];
+	UInt32						index			= 0;
+	UInt32						attempt			= 0;
+	UInt32						errors			= 0;
+	UInt32						fewestErrors	= 0;
+	UInt64						offset			= 0;
+	bool						haveData		= false;
+	IOReturn					readStatus		= kIOReturnSuccess;
+	IOReturn					status			= kIOReturnNoResources;
+	
+	sectorBuffer = IOBufferMemoryDescriptor::withCapacity ( extraction->sectorSize, kIODirectionIn );
+	require_nonzero ( sectorBuffer, ErrorExit );
+	
+	sectorData	= ( UInt8 * ) sectorBuffer->getBytesNoCopy ( );
+	status		= kIOReturnSuccess;
+	
+	for ( index = 0; index < extraction->blockCount; index++ )
 	{
 		
-		// The current bit in the Random Writable Descriptor
-		// tells us whether the disc is write protected. It is located
-		// at byte 2 of the Random Writable Descriptor Feature page
-		if ( buffer[kProfileFeatureHeaderSize + 2] & kRandomWritableProtectionMask )
+		if ( ( extraction->flagged[index >> 3] & ( 0x80 >> ( index & 7 ) ) ) == 0 )
+			continue;
+		
+		offset			= ( UInt64 ) index * extraction->sectorSize;
+		haveData		= ( ( extraction->missing[index >> 3] & ( 0x80 >> ( index & 7 ) ) ) == 0 );
+		fewestErrors	= 0xFFFFFFFF;
+		
+		if ( ( haveData == true ) &&
+			 ( extraction->buffer->readBytes ( offset + kAudioSectorSize, errorFlags, sizeof ( errorFlags ) ) == sizeof ( errorFlags ) ) )
+		{
+			fewestErrors = CountAudioSectorErrors ( errorFlags );
+		}
+		
+		for ( attempt = 0; ( attempt < kAudioExtractionRereadAttempts ) && ( fewestErrors != 0 ); attempt++ )
 		{
 			
-			fMediaIsWriteProtected = false;
+			OSAddAtomic64 ( 1, ( SInt64 * ) &fAudioSectorsReread );
+			
+			readStatus = ReadAudioSector ( extraction, extraction->startBlock + index, sectorBuffer );
+			if ( readStatus == kIOReturnIOError )
+				continue;
+			
+			// The media went away or the drive refused the read, so no
+			// amount of re-reading will help.
+			require_success_action ( readStatus, ReleaseBuffer, status = readStatus );
+			
+			errors = CountAudioSectorErrors ( sectorData + kAudioSectorSize );
+			if ( errors < fewestErrors )
+			{
+				
+				extraction->buffer->writeBytes ( offset, sectorData, extraction->sectorSize );
+				fewestErrors	= errors;
+				haveData		= true;
+				
+			}
+			
+		}
+		
+		if ( fewestErrors == 0 )
+		{
+			OSAddAtomic64 ( 1, ( SInt64 * ) &fAudioSectorsRecovered );
+		}
+		
+		// A sector still flagged after the last attempt goes back with its
+		// C2 pointers for the client to judge. One never read at all fails
+		// the request.
+		if ( haveData == false )
+		{
+			
+			ERROR_LOG ( ( "%s::%s could not read block %ld\n", getName ( ), __FUNCTION__,
+						  ( long ) ( extraction->startBlock + index ) ) );
+			status = kIOReturnIOError;
 			
 		}
 		
 	}
 	
-	ReleaseSCSITask ( request );
-	
 	
-ReleaseDescriptor:
+ReleaseBuffer:
 	
 	
-	require_nonzero_quiet ( bufferDesc, Exit );
-	bufferDesc->release ( );	
-	bufferDesc = NULL;
+	sectorBuffer->release ( );
+	sectorBuffer = NULL;
 	
 	
 ErrorExit:
-Exit:
 	
 	
-	return;
+	return status;
 	
 }
 
 
 //
-//	 IssueRead - DEPRECATED.										[PROTECTED]
-//
-
-IOReturn
-IOSCSIMultimediaCommandsDevice::IssueRead (
-							IOMemoryDescriptor *	buffer,
-							UInt64					startBlock,
-							UInt64					blockCount )
-{
-	return kIOReturnUnsupported;
-}
-
-
-
-//
-//	 IssueWrite - DEPRECATED.										[PROTECTED]
-//
-
-IOReturn
-IOSCSIMultimediaCommandsDevice::IssueWrite (
-							IOMemoryDescriptor *	buffer,
-							UInt64					startBlock,
-							UInt64					blockCount )
-{
-	return kIOReturnUnsupported;
-}
-
-
-
-//
-//	 IssueRead - Issues an asynchronous read request.				[PROTECTED]
+//	 ReadAudioSector - Reads a single sector of an extraction. With
+//						sub-channel Q, the sector's absolute address must
+//						match the one asked for, since a drive reading from
+//						a standstill may not land on it exactly. Returns
+//						as GetAudioExtractionStatus does.			  [PRIVATE]
 //
 
 IOReturn
-IOSCSIMultimediaCommandsDevice::IssueRead (
-							IOMemoryDescriptor *	buffer,
-							void *					clientData,
-							UInt64					startBlock,
-							UInt64					blockCount )
+IOSCSIMultimediaCommandsDevice::ReadAudioSector (
+										SCSIAudioExtraction *	extraction,
+										UInt32					block,
+										IOMemoryDescriptor *	buffer )
 {
 	
-	IOReturn 				status	= kIOReturnNoResources;
-	SCSITaskIdentifier		request	= NULL;
+	SCSIServiceResponse		serviceResponse = kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
+	SCSITaskIdentifier		request			= NULL;
+	UInt8					subChannelQ[SUBCHANNELQ_DATA_SIZE];
+	UInt32					address			= 0;
+	IOReturn				status			= kIOReturnIOError;
 	
 	request = GetSCSITask ( );
 	require_nonzero ( request, ErrorExit );
 	
-	if ( READ_10 ( 	request,
+	if ( READ_CD (	request,
 					buffer,
-					fMediaBlockSize,
+					kCDSectorTypeCDDA,
 					0,
+					block,
+					1,
 					0,
 					0,
-					startBlock,
-					blockCount,
+					0x1,
+					0,
+					0x1,
+					extraction->subChannel,
 					0 ) == true )
 	{
 		
-		SetApplicationLayerReference ( request, clientData );
-		
 		// The command was successfully built, now send it
-		SendCommand ( request,
-					  fReadTimeoutDuration,
-					  &IOSCSIMultimediaCommandsDevice::AsyncReadWriteComplete );
-		
-		status = kIOReturnSuccess;
+		serviceResponse = SendCommand ( request, fReadTimeoutDuration );
 		
 	}
 	
-	else
+	if ( serviceResponse == kSCSIServiceResponse_TASK_COMPLETE )
+	{
+		status = GetAudioExtractionStatus ( request );
+	}
+	
+	ReleaseSCSITask ( request );
+	request = NULL;
+	
+	require_success_quiet ( status, ErrorExit );
+	require_quiet ( ( extraction->subChannel == 0x2 ), ErrorExit );
+	
+	buffer->readBytes ( extraction->subChannelOffset, subChannelQ, sizeof ( subChannelQ ) );
+	
+	// Only mode 1 Q carries a position.
+	require_quiet ( ( ( subChannelQ[0] & kSubChannelQADRMask ) == kSubChannelQADRPosition ), ErrorExit );
+	
+	address = ( ( ConvertBCDToHex ( subChannelQ[kSubChannelQAbsoluteMinuteOffset] ) * SECONDS_IN_A_MINUTE ) +
+				  ConvertBCDToHex ( subChannelQ[kSubChannelQAbsoluteSecondOffset] ) ) * FRAMES_IN_A_SECOND +
+				  ConvertBCDToHex ( subChannelQ[kSubChannelQAbsoluteFrameOffset] );
+	
+	if ( address != ( block + LBA_0_OFFSET ) )
 	{
 		
-		status = kIOReturnBadArgument;
-		ReleaseSCSITask ( request );
-		request = NULL;
+		STATUS_LOG ( ( "%s::%s block %ld read as %ld\n", getName ( ), __FUNCTION__,
+					   ( long ) block, ( long ) address - LBA_0_OFFSET ) );
+		status = kIOReturnIOError;
 		
 	}
 	
@@ -4876,59 +8429,79 @@ ErrorExit:
 
 
 //
-//	 IssueWrite - Issues an asynchronous write request.			[PROTECTED]
+//	 CountAudioSectorErrors - 	Counts the bytes of a sector which its C2
+//								error pointers flag.				  [PRIVATE]
 //
 
-IOReturn
-IOSCSIMultimediaCommandsDevice::IssueWrite (
-							IOMemoryDescriptor *	buffer,
-							void *					clientData,
-							UInt64					startBlock,
-							UInt64					blockCount )
+UInt32
+IOSCSIMultimediaCommandsDevice::CountAudioSectorErrors ( UInt8 * errorFlags )
 {
 	
-	IOReturn 				status	= kIOReturnNoResources;
-	SCSITaskIdentifier		request	= NULL;
-	
-	request = GetSCSITask ( );
-	require_nonzero ( request, ErrorExit );
+	UInt32	count	= 0;
+	UInt32	index	= 0;
+	UInt8	bits	= 0;
 	
-	if ( WRITE_10 ( request, 
-					buffer,
-					fMediaBlockSize,
-					0,
-					0,
-					0,
-					( SCSICmdField4Byte ) startBlock,
-					( SCSICmdField2Byte ) blockCount,
-					0 ) == true )
+	for ( index = 0; index < C2_ERROR_BLOCK_DATA_SIZE; index++ )
 	{
 		
-		SetApplicationLayerReference ( request, clientData );
-		
-		// The command was successfully built, now send it
-		SendCommand ( request,
-					  fWriteTimeoutDuration,
-					  &IOSCSIMultimediaCommandsDevice::AsyncReadWriteComplete );
-		
-		status = kIOReturnSuccess;
+		for ( bits = errorFlags[index]; bits != 0; bits &= ( bits - 1 ) )
+		{
+			count++;
+		}
 		
 	}
 	
-	else
+	return count;
+	
+}
+
+
+//
+//	 UpdateAudioExtractionStatistics - Publishes the sector counts and the
+//										throughput of audio extraction.
+//																	  [PRIVATE]
+//
+
+void
+IOSCSIMultimediaCommandsDevice::UpdateAudioExtractionStatistics ( void )
+{
+	
+	OSNumber *	number		= NULL;
+	UInt64		elapsedTime	= 0;
+	UInt64		values[kAudioExtractionStatisticsCount];
+	UInt32		index		= 0;
+	
+	require_nonzero_quiet ( fAudioExtractionStatistics, ErrorExit );
+	
+	// Kilobytes per second, from bytes and milliseconds.
+	absolutetime_to_nanoseconds ( fAudioExtractionTime, &elapsedTime );
+	elapsedTime /= kMillisecondScale;
+	
+	values[0] = fAudioSectorsRead;
+	values[1] = fAudioSectorsFlagged;
+	values[2] = fAudioSectorsReread;
+	values[3] = fAudioSectorsRecovered;
+	values[4] = ( elapsedTime != 0 ) ? ( fAudioBytesExtracted * 1000 ) / ( elapsedTime * 1024 ) : 0;
+	
+	for ( index = 0; index < kAudioExtractionStatisticsCount; index++ )
 	{
 		
-		status = kIOReturnBadArgument;
-		ReleaseSCSITask ( request );
-		request = NULL;
+		number = OSDynamicCast ( OSNumber, fAudioExtractionStatistics->getObject ( gAudioExtractionStatisticsKeys[index] ) );
+		if ( number != NULL )
+			number->setValue ( values[index] );
 		
 	}
 	
+	if ( getProperty ( kIOPropertyAudioExtractionStatisticsKey ) == NULL )
+	{
+		setProperty ( kIOPropertyAudioExtractionStatisticsKey, fAudioExtractionStatistics );
+	}
+	
 	
 ErrorExit:
 	
 	
-	return status;
+	return;
 	
 }
 
@@ -4979,14 +8552,28 @@ IOSCSIMultimediaCommandsDevice::AsyncReadWriteCompletion (
 										SCSITaskIdentifier completedTask )
 {
 	
-	IOReturn	status		= kIOReturnSuccess;
-	UInt64		actCount	= 0;
-	void *		clientData	= NULL;
+	IOReturn			status		= kIOReturnSuccess;
+	UInt64				actCount	= 0;
+	void *				clientData	= NULL;
+	SCSITaskTimestamps	timestamps;
 	
 	// Extract the client data from the SCSITaskIdentifier
 	clientData = GetApplicationLayerReference ( completedTask );
 	require_nonzero ( clientData, ErrorExit );
 	
+	GetTaskTimestamps ( completedTask, &timestamps );
+	
+	if ( GetDataTransferDirection ( completedTask ) == kSCSIDataTransfer_FromInitiatorToTarget )
+	{
+		
+		// Anything read while the write was in progress may be stale.
+		InvalidateMediaMetadata ( );
+		
+		// A flush of gathered data may be waiting for this write.
+		UngatheredWriteDone ( );
+		
+	}
+	
 	if ( ( GetServiceResponse ( completedTask ) == kSCSIServiceResponse_TASK_COMPLETE ) &&
 		 ( GetTaskStatus ( completedTask ) == kSCSITaskStatus_GOOD ) )
 	{
@@ -4994,6 +8581,12 @@ IOSCSIMultimediaCommandsDevice::AsyncReadWriteCompletion (
 		// Our status is good, so return a success
 		actCount = GetRealizedDataTransferCount ( completedTask );
 		
+		if ( ( fStreamingEnabled == true ) &&
+			 ( GetDataTransferDirection ( completedTask ) == kSCSIDataTransfer_FromTargetToInitiator ) )
+		{
+			OSAddAtomic64 ( actCount, ( SInt64 * ) &fStreamByteCount );
+		}
+		
 	}
 	
 	else
@@ -5014,13 +8607,15 @@ IOSCSIMultimediaCommandsDevice::AsyncReadWriteCompletion (
 			if ( senseIsValid )
 			{
 				
-				IOLog ( "SAM Multimedia: READ or WRITE failed, ASC = 0x%02x, ASCQ = 0x%02x\n", 
+				// Counts the error against this unit and logs it, rate limited.
+				SCSISenseCategory	category = RecordSenseData ( &senseDataBuffer );
+				
+				ERROR_LOG ( ( "SAM Multimedia: READ or WRITE failed, ASC = 0x%02x, ASCQ = 0x%02x\n", 
 				senseDataBuffer.ADDITIONAL_SENSE_CODE,
-				senseDataBuffer.ADDITIONAL_SENSE_CODE_QUALIFIER );
+				senseDataBuffer.ADDITIONAL_SENSE_CODE_QUALIFIER ) );
 				
-				if ( ( senseDataBuffer.ADDITIONAL_SENSE_CODE == 0x3A ) ||
-					 ( ( senseDataBuffer.ADDITIONAL_SENSE_CODE == 0x28 ) &&
-					   ( senseDataBuffer.ADDITIONAL_SENSE_CODE_QUALIFIER == 0x00 ) ) )
+				if ( ( category == kSCSISenseCategory_MediumNotPresent ) ||
+					 ( category == kSCSISenseCategory_MediumChanged ) )
 				{
 					
 					// Message up the chain that we do not have media
@@ -5072,6 +8667,7 @@ IOSCSIMultimediaCommandsDevice::AsyncReadWriteCompletion (
 	}
 	
 	ReleaseSCSITask ( completedTask );
+	RecordTaskLatency ( &timestamps );
 	
 	
 ErrorExit:
@@ -5117,6 +8713,97 @@ ErrorExit:
 }
 
 
+//
+//	 sWriteGatherTimerExpired - 	Static routine to flush the gathered
+//									ECC block.				  [STATIC][PRIVATE]
+//
+
+void
+IOSCSIMultimediaCommandsDevice::sWriteGatherTimerExpired ( void * device, void * unused )
+{
+	
+	IOSCSIMultimediaCommandsDevice *	driver;
+	
+	driver = ( IOSCSIMultimediaCommandsDevice * ) device;
+	
+	driver->ServiceWriteGather ( );
+	
+	// Balance the retain taken when the flush was scheduled.
+	driver->release ( );
+	
+}
+
+
+//
+//	 sProgramStreaming - 	Static routine to set the drive up for a
+//							stream.					  [STATIC][PRIVATE]
+//
+
+void
+IOSCSIMultimediaCommandsDevice::sProgramStreaming ( void * device, void * unused )
+{
+	
+	IOSCSIMultimediaCommandsDevice *	driver;
+	
+	driver = ( IOSCSIMultimediaCommandsDevice * ) device;
+	
+	driver->ProgramStreaming ( );
+	
+	// Balance the retain taken when the update was scheduled.
+	driver->release ( );
+	
+}
+
+
+//
+//	 AudioExtractionComplete - Static completion routine for a chunk of
+//								an extraction.				  [STATIC][PRIVATE]
+//
+
+void
+IOSCSIMultimediaCommandsDevice::AudioExtractionComplete (
+										SCSITaskIdentifier request )
+{
+	
+	IOSCSIMultimediaCommandsDevice	*	taskOwner = NULL;
+	
+	require_nonzero ( request, ErrorExit );
+	
+	taskOwner = OSDynamicCast ( IOSCSIMultimediaCommandsDevice, sGetOwnerForTask ( request ) );
+	require_nonzero ( taskOwner, ErrorExit );
+	
+	taskOwner->AudioExtractionCompletion ( request );
+	
+	
+ErrorExit:
+	
+	
+	return;
+	
+}
+
+
+//
+//	 sRereadAudioSectors - Static routine to re-read flagged audio
+//							sectors.					  [STATIC][PRIVATE]
+//
+
+void
+IOSCSIMultimediaCommandsDevice::sRereadAudioSectors ( void * device, void * unused )
+{
+	
+	IOSCSIMultimediaCommandsDevice *	driver;
+	
+	driver = ( IOSCSIMultimediaCommandsDevice * ) device;
+	
+	driver->RereadAudioSectors ( );
+	
+	// Balance the retain taken when the re-read was scheduled.
+	driver->release ( );
+	
+}
+
+
 //
 //	 sPollForMedia - 	Static routine to poll for media.	[STATIC][PROTECTED]
 //
@@ -5128,11 +8815,22 @@ IOSCSIMultimediaCommandsDevice::sPollForMedia (
 {
 	
 	IOSCSIMultimediaCommandsDevice *	driver;
+	UInt64								startTime	= 0;
+	UInt32								pollingMode	= kPollingMode_Suspended;
 	
 	driver = ( IOSCSIMultimediaCommandsDevice * ) pdtDriver;
 	
+	clock_get_uptime ( &startTime );
+	pollingMode = driver->fPollingMode;
+	
 	driver->PollForMedia ( );
 	
+	// A poll which was waiting for media and still found none is idle, and
+	// lets the scheduler back off.
+	driver->RecordMediaPoll ( startTime,
+							  ( pollingMode == kPollingMode_NewMedia ) &&
+							  ( driver->fPollingMode == kPollingMode_NewMedia ) );
+	
 	if ( driver->fPollingMode != kPollingMode_Suspended )
 	{
 		
@@ -199,6 +199,10 @@ enum
 // Forward definitions for internal use only classes
 class SCSIMultimediaCommands;
 class SCSIBlockCommands;
+struct SCSIMediaMetadataCacheEntry;
+struct SCSIAudioExtraction;
+struct SCSIAudioExtractionChunk;
+struct SCSIWriteGatherRequest;
 
 
 //-----------------------------------------------------------------------------
@@ -214,6 +218,90 @@ private:
 	
 	static void		AsyncReadWriteComplete ( SCSITaskIdentifier completedTask );
 	
+	IOReturn		CheckForMediaEventNotificationSupport ( void );
+	bool			ProcessMediaEvents ( SCSITaskIdentifier request );
+	
+	bool			CreateMediaMetadataCache ( void );
+	void			FreeMediaMetadataCache ( void );
+	void			InvalidateMediaMetadata ( void );
+	bool			CopyMediaMetadata ( UInt32					type,
+										UInt64					key,
+										IOMemoryDescriptor *	buffer,
+										UInt32					allocationLength,
+										UInt16 *				actualByteCount );
+	void			StoreMediaMetadata ( UInt32					generation,
+										 UInt32					type,
+										 UInt64					key,
+										 IOMemoryDescriptor *	buffer,
+										 UInt32					count );
+	
+	IOReturn		ParseFeatureDescriptors ( UInt8 * buffer, UInt32 length );
+	void			ApplyDeviceCapabilities ( void );
+	void			RefreshDeviceConfiguration ( void );
+	
+	bool			CreateWriteGather ( void );
+	void			FreeWriteGather ( void );
+	void			ConfigureWriteGather ( void );
+	bool			GatherWrite ( IOMemoryDescriptor *	buffer,
+								  void *				clientData,
+								  UInt64				startBlock,
+								  UInt64				blockCount );
+	bool			DeferGatheredRead ( IOMemoryDescriptor *	buffer,
+										void *					clientData,
+										UInt64					startBlock,
+										UInt64					blockCount );
+	IOReturn		FlushWriteGather ( void );
+	IOReturn		WriteGatherBlocks ( UInt32 offset, UInt32 blockCount );
+	IOReturn		SynchronizeWriteGather ( void );
+	void			StopWriteGather ( void );
+	void			ScheduleWriteGatherFlush ( void );
+	void			RequestWriteGatherFlush ( void );
+	bool			DeferWriteGatherRequest ( IOMemoryDescriptor *	buffer,
+											  void *				clientData,
+											  UInt64				startBlock,
+											  UInt64				blockCount,
+											  bool					write );
+	void			ServiceWriteGather ( void );
+	void			UngatheredWriteDone ( void );
+	void			CompleteWriteGatherClient ( void *		clientData,
+												IOReturn	status,
+												UInt64		byteCount );
+	static void		sWriteGatherTimerExpired ( void * device, void * unused );
+	
+	IOReturn		GetStreamingPerformance ( UInt32		startBlock,
+											  UInt32		endBlock,
+											  UInt32 *		kilobytesPerSecond );
+	IOReturn		SendStreamingDescriptor ( UInt8 *		descriptor );
+	void			RecordStreamingRead ( UInt64 startBlock, UInt64 blockCount );
+	void			ProgramStreaming ( void );
+	void			UpdateStreamingStatistics ( void );
+	static void		sProgramStreaming ( void * device, void * unused );
+	
+	bool			CreateAudioExtraction ( void );
+	void			FreeAudioExtraction ( void );
+	IOReturn		ExtractAudio ( IOMemoryDescriptor *	buffer,
+								   UInt32				startBlock,
+								   UInt32				blockCount,
+								   CDSectorArea			sectorArea,
+								   void *				clientData );
+	bool			IssueAudioExtractionChunk ( SCSIAudioExtraction * extraction );
+	bool			SendAudioExtractionChunk ( SCSIAudioExtractionChunk * chunk );
+	IOReturn		GetAudioExtractionStatus ( SCSITaskIdentifier request );
+	void			AudioExtractionCompletion ( SCSITaskIdentifier completedTask );
+	void			ReleaseAudioExtraction ( SCSIAudioExtraction * extraction );
+	SCSIAudioExtraction *	DequeueAudioExtraction ( void );
+	void			CompleteAudioExtraction ( SCSIAudioExtraction *	extraction,
+											  IOReturn				status );
+	void			RereadAudioSectors ( void );
+	IOReturn		RereadAudioExtraction ( SCSIAudioExtraction * extraction );
+	IOReturn		ReadAudioSector ( SCSIAudioExtraction *	extraction,
+									  UInt32				block,
+									  IOMemoryDescriptor *	buffer );
+	UInt32			CountAudioSectorErrors ( UInt8 * errorFlags );
+	void			UpdateAudioExtractionStatistics ( void );
+	static void		AudioExtractionComplete ( SCSITaskIdentifier completedTask );
+	static void		sRereadAudioSectors ( void * device, void * unused );
+	
 protected:
 	
     // Reserve space for future expansion.
@@ -226,6 +314,69 @@ protected:
 		bool				fDeviceSupportsFastSpindown;
 		UInt8				fCDLoadingMechanism;
         bool                fDoNotLockMedia;
+		
+		// GET EVENT STATUS NOTIFICATION classes used for media detection.
+		UInt8				fSupportedEventClasses;
+		bool				fMediaEventPending;
+		UInt32				fMediaEventPollCount;
+		
+		// Metadata read from the medium, valid while its generation
+		// matches fMediaGeneration.
+		UInt32							fMediaGeneration;
+		IOSimpleLock *					fMediaMetadataLock;
+		SCSIMediaMetadataCacheEntry *	fMediaMetadataCache;
+		UInt32							fMediaMetadataCacheNext;
+		
+		// Features reported by GET CONFIGURATION, read once and kept until
+		// the drive reports a feature change.
+		UInt32							fDeviceCapabilities;
+		bool							fDeviceConfigurationValid;
+		bool							fDeviceConfigurationChanged;
+		
+		// Writes smaller than an ECC block on rewritable media, gathered
+		// until the block is whole or must be flushed. Flushes run on
+		// fWriteGatherThread. While fWriteGatherFlushing is set, writes and
+		// reads which overlap the block wait on fWriteGatherDeferred.
+		IOLock *						fWriteGatherLock;
+		thread_call_t					fWriteGatherThread;
+		UInt8 *							fWriteGatherData;
+		UInt8 *							fWriteGatherFillData;
+		UInt32							fWriteGatherBufferSize;
+		UInt32							fWriteGatherBlocks;
+		UInt64							fWriteGatherCluster;
+		UInt32							fWriteGatherValid;
+		IOReturn						fWriteGatherStatus;
+		bool							fWriteGatherFlushing;
+		UInt32							fWriteGatherWritesInFlight;
+		SCSIWriteGatherRequest *		fWriteGatherDeferred;
+		
+		// Streaming reads. Sequential reads are detected in the I/O path
+		// and the drive is set up for them from fStreamingThread.
+		thread_call_t					fStreamingThread;
+		bool							fStreamingEnabled;
+		UInt32							fStreamingStartBlock;
+		UInt32							fStreamingEndBlock;
+		UInt32							fStreamingRate;
+		UInt32							fStreamingCount;
+		UInt64							fStreamNextBlock;
+		UInt32							fStreamSequentialCount;
+		UInt64							fStreamReadAheadBlock;
+		UInt64							fStreamStartTime;
+		UInt64							fStreamByteCount;
+		OSDictionary *					fStreamingStatistics;
+		
+		// CD-DA extraction. Extractions with sectors left to re-read are
+		// queued on fAudioRereadQueue for fAudioRereadThread.
+		IOSimpleLock *					fAudioExtractionLock;
+		thread_call_t					fAudioRereadThread;
+		SCSIAudioExtraction *			fAudioRereadQueue;
+		UInt64							fAudioSectorsRead;
+		UInt64							fAudioSectorsFlagged;
+		UInt64							fAudioSectorsReread;
+		UInt64							fAudioSectorsRecovered;
+		UInt64							fAudioBytesExtracted;
+		UInt64							fAudioExtractionTime;
+		OSDictionary *					fAudioExtractionStatistics;
 	};
     IOSCSIMultimediaCommandsDeviceExpansionData * fIOSCSIMultimediaCommandsDeviceReserved;
 	
@@ -236,6 +387,50 @@ protected:
 	#define fDeviceSupportsFastSpindown			fIOSCSIMultimediaCommandsDeviceReserved->fDeviceSupportsFastSpindown
 	#define fCDLoadingMechanism					fIOSCSIMultimediaCommandsDeviceReserved->fCDLoadingMechanism
     #define fDoNotLockMedia                     fIOSCSIMultimediaCommandsDeviceReserved->fDoNotLockMedia
+	#define fSupportedEventClasses				fIOSCSIMultimediaCommandsDeviceReserved->fSupportedEventClasses
+	#define fMediaEventPending					fIOSCSIMultimediaCommandsDeviceReserved->fMediaEventPending
+	#define fMediaEventPollCount				fIOSCSIMultimediaCommandsDeviceReserved->fMediaEventPollCount
+	#define fMediaGeneration					fIOSCSIMultimediaCommandsDeviceReserved->fMediaGeneration
+	#define fMediaMetadataLock					fIOSCSIMultimediaCommandsDeviceReserved->fMediaMetadataLock
+	#define fMediaMetadataCache					fIOSCSIMultimediaCommandsDeviceReserved->fMediaMetadataCache
+	#define fMediaMetadataCacheNext				fIOSCSIMultimediaCommandsDeviceReserved->fMediaMetadataCacheNext
+	#define fDeviceCapabilities					fIOSCSIMultimediaCommandsDeviceReserved->fDeviceCapabilities
+	#define fDeviceConfigurationValid			fIOSCSIMultimediaCommandsDeviceReserved->fDeviceConfigurationValid
+	#define fDeviceConfigurationChanged			fIOSCSIMultimediaCommandsDeviceReserved->fDeviceConfigurationChanged
+	#define fWriteGatherLock					fIOSCSIMultimediaCommandsDeviceReserved->fWriteGatherLock
+	#define fWriteGatherThread					fIOSCSIMultimediaCommandsDeviceReserved->fWriteGatherThread
+	#define fWriteGatherData					fIOSCSIMultimediaCommandsDeviceReserved->fWriteGatherData
+	#define fWriteGatherFillData				fIOSCSIMultimediaCommandsDeviceReserved->fWriteGatherFillData
+	#define fWriteGatherBufferSize				fIOSCSIMultimediaCommandsDeviceReserved->fWriteGatherBufferSize
+	#define fWriteGatherBlocks					fIOSCSIMultimediaCommandsDeviceReserved->fWriteGatherBlocks
+	#define fWriteGatherCluster					fIOSCSIMultimediaCommandsDeviceReserved->fWriteGatherCluster
+	#define fWriteGatherValid					fIOSCSIMultimediaCommandsDeviceReserved->fWriteGatherValid
+	#define fWriteGatherStatus					fIOSCSIMultimediaCommandsDeviceReserved->fWriteGatherStatus
+	#define fWriteGatherFlushing				fIOSCSIMultimediaCommandsDeviceReserved->fWriteGatherFlushing
+	#define fWriteGatherWritesInFlight			fIOSCSIMultimediaCommandsDeviceReserved->fWriteGatherWritesInFlight
+	#define fWriteGatherDeferred				fIOSCSIMultimediaCommandsDeviceReserved->fWriteGatherDeferred
+	#define fStreamingThread					fIOSCSIMultimediaCommandsDeviceReserved->fStreamingThread
+	#define fStreamingEnabled					fIOSCSIMultimediaCommandsDeviceReserved->fStreamingEnabled
+	#define fStreamingStartBlock				fIOSCSIMultimediaCommandsDeviceReserved->fStreamingStartBlock
+	#define fStreamingEndBlock					fIOSCSIMultimediaCommandsDeviceReserved->fStreamingEndBlock
+	#define fStreamingRate						fIOSCSIMultimediaCommandsDeviceReserved->fStreamingRate
+	#define fStreamingCount						fIOSCSIMultimediaCommandsDeviceReserved->fStreamingCount
+	#define fStreamNextBlock					fIOSCSIMultimediaCommandsDeviceReserved->fStreamNextBlock
+	#define fStreamSequentialCount				fIOSCSIMultimediaCommandsDeviceReserved->fStreamSequentialCount
+	#define fStreamReadAheadBlock				fIOSCSIMultimediaCommandsDeviceReserved->fStreamReadAheadBlock
+	#define fStreamStartTime					fIOSCSIMultimediaCommandsDeviceReserved->fStreamStartTime
+	#define fStreamByteCount					fIOSCSIMultimediaCommandsDeviceReserved->fStreamByteCount
+	#define fStreamingStatistics				fIOSCSIMultimediaCommandsDeviceReserved->fStreamingStatistics
+	#define fAudioExtractionLock				fIOSCSIMultimediaCommandsDeviceReserved->fAudioExtractionLock
+	#define fAudioRereadThread					fIOSCSIMultimediaCommandsDeviceReserved->fAudioRereadThread
+	#define fAudioRereadQueue					fIOSCSIMultimediaCommandsDeviceReserved->fAudioRereadQueue
+	#define fAudioSectorsRead					fIOSCSIMultimediaCommandsDeviceReserved->fAudioSectorsRead
+	#define fAudioSectorsFlagged				fIOSCSIMultimediaCommandsDeviceReserved->fAudioSectorsFlagged
+	#define fAudioSectorsReread					fIOSCSIMultimediaCommandsDeviceReserved->fAudioSectorsReread
+	#define fAudioSectorsRecovered				fIOSCSIMultimediaCommandsDeviceReserved->fAudioSectorsRecovered
+	#define fAudioBytesExtracted				fIOSCSIMultimediaCommandsDeviceReserved->fAudioBytesExtracted
+	#define fAudioExtractionTime				fIOSCSIMultimediaCommandsDeviceReserved->fAudioExtractionTime
+	#define fAudioExtractionStatistics			fIOSCSIMultimediaCommandsDeviceReserved->fAudioExtractionStatistics
 	
 	CDFeatures						fSupportedCDFeatures;
 	DVDFeatures						fSupportedDVDFeatures;
@@ -412,6 +607,11 @@ public:
 	virtual IOReturn	SetMediaAccessSpeed ( UInt16 kilobytesPerSecond );
 	
 	virtual IOReturn	GetMediaAccessSpeed ( UInt16 * kilobytesPerSecond );
+	
+	// Sets the drive up to stream the given extent at the rate it reports
+	// it can sustain over it, and undoes that again.
+	IOReturn			EnableStreaming ( UInt32 startBlock, UInt32 endBlock );
+	IOReturn			DisableStreaming ( void );
 
 	virtual IOReturn	AsyncReadCD ( 	IOMemoryDescriptor * buffer,
 										UInt32 block,
@@ -199,6 +199,9 @@ IOSCSIMultimediaCommandsDevice::PowerDownHandler ( void * 		refCon,
 		if ( fCurrentPowerState > kMMCPowerStateSleep )
 		{
 			
+			// Don't lose anything still being gathered.
+			( void ) SynchronizeWriteGather ( );
+			
 			// Make sure the drive is spun down
 			if ( START_STOP_UNIT ( request, 1, 0, 0, 0, 0 ) == true )
 			{
@@ -312,6 +315,7 @@ IOSCSIMultimediaCommandsDevice::HandleCheckPowerState ( void )
 	if ( IsDeviceAccessEnabled ( ) )
 	{
 		
+		HandleWaitWhileQuiesced ( );
 		super::HandleCheckPowerState ( kMMCPowerStateActive );
 		
 	}
@@ -524,15 +528,11 @@ IOSCSIMultimediaCommandsDevice::HandlePowerChange ( void )
 				// let outstanding commands complete
 				fCurrentPowerState = fProposedPowerState;
 
-				while ( fNumCommandsOutstanding > 1 )
-				{
-					
-					// Sleep this thread for 1ms until all outstanding commands
-					// have completed. This prevents a sleep command from entering
-					// the queue before an I/O and causing a problem on wakeup.
-					IOSleep ( 1 );
-					
-				}
+				// Wait for all outstanding commands to complete. This prevents
+				// a sleep command from entering the queue before an I/O and
+				// causing a problem on wakeup. The task we hold is the only one
+				// allowed to remain.
+				( void ) QuiesceCommands ( 1 );
 				
 				// Set the tray state to closed.
 				if ( START_STOP_UNIT ( request, 0, 0, 1, 1, 0 ) == true )
@@ -600,6 +600,7 @@ IOSCSIMultimediaCommandsDevice::HandlePowerChange ( void )
 					
 				}
 				
+				ResumeCommands ( );
 				break;
 				
 			}
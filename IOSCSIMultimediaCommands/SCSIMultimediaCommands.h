@@ -71,6 +71,7 @@
 #define		FMT_DATA_PRESENT					1
 #define		PERFORMANCE_HEADER_SIZE				8
 #define		PERFORMANCE_DESCRIPTOR_SIZE			8
+#define		NOMINAL_PERFORMANCE_DESCRIPTOR_SIZE	16
 #define		C2_ERROR_BLOCK_DATA_SIZE			294
 #define		C2_AND_BLOCK_ERROR_BITS_SIZE		296
 #define		SUBCHANNEL_DATA_SIZE				96
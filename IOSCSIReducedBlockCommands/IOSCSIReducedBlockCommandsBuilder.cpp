@@ -70,7 +70,7 @@ IOSCSIReducedBlockCommandsDevice::FORMAT_UNIT (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -107,7 +107,7 @@ IOSCSIReducedBlockCommandsDevice::INQUIRY (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -145,7 +145,7 @@ IOSCSIReducedBlockCommandsDevice::MODE_SELECT_6 (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -183,7 +183,7 @@ IOSCSIReducedBlockCommandsDevice::MODE_SENSE_6 (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -221,7 +221,7 @@ IOSCSIReducedBlockCommandsDevice::PERSISTENT_RESERVE_IN (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -258,7 +258,7 @@ IOSCSIReducedBlockCommandsDevice::PERSISTENT_RESERVE_OUT (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -293,7 +293,7 @@ IOSCSIReducedBlockCommandsDevice::PREVENT_ALLOW_MEDIUM_REMOVAL (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -327,7 +327,7 @@ IOSCSIReducedBlockCommandsDevice::READ_10 (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -360,7 +360,7 @@ IOSCSIReducedBlockCommandsDevice::READ_CAPACITY (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -389,7 +389,7 @@ IOSCSIReducedBlockCommandsDevice::RELEASE_6 (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -420,7 +420,7 @@ IOSCSIReducedBlockCommandsDevice::REQUEST_SENSE (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -452,7 +452,7 @@ IOSCSIReducedBlockCommandsDevice::RESERVE_6 (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -486,7 +486,7 @@ IOSCSIReducedBlockCommandsDevice::START_STOP_UNIT (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -519,7 +519,7 @@ IOSCSIReducedBlockCommandsDevice::SYNCHRONIZE_CACHE (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -547,7 +547,7 @@ IOSCSIReducedBlockCommandsDevice::TEST_UNIT_READY (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -579,7 +579,7 @@ IOSCSIReducedBlockCommandsDevice::VERIFY (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -615,7 +615,7 @@ IOSCSIReducedBlockCommandsDevice::WRITE_10 (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -654,7 +654,7 @@ IOSCSIReducedBlockCommandsDevice::WRITE_BUFFER (
 	SCSITask *	scsiRequest	= NULL;
 	bool		status 		= false;
 	
-	scsiRequest = OSDynamicCast ( SCSITask, request );
+	scsiRequest = SCSITaskFromIdentifier ( request );
 	require_nonzero ( scsiRequest, ErrorExit );
 	require ( scsiRequest->ResetForNewTask ( ), ErrorExit );
 	
@@ -41,6 +41,7 @@
 
 #include "IOSCSIReducedBlockCommandsDevice.h"
 #include "SCSIReducedBlockCommands.h"
+#include "SCSICommandDescriptorBlockLayout.h"
 
 
 //
@@ -764,6 +765,8 @@ void
 IOSCSIReducedBlockCommandsDevice::StartDeviceSupport ( void )
 {
 	
+	InitializeReadWriteTaskTemplates ( &IOSCSIReducedBlockCommandsDevice::AsyncReadWriteComplete );
+	
 	// Start polling
 	EnablePolling ( );
 	
@@ -1097,8 +1100,6 @@ void
 IOSCSIReducedBlockCommandsDevice::EnablePolling ( void )
 {		
 	
-	AbsoluteTime	time;
-	
 	// No reason to start a thread if we've been terminatated
 	require ( ( isInactive ( ) == false ), Exit );
 	require ( fPollingThread, Exit );
@@ -1109,8 +1110,15 @@ IOSCSIReducedBlockCommandsDevice::EnablePolling ( void )
 	
 	retain ( );
 	
-	clock_interval_to_deadline ( 1000, kMillisecondScale, &time );
-	thread_call_enter_delayed ( fPollingThread, time );
+	// The shared media poll scheduler enters fPollingThread once the poll
+	// interval for this logical unit has passed.
+	if ( ScheduleMediaPoll ( fPollingThread ) == false )
+	{
+		
+		// A poll is already scheduled and holds its own retain.
+		release ( );
+		
+	}
 	
 	
 Exit:
@@ -1132,8 +1140,8 @@ IOSCSIReducedBlockCommandsDevice::DisablePolling ( void )
 	
 	fPollingMode = kPollingMode_Suspended;
 	
-	// Cancel the thread if it is scheduled to run
-	require ( thread_call_cancel ( fPollingThread ), Exit );
+	// Cancel the poll if it is scheduled to run
+	require ( CancelMediaPoll ( fPollingThread ), Exit );
 	
 	// It was scheduled to run, so we balance out the retain()
 	// with a release()
@@ -1944,36 +1952,33 @@ IOSCSIReducedBlockCommandsDevice::IssueRead (
 									void *					clientData )
 {
 	
-	IOReturn 				status 	= kIOReturnNoResources;
-	SCSITaskIdentifier		request	= NULL;
+	IOReturn 				status				= kIOReturnBadArgument;
+	SCSITaskIdentifier		request				= NULL;
+	UInt64					requestedByteCount	= blockCount * fMediaBlockSize;
+	SCSICDBBuilder < SCSICDB_READ_10 >	cdb;
+	
+	require_nonzero ( fMediaBlockSize, ErrorExit );
+	require ( IsMemoryDescriptorValid ( buffer, requestedByteCount ), ErrorExit );
+	
+	// The transfer length must fit the CDB, or the device would be asked
+	// for fewer blocks than the buffer is set up for.
+	require ( ( blockCount <= kSCSICmdFieldMask2Byte ), ErrorExit );
 	
 	request = GetSCSITask ( );
-	require_nonzero ( request, ErrorExit );
+	require_action ( ( request != NULL ), ErrorExit, status = kIOReturnNoResources );
 	
-	if ( READ_10 (	request,
-					buffer,
-					fMediaBlockSize,
-					( SCSICmdField4Byte ) startBlock,
-					( SCSICmdField2Byte ) blockCount ) == true )
-	{
-		
-		SetApplicationLayerReference ( request, clientData );
-		SendCommand ( request,
-					  fReadTimeoutDuration,
-					  &IOSCSIReducedBlockCommandsDevice::AsyncReadWriteComplete );
-		
-		status = kIOReturnSuccess;
-		
-	}
+	// Only the CDB, buffer and transfer count change from one read to the
+	// next. Everything else comes from the read task template.
+	cdb.Set < SCSICDB_READ_10::LOGICAL_BLOCK_ADDRESS > ( ( SCSICmdField4Byte ) startBlock );
+	cdb.Set < SCSICDB_READ_10::TRANSFER_LENGTH > ( ( SCSICmdField2Byte ) blockCount );
+	SetCommandDescriptorBlock ( request, cdb.GetCommandDescriptorBlock ( ), cdb.GetSize ( ) );
 	
-	else
-	{
-		
-		ReleaseSCSITask ( request );
-		request = NULL;
-		status = kIOReturnBadArgument;
-		
-	}
+	SetDataBuffer ( request, buffer );
+	SetRequestedDataTransferCount ( request, requestedByteCount );
+	SetApplicationLayerReference ( request, clientData );
+	
+	SendTemplatedCommand ( request, &fReadTaskTemplate );
+	status = kIOReturnSuccess;
 	
 	
 ErrorExit:
@@ -2010,37 +2015,33 @@ IOSCSIReducedBlockCommandsDevice::IssueWrite (
 							void *					clientData )
 {
 	
-	IOReturn				status	= kIOReturnNoResources;
-	SCSITaskIdentifier		request	= NULL;
+	IOReturn 				status				= kIOReturnBadArgument;
+	SCSITaskIdentifier		request				= NULL;
+	UInt64					requestedByteCount	= blockCount * fMediaBlockSize;
+	SCSICDBBuilder < SCSICDB_WRITE_10 >	cdb;
+	
+	require_nonzero ( fMediaBlockSize, ErrorExit );
+	require ( IsMemoryDescriptorValid ( buffer, requestedByteCount ), ErrorExit );
+	
+	// The transfer length must fit the CDB, or the device would be asked
+	// for fewer blocks than the buffer is set up for.
+	require ( ( blockCount <= kSCSICmdFieldMask2Byte ), ErrorExit );
 	
 	request = GetSCSITask ( );
-	require_nonzero ( request, ErrorExit );
+	require_action ( ( request != NULL ), ErrorExit, status = kIOReturnNoResources );
 	
-	if ( WRITE_10 ( request, 
-					buffer,
-	 				fMediaBlockSize,
-					0,
-					( SCSICmdField4Byte ) startBlock,
-					( SCSICmdField2Byte ) blockCount ) == true )
-	{
-		
-		SetApplicationLayerReference ( request, clientData );
-		SendCommand ( request,
-					  fWriteTimeoutDuration,
-					  &IOSCSIReducedBlockCommandsDevice::AsyncReadWriteComplete );
-		
-		status = kIOReturnSuccess;
-		
-	}
+	// Only the CDB, buffer and transfer count change from one write to the
+	// next. Everything else comes from the write task template.
+	cdb.Set < SCSICDB_WRITE_10::LOGICAL_BLOCK_ADDRESS > ( ( SCSICmdField4Byte ) startBlock );
+	cdb.Set < SCSICDB_WRITE_10::TRANSFER_LENGTH > ( ( SCSICmdField2Byte ) blockCount );
+	SetCommandDescriptorBlock ( request, cdb.GetCommandDescriptorBlock ( ), cdb.GetSize ( ) );
 	
-	else
-	{
-		
-		ReleaseSCSITask ( request );
-		request = NULL;
-		status = kIOReturnBadArgument;
-		
-	}
+	SetDataBuffer ( request, buffer );
+	SetRequestedDataTransferCount ( request, requestedByteCount );
+	SetApplicationLayerReference ( request, clientData );
+	
+	SendTemplatedCommand ( request, &fWriteTaskTemplate );
+	status = kIOReturnSuccess;
 	
 	
 ErrorExit:
@@ -2061,14 +2062,17 @@ IOSCSIReducedBlockCommandsDevice::AsyncReadWriteCompletion (
 										SCSITaskIdentifier completedTask )
 {
 	
-	IOReturn	status		= kIOReturnSuccess;
-	UInt64		actCount	= 0;
-	void *		clientData	= NULL;
+	IOReturn			status		= kIOReturnSuccess;
+	UInt64				actCount	= 0;
+	void *				clientData	= NULL;
+	SCSITaskTimestamps	timestamps;
 	
 	// Extract the client data from the SCSITaskIdentifier
 	clientData = GetApplicationLayerReference ( completedTask );
 	require_nonzero ( clientData, ErrorExit );
 	
+	GetTaskTimestamps ( completedTask, &timestamps );
+	
 	if ( ( GetServiceResponse ( completedTask ) == kSCSIServiceResponse_TASK_COMPLETE ) &&
 		 ( GetTaskStatus ( completedTask ) == kSCSITaskStatus_GOOD ) )
 	{
@@ -2098,18 +2102,15 @@ IOSCSIReducedBlockCommandsDevice::AsyncReadWriteCompletion (
 				if ( senseIsValid )
 				{
 					
+					// Counts the error against this unit and logs it, rate limited.
+					SCSISenseCategory	category = RecordSenseData ( &senseDataBuffer );
+					
 					// Check if this is a recovered error and the amount of data transferred
 					// was the amount requested. If so, don't treat those as hard errors.
-					if ( ( ( senseDataBuffer.SENSE_KEY & kSENSE_KEY_Mask ) == kSENSE_KEY_RECOVERED_ERROR ) &&
+					if ( ( category == kSCSISenseCategory_RecoveredError ) &&
 						 ( GetRequestedDataTransferCount ( completedTask ) == GetRealizedDataTransferCount ( completedTask ) ) )
 					{
 						
-						IOLog ( "READ or WRITE succeeded, but recoverable (soft) error occurred, SENSE_KEY = 0x%01x, ASC = 0x%02x, ASCQ = 0x%02x, LBA = 0x%08x\n",
-								senseDataBuffer.SENSE_KEY & kSENSE_KEY_Mask,
-								senseDataBuffer.ADDITIONAL_SENSE_CODE,
-								senseDataBuffer.ADDITIONAL_SENSE_CODE_QUALIFIER,
-								OSReadBigInt32 ( &senseDataBuffer.INFORMATION_1, 0 ) );
-						
 						status		= kIOReturnSuccess;
 						actCount 	= GetRealizedDataTransferCount ( completedTask );
 						
@@ -2135,6 +2136,7 @@ IOSCSIReducedBlockCommandsDevice::AsyncReadWriteCompletion (
 	IOReducedBlockServices::AsyncReadWriteComplete ( clientData, status, actCount );
 	
 	ReleaseSCSITask ( completedTask );	
+	RecordTaskLatency ( &timestamps );
 	
 	
 ErrorExit:
@@ -2191,13 +2193,24 @@ IOSCSIReducedBlockCommandsDevice::sPollForMedia (
 									void *	refCon )
 {
 	
-	IOSCSIReducedBlockCommandsDevice *	driver = NULL;
+	IOSCSIReducedBlockCommandsDevice *	driver		= NULL;
+	UInt64								startTime	= 0;
+	UInt32								pollingMode	= kPollingMode_Suspended;
 	
 	driver = ( IOSCSIReducedBlockCommandsDevice * ) pdtDriver;
 	require_nonzero ( driver, ErrorExit );
 	
+	clock_get_uptime ( &startTime );
+	pollingMode = driver->fPollingMode;
+	
 	driver->PollForMedia ( );
 	
+	// A poll which was waiting for media and still found none is idle, and
+	// lets the scheduler back off.
+	driver->RecordMediaPoll ( startTime,
+							  ( pollingMode == kPollingMode_NewMedia ) &&
+							  ( driver->fPollingMode == kPollingMode_NewMedia ) );
+	
 	if ( driver->fPollingMode != kPollingMode_Suspended )
 	{
 		
@@ -227,6 +227,7 @@ IOSCSIReducedBlockCommandsDevice::HandleCheckPowerState ( void )
 	if ( IsDeviceAccessEnabled ( ) )
 	{
 		
+		HandleWaitWhileQuiesced ( );
 		super::HandleCheckPowerState ( kRBCPowerStateActive );
 		
 	}
@@ -393,15 +394,11 @@ IOSCSIReducedBlockCommandsDevice::HandlePowerChange ( void )
 				previousPowerState = fCurrentPowerState;
 				fCurrentPowerState = fProposedPowerState;
 
-				while ( fNumCommandsOutstanding > 1 )
-				{
-					
-					// Sleep this thread for 1ms until all outstanding commands
-					// have completed. This prevents a sleep command from entering
-					// the queue before an I/O and causing a problem on wakeup.
-					IOSleep ( 1 );
-					
-				}
+				// Wait for all outstanding commands to complete. This prevents
+				// a sleep command from entering the queue before an I/O and
+				// causing a problem on wakeup. The task we hold is the only one
+				// allowed to remain.
+				( void ) QuiesceCommands ( 1 );
 				
 				// If the device supports the power conditions mode page, and we haven't already
 				// put it to sleep using the START_STOP_UNIT command, issue one to the drive.
@@ -436,6 +433,7 @@ IOSCSIReducedBlockCommandsDevice::HandlePowerChange ( void )
 				}
 				
 				fCurrentPowerState = kRBCPowerStateSystemSleep;
+				ResumeCommands ( );
 				
 			}
 			break;
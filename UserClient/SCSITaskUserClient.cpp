@@ -273,6 +273,54 @@ SCSITaskUserClient::sMethods[kSCSITaskUserClientMethodCount] =
 		kIOUCStructIStructO,
 		sizeof ( AppleReadFormatCapacitiesStruct ),
 		sizeof ( SCSITaskStatus )
+	},
+	{
+		// Method #22 RingDoorbell
+		0,
+		( IOMethod ) &SCSITaskUserClient::RingDoorbell,
+		kIOUCScalarIScalarO,
+		0,
+		1
+	},
+	{
+		// Method #23 RegisterBuffer
+		0,
+		( IOMethod ) &SCSITaskUserClient::RegisterBuffer,
+		kIOUCScalarIScalarO,
+		3,
+		1
+	},
+	{
+		// Method #24 UnregisterBuffer
+		0,
+		( IOMethod ) &SCSITaskUserClient::UnregisterBuffer,
+		kIOUCScalarIScalarO,
+		1,
+		0
+	},
+	{
+		// Method #25 ExecuteTasks
+		0,
+		( IOMethod ) &SCSITaskUserClient::ExecuteTasks,
+		kIOUCStructIStructO,
+		0xFFFFFFFF,
+		0xFFFFFFFF
+	},
+	{
+		// Method #26 SetCompletionCoalescing
+		0,
+		( IOMethod ) &SCSITaskUserClient::SetCompletionCoalescing,
+		kIOUCScalarIScalarO,
+		2,
+		0
+	},
+	{
+		// Method #27 DestroyTaskRings
+		0,
+		( IOMethod ) &SCSITaskUserClient::DestroyTaskRings,
+		kIOUCScalarIScalarO,
+		0,
+		0
 	}
 };
 
@@ -285,6 +333,13 @@ IOExternalAsyncMethod SCSITaskUserClient::sAsyncMethods[kSCSITaskUserClientAsync
         kIOUCScalarIScalarO,
         3,
         0
+    },
+    {   //  Async Method #1  CreateTaskRings
+        0,
+        ( IOAsyncMethod ) &SCSITaskUserClient::CreateTaskRings,
+        kIOUCScalarIScalarO,
+        3,
+        0
     }
 };
 
@@ -338,14 +393,44 @@ SCSITaskUserClient::start ( IOService * provider )
 	OSIterator *	iterator	= NULL;
 	OSObject *		object		= NULL;
 	IOWorkLoop *	workLoop	= NULL;
+	OSNumber *		maxTasks	= NULL;
 	
 	STATUS_LOG ( ( "SCSITaskUserClient::start\n" ) );
 	
 	require ( ( fProvider == 0 ), GENERAL_ERR );
 	require ( super::start ( provider ), GENERAL_ERR );
 	
-	// Zero our array for tasks.
-	bzero ( fArray, sizeof ( SCSITask * ) * kMaxSCSITaskArraySize );
+	// Start with an empty task table. Chunks are allocated as tasks are
+	// created.
+	bzero ( fTaskTable, sizeof ( fTaskTable ) );
+	fTaskTableSize	= 0;
+	fFreeTaskSlot	= kSCSITaskTableNoFreeSlot;
+	
+	// The provider may raise or lower the number of tasks a client can
+	// create. Publish the limit we settle on so clients can size their
+	// queues to it.
+	fMaximumTasks = kSCSITaskDefaultMaximumTasks;
+	maxTasks = OSDynamicCast ( OSNumber, provider->getProperty ( kSCSITaskUserClientMaximumTasksKey ) );
+	if ( maxTasks != NULL )
+	{
+		
+		fMaximumTasks = maxTasks->unsigned32BitValue ( );
+		fMaximumTasks = max ( fMaximumTasks, kSCSITaskMinimumMaximumTasks );
+		fMaximumTasks = min ( fMaximumTasks, kSCSITaskTableMaximumSize );
+		fMaximumTasks = ( fMaximumTasks + kSCSITaskTableChunkSize - 1 ) & ~( kSCSITaskTableChunkSize - 1 );
+		
+	}
+	
+	setProperty ( kSCSITaskUserClientMaximumTasksKey, fMaximumTasks, 32 );
+	
+	// Zero our array for registered buffers.
+	bzero ( fRegisteredBuffers, sizeof ( fRegisteredBuffers ) );
+	fWiredBytes = 0;
+	
+	// Synchronous waiters block on this lock rather than the command gate.
+	fCompletionLock = IOLockAlloc ( );
+	require_nonzero ( fCompletionLock, GENERAL_ERR );
+	fSyncLatency = 0;
 	
 	// Save the provider
 	fProvider = provider;
@@ -452,10 +537,20 @@ void
 SCSITaskUserClient::free ( void )
 {
 	
-	// Remove the command gate from the workloop
+	// Remove the coalescing timer and the command gate from the workloop
 	if ( fWorkLoop != NULL )
 	{
 		
+		if ( fCoalesceTimer != NULL )
+		{
+			
+			fCoalesceTimer->cancelTimeout ( );
+			fWorkLoop->removeEventSource ( fCoalesceTimer );
+			fCoalesceTimer->release ( );
+			fCoalesceTimer = NULL;
+			
+		}
+		
 		fWorkLoop->removeEventSource ( fCommandGate );
 		fWorkLoop = NULL;
 		
@@ -470,6 +565,46 @@ SCSITaskUserClient::free ( void )
 		
 	}
 	
+	// Release the task rings. Any mappings still held by the
+	// library keep their own references.
+	if ( fSubmissionRingBuffer != NULL )
+	{
+		
+		fSubmissionRingBuffer->release ( );
+		fSubmissionRingBuffer 	= NULL;
+		fSubmissionRing			= NULL;
+		
+	}
+	
+	if ( fCompletionRingBuffer != NULL )
+	{
+		
+		fCompletionRingBuffer->release ( );
+		fCompletionRingBuffer 	= NULL;
+		fCompletionRing			= NULL;
+		
+	}
+	
+	// Free the task table.
+	for ( UInt32 chunk = 0; chunk < kSCSITaskTableMaximumChunks; chunk++ )
+	{
+		
+		if ( fTaskTable[chunk] == NULL )
+			continue;
+		
+		IOFree ( fTaskTable[chunk], sizeof ( SCSITaskTableEntry ) * kSCSITaskTableChunkSize );
+		fTaskTable[chunk] = NULL;
+		
+	}
+	
+	if ( fCompletionLock != NULL )
+	{
+		
+		IOLockFree ( fCompletionLock );
+		fCompletionLock = NULL;
+		
+	}
+	
 	super::free ( );
 	
 }
@@ -708,8 +843,7 @@ SCSITaskUserClient::ReleaseTask ( SInt32 taskReference )
 	
 	STATUS_LOG ( ( "SCSITaskUserClient::ReleaseTask\n" ) );
 	
-	require ( ( taskReference >= 0 ) && ( taskReference < kMaxSCSITaskArraySize ),
-			  GENERAL_ERR );
+	require ( ( taskReference >= 0 ), GENERAL_ERR );
 	
 	status = fCommandGate->runAction ( ( IOCommandGate::Action ) &SCSITaskUserClient::sReleaseTask,
 									   ( void * ) taskReference,
@@ -721,6 +855,16 @@ SCSITaskUserClient::ReleaseTask ( SInt32 taskReference )
 	if ( refCon != NULL )
 	{
 		
+		// Unwire the buffers SetBuffers prepared.
+		if ( refCon->buffersPrepared )
+		{
+			
+			refCon->taskResultsBuffer->complete ( );
+			task->GetAutosenseDataBuffer ( )->complete ( );
+			refCon->buffersPrepared = false;
+			
+		}
+		
 		buffer = refCon->taskResultsBuffer;
 		if ( buffer != NULL )
 		{
@@ -753,149 +897,14 @@ IOReturn
 SCSITaskUserClient::ExecuteTask ( SCSITaskData * args, UInt32 argSize )
 {
 	
-	SCSITask *				request				= NULL;
-	SCSITaskRefCon *		refCon				= NULL;
-	IOReturn				status				= kIOReturnBadArgument;
-	bool					userBufPrepared 	= false;
-	bool					resultsBufPrepared 	= false;
-	bool					senseBufPrepared 	= false;
-	IOMemoryDescriptor *	buffer				= NULL;
-	
 	STATUS_LOG ( ( "SCSITaskUserClient::ExecuteTask called\n" ) );
-	STATUS_LOG ( ( "argSize = %ld\n", argSize ) );
-	
-	fOutstandingCommands++;
-	
-	require_action ( isInactive ( ) == false, GENERAL_ERR, status = kIOReturnNoDevice );
 	
 	check ( args );
 	
-	require ( ( args->taskReference >= 0 ) && ( args->taskReference < kMaxSCSITaskArraySize ),
-			  GENERAL_ERR );
-	
-	request = fArray[args->taskReference];
-	require_nonzero ( request, GENERAL_ERR );
-	
-	nrequire_action ( request->IsTaskActive ( ), GENERAL_ERR, status = kIOReturnNotPermitted );
-	
-	refCon = ( SCSITaskRefCon * ) request->GetApplicationLayerReference ( );
-	
-	refCon->commandType = args->isSync ? kCommandTypeExecuteSync : kCommandTypeExecuteAsync;
-	refCon->self		= this;
-	
-	request->ResetForNewTask ( );
-	
-	request->SetApplicationLayerReference ( ( void * ) refCon );
-	
-	status = fCommandGate->runAction ( ( IOCommandGate::Action ) &SCSITaskUserClient::sValidateTask,
-									   ( void * ) request,
-									   ( void * ) args,
-									   ( void * ) argSize );
-	
-	require_success ( status, ACTION_FAILED_ERR );
-	
-	STATUS_LOG ( ( "Task is valid\n" ) );
-	
-	request->SetTimeoutDuration ( args->timeoutDuration );
-	
-	if ( ( args->scatterGatherEntries > 0 ) && ( args->requestedTransferCount > 0 ) )
-	{
-		
-		IODirection		ioDirection;
-		
-		STATUS_LOG ( ( "Preparing buffers\n" ) );
-		
-		ioDirection = ( args->transferDirection == kSCSIDataTransfer_FromTargetToInitiator ) ? kIODirectionIn : kIODirectionOut;
-		
-		buffer = IOMemoryDescriptor::withRanges ( args->scatterGatherList,
-												  args->scatterGatherEntries,
-												  ioDirection,
-												  fTask );
-		
-		require_nonzero_action_string ( buffer,
-										BUFFER_CREATE_FAILED_ERR,
-										status = kIOReturnNoResources,
-										"Error creating memory descriptor\n" );
-		
-		status = buffer->prepare ( );
-		require_success_string ( status,
-								 BUFFER_PREPARE_FAILED_ERR,
-								 "Error preparing user memory descriptor\n" );
-		
-		userBufPrepared = true;
-		
-		request->SetDataBuffer ( buffer );
-		request->SetRequestedDataTransferCount ( args->requestedTransferCount );
-		
-	}
-	
-	status = refCon->taskResultsBuffer->prepare ( );
-	require_success_string ( status,
-							 BUFFER_PREPARE_FAILED_ERR,
-							 "Error preparing results memory descriptor\n" );
-	
-	resultsBufPrepared = true;
-	
-	status = request->GetAutosenseDataBuffer ( )->prepare ( );
-	require_success_string ( status,
-							 BUFFER_PREPARE_FAILED_ERR,
-							 "Error preparing sense data memory descriptor\n" );
-	
-	senseBufPrepared = true;
-	
-	// Retain the task, results buffer, and sense data buffer. They will be released by sTaskCallback method.
-	request->retain ( );
-	refCon->taskResultsBuffer->retain ( );
-	
-	request->SetTaskCompletionCallback ( &SCSITaskUserClient::sTaskCallback );
-	request->SetAutosenseCommand ( kSCSICmd_REQUEST_SENSE, 0x00, 0x00, 0x00, sizeof ( SCSI_Sense_Data ), 0x00 );
-	fProtocolInterface->ExecuteCommand ( request );
-	
-	if ( refCon->commandType == kCommandTypeExecuteSync )
-	{
-		
-		retain ( );
-		
-		status = fCommandGate->runAction ( 	( IOCommandGate::Action ) &SCSITaskUserClient::sWaitForTask,
-									   		( void * ) request );
-		
-		if ( buffer != NULL )
-		{
-			
-			// Make sure to complete any data buffers from client
-			status = CompleteBuffers ( buffer );
-			
-		}
-		
-		release ( );
-		
-	}
-	
-	
-	return status;
-	
-	
-BUFFER_PREPARE_FAILED_ERR:
-	
-	
-	if ( userBufPrepared )
-		CompleteBuffers ( buffer );
-		
-	if ( resultsBufPrepared )
-		refCon->taskResultsBuffer->complete ( );
-		
-	if ( senseBufPrepared )
-		request->GetAutosenseDataBuffer ( )->complete ( );
-	
-	
-BUFFER_CREATE_FAILED_ERR:	
-ACTION_FAILED_ERR:
-GENERAL_ERR:
-	
-	
-	fOutstandingCommands--;
-	
-	return status;
+	return SubmitTask ( args,
+						argSize,
+						args->isSync ? kCommandTypeExecuteSync : kCommandTypeExecuteAsync,
+						0 );
 	
 }
 
@@ -915,9 +924,8 @@ SCSITaskUserClient::AbortTask ( SInt32 taskReference )
 	STATUS_LOG ( ( "SCSITaskUserClient::AbortTask called\n" ) );
 
 	require_action ( isInactive ( ) == false, GENERAL_ERR, status = kIOReturnNoDevice );	
-	require ( ( taskReference >= 0 ) && ( taskReference < kMaxSCSITaskArraySize ), GENERAL_ERR );
 	
-	task = fArray[taskReference];
+	task = GetTask ( taskReference );
 	require_nonzero ( task, GENERAL_ERR );
 	
 	// Can't abort an inactive task
@@ -961,9 +969,8 @@ SCSITaskUserClient::SetAsyncCallback ( OSAsyncReference	asyncRef,
 	STATUS_LOG ( ( "SCSITaskUserClient::SetAsyncCallback called\n" ) );
 	
 	require_action ( isInactive ( ) == false, GENERAL_ERR, status = kIOReturnNoDevice );
-	require ( ( taskReference >= 0 ) && ( taskReference < kMaxSCSITaskArraySize ), GENERAL_ERR );
 	
-	task = fArray[taskReference];
+	task = GetTask ( taskReference );
 	require_nonzero ( task, GENERAL_ERR );
 	
 	// Can't touch an active task
@@ -1013,10 +1020,8 @@ SCSITaskUserClient::SetBuffers ( SInt32			taskReference,
 	STATUS_LOG ( ( "SCSITaskUserClient::SetBuffers called\n" ) );
 	
 	require_action ( isInactive ( ) == false, GENERAL_ERR, status = kIOReturnNoDevice );	
-	require ( ( taskReference >= 0 ), GENERAL_ERR );
-	require ( ( taskReference < kMaxSCSITaskArraySize ), GENERAL_ERR );
 	
-	task = fArray[taskReference];
+	task = GetTask ( taskReference );
 	require ( task, GENERAL_ERR );
 	
 	// Can't touch an active task
@@ -1034,6 +1039,16 @@ SCSITaskUserClient::SetBuffers ( SInt32			taskReference,
 	
 	require_nonzero_action ( buffer, GENERAL_ERR, status = kIOReturnNoResources );
 	
+	// Unwire the old buffers before they are replaced.
+	if ( refCon->buffersPrepared )
+	{
+		
+		refCon->taskResultsBuffer->complete ( );
+		task->GetAutosenseDataBuffer ( )->complete ( );
+		refCon->buffersPrepared = false;
+		
+	}
+	
 	if ( refCon->taskResultsBuffer != NULL )
 	{
 		
@@ -1049,7 +1064,17 @@ SCSITaskUserClient::SetBuffers ( SInt32			taskReference,
 	
 	require_action ( result, GENERAL_ERR, status = kIOReturnNoResources );
 	
-	status = kIOReturnSuccess;
+	// The results and sense buffers are used by every execution of the
+	// task, so wire them once here rather than on each ExecuteTask.
+	status = refCon->taskResultsBuffer->prepare ( );
+	require_success ( status, GENERAL_ERR );
+	
+	status = task->GetAutosenseDataBuffer ( )->prepare ( );
+	require_success_action ( status,
+							 GENERAL_ERR,
+							 refCon->taskResultsBuffer->complete ( ) );
+	
+	refCon->buffersPrepared = true;
 	
 	
 GENERAL_ERR:
@@ -1061,235 +1086,206 @@ GENERAL_ERR:
 
 
 //
-//	 Inquiry - Issues an INQUIRY command to the drive as defined by SPC-2.	
+//	 CreateTaskRings - Creates the submission and completion rings shared
+//						with the library and sets the async callback used
+//						to signal completions posted to the ring. Only the
+//						client holding exclusive access may create them.
 //																	[PUBLIC]
 //
 
 IOReturn
-SCSITaskUserClient::Inquiry ( AppleInquiryStruct * 	inquiryData,
-							  SCSITaskStatus * 		taskStatus,
-							  UInt32				inStructSize,
-							  UInt32 *				outStructSize )
+SCSITaskUserClient::CreateTaskRings ( OSAsyncReference	asyncRef,
+									  UInt32			ringEntries,
+									  void *			callback,
+									  void *			userRefCon )
 {
 	
-	IOReturn				status 	= kIOReturnExclusiveAccess;
-	IOReturn				status2 = kIOReturnExclusiveAccess;
-	SCSITask * 				task 	= NULL;
-	IOMemoryDescriptor *	buffer	= NULL;
-	bool					state 	= true;
-	
-	check ( inquiryData );
-	check ( taskStatus );
-	check ( outStructSize );
+	IOBufferMemoryDescriptor *	submissionRing	= NULL;
+	IOBufferMemoryDescriptor *	completionRing	= NULL;
+	IOByteCount					size			= 0;
+	IOReturn					status			= kIOReturnBadArgument;
 	
-	*outStructSize = 0;
+	check ( callback );
 	
-	fOutstandingCommands++;
+	STATUS_LOG ( ( "SCSITaskUserClient::CreateTaskRings called\n" ) );
 	
 	require_action ( isInactive ( ) == false, GENERAL_ERR, status = kIOReturnNoDevice );
+	require ( ( ringEntries >= kSCSITaskRingMinimumEntries ), GENERAL_ERR );
+	require ( ( ringEntries <= kSCSITaskRingMaximumEntries ), GENERAL_ERR );
+	require ( ( ( ringEntries & ( ringEntries - 1 ) ) == 0 ), GENERAL_ERR );
+	
+	// We must be the client holding exclusive access. This is checked
+	// behind the protocol interface's gate and never takes exclusive
+	// access on our behalf.
+	require_action ( fProtocolInterface->IsUserClientExclusiveOwner ( this ),
+					 GENERAL_ERR,
+					 status = kIOReturnExclusiveAccess );
+	
+	size = sizeof ( SCSITaskRingHeader ) + ( ringEntries * sizeof ( SCSITaskRingSubmission ) );
+	submissionRing = IOBufferMemoryDescriptor::withOptions (
+								kIODirectionInOut | kIOMemoryKernelUserShared,
+								size,
+								PAGE_SIZE );
+	require_nonzero_action ( submissionRing, GENERAL_ERR, status = kIOReturnNoMemory );
+	
+	size = sizeof ( SCSITaskRingHeader ) + ( ringEntries * sizeof ( SCSITaskRingCompletion ) );
+	completionRing = IOBufferMemoryDescriptor::withOptions (
+								kIODirectionInOut | kIOMemoryKernelUserShared,
+								size,
+								PAGE_SIZE );
+	require_nonzero_action ( completionRing, RELEASE_SUBMISSION_RING, status = kIOReturnNoMemory );
+	
+	bzero ( submissionRing->getBytesNoCopy ( ), submissionRing->getLength ( ) );
+	bzero ( completionRing->getBytesNoCopy ( ), completionRing->getLength ( ) );
+	
+	( ( SCSITaskRingHeader * ) submissionRing->getBytesNoCopy ( ) )->entries = ringEntries;
+	( ( SCSITaskRingHeader * ) completionRing->getBytesNoCopy ( ) )->entries = ringEntries;
+	
+	super::setAsyncReference ( asyncRef, ( mach_port_t ) asyncRef[0], callback, userRefCon );
+	
+	// Two threads of the client may race to create the rings, so only
+	// install them under the gate.
+	status = fCommandGate->runAction ( ( IOCommandGate::Action ) &SCSITaskUserClient::sCreateTaskRings,
+									   ( void * ) asyncRef,
+									   ( void * ) submissionRing,
+									   ( void * ) completionRing );
+	require_success ( status, RELEASE_COMPLETION_RING );
 	
-	state = fProtocolInterface->GetUserClientExclusivityState ( );
-	nrequire ( state, EXCLUSIVE_ACCESS_ERR );
-	
-	// Create and initialize a task
-	status = SetupTask ( &task );
-	require_success ( status, TASK_SETUP_ERR );
-	
-	// Prepare the buffers
-	status = PrepareBuffers ( &buffer, inquiryData->buffer, inquiryData->bufferSize, kIODirectionIn );
-	require_success ( status, BUFFER_PREPARATION_ERR );
-	
-	// Prepare the task
-	task->SetCommandDescriptorBlock ( kSCSICmd_INQUIRY,
-									  0x00,
-									  0x00,
-									  0x00,
-									  inquiryData->bufferSize,
-									  0x00 );
-	
-	task->SetTimeoutDuration ( kTenSecondTimeoutInMS );
-	task->SetDataTransferDirection ( kSCSIDataTransfer_FromTargetToInitiator );
-	task->SetDataBuffer ( buffer );
-	task->SetRequestedDataTransferCount ( inquiryData->bufferSize );
-	
-	status	= SendCommand ( task, inquiryData->senseDataBuffer, taskStatus );
-	status2	= CompleteBuffers ( buffer );
+	return status;
 	
-	if ( ( status == kIOReturnSuccess ) && ( status2 != kIOReturnSuccess ) )
-	{
-		status = status2;
-	}
 	
-	*outStructSize = sizeof ( SCSITaskStatus );
+RELEASE_COMPLETION_RING:
 	
-	task->release ( );
 	
-	return status;
+	completionRing->release ( );
+	completionRing = NULL;
 	
 	
-BUFFER_PREPARATION_ERR:
+RELEASE_SUBMISSION_RING:
 	
 	
-	task->release ( );
+	submissionRing->release ( );
+	submissionRing = NULL;
 	
 	
-TASK_SETUP_ERR:
-EXCLUSIVE_ACCESS_ERR:
 GENERAL_ERR:
 	
 	
-	fOutstandingCommands--;
-	
 	return status;
 	
 }
 
 
 //
-//	 TestUnitReady - 	Issues a TEST_UNIT_READY command to the drive as
-//						defined by SPC-2.							[PUBLIC]
+//	 DestroyTaskRings - 	Frees the rings created by CreateTaskRings, so
+//							that new ones can be created. Fails while any
+//							task taken from the submission ring has not
+//							posted its completion.				[PUBLIC]
 //
 
 IOReturn
-SCSITaskUserClient::TestUnitReady ( vm_address_t 		senseDataBuffer,
-									SCSITaskStatus * 	taskStatus,
-									UInt32 *			outStructSize )
+SCSITaskUserClient::DestroyTaskRings ( void )
 {
 	
-	IOReturn				status 	= kIOReturnExclusiveAccess;
-	SCSITask * 				task 	= NULL;
-	bool					state 	= true;
-	
-	check ( taskStatus );
-	check ( outStructSize );
-	
-	*outStructSize = 0;
-	
-	fOutstandingCommands++;
-	
-	require_action ( isInactive ( ) == false, GENERAL_ERR, status = kIOReturnNoDevice );
-	
-	state = fProtocolInterface->GetUserClientExclusivityState ( );
-	nrequire ( state, EXCLUSIVE_ACCESS_ERR );
-	
-	// Create and initialize a task
-	status = SetupTask ( &task );
-	require_success ( status, TASK_SETUP_ERR );
-	
-	task->SetCommandDescriptorBlock ( kSCSICmd_TEST_UNIT_READY,
-									  0x00,
-									  0x00,
-									  0x00,
-									  0x00,
-									  0x00 );
-	
-	task->SetTimeoutDuration ( kTenSecondTimeoutInMS );
-	task->SetDataTransferDirection ( kSCSIDataTransfer_NoDataTransfer );
+	IOReturn	status = kIOReturnNoDevice;
 	
-	status = SendCommand ( task, ( void * ) senseDataBuffer, taskStatus );
+	STATUS_LOG ( ( "SCSITaskUserClient::DestroyTaskRings called\n" ) );
 	
-	task->release ( );
-	*outStructSize = sizeof ( SCSITaskStatus );
+	require ( isInactive ( ) == false, GENERAL_ERR );
 	
-	return status;
+	status = fCommandGate->runAction ( ( IOCommandGate::Action ) &SCSITaskUserClient::sDestroyTaskRings );
 	
 	
-TASK_SETUP_ERR:
-EXCLUSIVE_ACCESS_ERR:
 GENERAL_ERR:
 	
 	
-	fOutstandingCommands--;
-	
 	return status;
 	
 }
 
 
 //
-//	 GetPerformance - 	Issues a GET_PERFORMANCE command to the drive as
-//						defined by Mt. Fuji/SFF-8090i revision 5.0.	[PUBLIC]
+//	 RingDoorbell - 	Submits every task posted to the submission ring
+//						since the last doorbell.					[PUBLIC]
 //
 
 IOReturn
-SCSITaskUserClient::GetPerformance ( AppleGetPerformanceStruct * 	performanceData,
-									 SCSITaskStatus * 				taskStatus,
-									 UInt32 						inStructSize,
-									 UInt32 * 						outStructSize )
+SCSITaskUserClient::RingDoorbell ( UInt32 * consumed )
 {
 	
-	IOReturn				status 	= kIOReturnExclusiveAccess;
-	IOReturn				status2 = kIOReturnExclusiveAccess;
-	SCSITask * 				task 	= NULL;
-	IOMemoryDescriptor *	buffer	= NULL;
-	bool					state 	= true;
-	
-	check ( performanceData );
-	check ( taskStatus );
-	check ( outStructSize );
-	
-	*outStructSize = 0;
-	
-	fOutstandingCommands++;
-	
-	require_action ( isInactive ( ) == false, GENERAL_ERR, status = kIOReturnNoDevice );
+	SCSITaskRingSubmission	entries[kSCSITaskRingBatchSize];
+	IOReturn				status	= kIOReturnNoDevice;
+	UInt32					count	= 0;
+	UInt32					total	= 0;
 	
-	state = fProtocolInterface->GetUserClientExclusivityState ( );
-	nrequire ( state, EXCLUSIVE_ACCESS_ERR );
+	STATUS_LOG ( ( "SCSITaskUserClient::RingDoorbell called\n" ) );
 	
-	// Create and initialize a task
-	status = SetupTask ( &task );
-	require_success ( status, TASK_SETUP_ERR );
+	check ( consumed );
 	
-	// Prepare the buffers
-	status = PrepareBuffers ( &buffer, performanceData->buffer, performanceData->bufferSize, kIODirectionIn );
-	require_success ( status, BUFFER_PREPARATION_ERR );	
+	require ( isInactive ( ) == false, GENERAL_ERR );
+	require_nonzero_action ( fSubmissionRing, GENERAL_ERR, status = kIOReturnNotReady );
 	
-	task->SetCommandDescriptorBlock ( kSCSICmd_GET_PERFORMANCE,
-									  performanceData->DATA_TYPE,
-									  ( performanceData->STARTING_LBA >> 24 ) 	& 0xFF,
-									  ( performanceData->STARTING_LBA >> 16 ) 	& 0xFF,
-									  ( performanceData->STARTING_LBA >>  8 ) 	& 0xFF,
-									  performanceData->STARTING_LBA         	& 0xFF,
-									  0x00,
-									  0x00,
-									  ( performanceData->MAXIMUM_NUMBER_OF_DESCRIPTORS >> 8 )	& 0xFF,
-									    performanceData->MAXIMUM_NUMBER_OF_DESCRIPTORS			& 0xFF,
-									  performanceData->TYPE,
-									  0x00 );
+	// Copy the posted entries out a batch at a time under the gate, then
+	// submit them without holding it. A short batch means the ring is
+	// empty, or the completion ring has no room for more tasks.
+	do
+	{
+		
+		count = kSCSITaskRingBatchSize;
+		status = fCommandGate->runAction ( ( IOCommandGate::Action ) &SCSITaskUserClient::sConsumeRingSubmissions,
+										   ( void * ) entries,
+										   ( void * ) &count );
+		require_success ( status, GENERAL_ERR );
+		
+		for ( UInt32 index = 0; index < count; index++ )
+		{
+			SubmitRingTask ( &entries[index] );
+		}
+		
+		total += count;
+		
+	} while ( count == kSCSITaskRingBatchSize );
 	
-	task->SetTimeoutDuration ( kThirtySecondTimeoutInMS );
-	task->SetDataTransferDirection ( kSCSIDataTransfer_FromTargetToInitiator );
-	task->SetDataBuffer ( buffer );
-	task->SetRequestedDataTransferCount ( performanceData->bufferSize );
 	
-	status	= SendCommand ( task, performanceData->senseDataBuffer, taskStatus );
-	status2	= CompleteBuffers ( buffer );
+GENERAL_ERR:
 	
-	if ( ( status == kIOReturnSuccess ) && ( status2 != kIOReturnSuccess ) )
-	{
-		status = status2;
-	}
 	
-	*outStructSize = sizeof ( SCSITaskStatus );
+	*consumed = total;
 	
-	task->release ( );
+	STATUS_LOG ( ( "RingDoorbell: consumed = %ld, status = 0x%08x\n", total, status ) );
 	
 	return status;
 	
+}
+
+
+//
+//	 SetCompletionCoalescing - Lets up to maxCompletions ring completions
+//								share one notification, holding back the
+//								first of them for at most maxDelay
+//								microseconds. A maxCompletions of 0 or 1
+//								turns coalescing off.			[PUBLIC]
+//
+
+IOReturn
+SCSITaskUserClient::SetCompletionCoalescing ( UInt32 maxCompletions, UInt32 maxDelay )
+{
 	
-BUFFER_PREPARATION_ERR:
+	IOReturn	status = kIOReturnBadArgument;
 	
+	STATUS_LOG ( ( "SCSITaskUserClient::SetCompletionCoalescing called\n" ) );
 	
-	task->release ( );
+	require_action ( isInactive ( ) == false, GENERAL_ERR, status = kIOReturnNoDevice );
+	require_nonzero_action ( fCompletionRing, GENERAL_ERR, status = kIOReturnNotReady );
+	require ( ( maxDelay <= kSCSITaskCoalescingMaximumDelay ), GENERAL_ERR );
 	
+	status = fCommandGate->runAction ( ( IOCommandGate::Action ) &SCSITaskUserClient::sSetCompletionCoalescing,
+									   ( void * ) maxCompletions,
+									   ( void * ) maxDelay );
 	
-TASK_SETUP_ERR:
-EXCLUSIVE_ACCESS_ERR:
-GENERAL_ERR:
 	
+GENERAL_ERR:
 	
-	fOutstandingCommands--;
 	
 	return status;
 	
@@ -1297,87 +1293,77 @@ GENERAL_ERR:
 
 
 //
-//	 GetConfiguration - 	Issues a GET_CONFIGURATION command to the drive as
-//							defined by MMC-2.						[PUBLIC]
+//	 RegisterBuffer - 	Wires a user buffer so tasks can transfer into it
+//						without preparing it on each execution. Returns a
+//						handle for the buffer.						[PUBLIC]
 //
 
 IOReturn
-SCSITaskUserClient::GetConfiguration ( AppleGetConfigurationStruct * 	configData,
-									   SCSITaskStatus * 				taskStatus,
-									   UInt32 							inStructSize,
-									   UInt32 * 						outStructSize )
+SCSITaskUserClient::RegisterBuffer ( vm_address_t	address,
+									 UInt32			length,
+									 UInt32			transferDirection,
+									 UInt32 *		bufferHandle )
 {
 	
-	IOReturn				status 	= kIOReturnExclusiveAccess;
-	IOReturn				status2 = kIOReturnExclusiveAccess;
-	SCSITask * 				task 	= NULL;
-	IOMemoryDescriptor *	buffer	= NULL;
-	bool					state 	= true;
+	SCSITaskRegisteredBuffer	entry;
+	IODirection					ioDirection	= kIODirectionNone;
+	IOReturn					status		= kIOReturnBadArgument;
 	
-	check ( configData );
-	check ( taskStatus );
-	check ( outStructSize );
+	STATUS_LOG ( ( "SCSITaskUserClient::RegisterBuffer called\n" ) );
 	
-	*outStructSize = 0;
+	check ( bufferHandle );
 	
-	fOutstandingCommands++;
+	*bufferHandle = kSCSITaskNullBufferHandle;
 	
 	require_action ( isInactive ( ) == false, GENERAL_ERR, status = kIOReturnNoDevice );
+	require_nonzero ( length, GENERAL_ERR );
 	
-	state = fProtocolInterface->GetUserClientExclusivityState ( );
-	nrequire ( state, EXCLUSIVE_ACCESS_ERR );
-	
-	// Create and initialize a task
-	status = SetupTask ( &task );
-	require_success ( status, TASK_SETUP_ERR );
+	if ( transferDirection == kSCSIDataTransfer_FromTargetToInitiator )
+		ioDirection = kIODirectionIn;
 	
-	// Prepare the buffers
-	status = PrepareBuffers ( &buffer, configData->buffer, configData->bufferSize, kIODirectionIn );
-	require_success ( status, BUFFER_PREPARATION_ERR );
+	else if ( transferDirection == kSCSIDataTransfer_FromInitiatorToTarget )
+		ioDirection = kIODirectionOut;
 	
-	task->SetCommandDescriptorBlock ( 	kSCSICmd_GET_CONFIGURATION,
-										configData->RT,
-										( configData->STARTING_FEATURE_NUMBER >> 8 ) & 0xFF,
-										  configData->STARTING_FEATURE_NUMBER        & 0xFF,
-										0x00,
-										0x00,
-										0x00,
-										( configData->bufferSize >> 8 ) 	& 0xFF,
-										  configData->bufferSize        	& 0xFF,
-										0x00 );
+	require ( ( ioDirection != kIODirectionNone ), GENERAL_ERR );
 	
-	task->SetTimeoutDuration ( kThirtySecondTimeoutInMS );
-	task->SetDataTransferDirection ( kSCSIDataTransfer_FromTargetToInitiator );
-	task->SetDataBuffer ( buffer );
-	task->SetRequestedDataTransferCount ( configData->bufferSize );
+	bzero ( &entry, sizeof ( entry ) );
 	
-	status	= SendCommand ( task, configData->senseDataBuffer, taskStatus );
-	status2	= CompleteBuffers ( buffer );
+	entry.length			= length;
+	entry.transferDirection	= transferDirection;
+	entry.buffer			= IOMemoryDescriptor::withAddress ( address,
+																length,
+																ioDirection,
+																fTask );
+	require_nonzero_action ( entry.buffer, GENERAL_ERR, status = kIOReturnNoResources );
 	
-	if ( ( status == kIOReturnSuccess ) && ( status2 != kIOReturnSuccess ) )
-	{
-		status = status2;
-	}
+	status = entry.buffer->prepare ( );
+	require_success ( status, RELEASE_BUFFER );
 	
-	*outStructSize = sizeof ( SCSITaskStatus );
+	status = fCommandGate->runAction ( ( IOCommandGate::Action ) &SCSITaskUserClient::sRegisterBuffer,
+									   ( void * ) &entry,
+									   ( void * ) bufferHandle );
+	require_success ( status, COMPLETE_BUFFER );
 	
-	task->release ( );
+	STATUS_LOG ( ( "RegisterBuffer: handle = %ld, wired bytes = %lld\n", *bufferHandle, fWiredBytes ) );
 	
 	return status;
 	
 	
-BUFFER_PREPARATION_ERR:
+COMPLETE_BUFFER:
 	
 	
-	task->release ( );
+	entry.buffer->complete ( );
 	
 	
-TASK_SETUP_ERR:
-EXCLUSIVE_ACCESS_ERR:
-GENERAL_ERR:
+RELEASE_BUFFER:
+	
 	
+	entry.buffer->release ( );
+	entry.buffer = NULL;
+	
+	
+GENERAL_ERR:
 	
-	fOutstandingCommands--;
 	
 	return status;
 	
@@ -1385,213 +1371,183 @@ GENERAL_ERR:
 
 
 //
-//	 ModeSense10 - Issues a MODE_SENSE_10 command to the drive as
-//					defined by SPC-2.								[PUBLIC]
+//	 UnregisterBuffer - 	Unwires a buffer registered by RegisterBuffer.
+//																	[PUBLIC]
 //
 
 IOReturn
-SCSITaskUserClient::ModeSense10 ( AppleModeSense10Struct * 	modeSenseData,
-								  SCSITaskStatus * 			taskStatus,
-								  UInt32 					inStructSize,
-								  UInt32 * 					outStructSize )
+SCSITaskUserClient::UnregisterBuffer ( UInt32 bufferHandle )
 {
 	
-	IOReturn				status 	= kIOReturnExclusiveAccess;
-	IOReturn				status2 = kIOReturnExclusiveAccess;
-	SCSITask * 				task 	= NULL;
-	IOMemoryDescriptor *	buffer	= NULL;
-	bool					state 	= true;
-	
-	check ( modeSenseData );
-	check ( taskStatus );
-	check ( outStructSize );
-	
-	*outStructSize = 0;
-	
-	fOutstandingCommands++;
-	
-	require_action ( isInactive ( ) == false, GENERAL_ERR, status = kIOReturnNoDevice );
-	
-	state = fProtocolInterface->GetUserClientExclusivityState ( );
-	nrequire ( state, EXCLUSIVE_ACCESS_ERR );
-	
-	// Create and initialize a task
-	status = SetupTask ( &task );
-	require_success ( status, TASK_SETUP_ERR );
-	
-	// Prepare the buffers
-	status = PrepareBuffers ( &buffer, modeSenseData->buffer, modeSenseData->bufferSize, kIODirectionIn );
-	require_success ( status, BUFFER_PREPARATION_ERR );
-	
-	task->SetCommandDescriptorBlock ( kSCSICmd_MODE_SENSE_10,
-									  ( modeSenseData->LLBAA << 4 ) | ( modeSenseData->DBD << 3 ),
-									  ( modeSenseData->PC << 6 ) | modeSenseData->PAGE_CODE,
-									  0x00,
-									  0x00,
-									  0x00,
-									  0x00,
-									  ( modeSenseData->bufferSize >> 8 & 0xFF ),
-									  ( modeSenseData->bufferSize & 0xFF ),
-									  0x00 );
-	
-	task->SetTimeoutDuration ( kThirtySecondTimeoutInMS );
-	task->SetDataTransferDirection ( kSCSIDataTransfer_FromTargetToInitiator );
-	task->SetDataBuffer ( buffer );
-	task->SetRequestedDataTransferCount ( modeSenseData->bufferSize );
-	
-	status	= SendCommand ( task, modeSenseData->senseDataBuffer, taskStatus );	
-	status2	= CompleteBuffers ( buffer );
-	
-	if ( ( status == kIOReturnSuccess ) && ( status2 != kIOReturnSuccess ) )
-	{
-		status = status2;
-	}
-	
-	*outStructSize = sizeof ( SCSITaskStatus );
-	
-	task->release ( );
-	
-	return status;
+	SCSITaskRegisteredBuffer	entry;
+	IOReturn					status = kIOReturnBadArgument;
 	
+	STATUS_LOG ( ( "SCSITaskUserClient::UnregisterBuffer called\n" ) );
 	
-BUFFER_PREPARATION_ERR:
+	bzero ( &entry, sizeof ( entry ) );
 	
+	status = fCommandGate->runAction ( ( IOCommandGate::Action ) &SCSITaskUserClient::sUnregisterBuffer,
+									   ( void * ) bufferHandle,
+									   ( void * ) &entry,
+									   ( void * ) false );
+	require_success ( status, GENERAL_ERR );
 	
-	task->release ( );
+	entry.buffer->complete ( );
+	entry.buffer->release ( );
 	
 	
-TASK_SETUP_ERR:
-EXCLUSIVE_ACCESS_ERR:
 GENERAL_ERR:
 	
 	
-	fOutstandingCommands--;
-	
 	return status;
 	
 }
 
 
 //
-//	 SetWriteParametersModePage - 	Issues a MODE_SELECT_10 command to the drive
-//									with the Write Parameters Mode Page set as
-//									defined by MMC-2.				[PUBLIC]
+//	 ExecuteTasks - 	Executes a batch of tasks passed in from user space
+//						with one pass through the command gate. Reports a
+//						status for each task.						[PUBLIC]
 //
 
 IOReturn
-SCSITaskUserClient::SetWriteParametersModePage ( AppleWriteParametersModePageStruct * paramsData,
-												 SCSITaskStatus * 	taskStatus,
-												 UInt32 			inStructSize,
-												 UInt32 * 			outStructSize )
+SCSITaskUserClient::ExecuteTasks ( SCSITaskBatchHeader *	batch,
+								   IOReturn *				results,
+								   UInt32					inStructSize,
+								   UInt32 *					outStructSize )
 {
 	
-	IOReturn				status 	= kIOReturnExclusiveAccess;
-	IOReturn				status2 = kIOReturnExclusiveAccess;
-	SCSITask * 				task 	= NULL;
-	IOMemoryDescriptor *	buffer	= NULL;
-	bool					state 	= true;
-	SCSICmdField1Bit		PF 		= 1;
-
-	check ( paramsData );
-	check ( taskStatus );
-	check ( outStructSize );
+	SCSITaskBatchEntry	entries[kSCSITaskBatchMaximumTasks];
+	IOReturn			status		= kIOReturnBadArgument;
+	UInt8 *				record		= NULL;
+	UInt32				remaining	= 0;
+	UInt32				count		= 0;
+	UInt32				index		= 0;
 	
-	*outStructSize = 0;
+	STATUS_LOG ( ( "SCSITaskUserClient::ExecuteTasks called\n" ) );
 	
-	fOutstandingCommands++;
+	check ( batch );
+	check ( results );
+	check ( outStructSize );
 	
 	require_action ( isInactive ( ) == false, GENERAL_ERR, status = kIOReturnNoDevice );
+	require ( ( inStructSize >= sizeof ( SCSITaskBatchHeader ) ), GENERAL_ERR );
 	
-	state = fProtocolInterface->GetUserClientExclusivityState ( );
-	nrequire ( state, EXCLUSIVE_ACCESS_ERR );
-	
-	// Create and initialize a task
-	status = SetupTask ( &task );
-	require_success ( status, TASK_SETUP_ERR );
-	
-	// Prepare the buffers
-	status = PrepareBuffers ( &buffer, paramsData->buffer, paramsData->bufferSize, kIODirectionOut );
-	require_success ( status, BUFFER_PREPARATION_ERR );
-	
-	task->SetCommandDescriptorBlock (	kSCSICmd_MODE_SELECT_10,
-										( PF << 4),
-										0x00,
-										0x00,
-										0x00,
-										0x00,
-										0x00,
-										( paramsData->bufferSize >> 8 ) & 0xFF,
-										  paramsData->bufferSize 		& 0xFF,
-										0x00 );
-	
-	task->SetTimeoutDuration ( kThirtySecondTimeoutInMS );
-	task->SetDataTransferDirection ( kSCSIDataTransfer_FromInitiatorToTarget );
-	task->SetDataBuffer ( buffer );
-	task->SetRequestedDataTransferCount ( paramsData->bufferSize );
+	count = batch->taskCount;
+	require ( ( count > 0 ) && ( count <= kSCSITaskBatchMaximumTasks ), GENERAL_ERR );
+	require ( ( *outStructSize >= ( count * sizeof ( IOReturn ) ) ), GENERAL_ERR );
 	
-	status	= SendCommand ( task, paramsData->senseDataBuffer, taskStatus );
-	status2	= CompleteBuffers ( buffer );
+	// Find every record before touching any task. A batch which doesn't
+	// hold the records it claims is rejected as a whole.
+	record		= ( UInt8 * ) ( batch + 1 );
+	remaining	= inStructSize - sizeof ( SCSITaskBatchHeader );
 	
-	if ( ( status == kIOReturnSuccess ) && ( status2 != kIOReturnSuccess ) )
+	for ( index = 0; index < count; index++ )
 	{
-		status = status2;
+		
+		SCSITaskData *	args = ( SCSITaskData * ) record;
+		UInt32			size = 0;
+		
+		require ( ( remaining >= SCSITaskDataSize ( 0 ) ), GENERAL_ERR );
+		require ( ( args->scatterGatherEntries <= ( remaining / sizeof ( IOVirtualRange ) ) ), GENERAL_ERR );
+		
+		size = SCSITaskBatchRecordSize ( args->scatterGatherEntries );
+		if ( size > remaining )
+			size = remaining;
+		
+		require ( ( SCSITaskDataSize ( args->scatterGatherEntries ) <= size ), GENERAL_ERR );
+		
+		entries[index].args		= args;
+		entries[index].argSize	= SCSITaskDataSize ( args->scatterGatherEntries );
+		entries[index].request	= NULL;
+		entries[index].status	= kIOReturnSuccess;
+		
+		record 		+= size;
+		remaining	-= size;
+		
 	}
 	
-	*outStructSize = sizeof ( SCSITaskStatus );
-	
-	task->release ( );
-	
-	return status;
-	
-	
-BUFFER_PREPARATION_ERR:
-	
-	
-	task->release ( );
-	
-	
-TASK_SETUP_ERR:
-EXCLUSIVE_ACCESS_ERR:
-GENERAL_ERR:
-	
-	
-	fOutstandingCommands--;
-	
-	return status;
-	
-}
-
-
-//
-//	 GetTrayState - Returns the current tray state of the drive.	[PUBLIC]
-//
-
-IOReturn
-SCSITaskUserClient::GetTrayState ( UInt32 * trayState )
-{
+	// Claim each task. A task which can't be claimed is skipped, as is a
+	// task which appears in the batch more than once.
+	for ( index = 0; index < count; index++ )
+	{
+		
+		for ( UInt32 earlier = 0; earlier < index; earlier++ )
+		{
+			
+			if ( entries[earlier].args->taskReference == entries[index].args->taskReference )
+			{
+				
+				entries[index].status = kIOReturnBadArgument;
+				break;
+				
+			}
+			
+		}
+		
+		if ( entries[index].status != kIOReturnSuccess )
+			continue;
+		
+		entries[index].status = PrepareTask ( entries[index].args,
+											  entries[index].args->isSync ? kCommandTypeExecuteSync : kCommandTypeExecuteAsync,
+											  0,
+											  &entries[index].request );
+		
+	}
 	
-	IOReturn		status 			= kIOReturnExclusiveAccess;
-	UInt8			actualTrayState	= 0;
-	bool			state			= false;
+	// Validate all of them while holding the gate once.
+	fCommandGate->runAction ( ( IOCommandGate::Action ) &SCSITaskUserClient::sValidateTasks,
+							  ( void * ) entries,
+							  ( void * ) count );
 	
-	fOutstandingCommands++;
+	// Send the valid tasks to the device.
+	for ( index = 0; index < count; index++ )
+	{
+		
+		if ( entries[index].status != kIOReturnSuccess )
+			continue;
+		
+		entries[index].status = LaunchTask ( entries[index].request, entries[index].args );
+		
+	}
 	
-	require_action ( isInactive ( ) == false, GENERAL_ERR, status = kIOReturnNoDevice );
+	// Wait for any synchronous tasks, now that the whole batch is on its
+	// way to the device, and drop the outstanding count for any task which
+	// was claimed but never sent.
+	for ( index = 0; index < count; index++ )
+	{
+		
+		if ( entries[index].request == NULL )
+			continue;
+		
+		if ( entries[index].status != kIOReturnSuccess )
+		{
+			
+			OSDecrementAtomic ( &fOutstandingCommands );
+			continue;
+			
+		}
+		
+		if ( entries[index].args->isSync )
+		{
+			entries[index].status = WaitForTask ( entries[index].request );
+		}
+		
+	}
 	
-	state = fProtocolInterface->GetUserClientExclusivityState ( );
-	nrequire ( state, EXCLUSIVE_ACCESS_ERR );
+	for ( index = 0; index < count; index++ )
+	{
+		results[index] = entries[index].status;
+	}
 	
-	status = ( ( IOSCSIMultimediaCommandsDevice * ) fProtocolInterface )->GetTrayState ( &actualTrayState );
-	require_success ( status, COMMAND_FAILED_ERR );
-	*trayState = actualTrayState;
+	*outStructSize	= count * sizeof ( IOReturn );
+	status			= kIOReturnSuccess;
 	
 	
-COMMAND_FAILED_ERR:
-EXCLUSIVE_ACCESS_ERR:
 GENERAL_ERR:
 	
 	
-	fOutstandingCommands--;
+	STATUS_LOG ( ( "ExecuteTasks: count = %ld, status = 0x%08x\n", count, status ) );
 	
 	return status;
 	
@@ -1599,63 +1555,66 @@ GENERAL_ERR:
 
 
 //
-//	 SetTrayState - Sets the drives tray state to the proposed state.
+//	 clientMemoryForType - Returns the ring the library asked to map.
 //																	[PUBLIC]
 //
 
 IOReturn
-SCSITaskUserClient::SetTrayState ( UInt32 trayState )
+SCSITaskUserClient::clientMemoryForType ( UInt32					type,
+										  IOOptionBits *			options,
+										  IOMemoryDescriptor **		memory )
 {
 	
-	IOReturn		status 				= kIOReturnExclusiveAccess;
-	UInt8			desiredTrayState	= 0;
-	bool			state				= false;
+	IOReturn	status = kIOReturnNoDevice;
 	
-	fOutstandingCommands++;
+	check ( options );
+	check ( memory );
 	
-	require_action ( isInactive ( ) == false, GENERAL_ERR, status = kIOReturnNoDevice );
+	require ( isInactive ( ) == false, GENERAL_ERR );
 	
-	state = fProtocolInterface->GetUserClientExclusivityState ( );
-	nrequire ( state, EXCLUSIVE_ACCESS_ERR );
+	// DestroyTaskRings may free the rings at any time, so only look at
+	// them under the gate.
+	status = fCommandGate->runAction ( ( IOCommandGate::Action ) &SCSITaskUserClient::sClientMemoryForType,
+									   ( void * ) type,
+									   ( void * ) memory );
+	require_success ( status, GENERAL_ERR );
 	
-	desiredTrayState = trayState & kMMCDeviceTrayMask;
-	status = ( ( IOSCSIMultimediaCommandsDevice * ) fProtocolInterface )->SetTrayState ( desiredTrayState );
+	*options = 0;
 	
 	
-EXCLUSIVE_ACCESS_ERR:
 GENERAL_ERR:
 	
 	
-	fOutstandingCommands--;
-	
 	return status;
 	
 }
 
 
 //
-//	 ReadTableOfContents - Issues a READ_TOC_PMA_ATIP command to the drive as
-//							defined in MMC-2.						[PUBLIC]
+//	 Inquiry - Issues an INQUIRY command to the drive as defined by SPC-2.	
+//																	[PUBLIC]
 //
 
 IOReturn
-SCSITaskUserClient::ReadTableOfContents ( AppleReadTableOfContentsStruct * 	readTOCData,
-										  SCSITaskStatus * 					taskStatus,
-										  UInt32 							inStructSize,
-										  UInt32 * 							outStructSize )
+SCSITaskUserClient::Inquiry ( AppleInquiryStruct * 	inquiryData,
+							  SCSITaskStatus * 		taskStatus,
+							  UInt32				inStructSize,
+							  UInt32 *				outStructSize )
 {
 	
 	IOReturn				status 	= kIOReturnExclusiveAccess;
-	IOReturn				status2	= kIOReturnExclusiveAccess;
+	IOReturn				status2 = kIOReturnExclusiveAccess;
 	SCSITask * 				task 	= NULL;
 	IOMemoryDescriptor *	buffer	= NULL;
 	bool					state 	= true;
 	
-	check ( readTOCData );
+	check ( inquiryData );
 	check ( taskStatus );
 	check ( outStructSize );
 	
-	fOutstandingCommands++;
+	*outStructSize = 0;
+	
+	OSIncrementAtomic ( &fOutstandingCommands );
 	
 	require_action ( isInactive ( ) == false, GENERAL_ERR, status = kIOReturnNoDevice );
 	
@@ -1667,52 +1626,24 @@ SCSITaskUserClient::ReadTableOfContents ( AppleReadTableOfContentsStruct * 	read
 	require_success ( status, TASK_SETUP_ERR );
 	
 	// Prepare the buffers
-	status = PrepareBuffers ( &buffer, readTOCData->buffer, readTOCData->bufferSize, kIODirectionIn );
+	status = PrepareBuffers ( &buffer, inquiryData->buffer, inquiryData->bufferSize, kIODirectionIn );
 	require_success ( status, BUFFER_PREPARATION_ERR );
 	
-	if ( readTOCData->FORMAT & 0x04 )
-	{
-		
-		// Use new style from MMC-2
-		task->SetCommandDescriptorBlock ( kSCSICmd_READ_TOC_PMA_ATIP,
-										  readTOCData->MSF << 1,
-										  readTOCData->FORMAT,
-										  0x00,
-										  0x00,
-										  0x00,
-										  readTOCData->TRACK_SESSION_NUMBER,
-										  ( readTOCData->bufferSize >> 8 ) & 0xFF,
-										    readTOCData->bufferSize        & 0xFF,
-										  0x00 );
-
-	
-	}
-	
-	else
-	{
-
-		// Use old style from SFF-8020i
-		task->SetCommandDescriptorBlock ( kSCSICmd_READ_TOC_PMA_ATIP,
-										  readTOCData->MSF << 1,
-										  0x00,
-										  0x00,
-										  0x00,
-										  0x00,
-										  readTOCData->TRACK_SESSION_NUMBER,
-										  ( readTOCData->bufferSize >> 8 ) & 0xFF,
-										    readTOCData->bufferSize        & 0xFF,
-										  ( readTOCData->FORMAT & 0x03 ) << 6 );
-		
-	}
+	// Prepare the task
+	task->SetCommandDescriptorBlock ( kSCSICmd_INQUIRY,
+									  0x00,
+									  0x00,
+									  0x00,
+									  inquiryData->bufferSize,
+									  0x00 );
 	
-	// set timeout to 30 seconds
-	task->SetTimeoutDuration ( kThirtySecondTimeoutInMS );
+	task->SetTimeoutDuration ( kTenSecondTimeoutInMS );
 	task->SetDataTransferDirection ( kSCSIDataTransfer_FromTargetToInitiator );
 	task->SetDataBuffer ( buffer );
-	task->SetRequestedDataTransferCount ( readTOCData->bufferSize );
+	task->SetRequestedDataTransferCount ( inquiryData->bufferSize );
 	
-	status	= SendCommand ( task, readTOCData->senseDataBuffer, taskStatus );
-	status2 = CompleteBuffers ( buffer );
+	status	= SendCommand ( task, inquiryData->senseDataBuffer, taskStatus );
+	status2	= CompleteBuffers ( buffer );
 	
 	if ( ( status == kIOReturnSuccess ) && ( status2 != kIOReturnSuccess ) )
 	{
@@ -1737,7 +1668,7 @@ EXCLUSIVE_ACCESS_ERR:
 GENERAL_ERR:
 	
 	
-	fOutstandingCommands--;
+	OSDecrementAtomic ( &fOutstandingCommands );
 	
 	return status;
 	
@@ -1745,28 +1676,26 @@ GENERAL_ERR:
 
 
 //
-//	 ReadDiscInformation - Issues a READ_DISC_INFORMATION command to the
-//							drive as defined in MMC-2.				[PUBLIC]
+//	 TestUnitReady - 	Issues a TEST_UNIT_READY command to the drive as
+//						defined by SPC-2.							[PUBLIC]
 //
 
 IOReturn
-SCSITaskUserClient::ReadDiscInformation ( AppleReadDiscInfoStruct * 	discInfoData,
-										  SCSITaskStatus * 				taskStatus,
-										  UInt32 						inStructSize,
-										  UInt32 * 						outStructSize )
+SCSITaskUserClient::TestUnitReady ( vm_address_t 		senseDataBuffer,
+									SCSITaskStatus * 	taskStatus,
+									UInt32 *			outStructSize )
 {
 	
 	IOReturn				status 	= kIOReturnExclusiveAccess;
-	IOReturn				status2	= kIOReturnExclusiveAccess;
 	SCSITask * 				task 	= NULL;
-	IOMemoryDescriptor *	buffer	= NULL;
 	bool					state 	= true;
-		
-	check ( discInfoData );
+	
 	check ( taskStatus );
 	check ( outStructSize );
 	
-	fOutstandingCommands++;
+	*outStructSize = 0;
+	
+	OSIncrementAtomic ( &fOutstandingCommands );
 	
 	require_action ( isInactive ( ) == false, GENERAL_ERR, status = kIOReturnNoDevice );
 	
@@ -1777,54 +1706,30 @@ SCSITaskUserClient::ReadDiscInformation ( AppleReadDiscInfoStruct * 	discInfoDat
 	status = SetupTask ( &task );
 	require_success ( status, TASK_SETUP_ERR );
 	
-	// Prepare the buffers
-	status = PrepareBuffers ( &buffer, discInfoData->buffer, discInfoData->bufferSize, kIODirectionIn );
-	require_success ( status, BUFFER_PREPARATION_ERR );
-	
-	task->SetCommandDescriptorBlock ( kSCSICmd_READ_DISC_INFORMATION,
-									  0x00,
-									  0x00,
+	task->SetCommandDescriptorBlock ( kSCSICmd_TEST_UNIT_READY,
 									  0x00,
 									  0x00,
 									  0x00,
 									  0x00,
-									  ( discInfoData->bufferSize >> 8 ) & 0xFF,
-									    discInfoData->bufferSize        & 0xFF,
 									  0x00 );
 	
-	// set timeout to 30 seconds
-	task->SetTimeoutDuration ( kThirtySecondTimeoutInMS );
-	task->SetDataTransferDirection ( kSCSIDataTransfer_FromTargetToInitiator );
-	task->SetDataBuffer ( buffer );
-	task->SetRequestedDataTransferCount ( discInfoData->bufferSize );
-	
-	status 	= SendCommand ( task, discInfoData->senseDataBuffer, taskStatus );
-	status2 = CompleteBuffers ( buffer );
-	
-	if ( ( status == kIOReturnSuccess ) && ( status2 != kIOReturnSuccess ) )
-	{
-		status = status2;
-	}
+	task->SetTimeoutDuration ( kTenSecondTimeoutInMS );
+	task->SetDataTransferDirection ( kSCSIDataTransfer_NoDataTransfer );
 	
-	*outStructSize = sizeof ( SCSITaskStatus );
+	status = SendCommand ( task, ( void * ) senseDataBuffer, taskStatus );
 	
 	task->release ( );
+	*outStructSize = sizeof ( SCSITaskStatus );
 	
 	return status;
 	
 	
-BUFFER_PREPARATION_ERR:
+TASK_SETUP_ERR:
+EXCLUSIVE_ACCESS_ERR:
+GENERAL_ERR:
 	
 	
-	task->release ( );
-	
-	
-TASK_SETUP_ERR:
-EXCLUSIVE_ACCESS_ERR:
-GENERAL_ERR:
-	
-	
-	fOutstandingCommands--;
+	OSDecrementAtomic ( &fOutstandingCommands );
 	
 	return status;
 	
@@ -1832,15 +1737,15 @@ GENERAL_ERR:
 
 
 //
-//	 ReadTrackInformation - 	Issues a READ_TRACK/RZONE_INFORMATION command
-//								to the drive as defined in MMC-2.	[PUBLIC]
+//	 GetPerformance - 	Issues a GET_PERFORMANCE command to the drive as
+//						defined by Mt. Fuji/SFF-8090i revision 5.0.	[PUBLIC]
 //
 
 IOReturn
-SCSITaskUserClient::ReadTrackInformation ( AppleReadTrackInfoStruct * 	trackInfoData,
-										   SCSITaskStatus * 			taskStatus,
-										   UInt32 						inStructSize,
-										   UInt32 * 					outStructSize )
+SCSITaskUserClient::GetPerformance ( AppleGetPerformanceStruct * 	performanceData,
+									 SCSITaskStatus * 				taskStatus,
+									 UInt32 						inStructSize,
+									 UInt32 * 						outStructSize )
 {
 	
 	IOReturn				status 	= kIOReturnExclusiveAccess;
@@ -1849,11 +1754,13 @@ SCSITaskUserClient::ReadTrackInformation ( AppleReadTrackInfoStruct * 	trackInfo
 	IOMemoryDescriptor *	buffer	= NULL;
 	bool					state 	= true;
 	
-	check ( trackInfoData );
+	check ( performanceData );
 	check ( taskStatus );
 	check ( outStructSize );
 	
-	fOutstandingCommands++;
+	*outStructSize = 0;
+	
+	OSIncrementAtomic ( &fOutstandingCommands );
 	
 	require_action ( isInactive ( ) == false, GENERAL_ERR, status = kIOReturnNoDevice );
 	
@@ -1865,27 +1772,28 @@ SCSITaskUserClient::ReadTrackInformation ( AppleReadTrackInfoStruct * 	trackInfo
 	require_success ( status, TASK_SETUP_ERR );
 	
 	// Prepare the buffers
-	status = PrepareBuffers ( &buffer, trackInfoData->buffer, trackInfoData->bufferSize, kIODirectionIn );
-	require_success ( status, BUFFER_PREPARATION_ERR );
+	status = PrepareBuffers ( &buffer, performanceData->buffer, performanceData->bufferSize, kIODirectionIn );
+	require_success ( status, BUFFER_PREPARATION_ERR );	
 	
-	task->SetCommandDescriptorBlock ( kSCSICmd_READ_TRACK_INFORMATION,
-									  trackInfoData->ADDRESS_NUMBER_TYPE & 0x03,
-									  ( trackInfoData->LOGICAL_BLOCK_ADDRESS_TRACK_SESSION_NUMBER >> 24 ) & 0xFF,
-									  ( trackInfoData->LOGICAL_BLOCK_ADDRESS_TRACK_SESSION_NUMBER >> 16 ) & 0xFF,
-									  ( trackInfoData->LOGICAL_BLOCK_ADDRESS_TRACK_SESSION_NUMBER >>  8 ) & 0xFF,
-								 	    trackInfoData->LOGICAL_BLOCK_ADDRESS_TRACK_SESSION_NUMBER         & 0xFF,
+	task->SetCommandDescriptorBlock ( kSCSICmd_GET_PERFORMANCE,
+									  performanceData->DATA_TYPE,
+									  ( performanceData->STARTING_LBA >> 24 ) 	& 0xFF,
+									  ( performanceData->STARTING_LBA >> 16 ) 	& 0xFF,
+									  ( performanceData->STARTING_LBA >>  8 ) 	& 0xFF,
+									  performanceData->STARTING_LBA         	& 0xFF,
 									  0x00,
-									  ( trackInfoData->bufferSize >>  8 ) & 0xFF,
-								  	    trackInfoData->bufferSize         & 0xFF,
+									  0x00,
+									  ( performanceData->MAXIMUM_NUMBER_OF_DESCRIPTORS >> 8 )	& 0xFF,
+									    performanceData->MAXIMUM_NUMBER_OF_DESCRIPTORS			& 0xFF,
+									  performanceData->TYPE,
 									  0x00 );
 	
-	// set timeout to 30 seconds
 	task->SetTimeoutDuration ( kThirtySecondTimeoutInMS );
 	task->SetDataTransferDirection ( kSCSIDataTransfer_FromTargetToInitiator );
 	task->SetDataBuffer ( buffer );
-	task->SetRequestedDataTransferCount ( trackInfoData->bufferSize );
+	task->SetRequestedDataTransferCount ( performanceData->bufferSize );
 	
-	status	= SendCommand ( task, trackInfoData->senseDataBuffer, taskStatus );
+	status	= SendCommand ( task, performanceData->senseDataBuffer, taskStatus );
 	status2	= CompleteBuffers ( buffer );
 	
 	if ( ( status == kIOReturnSuccess ) && ( status2 != kIOReturnSuccess ) )
@@ -1911,7 +1819,7 @@ EXCLUSIVE_ACCESS_ERR:
 GENERAL_ERR:
 	
 	
-	fOutstandingCommands--;
+	OSDecrementAtomic ( &fOutstandingCommands );
 	
 	return status;
 	
@@ -1919,12 +1827,12 @@ GENERAL_ERR:
 
 
 //
-//	 ReadDVDStructure - 	Issues a READ_DVD_STRUCTURE command to the drive as
-//							defined in MMC-2.						[PUBLIC]
+//	 GetConfiguration - 	Issues a GET_CONFIGURATION command to the drive as
+//							defined by MMC-2.						[PUBLIC]
 //
 
 IOReturn
-SCSITaskUserClient::ReadDVDStructure ( AppleReadDVDStructureStruct * 	dvdStructData,
+SCSITaskUserClient::GetConfiguration ( AppleGetConfigurationStruct * 	configData,
 									   SCSITaskStatus * 				taskStatus,
 									   UInt32 							inStructSize,
 									   UInt32 * 						outStructSize )
@@ -1936,11 +1844,13 @@ SCSITaskUserClient::ReadDVDStructure ( AppleReadDVDStructureStruct * 	dvdStructD
 	IOMemoryDescriptor *	buffer	= NULL;
 	bool					state 	= true;
 	
-	check ( dvdStructData );
+	check ( configData );
 	check ( taskStatus );
 	check ( outStructSize );
 	
-	fOutstandingCommands++;
+	*outStructSize = 0;
+	
+	OSIncrementAtomic ( &fOutstandingCommands );
 	
 	require_action ( isInactive ( ) == false, GENERAL_ERR, status = kIOReturnNoDevice );
 	
@@ -1952,29 +1862,26 @@ SCSITaskUserClient::ReadDVDStructure ( AppleReadDVDStructureStruct * 	dvdStructD
 	require_success ( status, TASK_SETUP_ERR );
 	
 	// Prepare the buffers
-	status = PrepareBuffers ( &buffer, dvdStructData->buffer, dvdStructData->bufferSize, kIODirectionIn );
+	status = PrepareBuffers ( &buffer, configData->buffer, configData->bufferSize, kIODirectionIn );
 	require_success ( status, BUFFER_PREPARATION_ERR );
 	
-	task->SetCommandDescriptorBlock ( kSCSICmd_READ_DVD_STRUCTURE,
-									  0x00,
-									  ( dvdStructData->ADDRESS >> 24 ) & 0xFF,
-									  ( dvdStructData->ADDRESS >> 16 ) & 0xFF,
-									  ( dvdStructData->ADDRESS >> 8  ) & 0xFF,
-									    dvdStructData->ADDRESS		   & 0xFF,
-									    dvdStructData->LAYER_NUMBER,
-									    dvdStructData->FORMAT,
-									  ( dvdStructData->bufferSize >> 8 ) & 0xFF,
-									    dvdStructData->bufferSize        & 0xFF,
-									  ( dvdStructData->AGID << 6 ),
-									  0x00 );
+	task->SetCommandDescriptorBlock ( 	kSCSICmd_GET_CONFIGURATION,
+										configData->RT,
+										( configData->STARTING_FEATURE_NUMBER >> 8 ) & 0xFF,
+										  configData->STARTING_FEATURE_NUMBER        & 0xFF,
+										0x00,
+										0x00,
+										0x00,
+										( configData->bufferSize >> 8 ) 	& 0xFF,
+										  configData->bufferSize        	& 0xFF,
+										0x00 );
 	
-	// set timeout to 30 seconds
 	task->SetTimeoutDuration ( kThirtySecondTimeoutInMS );
 	task->SetDataTransferDirection ( kSCSIDataTransfer_FromTargetToInitiator );
 	task->SetDataBuffer ( buffer );
-	task->SetRequestedDataTransferCount ( dvdStructData->bufferSize );
+	task->SetRequestedDataTransferCount ( configData->bufferSize );
 	
-	status	= SendCommand ( task, dvdStructData->senseDataBuffer, taskStatus );
+	status	= SendCommand ( task, configData->senseDataBuffer, taskStatus );
 	status2	= CompleteBuffers ( buffer );
 	
 	if ( ( status == kIOReturnSuccess ) && ( status2 != kIOReturnSuccess ) )
@@ -2000,7 +1907,7 @@ EXCLUSIVE_ACCESS_ERR:
 GENERAL_ERR:
 	
 	
-	fOutstandingCommands--;
+	OSDecrementAtomic ( &fOutstandingCommands );
 	
 	return status;
 	
@@ -2008,29 +1915,30 @@ GENERAL_ERR:
 
 
 //
-//	 SetCDSpeed - Called to set the new CD read/write speeds.
-//																	[PUBLIC]
+//	 ModeSense10 - Issues a MODE_SENSE_10 command to the drive as
+//					defined by SPC-2.								[PUBLIC]
 //
 
 IOReturn
-SCSITaskUserClient::SetCDSpeed ( AppleSetCDSpeedStruct *	setCDSpeedData,
-								 SCSITaskStatus * 			taskStatus,
-								 UInt32 					inStructSize,
-								 UInt32 * 					outStructSize )
+SCSITaskUserClient::ModeSense10 ( AppleModeSense10Struct * 	modeSenseData,
+								  SCSITaskStatus * 			taskStatus,
+								  UInt32 					inStructSize,
+								  UInt32 * 					outStructSize )
 {
 	
-	IOReturn				status			= kIOReturnExclusiveAccess;
-	SCSITask * 				task			= NULL;
-	bool					state			= true;
-	UInt16					readSpeed		= 0;
-	UInt16					writeSpeed		= 0;
-	
+	IOReturn				status 	= kIOReturnExclusiveAccess;
+	IOReturn				status2 = kIOReturnExclusiveAccess;
+	SCSITask * 				task 	= NULL;
+	IOMemoryDescriptor *	buffer	= NULL;
+	bool					state 	= true;
 	
-	check ( setCDSpeedData );
+	check ( modeSenseData );
 	check ( taskStatus );
 	check ( outStructSize );
 	
-	fOutstandingCommands++;
+	*outStructSize = 0;
+	
+	OSIncrementAtomic ( &fOutstandingCommands );
 	
 	require_action ( isInactive ( ) == false, GENERAL_ERR, status = kIOReturnNoDevice );
 	
@@ -2041,28 +1949,33 @@ SCSITaskUserClient::SetCDSpeed ( AppleSetCDSpeedStruct *	setCDSpeedData,
 	status = SetupTask ( &task );
 	require_success ( status, TASK_SETUP_ERR );
 	
-	readSpeed	= setCDSpeedData->LOGICAL_UNIT_READ_SPEED;
-	writeSpeed	= setCDSpeedData->LOGICAL_UNIT_WRITE_SPEED;
+	// Prepare the buffers
+	status = PrepareBuffers ( &buffer, modeSenseData->buffer, modeSenseData->bufferSize, kIODirectionIn );
+	require_success ( status, BUFFER_PREPARATION_ERR );
 	
-	task->SetCommandDescriptorBlock ( kSCSICmd_SET_CD_SPEED,
-									  0x00,
-									  ( readSpeed >>   8 )	& 0xFF,
-									  readSpeed				& 0xFF,
-									  ( writeSpeed >>  8 )	& 0xFF,
-									  writeSpeed			& 0xFF,
-									  0x00,
+	task->SetCommandDescriptorBlock ( kSCSICmd_MODE_SENSE_10,
+									  ( modeSenseData->LLBAA << 4 ) | ( modeSenseData->DBD << 3 ),
+									  ( modeSenseData->PC << 6 ) | modeSenseData->PAGE_CODE,
 									  0x00,
 									  0x00,
 									  0x00,
 									  0x00,
+									  ( modeSenseData->bufferSize >> 8 & 0xFF ),
+									  ( modeSenseData->bufferSize & 0xFF ),
 									  0x00 );
 	
 	task->SetTimeoutDuration ( kThirtySecondTimeoutInMS );
-	task->SetDataTransferDirection ( kSCSIDataTransfer_NoDataTransfer );
+	task->SetDataTransferDirection ( kSCSIDataTransfer_FromTargetToInitiator );
+	task->SetDataBuffer ( buffer );
+	task->SetRequestedDataTransferCount ( modeSenseData->bufferSize );
 	
-	status	= SendCommand ( task,
-							setCDSpeedData->senseDataBuffer,
-							taskStatus );
+	status	= SendCommand ( task, modeSenseData->senseDataBuffer, taskStatus );	
+	status2	= CompleteBuffers ( buffer );
+	
+	if ( ( status == kIOReturnSuccess ) && ( status2 != kIOReturnSuccess ) )
+	{
+		status = status2;
+	}
 	
 	*outStructSize = sizeof ( SCSITaskStatus );
 	
@@ -2071,12 +1984,18 @@ SCSITaskUserClient::SetCDSpeed ( AppleSetCDSpeedStruct *	setCDSpeedData,
 	return status;
 	
 	
+BUFFER_PREPARATION_ERR:
+	
+	
+	task->release ( );
+	
+	
 TASK_SETUP_ERR:
 EXCLUSIVE_ACCESS_ERR:
 GENERAL_ERR:
 	
 	
-	fOutstandingCommands--;
+	OSDecrementAtomic ( &fOutstandingCommands );
 	
 	return status;
 	
@@ -2084,29 +2003,32 @@ GENERAL_ERR:
 
 
 //
-//	 ReadFormatCapacities - Issues a READ_FORMAT_CAPACITIES command to the
-//							 drive as defined in MMC-2.				[PUBLIC]
+//	 SetWriteParametersModePage - 	Issues a MODE_SELECT_10 command to the drive
+//									with the Write Parameters Mode Page set as
+//									defined by MMC-2.				[PUBLIC]
 //
 
 IOReturn
-SCSITaskUserClient::ReadFormatCapacities ( AppleReadFormatCapacitiesStruct *	readFormatCapacitiesData,
-										   SCSITaskStatus * 					taskStatus,
-										   UInt32 								inStructSize,
-										   UInt32 * 							outStructSize )
+SCSITaskUserClient::SetWriteParametersModePage ( AppleWriteParametersModePageStruct * paramsData,
+												 SCSITaskStatus * 	taskStatus,
+												 UInt32 			inStructSize,
+												 UInt32 * 			outStructSize )
 {
 	
-	IOReturn				status			= kIOReturnExclusiveAccess;
-	IOReturn				status2			= kIOReturnExclusiveAccess;
-	bool					state			= true;
-	SCSITask * 				task			= NULL;
-	IOMemoryDescriptor *	buffer			= NULL;
-	
-	
-	check ( readFormatCapacitiesData );
+	IOReturn				status 	= kIOReturnExclusiveAccess;
+	IOReturn				status2 = kIOReturnExclusiveAccess;
+	SCSITask * 				task 	= NULL;
+	IOMemoryDescriptor *	buffer	= NULL;
+	bool					state 	= true;
+	SCSICmdField1Bit		PF 		= 1;
+
+	check ( paramsData );
 	check ( taskStatus );
 	check ( outStructSize );
 	
-	fOutstandingCommands++;
+	*outStructSize = 0;
+	
+	OSIncrementAtomic ( &fOutstandingCommands );
 	
 	require_action ( isInactive ( ) == false, GENERAL_ERR, status = kIOReturnNoDevice );
 	
@@ -2118,27 +2040,26 @@ SCSITaskUserClient::ReadFormatCapacities ( AppleReadFormatCapacitiesStruct *	rea
 	require_success ( status, TASK_SETUP_ERR );
 	
 	// Prepare the buffers
-	status = PrepareBuffers ( &buffer, readFormatCapacitiesData->buffer, readFormatCapacitiesData->bufferSize, kIODirectionIn );
+	status = PrepareBuffers ( &buffer, paramsData->buffer, paramsData->bufferSize, kIODirectionOut );
 	require_success ( status, BUFFER_PREPARATION_ERR );
 	
-	task->SetCommandDescriptorBlock ( kSCSICmd_READ_FORMAT_CAPACITIES,
-									  0x00,
-									  0x00,
-									  0x00,
-									  0x00,
-									  0x00,
-									  0x00,
-									  ( readFormatCapacitiesData->bufferSize >> 8 ) & 0xFF,
-									    readFormatCapacitiesData->bufferSize        & 0xFF,
-									  0 );
+	task->SetCommandDescriptorBlock (	kSCSICmd_MODE_SELECT_10,
+										( PF << 4),
+										0x00,
+										0x00,
+										0x00,
+										0x00,
+										0x00,
+										( paramsData->bufferSize >> 8 ) & 0xFF,
+										  paramsData->bufferSize 		& 0xFF,
+										0x00 );
 	
 	task->SetTimeoutDuration ( kThirtySecondTimeoutInMS );
-	task->SetDataTransferDirection ( kSCSIDataTransfer_FromTargetToInitiator );
+	task->SetDataTransferDirection ( kSCSIDataTransfer_FromInitiatorToTarget );
 	task->SetDataBuffer ( buffer );
-	task->SetRequestedDataTransferCount ( readFormatCapacitiesData->bufferSize );
-	
-	status	= SendCommand ( task, readFormatCapacitiesData->senseDataBuffer, taskStatus );
+	task->SetRequestedDataTransferCount ( paramsData->bufferSize );
 	
+	status	= SendCommand ( task, paramsData->senseDataBuffer, taskStatus );
 	status2	= CompleteBuffers ( buffer );
 	
 	if ( ( status == kIOReturnSuccess ) && ( status2 != kIOReturnSuccess ) )
@@ -2163,150 +2084,1971 @@ TASK_SETUP_ERR:
 EXCLUSIVE_ACCESS_ERR:
 GENERAL_ERR:
 	
-	fOutstandingCommands--;
+	
+	OSDecrementAtomic ( &fOutstandingCommands );
 	
 	return status;
 	
 }
 
 
-#if 0
-#pragma mark -
-#pragma mark Protected Methods
-#pragma mark -
-#endif
-
-
 //
-//	 getTargetAndMethodForIndex - 	Returns a pointer to the target of the
-//									method call and the method vector itself
-//									based on the provided index.	[PROTECTED]
+//	 GetTrayState - Returns the current tray state of the drive.	[PUBLIC]
 //
 
-IOExternalMethod *
-SCSITaskUserClient::getTargetAndMethodForIndex (
-							IOService **	target,
-							UInt32			index )
+IOReturn
+SCSITaskUserClient::GetTrayState ( UInt32 * trayState )
 {
 	
-	IOExternalMethod *	method = NULL;
+	IOReturn		status 			= kIOReturnExclusiveAccess;
+	UInt8			actualTrayState	= 0;
+	bool			state			= false;
 	
-	check ( target );
-	require ( index < kSCSITaskUserClientMethodCount, GENERAL_ERR );
+	OSIncrementAtomic ( &fOutstandingCommands );
 	
-	fOutstandingCommands++;
+	require_action ( isInactive ( ) == false, GENERAL_ERR, status = kIOReturnNoDevice );
 	
-	require ( isInactive ( ) == false, DECREMENT_COUNTER );
+	state = fProtocolInterface->GetUserClientExclusivityState ( );
+	nrequire ( state, EXCLUSIVE_ACCESS_ERR );
 	
-	fProtocolInterface->retain ( );
+	status = ( ( IOSCSIMultimediaCommandsDevice * ) fProtocolInterface )->GetTrayState ( &actualTrayState );
+	require_success ( status, COMMAND_FAILED_ERR );
+	*trayState = actualTrayState;
 	
-	if ( fProtocolInterface->IsPowerManagementIntialized ( ) )
-	{
-		fProtocolInterface->CheckPowerState ( );
-	}
 	
-	fProtocolInterface->release ( );
+COMMAND_FAILED_ERR:
+EXCLUSIVE_ACCESS_ERR:
+GENERAL_ERR:
 	
-	*target = this;
-	method 	= &sMethods[index];
 	
+	OSDecrementAtomic ( &fOutstandingCommands );
 	
-DECREMENT_COUNTER:
+	return status;
+	
+}
+
+
+//
+//	 SetTrayState - Sets the drives tray state to the proposed state.
+//																	[PUBLIC]
+//
+
+IOReturn
+SCSITaskUserClient::SetTrayState ( UInt32 trayState )
+{
+	
+	IOReturn		status 				= kIOReturnExclusiveAccess;
+	UInt8			desiredTrayState	= 0;
+	bool			state				= false;
+	
+	OSIncrementAtomic ( &fOutstandingCommands );
+	
+	require_action ( isInactive ( ) == false, GENERAL_ERR, status = kIOReturnNoDevice );
+	
+	state = fProtocolInterface->GetUserClientExclusivityState ( );
+	nrequire ( state, EXCLUSIVE_ACCESS_ERR );
+	
+	desiredTrayState = trayState & kMMCDeviceTrayMask;
+	status = ( ( IOSCSIMultimediaCommandsDevice * ) fProtocolInterface )->SetTrayState ( desiredTrayState );
+	
+	
+EXCLUSIVE_ACCESS_ERR:
+GENERAL_ERR:
+	
+	
+	OSDecrementAtomic ( &fOutstandingCommands );
+	
+	return status;
+	
+}
+
+
+//
+//	 ReadTableOfContents - Issues a READ_TOC_PMA_ATIP command to the drive as
+//							defined in MMC-2.						[PUBLIC]
+//
+
+IOReturn
+SCSITaskUserClient::ReadTableOfContents ( AppleReadTableOfContentsStruct * 	readTOCData,
+										  SCSITaskStatus * 					taskStatus,
+										  UInt32 							inStructSize,
+										  UInt32 * 							outStructSize )
+{
+	
+	IOReturn				status 	= kIOReturnExclusiveAccess;
+	IOReturn				status2	= kIOReturnExclusiveAccess;
+	SCSITask * 				task 	= NULL;
+	IOMemoryDescriptor *	buffer	= NULL;
+	bool					state 	= true;
+	
+	check ( readTOCData );
+	check ( taskStatus );
+	check ( outStructSize );
+	
+	OSIncrementAtomic ( &fOutstandingCommands );
+	
+	require_action ( isInactive ( ) == false, GENERAL_ERR, status = kIOReturnNoDevice );
+	
+	state = fProtocolInterface->GetUserClientExclusivityState ( );
+	nrequire ( state, EXCLUSIVE_ACCESS_ERR );
+	
+	// Create and initialize a task
+	status = SetupTask ( &task );
+	require_success ( status, TASK_SETUP_ERR );
+	
+	// Prepare the buffers
+	status = PrepareBuffers ( &buffer, readTOCData->buffer, readTOCData->bufferSize, kIODirectionIn );
+	require_success ( status, BUFFER_PREPARATION_ERR );
+	
+	if ( readTOCData->FORMAT & 0x04 )
+	{
+		
+		// Use new style from MMC-2
+		task->SetCommandDescriptorBlock ( kSCSICmd_READ_TOC_PMA_ATIP,
+										  readTOCData->MSF << 1,
+										  readTOCData->FORMAT,
+										  0x00,
+										  0x00,
+										  0x00,
+										  readTOCData->TRACK_SESSION_NUMBER,
+										  ( readTOCData->bufferSize >> 8 ) & 0xFF,
+										    readTOCData->bufferSize        & 0xFF,
+										  0x00 );
+
+	
+	}
+	
+	else
+	{
+
+		// Use old style from SFF-8020i
+		task->SetCommandDescriptorBlock ( kSCSICmd_READ_TOC_PMA_ATIP,
+										  readTOCData->MSF << 1,
+										  0x00,
+										  0x00,
+										  0x00,
+										  0x00,
+										  readTOCData->TRACK_SESSION_NUMBER,
+										  ( readTOCData->bufferSize >> 8 ) & 0xFF,
+										    readTOCData->bufferSize        & 0xFF,
+										  ( readTOCData->FORMAT & 0x03 ) << 6 );
+		
+	}
+	
+	// set timeout to 30 seconds
+	task->SetTimeoutDuration ( kThirtySecondTimeoutInMS );
+	task->SetDataTransferDirection ( kSCSIDataTransfer_FromTargetToInitiator );
+	task->SetDataBuffer ( buffer );
+	task->SetRequestedDataTransferCount ( readTOCData->bufferSize );
+	
+	status	= SendCommand ( task, readTOCData->senseDataBuffer, taskStatus );
+	status2 = CompleteBuffers ( buffer );
+	
+	if ( ( status == kIOReturnSuccess ) && ( status2 != kIOReturnSuccess ) )
+	{
+		status = status2;
+	}
+	
+	*outStructSize = sizeof ( SCSITaskStatus );
+	
+	task->release ( );
+	
+	return status;
+	
+	
+BUFFER_PREPARATION_ERR:
+	
+	
+	task->release ( );
+	
+	
+TASK_SETUP_ERR:
+EXCLUSIVE_ACCESS_ERR:
+GENERAL_ERR:
+	
+	
+	OSDecrementAtomic ( &fOutstandingCommands );
+	
+	return status;
+	
+}
+
+
+//
+//	 ReadDiscInformation - Issues a READ_DISC_INFORMATION command to the
+//							drive as defined in MMC-2.				[PUBLIC]
+//
+
+IOReturn
+SCSITaskUserClient::ReadDiscInformation ( AppleReadDiscInfoStruct * 	discInfoData,
+										  SCSITaskStatus * 				taskStatus,
+										  UInt32 						inStructSize,
+										  UInt32 * 						outStructSize )
+{
+	
+	IOReturn				status 	= kIOReturnExclusiveAccess;
+	IOReturn				status2	= kIOReturnExclusiveAccess;
+	SCSITask * 				task 	= NULL;
+	IOMemoryDescriptor *	buffer	= NULL;
+	bool					state 	= true;
+		
+	check ( discInfoData );
+	check ( taskStatus );
+	check ( outStructSize );
+	
+	OSIncrementAtomic ( &fOutstandingCommands );
+	
+	require_action ( isInactive ( ) == false, GENERAL_ERR, status = kIOReturnNoDevice );
+	
+	state = fProtocolInterface->GetUserClientExclusivityState ( );
+	nrequire ( state, EXCLUSIVE_ACCESS_ERR );
+	
+	// Create and initialize a task
+	status = SetupTask ( &task );
+	require_success ( status, TASK_SETUP_ERR );
+	
+	// Prepare the buffers
+	status = PrepareBuffers ( &buffer, discInfoData->buffer, discInfoData->bufferSize, kIODirectionIn );
+	require_success ( status, BUFFER_PREPARATION_ERR );
+	
+	task->SetCommandDescriptorBlock ( kSCSICmd_READ_DISC_INFORMATION,
+									  0x00,
+									  0x00,
+									  0x00,
+									  0x00,
+									  0x00,
+									  0x00,
+									  ( discInfoData->bufferSize >> 8 ) & 0xFF,
+									    discInfoData->bufferSize        & 0xFF,
+									  0x00 );
+	
+	// set timeout to 30 seconds
+	task->SetTimeoutDuration ( kThirtySecondTimeoutInMS );
+	task->SetDataTransferDirection ( kSCSIDataTransfer_FromTargetToInitiator );
+	task->SetDataBuffer ( buffer );
+	task->SetRequestedDataTransferCount ( discInfoData->bufferSize );
+	
+	status 	= SendCommand ( task, discInfoData->senseDataBuffer, taskStatus );
+	status2 = CompleteBuffers ( buffer );
+	
+	if ( ( status == kIOReturnSuccess ) && ( status2 != kIOReturnSuccess ) )
+	{
+		status = status2;
+	}
+	
+	*outStructSize = sizeof ( SCSITaskStatus );
+	
+	task->release ( );
+	
+	return status;
+	
+	
+BUFFER_PREPARATION_ERR:
+	
+	
+	task->release ( );
+	
+	
+TASK_SETUP_ERR:
+EXCLUSIVE_ACCESS_ERR:
+GENERAL_ERR:
+	
+	
+	OSDecrementAtomic ( &fOutstandingCommands );
+	
+	return status;
+	
+}
+
+
+//
+//	 ReadTrackInformation - 	Issues a READ_TRACK/RZONE_INFORMATION command
+//								to the drive as defined in MMC-2.	[PUBLIC]
+//
+
+IOReturn
+SCSITaskUserClient::ReadTrackInformation ( AppleReadTrackInfoStruct * 	trackInfoData,
+										   SCSITaskStatus * 			taskStatus,
+										   UInt32 						inStructSize,
+										   UInt32 * 					outStructSize )
+{
+	
+	IOReturn				status 	= kIOReturnExclusiveAccess;
+	IOReturn				status2 = kIOReturnExclusiveAccess;
+	SCSITask * 				task 	= NULL;
+	IOMemoryDescriptor *	buffer	= NULL;
+	bool					state 	= true;
+	
+	check ( trackInfoData );
+	check ( taskStatus );
+	check ( outStructSize );
+	
+	OSIncrementAtomic ( &fOutstandingCommands );
+	
+	require_action ( isInactive ( ) == false, GENERAL_ERR, status = kIOReturnNoDevice );
+	
+	state = fProtocolInterface->GetUserClientExclusivityState ( );
+	nrequire ( state, EXCLUSIVE_ACCESS_ERR );
+	
+	// Create and initialize a task
+	status = SetupTask ( &task );
+	require_success ( status, TASK_SETUP_ERR );
+	
+	// Prepare the buffers
+	status = PrepareBuffers ( &buffer, trackInfoData->buffer, trackInfoData->bufferSize, kIODirectionIn );
+	require_success ( status, BUFFER_PREPARATION_ERR );
+	
+	task->SetCommandDescriptorBlock ( kSCSICmd_READ_TRACK_INFORMATION,
+									  trackInfoData->ADDRESS_NUMBER_TYPE & 0x03,
+									  ( trackInfoData->LOGICAL_BLOCK_ADDRESS_TRACK_SESSION_NUMBER >> 24 ) & 0xFF,
+									  ( trackInfoData->LOGICAL_BLOCK_ADDRESS_TRACK_SESSION_NUMBER >> 16 ) & 0xFF,
+									  ( trackInfoData->LOGICAL_BLOCK_ADDRESS_TRACK_SESSION_NUMBER >>  8 ) & 0xFF,
+								 	    trackInfoData->LOGICAL_BLOCK_ADDRESS_TRACK_SESSION_NUMBER         & 0xFF,
+									  0x00,
+									  ( trackInfoData->bufferSize >>  8 ) & 0xFF,
+								  	    trackInfoData->bufferSize         & 0xFF,
+									  0x00 );
+	
+	// set timeout to 30 seconds
+	task->SetTimeoutDuration ( kThirtySecondTimeoutInMS );
+	task->SetDataTransferDirection ( kSCSIDataTransfer_FromTargetToInitiator );
+	task->SetDataBuffer ( buffer );
+	task->SetRequestedDataTransferCount ( trackInfoData->bufferSize );
+	
+	status	= SendCommand ( task, trackInfoData->senseDataBuffer, taskStatus );
+	status2	= CompleteBuffers ( buffer );
+	
+	if ( ( status == kIOReturnSuccess ) && ( status2 != kIOReturnSuccess ) )
+	{
+		status = status2;
+	}
+	
+	*outStructSize = sizeof ( SCSITaskStatus );
+	
+	task->release ( );
+	
+	return status;
+	
+	
+BUFFER_PREPARATION_ERR:
+	
+	
+	task->release ( );
+	
+	
+TASK_SETUP_ERR:
+EXCLUSIVE_ACCESS_ERR:
+GENERAL_ERR:
+	
+	
+	OSDecrementAtomic ( &fOutstandingCommands );
+	
+	return status;
+	
+}
+
+
+//
+//	 ReadDVDStructure - 	Issues a READ_DVD_STRUCTURE command to the drive as
+//							defined in MMC-2.						[PUBLIC]
+//
+
+IOReturn
+SCSITaskUserClient::ReadDVDStructure ( AppleReadDVDStructureStruct * 	dvdStructData,
+									   SCSITaskStatus * 				taskStatus,
+									   UInt32 							inStructSize,
+									   UInt32 * 						outStructSize )
+{
+	
+	IOReturn				status 	= kIOReturnExclusiveAccess;
+	IOReturn				status2 = kIOReturnExclusiveAccess;
+	SCSITask * 				task 	= NULL;
+	IOMemoryDescriptor *	buffer	= NULL;
+	bool					state 	= true;
+	
+	check ( dvdStructData );
+	check ( taskStatus );
+	check ( outStructSize );
+	
+	OSIncrementAtomic ( &fOutstandingCommands );
+	
+	require_action ( isInactive ( ) == false, GENERAL_ERR, status = kIOReturnNoDevice );
+	
+	state = fProtocolInterface->GetUserClientExclusivityState ( );
+	nrequire ( state, EXCLUSIVE_ACCESS_ERR );
+	
+	// Create and initialize a task
+	status = SetupTask ( &task );
+	require_success ( status, TASK_SETUP_ERR );
+	
+	// Prepare the buffers
+	status = PrepareBuffers ( &buffer, dvdStructData->buffer, dvdStructData->bufferSize, kIODirectionIn );
+	require_success ( status, BUFFER_PREPARATION_ERR );
+	
+	task->SetCommandDescriptorBlock ( kSCSICmd_READ_DVD_STRUCTURE,
+									  0x00,
+									  ( dvdStructData->ADDRESS >> 24 ) & 0xFF,
+									  ( dvdStructData->ADDRESS >> 16 ) & 0xFF,
+									  ( dvdStructData->ADDRESS >> 8  ) & 0xFF,
+									    dvdStructData->ADDRESS		   & 0xFF,
+									    dvdStructData->LAYER_NUMBER,
+									    dvdStructData->FORMAT,
+									  ( dvdStructData->bufferSize >> 8 ) & 0xFF,
+									    dvdStructData->bufferSize        & 0xFF,
+									  ( dvdStructData->AGID << 6 ),
+									  0x00 );
+	
+	// set timeout to 30 seconds
+	task->SetTimeoutDuration ( kThirtySecondTimeoutInMS );
+	task->SetDataTransferDirection ( kSCSIDataTransfer_FromTargetToInitiator );
+	task->SetDataBuffer ( buffer );
+	task->SetRequestedDataTransferCount ( dvdStructData->bufferSize );
+	
+	status	= SendCommand ( task, dvdStructData->senseDataBuffer, taskStatus );
+	status2	= CompleteBuffers ( buffer );
+	
+	if ( ( status == kIOReturnSuccess ) && ( status2 != kIOReturnSuccess ) )
+	{
+		status = status2;
+	}
+	
+	*outStructSize = sizeof ( SCSITaskStatus );
+	
+	task->release ( );
+	
+	return status;
+	
+	
+BUFFER_PREPARATION_ERR:
+	
+	
+	task->release ( );
+	
+	
+TASK_SETUP_ERR:
+EXCLUSIVE_ACCESS_ERR:
+GENERAL_ERR:
+	
+	
+	OSDecrementAtomic ( &fOutstandingCommands );
+	
+	return status;
+	
+}
+
+
+//
+//	 SetCDSpeed - Called to set the new CD read/write speeds.
+//																	[PUBLIC]
+//
+
+IOReturn
+SCSITaskUserClient::SetCDSpeed ( AppleSetCDSpeedStruct *	setCDSpeedData,
+								 SCSITaskStatus * 			taskStatus,
+								 UInt32 					inStructSize,
+								 UInt32 * 					outStructSize )
+{
+	
+	IOReturn				status			= kIOReturnExclusiveAccess;
+	SCSITask * 				task			= NULL;
+	bool					state			= true;
+	UInt16					readSpeed		= 0;
+	UInt16					writeSpeed		= 0;
+	
+	
+	check ( setCDSpeedData );
+	check ( taskStatus );
+	check ( outStructSize );
+	
+	OSIncrementAtomic ( &fOutstandingCommands );
+	
+	require_action ( isInactive ( ) == false, GENERAL_ERR, status = kIOReturnNoDevice );
+	
+	state = fProtocolInterface->GetUserClientExclusivityState ( );
+	nrequire ( state, EXCLUSIVE_ACCESS_ERR );
+	
+	// Create and initialize a task
+	status = SetupTask ( &task );
+	require_success ( status, TASK_SETUP_ERR );
+	
+	readSpeed	= setCDSpeedData->LOGICAL_UNIT_READ_SPEED;
+	writeSpeed	= setCDSpeedData->LOGICAL_UNIT_WRITE_SPEED;
+	
+	task->SetCommandDescriptorBlock ( kSCSICmd_SET_CD_SPEED,
+									  0x00,
+									  ( readSpeed >>   8 )	& 0xFF,
+									  readSpeed				& 0xFF,
+									  ( writeSpeed >>  8 )	& 0xFF,
+									  writeSpeed			& 0xFF,
+									  0x00,
+									  0x00,
+									  0x00,
+									  0x00,
+									  0x00,
+									  0x00 );
+	
+	task->SetTimeoutDuration ( kThirtySecondTimeoutInMS );
+	task->SetDataTransferDirection ( kSCSIDataTransfer_NoDataTransfer );
+	
+	status	= SendCommand ( task,
+							setCDSpeedData->senseDataBuffer,
+							taskStatus );
+	
+	*outStructSize = sizeof ( SCSITaskStatus );
+	
+	task->release ( );
+	
+	return status;
+	
+	
+TASK_SETUP_ERR:
+EXCLUSIVE_ACCESS_ERR:
+GENERAL_ERR:
+	
+	
+	OSDecrementAtomic ( &fOutstandingCommands );
+	
+	return status;
+	
+}
+
+
+//
+//	 ReadFormatCapacities - Issues a READ_FORMAT_CAPACITIES command to the
+//							 drive as defined in MMC-2.				[PUBLIC]
+//
+
+IOReturn
+SCSITaskUserClient::ReadFormatCapacities ( AppleReadFormatCapacitiesStruct *	readFormatCapacitiesData,
+										   SCSITaskStatus * 					taskStatus,
+										   UInt32 								inStructSize,
+										   UInt32 * 							outStructSize )
+{
+	
+	IOReturn				status			= kIOReturnExclusiveAccess;
+	IOReturn				status2			= kIOReturnExclusiveAccess;
+	bool					state			= true;
+	SCSITask * 				task			= NULL;
+	IOMemoryDescriptor *	buffer			= NULL;
+	
+	
+	check ( readFormatCapacitiesData );
+	check ( taskStatus );
+	check ( outStructSize );
+	
+	OSIncrementAtomic ( &fOutstandingCommands );
+	
+	require_action ( isInactive ( ) == false, GENERAL_ERR, status = kIOReturnNoDevice );
+	
+	state = fProtocolInterface->GetUserClientExclusivityState ( );
+	nrequire ( state, EXCLUSIVE_ACCESS_ERR );
+	
+	// Create and initialize a task
+	status = SetupTask ( &task );
+	require_success ( status, TASK_SETUP_ERR );
+	
+	// Prepare the buffers
+	status = PrepareBuffers ( &buffer, readFormatCapacitiesData->buffer, readFormatCapacitiesData->bufferSize, kIODirectionIn );
+	require_success ( status, BUFFER_PREPARATION_ERR );
+	
+	task->SetCommandDescriptorBlock ( kSCSICmd_READ_FORMAT_CAPACITIES,
+									  0x00,
+									  0x00,
+									  0x00,
+									  0x00,
+									  0x00,
+									  0x00,
+									  ( readFormatCapacitiesData->bufferSize >> 8 ) & 0xFF,
+									    readFormatCapacitiesData->bufferSize        & 0xFF,
+									  0 );
+	
+	task->SetTimeoutDuration ( kThirtySecondTimeoutInMS );
+	task->SetDataTransferDirection ( kSCSIDataTransfer_FromTargetToInitiator );
+	task->SetDataBuffer ( buffer );
+	task->SetRequestedDataTransferCount ( readFormatCapacitiesData->bufferSize );
+	
+	status	= SendCommand ( task, readFormatCapacitiesData->senseDataBuffer, taskStatus );
+	
+	status2	= CompleteBuffers ( buffer );
+	
+	if ( ( status == kIOReturnSuccess ) && ( status2 != kIOReturnSuccess ) )
+	{
+		status = status2;
+	}
+	
+	*outStructSize = sizeof ( SCSITaskStatus );
+	
+	task->release ( );
+	
+	return status;
+	
+	
+BUFFER_PREPARATION_ERR:
+	
+	
+	task->release ( );
+	
+	
+TASK_SETUP_ERR:
+EXCLUSIVE_ACCESS_ERR:
+GENERAL_ERR:
+	
+	OSDecrementAtomic ( &fOutstandingCommands );
+	
+	return status;
+	
+}
+
+
+#if 0
+#pragma mark -
+#pragma mark Protected Methods
+#pragma mark -
+#endif
+
+
+//
+//	 getTargetAndMethodForIndex - 	Returns a pointer to the target of the
+//									method call and the method vector itself
+//									based on the provided index.	[PROTECTED]
+//
+
+IOExternalMethod *
+SCSITaskUserClient::getTargetAndMethodForIndex (
+							IOService **	target,
+							UInt32			index )
+{
+	
+	IOExternalMethod *	method = NULL;
+	
+	check ( target );
+	require ( index < kSCSITaskUserClientMethodCount, GENERAL_ERR );
+	
+	OSIncrementAtomic ( &fOutstandingCommands );
+	
+	require ( isInactive ( ) == false, DECREMENT_COUNTER );
+	
+	fProtocolInterface->retain ( );
+	
+	if ( fProtocolInterface->IsPowerManagementIntialized ( ) )
+	{
+		fProtocolInterface->CheckPowerState ( );
+	}
+	
+	fProtocolInterface->release ( );
+	
+	*target = this;
+	method 	= &sMethods[index];
+	
+	
+DECREMENT_COUNTER:
+	
+	
+	OSDecrementAtomic ( &fOutstandingCommands );
+	
+	
+GENERAL_ERR:
+	
+	
+	return method;
+	
+}
+
+
+//
+//	 getAsyncTargetAndMethodForIndex - Returns a pointer to the target of the
+//										async method call and the method
+//										vector itself based on the provided
+//										index.						[PROTECTED]
+//
+
+IOExternalAsyncMethod *
+SCSITaskUserClient::getAsyncTargetAndMethodForIndex (
+							IOService **	target,
+							UInt32			index )
+{
+	
+	
+	IOExternalAsyncMethod *	method = NULL;
+	
+	check ( target );
+	require ( index < kSCSITaskUserClientAsyncMethodCount, GENERAL_ERR );
+	
+	OSIncrementAtomic ( &fOutstandingCommands );
+	
+	require ( isInactive ( ) == false, DECREMENT_COUNTER );
+	
+	fProtocolInterface->retain ( );
+	
+	if ( fProtocolInterface->IsPowerManagementIntialized ( ) )
+	{
+		fProtocolInterface->CheckPowerState ( );
+	}
+	
+	fProtocolInterface->release ( );
+	
+	*target = this;
+	method 	= &sAsyncMethods[index];
+	
+	
+DECREMENT_COUNTER:
+	
+	
+	OSDecrementAtomic ( &fOutstandingCommands );
+	
+	
+GENERAL_ERR:
+	
+	
+	return method;
+	
+}
+
+
+//
+//	 GatedCreateTask -	Safely obtains a taskReference for the newly created
+//						task if one is available. It is called while holding
+//						the workloop lock.							[PROTECTED]
+//
+
+IOReturn
+SCSITaskUserClient::GatedCreateTask ( SCSITask * task, SInt32 * taskReference )
+{
+	
+	IOReturn				status 	= kIOReturnNoResources;
+	UInt32					index	= 0;
+	SCSITaskTableEntry *	entry	= NULL;
+	
+	check ( task );
+	check ( taskReference );
+	
+	*taskReference = -1;
+	
+	// Grow the table if every slot is in use.
+	if ( fFreeTaskSlot == kSCSITaskTableNoFreeSlot )
+	{
+		
+		status = GrowTaskTable ( );
+		require_success ( status, ARRAY_INDEX_ERR );
+		
+	}
+	
+	// Pop a slot off the free stack.
+	index			= fFreeTaskSlot;
+	entry			= GetTaskTableEntry ( index );
+	fFreeTaskSlot	= entry->nextFree;
+	
+	entry->task		= task;
+	entry->nextFree	= kSCSITaskTableNoFreeSlot;
+	*taskReference 	= SCSITaskReference ( index, entry->generation );
+	status			= kIOReturnSuccess;
+	
+	
+ARRAY_INDEX_ERR:	
+	
+	
+	return status;
+	
+}
+
+
+//
+//	 GatedReleaseTask -	Safely obtains a taskReference for the newly
+//							created task if one is available. It is called
+//							while holding the workloop lock.		[PROTECTED]
+//
+
+IOReturn
+SCSITaskUserClient::GatedReleaseTask ( SInt32 taskReference, SCSITask ** task )
+{
+	
+	IOReturn				status 	= kIOReturnSuccess;
+	SCSITask *				victim	= NULL;
+	SCSITaskTableEntry *	entry	= NULL;
+	UInt32					index	= 0;
+	
+	check ( task != NULL );
+	
+	// Sanity check
+	victim = GetTask ( taskReference );
+	require_nonzero_action ( victim, GENERAL_ERR, status = kIOReturnBadArgument );
+	
+	// If the task is still active, it cannot be released.
+	require_action ( ( victim->IsTaskActive ( ) == false ), GENERAL_ERR, status = kIOReturnNotPermitted );
+	
+	// Remove it now. Bump the slot's generation so the old reference no
+	// longer resolves, then push the slot back on the free stack.
+	index	= SCSITaskReferenceIndex ( taskReference );
+	entry	= GetTaskTableEntry ( index );
+	
+	entry->task			= NULL;
+	entry->generation	= ( entry->generation + 1 ) & kSCSITaskReferenceGenerationMask;
+	if ( entry->generation == 0 )
+		entry->generation = 1;
+	
+	entry->nextFree		= fFreeTaskSlot;
+	fFreeTaskSlot		= index;
+	
+	STATUS_LOG ( ( "Removed object from array\n" ) );
+	
+	// Pass back the pointer to the object so it can be safely destroyed.
+	*task = victim;	
+	
+	
+GENERAL_ERR:
+	
+	
+	return status;
+	
+}
+
+
+//
+//	 GatedValidateTask -	Safely validates a task. It is called while
+//							holding the workloop lock.				[PROTECTED]
+//
+
+IOReturn
+SCSITaskUserClient::GatedValidateTask ( SCSITask * 		request,
+										SCSITaskData * 	args,
+										UInt32 			argSize )
+{
+	
+	IOReturn	status = kIOReturnBadArgument;
+	
+	STATUS_LOG ( ( "SCSITaskUserClient::GatedValidateTask called\n" ) );
+	
+	check ( request );
+	check ( args );
+	
+	require ( ( args->taskAttribute >= kSCSITask_SIMPLE ) &&
+			  ( args->taskAttribute <= kSCSITask_ACA ),
+			  INVALID_ARGUMENT );
+	
+	request->SetTaskAttribute ( args->taskAttribute );
+	
+	#if ( SCSI_TASK_USER_CLIENT_DEBUGGING_LEVEL >= 3 )
+	{
+		
+		SCSICommandDescriptorBlock	cdb;
+		UInt8						commandLength;
+		
+		request->GetCommandDescriptorBlock ( &cdb );
+		commandLength = request->GetCommandDescriptorBlockSize ( );
+		
+		if ( commandLength == kSCSICDBSize_6Byte )
+		{
+			
+			STATUS_LOG ( ( "cdb = %02x:%02x:%02x:%02x:%02x:%02x\n", cdb[0], cdb[1],
+						cdb[2], cdb[3], cdb[4], cdb[5] ) );
+			
+		}
+		
+		else if ( commandLength == kSCSICDBSize_10Byte )
+		{
+			
+			STATUS_LOG ( ( "cdb = %02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x\n", cdb[0],
+						cdb[1], cdb[2], cdb[3], cdb[4], cdb[5], cdb[6], cdb[7], cdb[8],
+						cdb[9] ) );
+			
+		}
+		
+		else if ( commandLength == kSCSICDBSize_12Byte )
+		{
+			
+			STATUS_LOG ( ( "cdb = %02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x\n", cdb[0],
+						cdb[1], cdb[2], cdb[3], cdb[4], cdb[5], cdb[6], cdb[7], cdb[8],
+						cdb[9], cdb[10], cdb[11] ) );
+			
+		}
+		
+		else if ( commandLength == kSCSICDBSize_16Byte )
+		{
+			
+			STATUS_LOG ( ( "cdb = %02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x\n", cdb[0],
+						cdb[1], cdb[2], cdb[3], cdb[4], cdb[5], cdb[6], cdb[7], cdb[8],
+						cdb[9], cdb[10], cdb[11], cdb[12], cdb[13], cdb[14], cdb[15] ) );
+			
+		}
+		
+	}
+	#endif /* ( SCSI_TASK_USER_CLIENT_DEBUGGING_LEVEL >= 3 ) */
+	
+	switch ( args->cdbSize )
+	{
+		
+		case kSCSICDBSize_6Byte:
+			request->SetCommandDescriptorBlock ( args->cdbData[0],
+												 args->cdbData[1],
+												 args->cdbData[2],
+												 args->cdbData[3],
+												 args->cdbData[4],
+												 args->cdbData[5] );
+			break;
+		
+		case kSCSICDBSize_10Byte:
+			request->SetCommandDescriptorBlock ( args->cdbData[0],
+												 args->cdbData[1],
+												 args->cdbData[2],
+												 args->cdbData[3],
+												 args->cdbData[4],
+												 args->cdbData[5],
+												 args->cdbData[6],
+												 args->cdbData[7],
+												 args->cdbData[8],
+												 args->cdbData[9] );
+			break;
+		
+		case kSCSICDBSize_12Byte:
+			request->SetCommandDescriptorBlock ( args->cdbData[0],
+												 args->cdbData[1],
+												 args->cdbData[2],
+												 args->cdbData[3],
+												 args->cdbData[4],
+												 args->cdbData[5],
+												 args->cdbData[6],
+												 args->cdbData[7],
+												 args->cdbData[8],
+												 args->cdbData[9],
+												 args->cdbData[10],
+												 args->cdbData[11] );
+			break;
+		
+		case kSCSICDBSize_16Byte:
+			request->SetCommandDescriptorBlock ( args->cdbData[0],
+												 args->cdbData[1],
+												 args->cdbData[2],
+												 args->cdbData[3],
+												 args->cdbData[4],
+												 args->cdbData[5],
+												 args->cdbData[6],
+												 args->cdbData[7],
+												 args->cdbData[8],
+												 args->cdbData[9],
+												 args->cdbData[10],
+												 args->cdbData[11],
+												 args->cdbData[12],
+												 args->cdbData[13],
+												 args->cdbData[14],
+												 args->cdbData[15] );
+			break;
+		
+		default:
+			ERROR_LOG ( ( "Invalid command length size\n" ) );
+			goto INVALID_ARGUMENT;
+		
+	}
+	
+	require ( ( args->transferDirection <= kSCSIDataTransfer_FromTargetToInitiator ),
+			  INVALID_ARGUMENT );
+	
+	request->SetDataTransferDirection ( args->transferDirection );
+	
+	if ( args->scatterGatherEntries > 0 )
+	{
+		
+		UInt32		structSizeWithoutList = sizeof ( SCSITaskData ) - sizeof ( IOVirtualRange );
+		UInt32		sgListSize = 0;
+		
+		sgListSize = argSize - structSizeWithoutList;
+		
+		require_string ( ( sgListSize / sizeof ( IOVirtualRange ) ) == args->scatterGatherEntries,
+						 INVALID_ARGUMENT,
+						 "Invalid scatter-gather list" );
+		
+	}
+	
+	// This must be the last check, since it takes a use count on the
+	// registered buffer which is only dropped when the task completes.
+	if ( args->bufferHandle != kSCSITaskNullBufferHandle )
+	{
+		
+		require_string ( ( args->scatterGatherEntries == 0 ),
+						 INVALID_ARGUMENT,
+						 "Task has both a registered buffer and a scatter-gather list" );
+		
+		status = GatedUseRegisteredBuffer ( request, args );
+		require_success ( status, INVALID_ARGUMENT );
+		
+	}
+	
+	status = kIOReturnSuccess;
+	
+	
+INVALID_ARGUMENT:
+	
+	
+	return status;
+	
+}
+
+
+//
+//	 GatedValidateTasks -	Validates each claimed task of a batch. It is
+//							called while holding the workloop lock.	[PROTECTED]
+//
+
+IOReturn
+SCSITaskUserClient::GatedValidateTasks ( SCSITaskBatchEntry *	entries,
+										 UInt32					count )
+{
+	
+	STATUS_LOG ( ( "SCSITaskUserClient::GatedValidateTasks called\n" ) );
+	
+	check ( entries );
+	
+	for ( UInt32 index = 0; index < count; index++ )
+	{
+		
+		if ( entries[index].status != kIOReturnSuccess )
+			continue;
+		
+		entries[index].status = GatedValidateTask ( entries[index].request,
+													entries[index].args,
+													entries[index].argSize );
+		
+	}
+	
+	return kIOReturnSuccess;
+	
+}
+
+
+//
+//	 GatedCreateTaskRings - 	Installs a new pair of rings, unless the
+//								client already has some. It is called
+//								while holding the workloop lock.
+//																	[PROTECTED]
+//
+
+IOReturn
+SCSITaskUserClient::GatedCreateTaskRings ( OSAsyncReference				asyncRef,
+										   IOBufferMemoryDescriptor *	submissionRing,
+										   IOBufferMemoryDescriptor *	completionRing )
+{
+	
+	IOReturn	status = kIOReturnBusy;
+	
+	check ( submissionRing );
+	check ( completionRing );
+	
+	require ( ( fSubmissionRing == NULL ), GENERAL_ERR );
+	
+	bcopy ( asyncRef, fRingAsyncReference, sizeof ( OSAsyncReference ) );
+	
+	fRingEntries		= ( ( SCSITaskRingHeader * ) submissionRing->getBytesNoCopy ( ) )->entries;
+	fSubmissionHead		= 0;
+	fCompletionTail		= 0;
+	
+	// The submission ring is published last, since RingDoorbell ( )
+	// uses it to tell whether the rings exist.
+	fCompletionRingBuffer	= completionRing;
+	fCompletionRing			= ( SCSITaskRingHeader * ) completionRing->getBytesNoCopy ( );
+	fSubmissionRingBuffer	= submissionRing;
+	fSubmissionRing			= ( SCSITaskRingHeader * ) submissionRing->getBytesNoCopy ( );
+	
+	status = kIOReturnSuccess;
+	
+	
+GENERAL_ERR:
+	
+	
+	return status;
+	
+}
+
+
+//
+//	 GatedDestroyTaskRings - 	Frees the rings, unless a task taken from
+//								the submission ring has yet to post its
+//								completion. It is called while holding the
+//								workloop lock.					[PROTECTED]
+//
+
+IOReturn
+SCSITaskUserClient::GatedDestroyTaskRings ( void )
+{
+	
+	IOReturn	status = kIOReturnNotReady;
+	
+	require_nonzero ( fSubmissionRing, GENERAL_ERR );
+	
+	// Every submission consumed posts exactly one completion, so the
+	// completion ring is still in use until the two counts meet.
+	require_action ( ( fSubmissionHead == fCompletionTail ), GENERAL_ERR, status = kIOReturnBusy );
+	
+	if ( fCoalesceTimerArmed )
+	{
+		
+		fCoalesceTimer->cancelTimeout ( );
+		fCoalesceTimerArmed = false;
+		
+	}
+	
+	fUnnotifiedCompletions	= 0;
+	fCoalesceCompletions	= 0;
+	fCoalesceDelay			= 0;
+	
+	// Any mappings still held by the library keep their own references.
+	fSubmissionRing			= NULL;
+	fCompletionRing			= NULL;
+	fRingEntries			= 0;
+	
+	fSubmissionRingBuffer->release ( );
+	fSubmissionRingBuffer	= NULL;
+	
+	fCompletionRingBuffer->release ( );
+	fCompletionRingBuffer	= NULL;
+	
+	status = kIOReturnSuccess;
+	
+	
+GENERAL_ERR:
+	
+	
+	return status;
+	
+}
+
+
+//
+//	 GatedClientMemoryForType - 	Returns the ring the library asked to
+//									map, retained for the caller. It is
+//									called while holding the workloop lock.
+//																	[PROTECTED]
+//
+
+IOReturn
+SCSITaskUserClient::GatedClientMemoryForType ( UInt32					type,
+											   IOMemoryDescriptor **	memory )
+{
+	
+	IOMemoryDescriptor *	buffer	= NULL;
+	IOReturn				status	= kIOReturnBadArgument;
+	
+	switch ( type )
+	{
+		
+		case kSCSITaskUserClientSubmissionRing:
+			buffer = fSubmissionRingBuffer;
+			break;
+		
+		case kSCSITaskUserClientCompletionRing:
+			buffer = fCompletionRingBuffer;
+			break;
+		
+		default:
+			ERROR_LOG ( ( "clientMemoryForType: invalid type %ld\n", type ) );
+			goto GENERAL_ERR;
+		
+	}
+	
+	require_nonzero_action ( buffer, GENERAL_ERR, status = kIOReturnNotReady );
+	
+	// The caller releases the descriptor once it has been mapped.
+	buffer->retain ( );
+	
+	*memory	= buffer;
+	status	= kIOReturnSuccess;
+	
+	
+GENERAL_ERR:
+	
+	
+	return status;
+	
+}
+
+
+//
+//	 GatedConsumeRingSubmissions - Copies up to *count entries out of the
+//									submission ring. It is called while
+//									holding the workloop lock.	[PROTECTED]
+//
+
+IOReturn
+SCSITaskUserClient::GatedConsumeRingSubmissions ( SCSITaskRingSubmission *	entries,
+												  UInt32 *					count )
+{
+	
+	IOReturn	status		= kIOReturnNotReady;
+	UInt32		mask		= 0;
+	UInt32		available	= 0;
+	UInt32		inFlight	= 0;
+	UInt32		index		= 0;
+	
+	check ( entries );
+	check ( count );
+	
+	require_nonzero ( fSubmissionRing, GENERAL_ERR );
+	require_nonzero ( fCompletionRing, GENERAL_ERR );
+	
+	mask = fRingEntries - 1;
+	
+	// The shared headers are written by user space, so don't trust
+	// anything which would put more than a ring's worth of entries
+	// between the two ends.
+	available = fSubmissionRing->tail - fSubmissionHead;
+	require_action ( ( available <= fRingEntries ), GENERAL_ERR, status = kIOReturnBadArgument );
+	
+	// Every consumed submission is reported by exactly one completion, so
+	// only take as many as the completion ring has room for.
+	inFlight = fSubmissionHead - fCompletionRing->head;
+	require_action ( ( inFlight <= fRingEntries ), GENERAL_ERR, status = kIOReturnBadArgument );
+	
+	if ( available > ( fRingEntries - inFlight ) )
+		available = fRingEntries - inFlight;
+	
+	if ( available > *count )
+		available = *count;
+	
+	// Don't read the entries before the tail which covers them.
+	OSSynchronizeIO ( );
+	
+	for ( index = 0; index < available; index++ )
+	{
+		
+		entries[index] = SCSITaskRingSubmissionEntries ( fSubmissionRing )[fSubmissionHead & mask];
+		fSubmissionHead++;
+		
+	}
+	
+	fSubmissionRing->head = fSubmissionHead;
+	
+	*count = available;
+	status = kIOReturnSuccess;
+	
+	
+GENERAL_ERR:
+	
+	
+	return status;
+	
+}
+
+
+//
+//	 GatedPostRingCompletion -	Posts a completion to the completion ring and
+//								notifies the library unless a notification
+//								is already pending. It is called while
+//								holding the workloop lock.		[PROTECTED]
+//
+
+IOReturn
+SCSITaskUserClient::GatedPostRingCompletion ( SCSITaskRingCompletion * completion )
+{
+	
+	IOReturn	status = kIOReturnNotReady;
+	
+	check ( completion );
+	
+	require_nonzero ( fCompletionRing, GENERAL_ERR );
+	
+	SCSITaskRingCompletionEntries ( fCompletionRing )[fCompletionTail & ( fRingEntries - 1 )] = *completion;
+	
+	// Make the entry visible before the tail which covers it.
+	OSSynchronizeIO ( );
+	
+	fCompletionTail++;
+	fCompletionRing->tail = fCompletionTail;
+	fUnnotifiedCompletions++;
+	
+	// Notify now unless coalescing is on and more completions are coming.
+	// Once no ring task is left in flight, nothing else will share the
+	// notification, so there's no point making the last one wait.
+	if ( ( fCoalesceCompletions <= 1 ) ||
+		 ( fUnnotifiedCompletions >= fCoalesceCompletions ) ||
+		 ( fSubmissionHead == fCompletionTail ) )
+	{
+		GatedNotifyRingCompletions ( );
+	}
+	
+	else if ( fCoalesceTimerArmed == false )
+	{
+		
+		fCoalesceTimer->setTimeoutUS ( fCoalesceDelay );
+		fCoalesceTimerArmed = true;
+		
+	}
+	
+	status = kIOReturnSuccess;
+	
+	
+GENERAL_ERR:
+	
+	
+	return status;
+	
+}
+
+
+//
+//	 GatedNotifyRingCompletions -	Notifies the library of the completions
+//									posted since the last notification.
+//									It is called while holding the
+//									workloop lock.				[PROTECTED]
+//
+
+void
+SCSITaskUserClient::GatedNotifyRingCompletions ( void )
+{
+	
+	if ( fCoalesceTimerArmed )
+	{
+		
+		fCoalesceTimer->cancelTimeout ( );
+		fCoalesceTimerArmed = false;
+		
+	}
+	
+	require_nonzero ( fUnnotifiedCompletions, GENERAL_ERR );
+	fUnnotifiedCompletions = 0;
+	
+	// The library clears notificationPending before draining the ring, so
+	// anything posted while a notification is pending is picked up by the
+	// drain that notification triggers.
+	if ( OSCompareAndSwap ( 0, 1, &fCompletionRing->notificationPending ) )
+	{
+		( void ) sendAsyncResult ( fRingAsyncReference, kIOReturnSuccess, NULL, 0 );
+	}
+	
+	
+GENERAL_ERR:
+	
+	
+	return;
+	
+}
+
+
+//
+//	 GatedSetCompletionCoalescing -	Sets the coalescing limits, creating
+//										the coalescing timer the first time.
+//										It is called while holding the
+//										workloop lock.			[PROTECTED]
+//
+
+IOReturn
+SCSITaskUserClient::GatedSetCompletionCoalescing ( UInt32 maxCompletions, UInt32 maxDelay )
+{
+	
+	IOReturn	status = kIOReturnNotReady;
+	
+	// The rings may have been destroyed since SetCompletionCoalescing
+	// looked.
+	require_nonzero ( fCompletionRing, GENERAL_ERR );
+	
+	status = kIOReturnSuccess;
+	
+	if ( fCoalesceTimer == NULL )
+	{
+		
+		fCoalesceTimer = IOTimerEventSource::timerEventSource ( this, &SCSITaskUserClient::sCoalescingTimeout );
+		require_nonzero_action ( fCoalesceTimer, GENERAL_ERR, status = kIOReturnNoResources );
+		
+		status = fWorkLoop->addEventSource ( fCoalesceTimer );
+		require_success_action ( status,
+								 GENERAL_ERR,
+								 fCoalesceTimer->release ( );
+								 fCoalesceTimer = NULL );
+		
+	}
+	
+	// More completions than the ring holds can never be waiting at once.
+	if ( maxCompletions > fRingEntries )
+		maxCompletions = fRingEntries;
+	
+	if ( maxDelay == 0 )
+		maxCompletions = 0;
+	
+	fCoalesceCompletions	= maxCompletions;
+	fCoalesceDelay			= maxDelay;
+	
+	// Don't leave anything waiting on the old limits.
+	GatedNotifyRingCompletions ( );
+	
+	
+GENERAL_ERR:
+	
+	
+	return status;
+	
+}
+
+
+//
+//	 GatedRegisterBuffer -	Finds a free handle for a prepared buffer and
+//							accounts for the memory it keeps wired. It is
+//							called while holding the workloop lock.
+//																	[PROTECTED]
+//
+
+IOReturn
+SCSITaskUserClient::GatedRegisterBuffer ( SCSITaskRegisteredBuffer *	entry,
+										  UInt32 *						bufferHandle )
+{
+	
+	IOReturn	status	= kIOReturnNoResources;
+	UInt32		index	= 0;
+	
+	check ( entry );
+	check ( bufferHandle );
+	
+	require_string ( ( ( fWiredBytes + entry->length ) <= kSCSITaskMaxWiredBytes ),
+					 GENERAL_ERR,
+					 "Client has too much memory wired\n" );
+	
+	for ( index = 0; index < kMaxSCSITaskRegisteredBuffers; index++ )
+	{
+		
+		if ( fRegisteredBuffers[index].buffer == NULL )
+			break;
+		
+	}
+	
+	require ( ( index < kMaxSCSITaskRegisteredBuffers ), GENERAL_ERR );
+	
+	fRegisteredBuffers[index]	= *entry;
+	fWiredBytes					+= entry->length;
+	
+	// Handles start at 1 so kSCSITaskNullBufferHandle is never valid.
+	*bufferHandle	= index + 1;
+	status			= kIOReturnSuccess;
+	
+	
+GENERAL_ERR:
+	
+	
+	return status;
+	
+}
+
+
+//
+//	 GatedUnregisterBuffer -	Frees a registered buffer's handle if no task
+//								is using it and passes the buffer back so it
+//								can be unwired. With defer set, a buffer
+//								still in use is instead left for its last
+//								task to unregister. It is called while
+//								holding the workloop lock.		[PROTECTED]
+//
+
+IOReturn
+SCSITaskUserClient::GatedUnregisterBuffer ( UInt32						bufferHandle,
+											SCSITaskRegisteredBuffer *	entry,
+											bool						defer )
+{
+	
+	IOReturn					status	= kIOReturnBadArgument;
+	SCSITaskRegisteredBuffer *	victim	= NULL;
+	
+	check ( entry );
+	
+	require ( ( bufferHandle != kSCSITaskNullBufferHandle ), GENERAL_ERR );
+	require ( ( bufferHandle <= kMaxSCSITaskRegisteredBuffers ), GENERAL_ERR );
+	
+	victim = &fRegisteredBuffers[bufferHandle - 1];
+	require_nonzero ( victim->buffer, GENERAL_ERR );
+	
+	// Tasks still transferring into the buffer need it wired.
+	require_action_quiet ( ( victim->useCount == 0 ),
+						   GENERAL_ERR,
+						   victim->unregisterPending = ( victim->unregisterPending || defer );
+						   status = kIOReturnBusy );
+	
+	*entry = *victim;
+	fWiredBytes -= victim->length;
+	bzero ( victim, sizeof ( SCSITaskRegisteredBuffer ) );
+	
+	status = kIOReturnSuccess;
+	
+	
+GENERAL_ERR:
+	
+	
+	return status;
+	
+}
+
+
+//
+//	 GatedReleaseRegisteredBuffer -	Drops a task's use count on a
+//										registered buffer. Returns
+//										kIOReturnSuccess only if that
+//										unregistered the buffer, in which
+//										case it is passed back to be
+//										unwired. It is called while holding
+//										the workloop lock.		[PROTECTED]
+//
+
+IOReturn
+SCSITaskUserClient::GatedReleaseRegisteredBuffer ( UInt32						bufferHandle,
+												   SCSITaskRegisteredBuffer *	entry )
+{
+	
+	IOReturn					status	= kIOReturnBusy;
+	SCSITaskRegisteredBuffer *	victim	= NULL;
+	
+	check ( entry );
+	
+	victim = &fRegisteredBuffers[bufferHandle - 1];
+	OSDecrementAtomic ( &victim->useCount );
+	
+	// HandleTerminate left the buffer for its last task to unregister.
+	require_quiet ( victim->unregisterPending, GENERAL_ERR );
+	status = GatedUnregisterBuffer ( bufferHandle, entry, true );
+	
+	
+GENERAL_ERR:
+	
+	
+	return status;
+	
+}
+
+
+//
+//	 GatedUseRegisteredBuffer -	Points a task at the part of a registered
+//									buffer it transfers into and takes a use
+//									count on the buffer. It is called while
+//									holding the workloop lock.	[PROTECTED]
+//
+
+IOReturn
+SCSITaskUserClient::GatedUseRegisteredBuffer ( SCSITask *		request,
+											   SCSITaskData *	args )
+{
+	
+	IOReturn					status	= kIOReturnBadArgument;
+	SCSITaskRegisteredBuffer *	entry	= NULL;
+	SCSITaskRefCon *			refCon	= NULL;
+	
+	check ( request );
+	check ( args );
+	
+	require ( ( args->bufferHandle <= kMaxSCSITaskRegisteredBuffers ), GENERAL_ERR );
+	
+	entry = &fRegisteredBuffers[args->bufferHandle - 1];
+	require_nonzero ( entry->buffer, GENERAL_ERR );
+	
+	// The buffer was wired for one direction only.
+	require ( ( args->transferDirection == entry->transferDirection ), GENERAL_ERR );
 	
+	// Written so neither sum can overflow.
+	require ( ( args->bufferOffset <= entry->length ), GENERAL_ERR );
+	require ( ( args->requestedTransferCount <= ( entry->length - args->bufferOffset ) ),
+			  GENERAL_ERR );
+	
+	refCon = ( SCSITaskRefCon * ) request->GetApplicationLayerReference ( );
+	refCon->bufferHandle = args->bufferHandle;
+	
+	OSIncrementAtomic ( &entry->useCount );
 	
-	fOutstandingCommands--;
+	request->SetDataBuffer ( entry->buffer );
+	request->SetDataBufferOffset ( args->bufferOffset );
+	request->SetRequestedDataTransferCount ( args->requestedTransferCount );
+	
+	status = kIOReturnSuccess;
 	
 	
 GENERAL_ERR:
 	
 	
-	return method;
+	return status;
+	
+}
+
+
+//
+//	 didTerminate - Checks to see if termination should be deferred.
+//																	[PROTECTED]
+//
+
+bool
+SCSITaskUserClient::didTerminate ( IOService * 		provider,
+								   IOOptionBits		options,
+								   bool *			defer )
+{
+	
+	if ( fOutstandingCommands == 0 )
+	{
+		HandleTerminate ( provider );
+	}
+	
+	return true;
+	
+}
+
+
+//
+//	 HandleTerminate -	Handles terminating our object and any resources it
+//						allocated.									[PROTECTED]
+//
+
+IOReturn
+SCSITaskUserClient::HandleTerminate ( IOService * provider )
+{
+	
+	IOReturn	status = kIOReturnSuccess;
+	
+	check ( provider );
+	
+	// Check if we have our provider open.
+	if ( provider->isOpen ( this ) )
+	{
+		
+		// Yes we do, so close the connection
+		STATUS_LOG ( ( "Closing provider\n" ) );
+		provider->close ( this, kIOSCSITaskUserClientAccessMask );
+		
+	}
+	
+	// Decouple us from the IORegistry.
+	detach ( provider );
+	fProvider = NULL;
+	
+	// Clean up work.
+	
+	// 1) Release exclusive access to the device
+	ReleaseExclusiveAccess ( );
+	
+	// 2) Release any tasks not cleaned up by the userspace code.
+	for ( UInt32 index = 0; index < fTaskTableSize; index++ )
+	{
+		
+		SCSITaskTableEntry *	entry = NULL;
+		
+		entry = GetTaskTableEntry ( index );
+		if ( entry->task == NULL )
+			continue;
+		
+		ReleaseTask ( SCSITaskReference ( index, entry->generation ) );
+		
+	}
+	
+	// 3) Unwire any buffers still registered. One which tasks are still
+	//    transferring into is unwired when the last of them completes.
+	for ( UInt32 index = 0; index < kMaxSCSITaskRegisteredBuffers; index++ )
+	{
+		
+		SCSITaskRegisteredBuffer	entry;
+		
+		if ( fRegisteredBuffers[index].buffer == NULL )
+			continue;
+		
+		bzero ( &entry, sizeof ( entry ) );
+		
+		status = fCommandGate->runAction ( ( IOCommandGate::Action ) &SCSITaskUserClient::sUnregisterBuffer,
+										   ( void * ) ( index + 1 ),
+										   ( void * ) &entry,
+										   ( void * ) true );
+		if ( status != kIOReturnSuccess )
+			continue;
+		
+		entry.buffer->complete ( );
+		entry.buffer->release ( );
+		
+	}
+	
+	status = kIOReturnSuccess;
+	
+	return status;
+	
+}
+
+
+//
+//	 SendCommand -	Sends a command to the hardware synchronously. This is a
+//					helper method for all our non-exclusive methods.
+//																	[PROTECTED]
+//
+
+IOReturn
+SCSITaskUserClient::SendCommand ( SCSITask * 		request,
+								  void * 			senseBuffer,
+								  SCSITaskStatus *	taskStatus )
+{
+	
+	SCSITaskRefCon			refCon	= { 0 };
+	IOReturn				status	= kIOReturnNoResources;
+	bool					result  = false;
+	
+	check ( request );
+	check ( senseBuffer );
+	check ( taskStatus );
+	
+	*taskStatus = kSCSITaskStatus_No_Status;
+	
+	refCon.commandType 		= kCommandTypeNonExclusive;
+	refCon.self				= this;
+	refCon.completionState	= kSCSITaskCompletionPending;
+	
+	request->SetTaskCompletionCallback ( &SCSITaskUserClient::sTaskCallback );
+	request->SetApplicationLayerReference ( ( void * ) &refCon );
+	request->SetAutosenseCommand ( kSCSICmd_REQUEST_SENSE,
+								   0x00,
+								   0x00,
+								   0x00,
+								   sizeof ( SCSI_Sense_Data ),
+								   0x00 );
+	
+	result = request->SetAutoSenseDataBuffer (
+								( SCSI_Sense_Data * ) senseBuffer,
+								sizeof ( SCSI_Sense_Data ),
+								fTask );
+	
+	require ( result, ErrorExit );
+	
+	status = request->GetAutosenseDataBuffer ( )->prepare ( );
+	require_success ( status, ErrorExit );
+	
+	// Retain the task. It will be released by sTaskCallback method.
+	request->retain ( );
+	
+	fProtocolInterface->ExecuteCommand ( request );
+	WaitForCompletion ( &refCon );
+	
+	*taskStatus = request->GetTaskStatus ( );
+	
+	if ( request->GetServiceResponse ( ) == kSCSIServiceResponse_TASK_COMPLETE )
+		status = kIOReturnSuccess;
+	else
+		status = kIOReturnIOError;
+	
+	
+ErrorExit:
+	
+	
+	return status;
+	
+}
+
+
+//
+//	 TaskCallback - 	This method is called by sTaskCallback as the
+//						completion routine for all SCSITasks.
+//																	[PROTECTED]
+//
+
+void
+SCSITaskUserClient::TaskCallback ( SCSITask * task, SCSITaskRefCon * refCon )
+{
+	
+	IOMemoryDescriptor *	buffer = NULL;
+	
+	STATUS_LOG ( ( "SCSITaskUserClient::TaskCallback called.\n") );
+	
+	check ( task );
+	check ( refCon );
+	
+	buffer = refCon->taskResultsBuffer;	
+	if ( ( buffer != NULL ) && ( refCon->commandType != kCommandTypeExecuteRing ) )
+	{
+		
+		SCSITaskResults		results;
+		UInt32				numBytes = 0;
+		
+		results.serviceResponse			= task->GetServiceResponse ( );
+		results.taskStatus				= task->GetTaskStatus ( );
+		results.realizedTransferCount	= task->GetRealizedDataTransferCount ( );
+		
+		numBytes = sizeof ( SCSITaskResults );
+		
+		// The results buffer stays prepared until the task is released.
+		buffer->writeBytes ( 0, ( void * ) &results, numBytes );
+		buffer = NULL;
+		
+	}
+	
+	// Release the task as it was retained in ExecuteTask or SendCommand
+	task->release ( );
+	
+	if ( refCon->commandType == kCommandTypeNonExclusive )
+	{
+		
+		// SendCommand prepares the sense buffer on each command.
+		buffer = task->GetAutosenseDataBuffer ( );
+		if ( buffer != NULL )
+		{
+			buffer->complete ( );
+		}
+		
+		OSDecrementAtomic ( &fOutstandingCommands );
+		SignalCompletion ( refCon );
+		
+	}
+	
+	else if ( refCon->commandType == kCommandTypeExecuteSync )
+	{
+		
+		// We've executed the task, so decrement the count now.
+		OSDecrementAtomic ( &fOutstandingCommands );
+		SignalCompletion ( refCon );
+		
+	}
+	
+	else if ( refCon->commandType == kCommandTypeExecuteRing )
+	{
+		
+		// Make sure to complete any data buffers from client
+		CompleteDataBuffer ( task, refCon );
+		
+		// Post the results to the completion ring.
+		PostRingCompletion ( refCon->taskReference,
+							 refCon->userReference,
+							 kIOReturnSuccess,
+							 task );
+		
+		OSDecrementAtomic ( &fOutstandingCommands );
+		
+	}
+	
+	else
+	{
+		
+		OSAsyncReference	asyncRef;
+		
+		bcopy ( refCon->asyncReference, asyncRef, sizeof ( OSAsyncReference ) );
+		
+		STATUS_LOG ( ( "asyncRef[0] = %d\n", asyncRef[0] ) );
+		
+		// Make sure to complete any data buffers from client
+		CompleteDataBuffer ( task, refCon );
+		
+		// Send the result
+        ( void ) sendAsyncResult ( asyncRef, kIOReturnSuccess, NULL, 0 );
+		
+		// We've executed asynchronously, so decrement the count now.
+		OSDecrementAtomic ( &fOutstandingCommands );
+		
+	}
+	
+	if ( isInactive ( ) && ( fOutstandingCommands == 0 ) )
+		HandleTerminate ( fProvider );
 	
 }
 
 
 //
-//	 getAsyncTargetAndMethodForIndex - Returns a pointer to the target of the
-//										async method call and the method
-//										vector itself based on the provided
-//										index.						[PROTECTED]
+//	 SetupTask - 	Creates and initializes a new SCSITask.			[PROTECTED]
 //
 
-IOExternalAsyncMethod *
-SCSITaskUserClient::getAsyncTargetAndMethodForIndex (
-							IOService **	target,
-							UInt32			index )
+IOReturn
+SCSITaskUserClient::SetupTask ( SCSITask ** task )
 {
 	
+	SCSITask *		newTask = NULL;
+	IOReturn		status	= kIOReturnNoMemory;
 	
-	IOExternalAsyncMethod *	method = NULL;
+	check ( task );
 	
-	check ( target );
-	require ( index < kSCSITaskUserClientAsyncMethodCount, GENERAL_ERR );
+	newTask = OSTypeAlloc ( SCSITask );
+	require_nonzero ( newTask, TASK_CREATE_ERR );
+	require_action ( newTask->ResetForNewTask ( ),
+					 TASK_CREATE_ERR,
+					 newTask->release ( ) );
 	
-	fOutstandingCommands++;
+	newTask->SetTaskOwner ( this );
 	
-	require ( isInactive ( ) == false, DECREMENT_COUNTER );
+	*task 	= newTask;
+	status	= kIOReturnSuccess;
 	
-	fProtocolInterface->retain ( );
 	
-	if ( fProtocolInterface->IsPowerManagementIntialized ( ) )
-	{
-		fProtocolInterface->CheckPowerState ( );
-	}
+TASK_CREATE_ERR:
 	
-	fProtocolInterface->release ( );
 	
-	*target = this;
-	method 	= &sAsyncMethods[index];
+	return status;	
+	
+}
+
+
+//
+//	 GetTaskTableEntry - 	Returns the task table slot at index.	[PROTECTED]
+//
+
+SCSITaskTableEntry *
+SCSITaskUserClient::GetTaskTableEntry ( UInt32 index )
+{
+	return &fTaskTable[index / kSCSITaskTableChunkSize][index % kSCSITaskTableChunkSize];
+}
+
+
+//
+//	 GetTask - 	Returns the task a reference names, or NULL if the
+//					reference is out of range or stale.			[PROTECTED]
+//
+
+SCSITask *
+SCSITaskUserClient::GetTask ( SInt32 taskReference )
+{
 	
+	SCSITaskTableEntry *	entry	= NULL;
+	SCSITask *				task	= NULL;
+	UInt32					index	= 0;
 	
-DECREMENT_COUNTER:
+	require ( ( taskReference >= 0 ), GENERAL_ERR );
+	
+	index = SCSITaskReferenceIndex ( taskReference );
+	require ( ( index < fTaskTableSize ), GENERAL_ERR );
 	
+	entry = GetTaskTableEntry ( index );
+	require ( ( entry->generation == SCSITaskReferenceGeneration ( taskReference ) ), GENERAL_ERR );
 	
-	fOutstandingCommands--;
+	task = entry->task;
 	
 	
 GENERAL_ERR:
 	
 	
-	return method;
+	return task;
 	
 }
 
 
 //
-//	 GatedCreateTask -	Safely obtains a taskReference for the newly created
-//						task if one is available. It is called while holding
-//						the workloop lock.							[PROTECTED]
+//	 GrowTaskTable - 	Adds a chunk of free slots to the task table. It
+//						is called while holding the workloop lock.
+//																	[PROTECTED]
 //
 
 IOReturn
-SCSITaskUserClient::GatedCreateTask ( SCSITask * task, SInt32 * taskReference )
+SCSITaskUserClient::GrowTaskTable ( void )
 {
 	
-	IOReturn		status 	= kIOReturnNoResources;
-	UInt32			index	= 0;
+	IOReturn				status	= kIOReturnNoResources;
+	SCSITaskTableEntry *	chunk	= NULL;
+	UInt32					first	= 0;
 	
-	check ( task );
-	check ( taskReference );
+	first = fTaskTableSize;
+	require ( ( first + kSCSITaskTableChunkSize <= fMaximumTasks ), GENERAL_ERR );
+	
+	chunk = ( SCSITaskTableEntry * ) IOMalloc ( sizeof ( SCSITaskTableEntry ) * kSCSITaskTableChunkSize );
+	require_nonzero_action ( chunk, GENERAL_ERR, status = kIOReturnNoMemory );
 	
-	for ( index = 0; index < kMaxSCSITaskArraySize; index++ )
+	// Chain the new slots together in index order so the lowest ones are
+	// handed out first.
+	for ( UInt32 index = 0; index < kSCSITaskTableChunkSize; index++ )
 	{
 		
-		if ( fArray[index] == NULL )
-			break;
+		chunk[index].task		= NULL;
+		chunk[index].generation	= 1;
+		chunk[index].nextFree	= ( index + 1 < kSCSITaskTableChunkSize ) ?
+								  first + index + 1 : fFreeTaskSlot;
 		
 	}
 	
-	require_action ( index < kMaxSCSITaskArraySize, ARRAY_INDEX_ERR, *taskReference = -1 );
+	fTaskTable[first / kSCSITaskTableChunkSize] = chunk;
+	
+	// Publish the chunk before the size so ungated lookups never see a
+	// size covering a chunk which isn't there yet.
+	OSSynchronizeIO ( );
 	
-	fArray[index]	= task;
-	*taskReference 	= index;
+	fTaskTableSize	= first + kSCSITaskTableChunkSize;
+	fFreeTaskSlot	= first;
 	status			= kIOReturnSuccess;
 	
 	
-ARRAY_INDEX_ERR:	
+GENERAL_ERR:
 	
 	
 	return status;
@@ -2315,37 +4057,39 @@ ARRAY_INDEX_ERR:
 
 
 //
-//	 GatedReleaseTask -	Safely obtains a taskReference for the newly
-//							created task if one is available. It is called
-//							while holding the workloop lock.		[PROTECTED]
+//	 PrepareBuffers - 	Prepares any user space buffers.			[PROTECTED]
 //
 
 IOReturn
-SCSITaskUserClient::GatedReleaseTask ( SInt32 taskReference, SCSITask ** task )
+SCSITaskUserClient::PrepareBuffers ( IOMemoryDescriptor **	buffer,
+									 void *					userBuffer,
+									 IOByteCount			bufferSize,
+									 IODirection			direction )
 {
 	
-	IOReturn	status 	= kIOReturnSuccess;
-	SCSITask *	victim	= NULL;
-	
-	check ( task != NULL );
-	
-	// Sanity check
-	victim = fArray[taskReference];
-	require_nonzero_action ( victim, GENERAL_ERR, status = kIOReturnBadArgument );
+	IOReturn	status = kIOReturnNoMemory;
 	
-	// If the task is still active, it cannot be released.
-	require_action ( ( victim->IsTaskActive ( ) == false ), GENERAL_ERR, status = kIOReturnNotPermitted );
+	check ( buffer );
+	check ( userBuffer );
 	
-	// Remove it now.
-	fArray[taskReference] = 0;
+	*buffer = IOMemoryDescriptor::withAddress ( ( vm_address_t ) userBuffer,
+											    bufferSize,
+											    direction,
+											    fTask );
 	
-	STATUS_LOG ( ( "Removed object from array\n" ) );
+	require_nonzero ( *buffer, BUFFER_CREATE_ERR );
 	
-	// Pass back the pointer to the object so it can be safely destroyed.
-	*task = victim;	
+	status = ( *buffer )->prepare ( );
+	if ( status != kIOReturnSuccess )
+	{
+		
+		( *buffer )->release ( );
+		( *buffer ) = NULL;
+		
+	}
 	
 	
-GENERAL_ERR:
+BUFFER_CREATE_ERR:
 	
 	
 	return status;
@@ -2354,196 +4098,126 @@ GENERAL_ERR:
 
 
 //
-//	 GatedValidateTask -	Safely validates a task. It is called while
-//							holding the workloop lock.				[PROTECTED]
+//	 CompleteBuffers - Completes any user space buffers.			[PROTECTED]
 //
 
 IOReturn
-SCSITaskUserClient::GatedValidateTask ( SCSITask * 		request,
-										SCSITaskData * 	args,
-										UInt32 			argSize )
+SCSITaskUserClient::CompleteBuffers ( IOMemoryDescriptor * buffer )
 {
 	
-	IOReturn	status = kIOReturnBadArgument;
-	
-	STATUS_LOG ( ( "SCSITaskUserClient::GatedValidateTask called\n" ) );
-	
-	check ( request );
-	check ( args );
+	IOReturn	status = kIOReturnSuccess;
 	
-	require ( ( args->taskAttribute >= kSCSITask_SIMPLE ) &&
-			  ( args->taskAttribute <= kSCSITask_ACA ),
-			  INVALID_ARGUMENT );
+	check ( buffer );
 	
-	request->SetTaskAttribute ( args->taskAttribute );
+	buffer->complete ( );
+	buffer->release ( );
 	
-	#if ( SCSI_TASK_USER_CLIENT_DEBUGGING_LEVEL >= 3 )
-	{
-		
-		SCSICommandDescriptorBlock	cdb;
-		UInt8						commandLength;
-		
-		request->GetCommandDescriptorBlock ( &cdb );
-		commandLength = request->GetCommandDescriptorBlockSize ( );
-		
-		if ( commandLength == kSCSICDBSize_6Byte )
-		{
-			
-			STATUS_LOG ( ( "cdb = %02x:%02x:%02x:%02x:%02x:%02x\n", cdb[0], cdb[1],
-						cdb[2], cdb[3], cdb[4], cdb[5] ) );
-			
-		}
-		
-		else if ( commandLength == kSCSICDBSize_10Byte )
-		{
-			
-			STATUS_LOG ( ( "cdb = %02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x\n", cdb[0],
-						cdb[1], cdb[2], cdb[3], cdb[4], cdb[5], cdb[6], cdb[7], cdb[8],
-						cdb[9] ) );
-			
-		}
-		
-		else if ( commandLength == kSCSICDBSize_12Byte )
-		{
-			
-			STATUS_LOG ( ( "cdb = %02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x\n", cdb[0],
-						cdb[1], cdb[2], cdb[3], cdb[4], cdb[5], cdb[6], cdb[7], cdb[8],
-						cdb[9], cdb[10], cdb[11] ) );
-			
-		}
-		
-		else if ( commandLength == kSCSICDBSize_16Byte )
-		{
-			
-			STATUS_LOG ( ( "cdb = %02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x\n", cdb[0],
-						cdb[1], cdb[2], cdb[3], cdb[4], cdb[5], cdb[6], cdb[7], cdb[8],
-						cdb[9], cdb[10], cdb[11], cdb[12], cdb[13], cdb[14], cdb[15] ) );
-			
-		}
-		
-	}
-	#endif /* ( SCSI_TASK_USER_CLIENT_DEBUGGING_LEVEL >= 3 ) */
+	return status;
 	
-	switch ( args->cdbSize )
-	{
-		
-		case kSCSICDBSize_6Byte:
-			request->SetCommandDescriptorBlock ( args->cdbData[0],
-												 args->cdbData[1],
-												 args->cdbData[2],
-												 args->cdbData[3],
-												 args->cdbData[4],
-												 args->cdbData[5] );
-			break;
-		
-		case kSCSICDBSize_10Byte:
-			request->SetCommandDescriptorBlock ( args->cdbData[0],
-												 args->cdbData[1],
-												 args->cdbData[2],
-												 args->cdbData[3],
-												 args->cdbData[4],
-												 args->cdbData[5],
-												 args->cdbData[6],
-												 args->cdbData[7],
-												 args->cdbData[8],
-												 args->cdbData[9] );
-			break;
-		
-		case kSCSICDBSize_12Byte:
-			request->SetCommandDescriptorBlock ( args->cdbData[0],
-												 args->cdbData[1],
-												 args->cdbData[2],
-												 args->cdbData[3],
-												 args->cdbData[4],
-												 args->cdbData[5],
-												 args->cdbData[6],
-												 args->cdbData[7],
-												 args->cdbData[8],
-												 args->cdbData[9],
-												 args->cdbData[10],
-												 args->cdbData[11] );
-			break;
-		
-		case kSCSICDBSize_16Byte:
-			request->SetCommandDescriptorBlock ( args->cdbData[0],
-												 args->cdbData[1],
-												 args->cdbData[2],
-												 args->cdbData[3],
-												 args->cdbData[4],
-												 args->cdbData[5],
-												 args->cdbData[6],
-												 args->cdbData[7],
-												 args->cdbData[8],
-												 args->cdbData[9],
-												 args->cdbData[10],
-												 args->cdbData[11],
-												 args->cdbData[12],
-												 args->cdbData[13],
-												 args->cdbData[14],
-												 args->cdbData[15] );
-			break;
-		
-		default:
-			ERROR_LOG ( ( "Invalid command length size\n" ) );
-			goto INVALID_ARGUMENT;
-		
-	}
+}
+
+
+//
+//	 CompleteDataBuffer - 	Completes a task's data buffer, or drops its use
+//							count on a registered buffer.		[PROTECTED]
+//
+
+void
+SCSITaskUserClient::CompleteDataBuffer ( SCSITask * task, SCSITaskRefCon * refCon )
+{
 	
-	require ( ( args->transferDirection <= kSCSIDataTransfer_FromTargetToInitiator ),
-			  INVALID_ARGUMENT );
+	IOMemoryDescriptor *		buffer = NULL;
+	SCSITaskRegisteredBuffer	entry;
 	
-	request->SetDataTransferDirection ( args->transferDirection );
+	check ( task );
+	check ( refCon );
 	
-	if ( args->scatterGatherEntries > 0 )
+	if ( refCon->bufferHandle != kSCSITaskNullBufferHandle )
 	{
 		
-		UInt32		structSizeWithoutList = sizeof ( SCSITaskData ) - sizeof ( IOVirtualRange );
-		UInt32		sgListSize = 0;
+		// Registered buffers stay prepared until they are unregistered,
+		// which may have been waiting on this task.
+		bzero ( &entry, sizeof ( entry ) );
 		
-		sgListSize = argSize - structSizeWithoutList;
+		if ( fCommandGate->runAction ( ( IOCommandGate::Action ) &SCSITaskUserClient::sReleaseRegisteredBuffer,
+									   ( void * ) refCon->bufferHandle,
+									   ( void * ) &entry ) == kIOReturnSuccess )
+		{
+			
+			entry.buffer->complete ( );
+			entry.buffer->release ( );
+			
+		}
 		
-		require_string ( ( sgListSize / sizeof ( IOVirtualRange ) ) == args->scatterGatherEntries,
-						 INVALID_ARGUMENT,
-						 "Invalid scatter-gather list" );
+		refCon->bufferHandle = kSCSITaskNullBufferHandle;
 		
 	}
 	
-	status = kIOReturnSuccess;
-	
-	
-INVALID_ARGUMENT:
-	
-	
-	return status;
+	else
+	{
+		
+		buffer = task->GetDataBuffer ( );
+		if ( buffer != NULL )
+		{
+			CompleteBuffers ( buffer );
+		}
+		
+	}
 	
 }
 
 
 //
-//	 GatedWaitForTask -	Waits for signal to wake up. It must hold the
-//							workloop lock in order to call commandSleep()
-//																	[PROTECTED]
+//	 SubmitTask - 	Submits a task described by user space. Called by
+//					ExecuteTask and for each task posted to the submission
+//					ring.										[PROTECTED]
 //
 
 IOReturn
-SCSITaskUserClient::GatedWaitForTask ( SCSITask * request )
+SCSITaskUserClient::SubmitTask ( SCSITaskData *	args,
+								 UInt32			argSize,
+								 UInt32			commandType,
+								 UInt64			userReference )
 {
 	
-	IOReturn			status	= kIOReturnSuccess;
-	SCSITaskRefCon *	refCon	= NULL;
+	SCSITask *		request	= NULL;
+	IOReturn		status	= kIOReturnBadArgument;
 	
-	check ( request );
-	refCon = ( SCSITaskRefCon * ) request->GetApplicationLayerReference ( );
-	check ( refCon );
+	STATUS_LOG ( ( "SCSITaskUserClient::SubmitTask called\n" ) );
+	STATUS_LOG ( ( "argSize = %ld\n", argSize ) );
+	
+	status = PrepareTask ( args, commandType, userReference, &request );
+	require_success ( status, GENERAL_ERR );
+	
+	status = fCommandGate->runAction ( ( IOCommandGate::Action ) &SCSITaskUserClient::sValidateTask,
+									   ( void * ) request,
+									   ( void * ) args,
+									   ( void * ) argSize );
 	
-	while ( request->GetTaskState ( ) != kSCSITaskState_ENDED )
+	require_success ( status, ACTION_FAILED_ERR );
+	
+	STATUS_LOG ( ( "Task is valid\n" ) );
+	
+	status = LaunchTask ( request, args );
+	require_success ( status, ACTION_FAILED_ERR );
+	
+	if ( commandType == kCommandTypeExecuteSync )
 	{
-		
-		status = fCommandGate->commandSleep ( &refCon->commandType, THREAD_UNINT );
-		
+		status = WaitForTask ( request );
 	}
 	
-	status = kIOReturnSuccess;
+	
+	return status;
+	
+	
+ACTION_FAILED_ERR:
+	
+	
+	OSDecrementAtomic ( &fOutstandingCommands );
+	
+	
+GENERAL_ERR:
+	
 	
 	return status;
 	
@@ -2551,405 +4225,622 @@ SCSITaskUserClient::GatedWaitForTask ( SCSITask * request )
 
 
 //
-//	 didTerminate - Checks to see if termination should be deferred.
-//																	[PROTECTED]
+//	 PrepareTask - Looks up the task a user space request names and readies
+//					it for validation. The task counts as outstanding if
+//					this succeeds.								[PROTECTED]
 //
 
-bool
-SCSITaskUserClient::didTerminate ( IOService * 		provider,
-								   IOOptionBits		options,
-								   bool *			defer )
+IOReturn
+SCSITaskUserClient::PrepareTask ( SCSITaskData *	args,
+								  UInt32			commandType,
+								  UInt64			userReference,
+								  SCSITask **		task )
 {
 	
-	if ( fOutstandingCommands == 0 )
-	{
-		HandleTerminate ( provider );
-	}
+	SCSITask *				request				= NULL;
+	SCSITaskRefCon *		refCon				= NULL;
+	IOReturn				status				= kIOReturnBadArgument;
 	
-	return true;
+	OSIncrementAtomic ( &fOutstandingCommands );
+	
+	require_action ( isInactive ( ) == false, GENERAL_ERR, status = kIOReturnNoDevice );
+	
+	check ( args );
+	check ( task );
+	
+	request = GetTask ( args->taskReference );
+	require_nonzero ( request, GENERAL_ERR );
+	
+	nrequire_action ( request->IsTaskActive ( ), GENERAL_ERR, status = kIOReturnNotPermitted );
+	
+	refCon = ( SCSITaskRefCon * ) request->GetApplicationLayerReference ( );
+	
+	// SetBuffers must have wired the results and sense buffers.
+	require_action ( refCon->buffersPrepared, GENERAL_ERR, status = kIOReturnNotReady );
+	
+	refCon->commandType 	= commandType;
+	refCon->taskReference	= args->taskReference;
+	refCon->userReference	= userReference;
+	refCon->bufferHandle	= kSCSITaskNullBufferHandle;
+	refCon->self			= this;
+	refCon->completionState	= kSCSITaskCompletionPending;
+	
+	request->ResetForNewTask ( );
+	
+	request->SetApplicationLayerReference ( ( void * ) refCon );
+	
+	*task	= request;
+	status	= kIOReturnSuccess;
+	
+	return status;
+	
+	
+GENERAL_ERR:
+	
+	
+	OSDecrementAtomic ( &fOutstandingCommands );
+	
+	return status;
 	
 }
 
 
 //
-//	 HandleTerminate -	Handles terminating our object and any resources it
-//						allocated.									[PROTECTED]
+//	 LaunchTask - 	Wires the data buffer of a validated task and sends the
+//					task to the device.							[PROTECTED]
 //
 
 IOReturn
-SCSITaskUserClient::HandleTerminate ( IOService * provider )
+SCSITaskUserClient::LaunchTask ( SCSITask * request, SCSITaskData * args )
 {
 	
-	IOReturn	status = kIOReturnSuccess;
+	IOReturn				status				= kIOReturnSuccess;
+	IOMemoryDescriptor *	buffer				= NULL;
 	
-	check ( provider );
+	check ( request );
+	check ( args );
 	
-	// Check if we have our provider open.
-	if ( provider->isOpen ( this ) )
+	request->SetTimeoutDuration ( args->timeoutDuration );
+	
+	if ( ( args->scatterGatherEntries > 0 ) && ( args->requestedTransferCount > 0 ) )
 	{
 		
-		// Yes we do, so close the connection
-		STATUS_LOG ( ( "Closing provider\n" ) );
-		provider->close ( this, kIOSCSITaskUserClientAccessMask );
+		IODirection		ioDirection;
 		
-	}
-	
-	// Decouple us from the IORegistry.
-	detach ( provider );
-	fProvider = NULL;
-	
-	// Clean up work.
-	
-	// 1) Release exclusive access to the device
-	ReleaseExclusiveAccess ( );
-	
-	// 2) Release any tasks not cleaned up by the userspace code.
-	for ( UInt32 index = 0; index < kMaxSCSITaskArraySize; index++ )
-	{
+		STATUS_LOG ( ( "Preparing buffers\n" ) );
 		
-		SCSITask *	task = NULL;
+		ioDirection = ( args->transferDirection == kSCSIDataTransfer_FromTargetToInitiator ) ? kIODirectionIn : kIODirectionOut;
 		
-		task = ( SCSITask * ) fArray[index];
-		if ( task == NULL )
-			continue;
+		buffer = IOMemoryDescriptor::withRanges ( args->scatterGatherList,
+												  args->scatterGatherEntries,
+												  ioDirection,
+												  fTask );
+		
+		require_nonzero_action_string ( buffer,
+										BUFFER_CREATE_FAILED_ERR,
+										status = kIOReturnNoResources,
+										"Error creating memory descriptor\n" );
+		
+		status = buffer->prepare ( );
+		require_success_string ( status,
+								 BUFFER_PREPARE_FAILED_ERR,
+								 "Error preparing user memory descriptor\n" );
 		
-		ReleaseTask ( index );
+		request->SetDataBuffer ( buffer );
+		request->SetRequestedDataTransferCount ( args->requestedTransferCount );
 		
 	}
 	
+	// Retain the task. It will be released by sTaskCallback method.
+	request->retain ( );
+	
+	request->SetTaskCompletionCallback ( &SCSITaskUserClient::sTaskCallback );
+	request->SetAutosenseCommand ( kSCSICmd_REQUEST_SENSE, 0x00, 0x00, 0x00, sizeof ( SCSI_Sense_Data ), 0x00 );
+	fProtocolInterface->ExecuteCommand ( request );
+	
+	return status;
+	
+	
+BUFFER_PREPARE_FAILED_ERR:
+	
+	
+	buffer->release ( );
+	buffer = NULL;
+	
+	
+BUFFER_CREATE_FAILED_ERR:
+	
+	
 	return status;
 	
 }
 
 
 //
-//	 SendCommand -	Sends a command to the hardware synchronously. This is a
-//					helper method for all our non-exclusive methods.
-//																	[PROTECTED]
+//	 WaitForTask - Waits for a synchronous task to complete.		[PROTECTED]
 //
 
 IOReturn
-SCSITaskUserClient::SendCommand ( SCSITask * 		request,
-								  void * 			senseBuffer,
-								  SCSITaskStatus *	taskStatus )
+SCSITaskUserClient::WaitForTask ( SCSITask * request )
 {
 	
-	SCSITaskRefCon			refCon	= { 0 };
-	IOReturn				status	= kIOReturnNoResources;
-	bool					result  = false;
+	IOReturn			status	= kIOReturnSuccess;
+	SCSITaskRefCon *	refCon	= NULL;
 	
 	check ( request );
-	check ( senseBuffer );
-	check ( taskStatus );
 	
-	*taskStatus = kSCSITaskStatus_No_Status;
+	refCon = ( SCSITaskRefCon * ) request->GetApplicationLayerReference ( );
 	
-	refCon.commandType 	= kCommandTypeNonExclusive;
-	refCon.self			= this;
+	retain ( );
 	
-	request->SetTaskCompletionCallback ( &SCSITaskUserClient::sTaskCallback );
-	request->SetApplicationLayerReference ( ( void * ) &refCon );
-	request->SetAutosenseCommand ( kSCSICmd_REQUEST_SENSE,
-								   0x00,
-								   0x00,
-								   0x00,
-								   sizeof ( SCSI_Sense_Data ),
-								   0x00 );
+	WaitForCompletion ( refCon );
 	
-	result = request->SetAutoSenseDataBuffer (
-								( SCSI_Sense_Data * ) senseBuffer,
-								sizeof ( SCSI_Sense_Data ),
-								fTask );
+	// Make sure to complete any data buffers from client
+	CompleteDataBuffer ( request, refCon );
 	
-	require ( result, ErrorExit );
+	release ( );
 	
-	status = request->GetAutosenseDataBuffer ( )->prepare ( );
-	require_success ( status, ErrorExit );
+	return status;
 	
-	// Retain the task. It will be released by sTaskCallback method.
-	request->retain ( );
+}
+
+
+//
+//	 WaitForCompletion - 	Waits for TaskCallback to publish a synchronous
+//							task's results. Spins briefly first, since
+//							short commands often finish before a sleep and
+//							wakeup could.						[PROTECTED]
+//
+
+void
+SCSITaskUserClient::WaitForCompletion ( SCSITaskRefCon * refCon )
+{
 	
-	fProtocolInterface->ExecuteCommand ( request );
-	fCommandGate->runAction ( ( IOCommandGate::Action ) &SCSITaskUserClient::sWaitForTask,
-							  ( void * ) request );
+	UInt64		startTime	= 0;
+	UInt64		deadline	= 0;
+	UInt64		now			= 0;
+	UInt64		elapsed		= 0;
+	UInt32		spinTime	= fSyncLatency;
 	
-	*taskStatus = request->GetTaskStatus ( );
+	check ( refCon );
 	
-	if ( request->GetServiceResponse ( ) == kSCSIServiceResponse_TASK_COMPLETE )
-		status = kIOReturnSuccess;
-	else
-		status = kIOReturnIOError;
+	clock_get_uptime ( &startTime );
+	now = startTime;
+	
+	// Spin for about as long as recent synchronous commands have taken,
+	// unless that is too long to be worth the CPU.
+	if ( spinTime <= kSCSITaskMaximumSpinTime )
+	{
+		
+		nanoseconds_to_absolutetime ( spinTime, &deadline );
+		deadline += startTime;
+		
+		while ( ( refCon->completionState != kSCSITaskCompletionDone ) && ( now < deadline ) )
+		{
+			clock_get_uptime ( &now );
+		}
+		
+	}
+	
+	if ( refCon->completionState != kSCSITaskCompletionDone )
+	{
+		
+		// Only sleep if TaskCallback hasn't published the results since
+		// we last looked. If it has, the swap fails and we're done.
+		IOLockLock ( fCompletionLock );
+		
+		if ( OSCompareAndSwap ( kSCSITaskCompletionPending,
+								kSCSITaskCompletionSleeping,
+								&refCon->completionState ) )
+		{
+			
+			while ( refCon->completionState != kSCSITaskCompletionDone )
+			{
+				
+				IOLockSleep ( fCompletionLock,
+							  ( void * ) &refCon->completionState,
+							  THREAD_UNINT );
+				
+			}
+			
+		}
+		
+		IOLockUnlock ( fCompletionLock );
+		
+	}
+	
+	// Don't read the task's results ahead of its completion state.
+	OSSynchronizeIO ( );
+	
+	// Fold this wait into the average. Concurrent waiters may race on it,
+	// which is fine since it is only a hint.
+	clock_get_uptime ( &now );
+	absolutetime_to_nanoseconds ( now - startTime, &elapsed );
+	
+	if ( elapsed > ( kSCSITaskMaximumSpinTime * 2 ) )
+		elapsed = kSCSITaskMaximumSpinTime * 2;
 	
+	fSyncLatency = ( UInt32 ) ( ( ( ( UInt64 ) fSyncLatency * 7 ) + elapsed ) / 8 );
+	
+}
+
+
+//
+//	 SignalCompletion - 	Publishes a synchronous task's results to its
+//							waiter. The waiter may return as soon as the
+//							state changes, so refCon must not be touched
+//							after this.							[PROTECTED]
+//
+
+void
+SCSITaskUserClient::SignalCompletion ( SCSITaskRefCon * refCon )
+{
 	
-ErrorExit:
+	check ( refCon );
 	
+	// The waiter hasn't gone to sleep, so it will see the new state while
+	// spinning or when it tries to sleep.
+	if ( OSCompareAndSwap ( kSCSITaskCompletionPending,
+							kSCSITaskCompletionDone,
+							&refCon->completionState ) )
+	{
+		return;
+	}
 	
-	return status;
+	// The waiter is asleep. IOLockSleep ( ) dropped the lock for it, so
+	// taking it here can't miss the wakeup.
+	IOLockLock ( fCompletionLock );
+	refCon->completionState = kSCSITaskCompletionDone;
+	IOLockWakeup ( fCompletionLock, ( void * ) &refCon->completionState, true );
+	IOLockUnlock ( fCompletionLock );
 	
 }
 
 
 //
-//	 TaskCallback - 	This method is called by sTaskCallback as the
-//						completion routine for all SCSITasks.
+//	 SubmitRingTask - 	Submits a task posted to the submission ring. A task
+//						which can't be submitted is completed right away so
+//						the library still sees a completion for it.
 //																	[PROTECTED]
 //
 
 void
-SCSITaskUserClient::TaskCallback ( SCSITask * task, SCSITaskRefCon * refCon )
+SCSITaskUserClient::SubmitRingTask ( SCSITaskRingSubmission * entry )
 {
 	
-	IOMemoryDescriptor *	buffer = NULL;
+	SCSITaskData	args;
+	IOReturn		status = kIOReturnSuccess;
 	
-	STATUS_LOG ( ( "SCSITaskUserClient::TaskCallback called.\n") );
+	check ( entry );
 	
-	check ( task );
-	check ( refCon );
+	bzero ( &args, sizeof ( args ) );
 	
-	buffer = refCon->taskResultsBuffer;	
-	if ( buffer != NULL )
+	args.taskReference			= entry->taskReference;
+	args.isSync					= false;
+	args.taskAttribute			= entry->taskAttribute;
+	args.cdbSize				= entry->cdbSize;
+	args.requestedTransferCount	= entry->requestedTransferCount;
+	args.transferDirection		= entry->transferDirection;
+	args.timeoutDuration		= entry->timeoutDuration;
+	args.bufferHandle			= entry->bufferHandle;
+	args.bufferOffset			= entry->bufferOffset;
+	
+	bcopy ( entry->cdbData, args.cdbData, sizeof ( SCSICommandDescriptorBlock ) );
+	
+	if ( entry->buffer.length > 0 )
 	{
 		
-		SCSITaskResults		results;
-		UInt32				numBytes = 0;
-		
-		results.serviceResponse			= task->GetServiceResponse ( );
-		results.taskStatus				= task->GetTaskStatus ( );
-		results.realizedTransferCount	= task->GetRealizedDataTransferCount ( );
-		
-		numBytes = sizeof ( SCSITaskResults );
-		
-		buffer->writeBytes ( 0, ( void * ) &results, numBytes );
-		buffer->complete ( );
-		
-		// Make sure to release since it was retained by ExecuteTask
-		buffer->release ( );
-		buffer = NULL;
+		args.scatterGatherEntries	= 1;
+		args.scatterGatherList[0]	= entry->buffer;
 		
 	}
 	
-	buffer = task->GetAutosenseDataBuffer ( );
-	if ( buffer != NULL )
-	{
-		buffer->complete ( );
-	}
-	
-	// Release the task as it was retained in ExecuteTask or SendCommand
-	task->release ( );
-	
-	if ( refCon->commandType == kCommandTypeNonExclusive )
+	status = SubmitTask ( &args, sizeof ( args ), kCommandTypeExecuteRing, entry->userReference );
+	if ( status != kIOReturnSuccess )
 	{
 		
-		fOutstandingCommands--;
-		fCommandGate->commandWakeup ( &refCon->commandType );
+		ERROR_LOG ( ( "SubmitRingTask: task %ld failed, status = 0x%08x\n",
+					  entry->taskReference, status ) );
+		PostRingCompletion ( entry->taskReference, entry->userReference, status, NULL );
 		
 	}
 	
-	else if ( refCon->commandType == kCommandTypeExecuteSync )
+}
+
+
+//
+//	 PostRingCompletion - 	Posts the results of a ring task to the
+//							completion ring. If task is NULL, the task never
+//							reached the device.						[PROTECTED]
+//
+
+void
+SCSITaskUserClient::PostRingCompletion ( UInt32		taskReference,
+										 UInt64		userReference,
+										 IOReturn	status,
+										 SCSITask *	task )
+{
+	
+	SCSITaskRingCompletion	completion;
+	
+	completion.userReference	= userReference;
+	completion.taskReference	= taskReference;
+	completion.status			= status;
+	
+	if ( task != NULL )
 	{
 		
-		// We've executed the task, so decrement the count now.
-		fOutstandingCommands--;
-		fCommandGate->commandWakeup ( &refCon->commandType );
+		completion.serviceResponse			= task->GetServiceResponse ( );
+		completion.taskStatus				= task->GetTaskStatus ( );
+		completion.realizedTransferCount	= task->GetRealizedDataTransferCount ( );
 		
 	}
-		
+	
 	else
 	{
 		
-		OSAsyncReference	asyncRef;
-		
-		bcopy ( refCon->asyncReference, asyncRef, sizeof ( OSAsyncReference ) );
-		
-		STATUS_LOG ( ( "asyncRef[0] = %d\n", asyncRef[0] ) );
-		
-		buffer = task->GetDataBuffer ( );
-		if ( buffer != NULL )
-		{
-			
-			// Make sure to complete any data buffers from client
-			CompleteBuffers ( buffer );
-			
-		}
-		
-		// Send the result
-        ( void ) sendAsyncResult ( asyncRef, kIOReturnSuccess, NULL, 0 );
-		
-		// We've executed asynchronously, so decrement the count now.
-		fOutstandingCommands--;
+		completion.serviceResponse			= kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
+		completion.taskStatus				= kSCSITaskStatus_No_Status;
+		completion.realizedTransferCount	= 0;
 		
 	}
 	
-	if ( isInactive ( ) && ( fOutstandingCommands == 0 ) )
-		HandleTerminate ( fProvider );
+	fCommandGate->runAction ( ( IOCommandGate::Action ) &SCSITaskUserClient::sPostRingCompletion,
+							  ( void * ) &completion );
 	
 }
 
 
+#if 0
+#pragma mark -
+#pragma mark Static Methods
+#pragma mark -
+#endif
+
+
 //
-//	 SetupTask - 	Creates and initializes a new SCSITask.			[PROTECTED]
+//	 sCreateTask - Called by runAction and holds the workloop lock.
+//																	[STATIC]
 //
 
 IOReturn
-SCSITaskUserClient::SetupTask ( SCSITask ** task )
+SCSITaskUserClient::sCreateTask ( void *		self,
+								  SCSITask *	task,
+								  SInt32 *		taskReference )
 {
 	
-	SCSITask *		newTask = NULL;
-	IOReturn		status	= kIOReturnNoMemory;
-	
-	check ( task );
-	
-	newTask = OSTypeAlloc ( SCSITask );
-	require_nonzero ( newTask, TASK_CREATE_ERR );
-	require_action ( newTask->ResetForNewTask ( ),
-					 TASK_CREATE_ERR,
-					 newTask->release ( ) );
-	
-	newTask->SetTaskOwner ( this );
-	
-	*task 	= newTask;
-	status	= kIOReturnSuccess;
-	
-	
-TASK_CREATE_ERR:
+	check ( self );
+	return ( ( SCSITaskUserClient * ) self )->GatedCreateTask ( task, taskReference );
 	
+}
+
+
+//
+//	 sReleaseTask - Called by runAction and holds the workloop lock.
+//																	[STATIC]
+//
+
+IOReturn
+SCSITaskUserClient::sReleaseTask ( void * self, SInt32 taskReference, void * task )
+{
 	
-	return status;	
+	check ( self );
+	return ( ( SCSITaskUserClient * ) self )->GatedReleaseTask ( taskReference,
+																 ( SCSITask ** ) task );
 	
 }
 
 
 //
-//	 PrepareBuffers - 	Prepares any user space buffers.			[PROTECTED]
+//	 sValidateTask - Called by runAction and holds the workloop lock.
+//																	[STATIC]
 //
 
 IOReturn
-SCSITaskUserClient::PrepareBuffers ( IOMemoryDescriptor **	buffer,
-									 void *					userBuffer,
-									 IOByteCount			bufferSize,
-									 IODirection			direction )
+SCSITaskUserClient::sValidateTask ( void *			userClient,
+									SCSITask *		request,
+									SCSITaskData *	args,
+									UInt32			argSize )
 {
 	
-	IOReturn	status = kIOReturnNoMemory;
+	check ( userClient );
+	return ( ( SCSITaskUserClient * ) userClient )->GatedValidateTask ( request, args, argSize );
 	
-	check ( buffer );
-	check ( userBuffer );
+}
+
+
+//
+//	 sValidateTasks - Called by runAction and holds the workloop lock.
+//																	[STATIC]
+//
+
+IOReturn
+SCSITaskUserClient::sValidateTasks ( void *					userClient,
+									 SCSITaskBatchEntry *	entries,
+									 UInt32					count )
+{
 	
-	*buffer = IOMemoryDescriptor::withAddress ( ( vm_address_t ) userBuffer,
-											    bufferSize,
-											    direction,
-											    fTask );
+	check ( userClient );
+	return ( ( SCSITaskUserClient * ) userClient )->GatedValidateTasks ( entries, count );
 	
-	require_nonzero ( *buffer, BUFFER_CREATE_ERR );
+}
+
+
+//
+//	 sCreateTaskRings - Called by runAction and holds the workloop lock.
+//																	[STATIC]
+//
+
+IOReturn
+SCSITaskUserClient::sCreateTaskRings ( void *						userClient,
+									   OSAsyncReference				asyncRef,
+									   IOBufferMemoryDescriptor *	submissionRing,
+									   IOBufferMemoryDescriptor *	completionRing )
+{
 	
-	status = ( *buffer )->prepare ( );
-	if ( status != kIOReturnSuccess )
-	{
-		
-		( *buffer )->release ( );
-		( *buffer ) = NULL;
-		
-	}
+	check ( userClient );
+	return ( ( SCSITaskUserClient * ) userClient )->GatedCreateTaskRings ( asyncRef, submissionRing, completionRing );
 	
+}
+
+
+//
+//	 sDestroyTaskRings - Called by runAction and holds the workloop lock.
+//																	[STATIC]
+//
+
+IOReturn
+SCSITaskUserClient::sDestroyTaskRings ( void * userClient )
+{
 	
-BUFFER_CREATE_ERR:
+	check ( userClient );
+	return ( ( SCSITaskUserClient * ) userClient )->GatedDestroyTaskRings ( );
 	
+}
+
+
+//
+//	 sClientMemoryForType - 	Called by runAction and holds the workloop
+//								lock.								[STATIC]
+//
+
+IOReturn
+SCSITaskUserClient::sClientMemoryForType ( void *					userClient,
+										   UInt32					type,
+										   IOMemoryDescriptor **	memory )
+{
 	
-	return status;
+	check ( userClient );
+	return ( ( SCSITaskUserClient * ) userClient )->GatedClientMemoryForType ( type, memory );
 	
 }
 
 
 //
-//	 CompleteBuffers - Completes any user space buffers.			[PROTECTED]
+//	 sConsumeRingSubmissions - Called by runAction and holds the workloop
+//								lock.								[STATIC]
 //
 
 IOReturn
-SCSITaskUserClient::CompleteBuffers ( IOMemoryDescriptor * buffer )
+SCSITaskUserClient::sConsumeRingSubmissions ( void *					userClient,
+											  SCSITaskRingSubmission *	entries,
+											  UInt32 *					count )
 {
 	
-	IOReturn	status = kIOReturnSuccess;
-	
-	check ( buffer );
+	check ( userClient );
+	return ( ( SCSITaskUserClient * ) userClient )->GatedConsumeRingSubmissions ( entries, count );
 	
-	buffer->complete ( );
-	buffer->release ( );
+}
+
+
+//
+//	 sPostRingCompletion - Called by runAction and holds the workloop lock.
+//																	[STATIC]
+//
+
+IOReturn
+SCSITaskUserClient::sPostRingCompletion ( void *					userClient,
+										  SCSITaskRingCompletion *	completion )
+{
 	
-	return status;
+	check ( userClient );
+	return ( ( SCSITaskUserClient * ) userClient )->GatedPostRingCompletion ( completion );
 	
 }
 
 
-#if 0
-#pragma mark -
-#pragma mark Static Methods
-#pragma mark -
-#endif
+//
+//	 sSetCompletionCoalescing - Called by runAction and holds the workloop
+//								 lock.								[STATIC]
+//
+
+IOReturn
+SCSITaskUserClient::sSetCompletionCoalescing ( void *	userClient,
+											   UInt32	maxCompletions,
+											   UInt32	maxDelay )
+{
+	
+	check ( userClient );
+	return ( ( SCSITaskUserClient * ) userClient )->GatedSetCompletionCoalescing ( maxCompletions, maxDelay );
+	
+}
 
 
 //
-//	 sCreateTask - Called by runAction and holds the workloop lock.
+//	 sCoalescingTimeout - 	Called on the workloop when a coalesced
+//							completion has waited as long as it may.
 //																	[STATIC]
 //
 
-IOReturn
-SCSITaskUserClient::sCreateTask ( void *		self,
-								  SCSITask *	task,
-								  SInt32 *		taskReference )
+void
+SCSITaskUserClient::sCoalescingTimeout ( OSObject * owner, IOTimerEventSource * sender )
 {
 	
-	check ( self );
-	return ( ( SCSITaskUserClient * ) self )->GatedCreateTask ( task, taskReference );
+	SCSITaskUserClient *	self = NULL;
+	
+	self = OSDynamicCast ( SCSITaskUserClient, owner );
+	require_nonzero ( self, GENERAL_ERR );
+	
+	self->fCoalesceTimerArmed = false;
+	self->GatedNotifyRingCompletions ( );
+	
+	
+GENERAL_ERR:
+	
+	
+	return;
 	
 }
 
 
 //
-//	 sReleaseTask - Called by runAction and holds the workloop lock.
+//	 sRegisterBuffer - Called by runAction and holds the workloop lock.
 //																	[STATIC]
 //
 
 IOReturn
-SCSITaskUserClient::sReleaseTask ( void * self, SInt32 taskReference, void * task )
+SCSITaskUserClient::sRegisterBuffer ( void *						userClient,
+									  SCSITaskRegisteredBuffer *	entry,
+									  UInt32 *						bufferHandle )
 {
 	
-	check ( self );
-	return ( ( SCSITaskUserClient * ) self )->GatedReleaseTask ( taskReference,
-																 ( SCSITask ** ) task );
+	check ( userClient );
+	return ( ( SCSITaskUserClient * ) userClient )->GatedRegisterBuffer ( entry, bufferHandle );
 	
 }
 
 
 //
-//	 sWaitForTask - Called by runAction and holds the workloop lock.
+//	 sUnregisterBuffer - Called by runAction and holds the workloop lock.
 //																	[STATIC]
 //
 
 IOReturn
-SCSITaskUserClient::sWaitForTask ( void *		userClient,
-								   SCSITask *	request )
+SCSITaskUserClient::sUnregisterBuffer ( void *						userClient,
+										UInt32						bufferHandle,
+										SCSITaskRegisteredBuffer *	entry,
+										bool						defer )
 {
 	
 	check ( userClient );
-	return ( ( SCSITaskUserClient * ) userClient )->GatedWaitForTask ( request );
+	return ( ( SCSITaskUserClient * ) userClient )->GatedUnregisterBuffer ( bufferHandle, entry, defer );
 	
 }
 
 
 //
-//	 sValidateTask - Called by runAction and holds the workloop lock.
-//																	[STATIC]
+//	 sReleaseRegisteredBuffer - Called by runAction and holds the workloop
+//								 lock.								[STATIC]
 //
 
 IOReturn
-SCSITaskUserClient::sValidateTask ( void *			userClient,
-									SCSITask *		request,
-									SCSITaskData *	args,
-									UInt32			argSize )
+SCSITaskUserClient::sReleaseRegisteredBuffer ( void *						userClient,
+											   UInt32						bufferHandle,
+											   SCSITaskRegisteredBuffer *	entry )
 {
 	
 	check ( userClient );
-	return ( ( SCSITaskUserClient * ) userClient )->GatedValidateTask ( request, args, argSize );
+	return ( ( SCSITaskUserClient * ) userClient )->GatedReleaseRegisteredBuffer ( bufferHandle, entry );
 	
 }
 
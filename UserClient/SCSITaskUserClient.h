@@ -35,6 +35,8 @@
 // IOKit includes
 #include <IOKit/IOLib.h>
 #include <IOKit/IOUserClient.h>
+#include <IOKit/IOBufferMemoryDescriptor.h>
+#include <IOKit/IOTimerEventSource.h>
 
 // SCSI Architecture Model Family includes
 #include <IOKit/scsi/SCSITask.h>
@@ -49,16 +51,76 @@
 //	Constants
 //
 
+// Tasks are kept in a table which grows a chunk at a time up to the
+// client's limit. Chunks never move once allocated, so a task can be
+// looked up without holding the workloop lock.
 enum
 {
-	kMaxSCSITaskArraySize	= 16
+	kSCSITaskTableChunkSize			= 64,
+	kSCSITaskTableMaximumSize		= 4096,
+	kSCSITaskTableMaximumChunks		= kSCSITaskTableMaximumSize / kSCSITaskTableChunkSize,
+	kSCSITaskTableNoFreeSlot		= 0xFFFFFFFF,
+	
+	// Limits on the number of tasks one client may create. The limit is
+	// always a whole number of chunks.
+	kSCSITaskDefaultMaximumTasks	= 256,
+	kSCSITaskMinimumMaximumTasks	= kSCSITaskTableChunkSize
+};
+
+// A task reference holds the task's slot in the low bits and the slot's
+// generation above them. The generation changes each time the slot is
+// freed, so a reference to a released task is never mistaken for the
+// task which reuses its slot. References are always positive.
+enum
+{
+	kSCSITaskReferenceIndexBits		= 16,
+	kSCSITaskReferenceIndexMask		= ( 1 << kSCSITaskReferenceIndexBits ) - 1,
+	kSCSITaskReferenceGenerationMask	= 0x7FFF
+};
+
+#define	SCSITaskReference(index,generation)	( SInt32 ) ( ( ( generation ) << kSCSITaskReferenceIndexBits ) | ( index ) )
+#define	SCSITaskReferenceIndex(ref)			( ( UInt32 ) ( ref ) & kSCSITaskReferenceIndexMask )
+#define	SCSITaskReferenceGeneration(ref)	( ( ( UInt32 ) ( ref ) >> kSCSITaskReferenceIndexBits ) & kSCSITaskReferenceGenerationMask )
+
+enum
+{
+	kMaxSCSITaskRegisteredBuffers	= 16,
+	
+	// Most memory one client may keep wired with registered buffers
+	kSCSITaskMaxWiredBytes			= 64 * 1024 * 1024
 };
 
 enum
 {
 	kCommandTypeExecuteSync		= 0,
 	kCommandTypeExecuteAsync	= 1,
-	kCommandTypeNonExclusive	= 2
+	kCommandTypeNonExclusive	= 2,
+	kCommandTypeExecuteRing		= 3
+};
+
+// States of a synchronous task's completion event. The waiter and
+// TaskCallback ( ) move between them with compare-and-swap, so results
+// are published without going through the command gate.
+enum
+{
+	kSCSITaskCompletionIdle		= 0,
+	kSCSITaskCompletionPending	= 1,
+	kSCSITaskCompletionSleeping	= 2,
+	kSCSITaskCompletionDone		= 3
+};
+
+enum
+{
+	// Longest a synchronous waiter spins before blocking, in nanoseconds.
+	// Waits are counted at no more than twice this when averaging, so one
+	// slow command doesn't stop spinning for long.
+	kSCSITaskMaximumSpinTime	= 50000
+};
+
+enum
+{
+	// Number of ring submissions copied out under the gate at a time
+	kSCSITaskRingBatchSize		= 8
 };
 
 // Forward class declaration
@@ -75,10 +137,52 @@ struct SCSITaskRefCon
 	IOMemoryDescriptor *	taskResultsBuffer;
 	OSAsyncReference		asyncReference;
 	UInt32					commandType;
+	UInt32					taskReference;
+	UInt64					userReference;
+	UInt32					bufferHandle;
+	bool					buffersPrepared;
+	volatile UInt32			completionState;
 };
 typedef struct SCSITaskRefCon SCSITaskRefCon;
 
 
+// One slot of the task table. Free slots are chained through nextFree.
+struct SCSITaskTableEntry
+{
+	SCSITask *				task;
+	UInt32					generation;
+	UInt32					nextFree;
+};
+typedef struct SCSITaskTableEntry SCSITaskTableEntry;
+
+
+// A user buffer wired by RegisterBuffer ( ). useCount counts the tasks
+// in flight which transfer into it; it can't be unregistered until they
+// have all completed. unregisterPending asks the last of them to do so.
+struct SCSITaskRegisteredBuffer
+{
+	IOMemoryDescriptor *	buffer;
+	IOByteCount				length;
+	UInt8					transferDirection;
+	volatile SInt32			useCount;
+	bool					unregisterPending;
+};
+typedef struct SCSITaskRegisteredBuffer SCSITaskRegisteredBuffer;
+
+
+// One task of a kSCSITaskUserClientExecuteTasks batch. request is set once
+// the task has been claimed for the batch, and status holds the first
+// failure on the way to the device.
+struct SCSITaskBatchEntry
+{
+	SCSITaskData *			args;
+	UInt32					argSize;
+	SCSITask *				request;
+	IOReturn				status;
+};
+typedef struct SCSITaskBatchEntry SCSITaskBatchEntry;
+
+
 //
 //	Class Declarations
 //
@@ -116,6 +220,33 @@ public:
 										  void * callback,
 										  void * userRefCon );
 	
+	// Task ring methods
+	virtual IOReturn CreateTaskRings	( OSAsyncReference asyncRef,
+										  UInt32 ringEntries,
+										  void * callback,
+										  void * userRefCon );
+	virtual IOReturn DestroyTaskRings	( void );
+	virtual IOReturn RingDoorbell		( UInt32 * consumed );
+	virtual IOReturn SetCompletionCoalescing ( UInt32 maxCompletions,
+											   UInt32 maxDelay );
+	
+	// Registered buffer methods
+	virtual IOReturn RegisterBuffer		( vm_address_t address,
+										  UInt32 length,
+										  UInt32 transferDirection,
+										  UInt32 * bufferHandle );
+	virtual IOReturn UnregisterBuffer	( UInt32 bufferHandle );
+	
+	// Batched submission
+	virtual IOReturn ExecuteTasks		( SCSITaskBatchHeader * batch,
+										  IOReturn * results,
+										  UInt32 inStructSize,
+										  UInt32 * outStructSize );
+	
+	virtual IOReturn clientMemoryForType ( UInt32 type,
+										   IOOptionBits * options,
+										   IOMemoryDescriptor ** memory );
+	
 	// MMC Device methods
 	virtual IOReturn Inquiry 			( AppleInquiryStruct * 	inquiryData,
 							  			  SCSITaskStatus * 		taskStatus,
@@ -189,23 +320,86 @@ protected:
 
 	static IOReturn	sCreateTask 		( void * self, SCSITask * task, SInt32 * taskReference );
 	static IOReturn	sReleaseTask 		( void * self, SInt32 taskReference, void * task );
-	static IOReturn	sWaitForTask 		( void * userClient, SCSITask * request );
 	static IOReturn	sValidateTask 		( void * userClient, SCSITask * request, SCSITaskData * args, UInt32 argSize );
+	static IOReturn	sValidateTasks 		( void * userClient, SCSITaskBatchEntry * entries, UInt32 count );
 	static void 	sTaskCallback		( SCSITaskIdentifier completedTask );
+	static IOReturn	sCreateTaskRings	( void * userClient, OSAsyncReference asyncRef, IOBufferMemoryDescriptor * submissionRing, IOBufferMemoryDescriptor * completionRing );
+	static IOReturn	sDestroyTaskRings	( void * userClient );
+	static IOReturn	sClientMemoryForType ( void * userClient, UInt32 type, IOMemoryDescriptor ** memory );
+	static IOReturn	sConsumeRingSubmissions ( void * userClient, SCSITaskRingSubmission * entries, UInt32 * count );
+	static IOReturn	sPostRingCompletion	( void * userClient, SCSITaskRingCompletion * completion );
+	static IOReturn	sSetCompletionCoalescing ( void * userClient, UInt32 maxCompletions, UInt32 maxDelay );
+	static void		sCoalescingTimeout	( OSObject * owner, IOTimerEventSource * sender );
+	static IOReturn	sRegisterBuffer		( void * userClient, SCSITaskRegisteredBuffer * entry, UInt32 * bufferHandle );
+	static IOReturn	sUnregisterBuffer	( void * userClient, UInt32 bufferHandle, SCSITaskRegisteredBuffer * entry, bool defer );
+	static IOReturn	sReleaseRegisteredBuffer ( void * userClient, UInt32 bufferHandle, SCSITaskRegisteredBuffer * entry );
 	
 	virtual IOReturn GatedCreateTask 	( SCSITask * task, SInt32 * taskReference );
 	virtual IOReturn GatedReleaseTask 	( SInt32 taskReference, SCSITask ** task );
-	virtual IOReturn GatedWaitForTask 	( SCSITask * request );
 	virtual IOReturn GatedValidateTask 	( SCSITask * request, SCSITaskData * args, UInt32 argSize );
+	virtual IOReturn GatedValidateTasks ( SCSITaskBatchEntry * entries, UInt32 count );
 	virtual void	 TaskCallback		( SCSITask * task, SCSITaskRefCon * refCon );
+	virtual IOReturn GatedCreateTaskRings ( OSAsyncReference asyncRef, IOBufferMemoryDescriptor * submissionRing, IOBufferMemoryDescriptor * completionRing );
+	virtual IOReturn GatedDestroyTaskRings ( void );
+	virtual IOReturn GatedClientMemoryForType ( UInt32 type, IOMemoryDescriptor ** memory );
+	virtual IOReturn GatedConsumeRingSubmissions ( SCSITaskRingSubmission * entries, UInt32 * count );
+	virtual IOReturn GatedPostRingCompletion ( SCSITaskRingCompletion * completion );
+	virtual IOReturn GatedSetCompletionCoalescing ( UInt32 maxCompletions, UInt32 maxDelay );
+	virtual void	 GatedNotifyRingCompletions ( void );
+	virtual IOReturn GatedRegisterBuffer ( SCSITaskRegisteredBuffer * entry, UInt32 * bufferHandle );
+	virtual IOReturn GatedUnregisterBuffer ( UInt32 bufferHandle, SCSITaskRegisteredBuffer * entry, bool defer );
+	virtual IOReturn GatedReleaseRegisteredBuffer ( UInt32 bufferHandle, SCSITaskRegisteredBuffer * entry );
+	virtual IOReturn GatedUseRegisteredBuffer ( SCSITask * request, SCSITaskData * args );
 	
 	task_t								fTask;
 	IOService *							fProvider;
 	IOSCSIProtocolInterface *			fProtocolInterface;
-	SCSITask *							fArray[kMaxSCSITaskArraySize];
+	
+	// Task table. fFreeTaskSlot is the head of the free slot stack and
+	// fTaskTableSize the number of slots allocated so far.
+	SCSITaskTableEntry *				fTaskTable[kSCSITaskTableMaximumChunks];
+	UInt32								fTaskTableSize;
+	UInt32								fFreeTaskSlot;
+	UInt32								fMaximumTasks;
+	
 	IOCommandGate *						fCommandGate;
 	IOWorkLoop *						fWorkLoop;
-	UInt32								fOutstandingCommands;
+	
+	// Changed with OSIncrementAtomic ( ) and OSDecrementAtomic ( ) only,
+	// since completions update it outside the command gate.
+	volatile SInt32						fOutstandingCommands;
+	
+	// Synchronous waiters sleep on fCompletionLock once they stop
+	// spinning. fSyncLatency is a running average of synchronous waits,
+	// in nanoseconds, which sets how long the next waiter spins.
+	IOLock *							fCompletionLock;
+	UInt32								fSyncLatency;
+	
+	// Task rings, created on request by CreateTaskRings ( ). The head and
+	// tail the user client owns are kept here rather than trusted from the
+	// shared headers.
+	IOBufferMemoryDescriptor *			fSubmissionRingBuffer;
+	IOBufferMemoryDescriptor *			fCompletionRingBuffer;
+	SCSITaskRingHeader *				fSubmissionRing;
+	SCSITaskRingHeader *				fCompletionRing;
+	UInt32								fRingEntries;
+	UInt32								fSubmissionHead;
+	UInt32								fCompletionTail;
+	OSAsyncReference					fRingAsyncReference;
+	
+	// Completion coalescing, set by SetCompletionCoalescing ( ). Up to
+	// fCoalesceCompletions completions share one notification, and none
+	// waits longer than fCoalesceDelay microseconds for it.
+	IOTimerEventSource *				fCoalesceTimer;
+	UInt32								fCoalesceCompletions;
+	UInt32								fCoalesceDelay;
+	UInt32								fUnnotifiedCompletions;
+	bool								fCoalesceTimerArmed;
+	
+	// Buffers registered by RegisterBuffer ( ), indexed by handle - 1,
+	// and the bytes they keep wired.
+	SCSITaskRegisteredBuffer			fRegisteredBuffers[kMaxSCSITaskRegisteredBuffers];
+	UInt64								fWiredBytes;
 	
 	virtual IOExternalAsyncMethod *		getAsyncTargetAndMethodForIndex ( IOService ** target, UInt32 index );	
 	virtual IOExternalMethod *			getTargetAndMethodForIndex 		( IOService ** target, UInt32 index );
@@ -214,8 +408,23 @@ protected:
 	virtual IOReturn	SendCommand 	( SCSITask * request, void * senseBuffer, SCSITaskStatus * taskStatus );
 	
 	virtual IOReturn	SetupTask		( SCSITask ** task );
+	
+	SCSITaskTableEntry *	GetTaskTableEntry	( UInt32 index );
+	SCSITask *				GetTask				( SInt32 taskReference );
+	virtual IOReturn		GrowTaskTable		( void );
+	
 	virtual IOReturn	PrepareBuffers	( IOMemoryDescriptor ** buffer, void * userBuffer, IOByteCount bufferSize, IODirection direction );
 	virtual IOReturn	CompleteBuffers ( IOMemoryDescriptor * buffer );
+	virtual void		CompleteDataBuffer ( SCSITask * task, SCSITaskRefCon * refCon );
+	
+	virtual IOReturn	SubmitTask		( SCSITaskData * args, UInt32 argSize, UInt32 commandType, UInt64 userReference );
+	virtual IOReturn	PrepareTask		( SCSITaskData * args, UInt32 commandType, UInt64 userReference, SCSITask ** task );
+	virtual IOReturn	LaunchTask		( SCSITask * request, SCSITaskData * args );
+	virtual IOReturn	WaitForTask		( SCSITask * request );
+	virtual void		WaitForCompletion ( SCSITaskRefCon * refCon );
+	virtual void		SignalCompletion ( SCSITaskRefCon * refCon );
+	virtual void		SubmitRingTask	( SCSITaskRingSubmission * entry );
+	virtual void		PostRingCompletion ( UInt32 taskReference, UInt64 userReference, IOReturn status, SCSITask * task );
 	
 };
 
@@ -98,6 +98,36 @@ SCSITaskClass::sSCSITaskInterface =
 	&SCSITaskClass::sSetSenseDataBuffer
 };
 
+SCSITaskInterface2
+SCSITaskClass::sSCSITaskInterface2 =
+{
+    0,
+	&SCSITaskClass::sQueryInterface,
+	&SCSITaskClass::sAddRef,
+	&SCSITaskClass::sRelease,
+	2, 0, // version/revision
+	&SCSITaskClass::sIsTaskActive,
+	&SCSITaskClass::sSetTaskAttribute,
+	&SCSITaskClass::sGetTaskAttribute,
+	&SCSITaskClass::sSetCommandDescriptorBlock,
+	&SCSITaskClass::sGetCommandDescriptorBlockSize,
+	&SCSITaskClass::sGetCommandDescriptorBlock,
+	&SCSITaskClass::sSetScatterGatherEntries,
+	&SCSITaskClass::sSetTimeoutDuration,
+	&SCSITaskClass::sGetTimeoutDuration,
+	&SCSITaskClass::sSetTaskCompletionCallback,
+	&SCSITaskClass::sExecuteTaskAsync,
+	&SCSITaskClass::sExecuteTaskSync,
+	&SCSITaskClass::sAbortTask,
+	&SCSITaskClass::sGetServiceResponse,
+	&SCSITaskClass::sGetTaskState,
+	&SCSITaskClass::sGetTaskStatus,
+	&SCSITaskClass::sGetRealizedDataTransferCount,
+	&SCSITaskClass::sGetAutoSenseData,
+	&SCSITaskClass::sSetSenseDataBuffer,
+	&SCSITaskClass::sSetRegisteredBuffer
+};
+
 
 #if 0
 #pragma mark -
@@ -351,6 +381,10 @@ SCSITaskClass::SCSITaskClass ( void ) :
 	// Set the task reference to an invalid reference
 	fTaskArguments.taskReference = kSCSITaskNULLReference;
 	
+	// create version 2 interface map
+	fSCSITaskInterface2Map.pseudoVTable = ( IUnknownVTbl * ) &sSCSITaskInterface2;
+	fSCSITaskInterface2Map.obj			= this;
+	
 }
 
 
@@ -417,6 +451,14 @@ SCSITaskClass::QueryInterface ( REFIID iid, void ** ppv )
 		
     }
 	
+	else if ( CFEqual ( uuid, kIOSCSITaskInterfaceID2 ) )
+	{
+		
+		*ppv = &fSCSITaskInterface2Map;
+        AddRef ( );
+		
+	}
+	
     else
     {
 		
@@ -593,6 +635,45 @@ SCSITaskClass::SetScatterGatherEntries ( IOVirtualRange * inScatterGatherList,
 	fTaskArguments.scatterGatherEntries 	= inScatterGatherEntries;
 	fTaskArguments.requestedTransferCount 	= transferCount;
 	fTaskArguments.transferDirection		= transferDirection;
+	fTaskArguments.bufferHandle				= kSCSITaskNullBufferHandle;
+	fTaskArguments.bufferOffset				= 0;
+	
+	return status;
+	
+}
+
+
+//
+//	 SetRegisteredBuffer - Called to set the data buffer to part of a
+//							registered buffer.					[PROTECTED]
+//
+
+IOReturn
+SCSITaskClass::SetRegisteredBuffer ( UInt32 bufferHandle,
+									 UInt64 bufferOffset,
+									 UInt64 transferCount,
+									 UInt8 transferDirection )
+{
+	
+	IOReturn 		status 	= kIOReturnBadArgument;
+	
+	PRINT ( ( "SCSITaskClass : SetRegisteredBuffer\n" ) );
+	
+	require ( ( bufferHandle != kSCSITaskNullBufferHandle ), ErrorExit );
+	
+	// The kernel checks the range against the registered buffer.
+	fSGList 								= NULL;
+	fTaskArguments.scatterGatherEntries 	= 0;
+	fTaskArguments.requestedTransferCount 	= transferCount;
+	fTaskArguments.transferDirection		= transferDirection;
+	fTaskArguments.bufferHandle				= bufferHandle;
+	fTaskArguments.bufferOffset				= bufferOffset;
+	
+	status = kIOReturnSuccess;
+	
+	
+ErrorExit:
+	
 	
 	return status;
 	
@@ -670,8 +751,19 @@ SCSITaskClass::ExecuteTaskAsync ( void )
 	// Not synchronous.
 	fTaskArguments.isSync = false;
 	
-	// Call through to the helper function which does the real work.
-	status = ExecuteTask ( );
+	// Init the transfer count.
+	fTaskResults.realizedTransferCount 	= 0;
+	fTaskState							= kSCSITaskState_ENABLED;
+	
+	// If the device has task rings, post the task there. It is submitted
+	// with the rest of the batch on the next doorbell. Otherwise (no rings,
+	// ring full or the task can't be described by a ring entry) call through
+	// to the helper function which does the real work.
+	status = fSCSITaskDevice->PostTaskToRing ( this, &fTaskArguments, fSGList );
+	if ( status != kIOReturnSuccess )
+	{
+		status = ExecuteTask ( );
+	}
 	
 	
 Error_Exit:
@@ -915,6 +1007,71 @@ SCSITaskClass::TaskCompletion ( IOReturn result, void ** args, int numArgs )
 }
 
 
+//
+//	 RingTaskCompletion - 	Called by the device when the task's completion
+//							is drained from the completion ring.	[PUBLIC]
+//
+
+void
+SCSITaskClass::RingTaskCompletion ( SCSITaskRingCompletion * completion )
+{
+	
+	check ( completion );
+	
+	fTaskResults.serviceResponse		= completion->serviceResponse;
+	fTaskResults.taskStatus				= completion->taskStatus;
+	fTaskResults.realizedTransferCount	= completion->realizedTransferCount;
+	
+	TaskCompletion ( completion->status, NULL, 0 );
+	
+}
+
+
+//
+//	 CopyBatchArguments - 	Called by the device to add the task to a batch
+//							for ExecuteTasks. On entry *size is the room
+//							left in the batch; on return it is the room
+//							the task used.							[PUBLIC]
+//
+
+IOReturn
+SCSITaskClass::CopyBatchArguments ( SCSITaskData * args, UInt32 * size )
+{
+	
+	IOReturn	status 	= kIOReturnNotPermitted;
+	UInt32		needed	= 0;
+	
+	PRINT ( ( "SCSITaskClass : CopyBatchArguments\n" ) );
+	
+	// Same sanity checks as ExecuteTaskAsync.
+	require ( fAsyncPort != MACH_PORT_NULL, Error_Exit );
+	require_nonzero ( fCallbackFunction, Error_Exit );
+	
+	needed = SCSITaskBatchRecordSize ( fTaskArguments.scatterGatherEntries );
+	require_action ( ( needed <= *size ), Error_Exit, status = kIOReturnNoSpace );
+	
+	// Not synchronous.
+	fTaskArguments.isSync = false;
+	
+	// Init the transfer count.
+	fTaskResults.realizedTransferCount 	= 0;
+	fTaskState							= kSCSITaskState_ENABLED;
+	
+	memcpy ( args, &fTaskArguments, SCSITaskDataSize ( 0 ) );
+	memcpy ( &args->scatterGatherList[0], fSGList, fTaskArguments.scatterGatherEntries * sizeof ( IOVirtualRange ) );
+	
+	*size	= needed;
+	status	= kIOReturnSuccess;
+	
+	
+Error_Exit:
+	
+	
+	return status;
+	
+}
+
+
 //
 //	 ExecuteTask - Internal method called by ExecuteTaskSync and
 //					ExecuteTaskAsync which handles the user-kernel transition.
@@ -1366,6 +1523,28 @@ SCSITaskClass::sTaskCompletion ( 	void *		refcon,
 }
 
 
+//
+//	 sSetRegisteredBuffer - Static function for C->C++ glue
+//																	[PROTECTED]
+//
+
+IOReturn
+SCSITaskClass::sSetRegisteredBuffer ( 	void *	task,
+										UInt32	bufferHandle,
+										UInt64	bufferOffset,
+										UInt64	transferCount,
+										UInt8	transferDirection )
+{
+	
+	check ( task != NULL );
+	return getThis ( task )->SetRegisteredBuffer ( bufferHandle,
+												   bufferOffset,
+												   transferCount,
+												   transferDirection );
+	
+}
+
+
 //
 //	 sSetSenseDataBuffer - Static function for C->C++ glue
 //																	[PROTECTED]
@@ -62,10 +62,20 @@ class SCSITaskClass : public SCSITaskIUnknown
 											io_connect_t connection,
 											mach_port_t asyncPort );
 		
+		virtual void RingTaskCompletion ( SCSITaskRingCompletion * completion );
+		
+		virtual IOReturn CopyBatchArguments ( SCSITaskData * args, UInt32 * size );
+		
+		// Returns the object behind a SCSITaskInterface
+		static inline SCSITaskClass * GetTaskClass ( SCSITaskInterface ** task )
+			{ return getThis ( task ); };
+		
 	protected:
 		
 		static SCSITaskInterface	sSCSITaskInterface;
+		static SCSITaskInterface2	sSCSITaskInterface2;
 		struct InterfaceMap			fSCSITaskInterfaceMap;
+		struct InterfaceMap			fSCSITaskInterface2Map;
 		
 		SCSITaskDeviceClass *		fSCSITaskDevice;
 		io_connect_t				fConnection;	// connection to user client in kernel
@@ -104,6 +114,11 @@ class SCSITaskClass : public SCSITaskIUnknown
 		
 		virtual IOReturn	SetSenseDataBuffer ( void * buffer, UInt8 bufferSize );
 		
+		virtual IOReturn	SetRegisteredBuffer ( UInt32 bufferHandle,
+												  UInt64 bufferOffset,
+												  UInt64 transferCount,
+												  UInt8 transferDirection );
+		
 		virtual void 		SetTimeoutDuration ( UInt32 timeoutDurationMS );
 		
 		virtual UInt32 		GetTimeoutDuration ( void );
@@ -149,6 +164,11 @@ class SCSITaskClass : public SCSITaskIUnknown
 										   				UInt64				transferCount,
 										   				UInt8				transferDirection );
 		static IOReturn		sSetSenseDataBuffer ( void * task, SCSI_Sense_Data * buffer, UInt8 bufferSize );
+		static IOReturn		sSetRegisteredBuffer ( 	void *	task,
+													UInt32	bufferHandle,
+													UInt64	bufferOffset,
+													UInt64	transferCount,
+													UInt8	transferDirection );
 		static IOReturn 	sSetTimeoutDuration ( void * task, UInt32 timeoutDurationMS );
 		static UInt32 		sGetTimeoutDuration ( void * task );
 		static IOReturn		sSetTaskCompletionCallback (	void *						task,
@@ -38,6 +38,10 @@
 
 // C Library includes
 #include <string.h>
+#include <stdint.h>
+
+// Libkern includes
+#include <libkern/OSAtomic.h>
 
 // Since mach headers dont have C++ wrappers we have to
 // declare extern C before including them.
@@ -100,7 +104,29 @@ SCSITaskDeviceClass::sSCSITaskDeviceInterface =
 	&SCSITaskDeviceClass::sRemoveCallbackDispatcherFromRunLoop,
 	&SCSITaskDeviceClass::sObtainExclusiveAccess,
 	&SCSITaskDeviceClass::sReleaseExclusiveAccess,
+	&SCSITaskDeviceClass::sCreateSCSITask
+};
+
+SCSITaskDeviceInterface2
+SCSITaskDeviceClass::sSCSITaskDeviceInterface2 =
+{
+	0,
+	&SCSITaskDeviceClass::sQueryInterface,
+	&SCSITaskDeviceClass::sAddRef,
+	&SCSITaskDeviceClass::sRelease,
+	2, 0, // version/revision
+	&SCSITaskDeviceClass::sIsExclusiveAccessAvailable,
+	&SCSITaskDeviceClass::sAddCallbackDispatcherToRunLoop,
+	&SCSITaskDeviceClass::sRemoveCallbackDispatcherFromRunLoop,
+	&SCSITaskDeviceClass::sObtainExclusiveAccess,
+	&SCSITaskDeviceClass::sReleaseExclusiveAccess,
 	&SCSITaskDeviceClass::sCreateSCSITask,
+	&SCSITaskDeviceClass::sCreateTaskRings,
+	&SCSITaskDeviceClass::sSubmitPostedTasks,
+	&SCSITaskDeviceClass::sRegisterBuffer,
+	&SCSITaskDeviceClass::sUnregisterBuffer,
+	&SCSITaskDeviceClass::sExecuteTasks,
+	&SCSITaskDeviceClass::sSetCompletionCoalescing
 };
 
 
@@ -258,6 +284,11 @@ SCSITaskDeviceClass::SCSITaskDeviceClass ( void ) :
 	fCFRunLoopSource 			= 0;
 	fTaskSet					= 0;
 	
+	// Init task rings
+	fSubmissionRing				= NULL;
+	fCompletionRing				= NULL;
+	fRingEntries				= 0;
+	
 	// init user client connection
 	fConnection 				= MACH_PORT_NULL;
 	fService 					= MACH_PORT_NULL;
@@ -268,6 +299,9 @@ SCSITaskDeviceClass::SCSITaskDeviceClass ( void ) :
 	fSCSITaskDeviceInterfaceMap.pseudoVTable = ( IUnknownVTbl * ) &sSCSITaskDeviceInterface;
 	fSCSITaskDeviceInterfaceMap.obj 		 = this;
 	
+	fSCSITaskDeviceInterface2Map.pseudoVTable = ( IUnknownVTbl * ) &sSCSITaskDeviceInterface2;
+	fSCSITaskDeviceInterface2Map.obj 		  = this;
+	
 }
 
 
@@ -280,6 +314,9 @@ SCSITaskDeviceClass::~SCSITaskDeviceClass ( void )
 	
 	PRINT ( ( "SCSITaskDeviceClass : Destructor called\n" ) );
 	
+	// Unmap the task rings if Stop() didn't already.
+	DestroyTaskRings ( );
+	
 	if ( fAsyncPort != MACH_PORT_NULL )
 	{
 		
@@ -336,6 +373,14 @@ SCSITaskDeviceClass::QueryInterface ( REFIID iid, void ** ppv )
 		*ppv = &fSCSITaskDeviceInterfaceMap;
         AddRef ( );
 		
+    }
+	
+	else if ( CFEqual ( uuid, kIOSCSITaskDeviceInterfaceID2 ) ) 
+	{
+		
+		*ppv = &fSCSITaskDeviceInterface2Map;
+        AddRef ( );
+		
     }
 	
     else
@@ -452,6 +497,8 @@ SCSITaskDeviceClass::Stop ( void )
 		
 	}
 	
+	DestroyTaskRings ( );
+	
 	if ( fConnection != 0 )
 	{
 		
@@ -835,6 +882,525 @@ SCSITaskDeviceClass::RemoveTaskFromTaskSet ( SCSITaskInterface ** task )
 }
 
 
+//
+//	 CreateTaskRings - Called to create and map the task rings.	[PROTECTED]
+//
+
+IOReturn
+SCSITaskDeviceClass::CreateTaskRings ( UInt32 ringEntries )
+{
+	
+	IOReturn				status		= kIOReturnNoDevice;
+	io_async_ref_t 			asyncRef	= { 0 };
+	io_scalar_inband_t		params		= { 0 };
+	mach_msg_type_number_t	size		= 0;
+	vm_address_t			address		= 0;
+	vm_size_t				length		= 0;
+	
+	PRINT ( ( "SCSITaskDeviceClass : CreateTaskRings\n" ) );
+	
+	require_nonzero ( fConnection, Error_Exit );
+	require_action ( fHasExclusiveAccess, Error_Exit, status = kIOReturnExclusiveAccess );
+	require_action ( ( fSubmissionRing == NULL ), Error_Exit, status = kIOReturnBusy );
+	
+	// Ring completions are signalled on the async port, so the callback
+	// dispatcher must already be on a run loop.
+	require_action ( ( fAsyncPort != MACH_PORT_NULL ), Error_Exit, status = kIOReturnNotReady );
+	
+	params[0]	= ringEntries;
+	params[1]	= ( UInt32 ) ( IOAsyncCallback ) &SCSITaskDeviceClass::sRingCompletion;
+	params[2]	= ( UInt32 ) this;
+	
+	status = io_async_method_scalarI_scalarO ( 	fConnection,
+												fAsyncPort,
+												asyncRef,
+												1,
+												kSCSITaskUserClientCreateTaskRings,
+												params,
+												3,
+												NULL,
+												&size );
+	
+	PRINT ( ( "CreateTaskRings : status = 0x%08x\n", status ) );
+	require_success ( status, Error_Exit );
+	
+	status = IOConnectMapMemory ( fConnection,
+								  kSCSITaskUserClientSubmissionRing,
+								  mach_task_self ( ),
+								  &address,
+								  &length,
+								  kIOMapAnywhere );
+	require_success ( status, DestroyRings );
+	
+	fSubmissionRing = ( SCSITaskRingHeader * ) address;
+	
+	status = IOConnectMapMemory ( fConnection,
+								  kSCSITaskUserClientCompletionRing,
+								  mach_task_self ( ),
+								  &address,
+								  &length,
+								  kIOMapAnywhere );
+	require_success ( status, DestroyRings );
+	
+	fCompletionRing = ( SCSITaskRingHeader * ) address;
+	
+	// Only now can tasks be posted to the ring.
+	fRingEntries = ringEntries;
+	
+	return status;
+	
+	
+DestroyRings:
+	
+	
+	// Unmap whichever ring was mapped and have the user client free both,
+	// or no later call could create them again.
+	DestroyTaskRings ( );
+	( void ) IOConnectMethodScalarIScalarO ( fConnection,
+											 kSCSITaskUserClientDestroyTaskRings,
+											 0,
+											 0 );
+	
+	
+Error_Exit:
+	
+	
+	return status;
+	
+}
+
+
+//
+//	 SubmitPostedTasks - 	Called to ring the doorbell for every task
+//							posted to the submission ring.		[PROTECTED]
+//
+
+IOReturn
+SCSITaskDeviceClass::SubmitPostedTasks ( void )
+{
+	
+	IOReturn	status		= kIOReturnNotReady;
+	UInt32		consumed	= 0;
+	
+	PRINT ( ( "SCSITaskDeviceClass : SubmitPostedTasks\n" ) );
+	
+	require_nonzero ( fRingEntries, Error_Exit );
+	
+	status = IOConnectMethodScalarIScalarO ( fConnection,
+											 kSCSITaskUserClientRingDoorbell,
+											 0,
+											 1,
+											 &consumed );
+	
+	PRINT ( ( "SubmitPostedTasks : consumed = %ld, status = 0x%08x\n", consumed, status ) );
+	
+	
+Error_Exit:
+	
+	
+	return status;
+	
+}
+
+
+//
+//	 SetCompletionCoalescing - Called to let several ring completions
+//								share one notification.			[PROTECTED]
+//
+
+IOReturn
+SCSITaskDeviceClass::SetCompletionCoalescing ( UInt32 maxCompletions, UInt32 maxDelay )
+{
+	
+	IOReturn	status = kIOReturnNotReady;
+	
+	PRINT ( ( "SCSITaskDeviceClass : SetCompletionCoalescing\n" ) );
+	
+	require_nonzero ( fRingEntries, Error_Exit );
+	
+	status = IOConnectMethodScalarIScalarO ( fConnection,
+											 kSCSITaskUserClientSetCompletionCoalescing,
+											 2,
+											 0,
+											 maxCompletions,
+											 maxDelay );
+	
+	PRINT ( ( "SetCompletionCoalescing : status = 0x%08x\n", status ) );
+	
+	
+Error_Exit:
+	
+	
+	return status;
+	
+}
+
+
+//
+//	 PostTaskToRing - 	Called to post an asynchronous task to the submission
+//						ring. Returns kIOReturnUnsupported if there is no
+//						ring or the task can't be described by a ring
+//						entry, and kIOReturnNoSpace if the ring is full.
+//																	[PUBLIC]
+//
+
+IOReturn
+SCSITaskDeviceClass::PostTaskToRing ( SCSITaskClass *		task,
+									  SCSITaskData *		args,
+									  IOVirtualRange *		sgList )
+{
+	
+	IOReturn					status	= kIOReturnUnsupported;
+	SCSITaskRingSubmission *	entry	= NULL;
+	UInt32						tail	= 0;
+	
+	check ( task );
+	check ( args );
+	
+	require_nonzero_quiet ( fRingEntries, Error_Exit );
+	require_quiet ( ( args->scatterGatherEntries <= 1 ), Error_Exit );
+	
+	tail = fSubmissionRing->tail;
+	require_action_quiet ( ( ( tail - fSubmissionRing->head ) < fRingEntries ),
+						   Error_Exit,
+						   status = kIOReturnNoSpace );
+	
+	entry = &SCSITaskRingSubmissionEntries ( fSubmissionRing )[tail & ( fRingEntries - 1 )];
+	
+	entry->userReference			= ( UInt64 ) ( uintptr_t ) task;
+	entry->taskReference			= args->taskReference;
+	entry->taskAttribute			= args->taskAttribute;
+	entry->cdbSize					= args->cdbSize;
+	entry->transferDirection		= args->transferDirection;
+	entry->timeoutDuration			= args->timeoutDuration;
+	entry->requestedTransferCount	= args->requestedTransferCount;
+	entry->buffer.address			= 0;
+	entry->buffer.length			= 0;
+	entry->bufferHandle				= args->bufferHandle;
+	entry->bufferOffset				= args->bufferOffset;
+	
+	memcpy ( entry->cdbData, args->cdbData, sizeof ( SCSICommandDescriptorBlock ) );
+	
+	if ( args->scatterGatherEntries == 1 )
+	{
+		entry->buffer = sgList[0];
+	}
+	
+	// Make the entry visible before the tail which covers it.
+	OSMemoryBarrier ( );
+	fSubmissionRing->tail = tail + 1;
+	
+	status = kIOReturnSuccess;
+	
+	
+Error_Exit:
+	
+	
+	return status;
+	
+}
+
+
+//
+//	 RingCompletion - 	Called when the kernel has posted completions to the
+//						completion ring. Drains the ring and completes each
+//						task.										[PROTECTED]
+//
+
+void
+SCSITaskDeviceClass::RingCompletion ( IOReturn result )
+{
+	
+	SCSITaskRingCompletion	completion;
+	SCSITaskClass *			task	= NULL;
+	UInt32					head	= 0;
+	UInt32					tail	= 0;
+	
+	PRINT ( ( "SCSITaskDeviceClass : RingCompletion, result = 0x%08x\n", result ) );
+	
+	require_nonzero ( fRingEntries, Error_Exit );
+	
+	// Clear notificationPending before reading the tail, so anything the
+	// kernel posts after this point is signalled by a new notification.
+	fCompletionRing->notificationPending = 0;
+	OSMemoryBarrier ( );
+	
+	head = fCompletionRing->head;
+	tail = fCompletionRing->tail;
+	
+	// Don't read the entries before the tail which covers them.
+	OSMemoryBarrier ( );
+	
+	while ( head != tail )
+	{
+		
+		completion = SCSITaskRingCompletionEntries ( fCompletionRing )[head & ( fRingEntries - 1 )];
+		
+		// Give the slot back before calling out, since the callback may
+		// post the task again.
+		head++;
+		fCompletionRing->head = head;
+		
+		task = ( SCSITaskClass * ) ( uintptr_t ) completion.userReference;
+		if ( task != NULL )
+		{
+			task->RingTaskCompletion ( &completion );
+		}
+		
+	}
+	
+	// The kernel leaves submissions on the ring when the completion ring
+	// has no room to report them. Now that there's room, submit them.
+	if ( fSubmissionRing->head != fSubmissionRing->tail )
+	{
+		( void ) SubmitPostedTasks ( );
+	}
+	
+	
+Error_Exit:
+	
+	
+	return;
+	
+}
+
+
+//
+//	 RegisterBuffer - Called to wire a buffer for use by many tasks.
+//																	[PROTECTED]
+//
+
+IOReturn
+SCSITaskDeviceClass::RegisterBuffer ( void *		buffer,
+									  UInt32		bufferSize,
+									  UInt8			transferDirection,
+									  UInt32 *		bufferHandle )
+{
+	
+	IOReturn	status = kIOReturnNoDevice;
+	
+	PRINT ( ( "SCSITaskDeviceClass : RegisterBuffer\n" ) );
+	
+	require_nonzero ( fConnection, Error_Exit );
+	require_nonzero_action ( buffer, Error_Exit, status = kIOReturnBadArgument );
+	require_nonzero_action ( bufferHandle, Error_Exit, status = kIOReturnBadArgument );
+	
+	status = IOConnectMethodScalarIScalarO ( fConnection,
+											 kSCSITaskUserClientRegisterBuffer,
+											 3,
+											 1,
+											 ( UInt32 ) buffer,
+											 bufferSize,
+											 ( UInt32 ) transferDirection,
+											 bufferHandle );
+	
+	PRINT ( ( "RegisterBuffer : handle = %ld, status = 0x%08x\n", *bufferHandle, status ) );
+	
+	
+Error_Exit:
+	
+	
+	return status;
+	
+}
+
+
+//
+//	 UnregisterBuffer - Called to unwire a registered buffer.		[PROTECTED]
+//
+
+IOReturn
+SCSITaskDeviceClass::UnregisterBuffer ( UInt32 bufferHandle )
+{
+	
+	IOReturn	status = kIOReturnNoDevice;
+	
+	PRINT ( ( "SCSITaskDeviceClass : UnregisterBuffer\n" ) );
+	
+	require_nonzero ( fConnection, Error_Exit );
+	
+	status = IOConnectMethodScalarIScalarO ( fConnection,
+											 kSCSITaskUserClientUnregisterBuffer,
+											 1,
+											 0,
+											 bufferHandle );
+	
+	PRINT ( ( "UnregisterBuffer : status = 0x%08x\n", status ) );
+	
+	
+Error_Exit:
+	
+	
+	return status;
+	
+}
+
+
+//
+//	 ExecuteTasks - 	Called to execute several tasks asynchronously with
+//						as few user-kernel transitions as possible.
+//																	[PROTECTED]
+//
+
+IOReturn
+SCSITaskDeviceClass::ExecuteTasks ( SCSITaskInterface **	tasks[],
+									UInt32					taskCount,
+									IOReturn				results[] )
+{
+	
+	// UInt64 keeps the records in the batch 8-byte aligned.
+	UInt64					batchData[kSCSITaskBatchMaximumSize / sizeof ( UInt64 )];
+	IOReturn				batchResults[kSCSITaskBatchMaximumTasks];
+	UInt32					batchTasks[kSCSITaskBatchMaximumTasks];
+	SCSITaskBatchHeader *	header		= ( SCSITaskBatchHeader * ) batchData;
+	IOReturn				status		= kIOReturnNoDevice;
+	IOReturn				firstError	= kIOReturnSuccess;
+	UInt32					index		= 0;
+	
+	PRINT ( ( "SCSITaskDeviceClass : ExecuteTasks, taskCount = %ld\n", taskCount ) );
+	
+	require_nonzero ( fConnection, Error_Exit );
+	require_nonzero ( fTaskSet, Error_Exit );
+	require_nonzero_action ( tasks, Error_Exit, status = kIOReturnBadArgument );
+	require_nonzero_action ( results, Error_Exit, status = kIOReturnBadArgument );
+	
+	while ( index < taskCount )
+	{
+		
+		IOByteCount		size		= sizeof ( SCSITaskBatchHeader );
+		IOByteCount		outputSize	= 0;
+		
+		header->taskCount	= 0;
+		header->reserved	= 0;
+		
+		// Pack as many tasks as fit into one batch.
+		while ( ( index < taskCount ) && ( header->taskCount < kSCSITaskBatchMaximumTasks ) )
+		{
+			
+			UInt32		recordSize = 0;
+			
+			// Only tasks created by this device have references the user
+			// client can resolve.
+			if ( CFSetContainsValue ( fTaskSet, tasks[index] ) == false )
+			{
+				
+				results[index++] = kIOReturnBadArgument;
+				continue;
+				
+			}
+			
+			recordSize	= sizeof ( batchData ) - size;
+			status		= SCSITaskClass::GetTaskClass ( tasks[index] )->CopyBatchArguments (
+								( SCSITaskData * ) ( ( UInt8 * ) batchData + size ),
+								&recordSize );
+			
+			// A task which doesn't fit goes in the next batch, unless it
+			// doesn't fit in an empty one either.
+			if ( ( status == kIOReturnNoSpace ) && ( header->taskCount > 0 ) )
+				break;
+			
+			if ( status != kIOReturnSuccess )
+			{
+				
+				results[index++] = status;
+				continue;
+				
+			}
+			
+			batchTasks[header->taskCount++] = index++;
+			size += recordSize;
+			
+		}
+		
+		if ( header->taskCount == 0 )
+			continue;
+		
+		outputSize = header->taskCount * sizeof ( IOReturn );
+		
+		status = IOConnectMethodStructureIStructureO ( fConnection,
+													   kSCSITaskUserClientExecuteTasks,
+													   size,
+													   &outputSize,
+													   ( void * ) batchData,
+													   ( void * ) batchResults );
+		
+		PRINT ( ( "ExecuteTasks : batch of %ld, status = 0x%08x\n", header->taskCount, status ) );
+		
+		for ( UInt32 task = 0; task < header->taskCount; task++ )
+		{
+			results[batchTasks[task]] = ( status == kIOReturnSuccess ) ? batchResults[task] : status;
+		}
+		
+	}
+	
+	for ( index = 0; index < taskCount; index++ )
+	{
+		
+		if ( results[index] != kIOReturnSuccess )
+		{
+			
+			firstError = results[index];
+			break;
+			
+		}
+		
+	}
+	
+	status = firstError;
+	
+	
+Error_Exit:
+	
+	
+	return status;
+	
+}
+
+
+//
+//	 DestroyTaskRings - Called to unmap the task rings.			[PROTECTED]
+//
+
+void
+SCSITaskDeviceClass::DestroyTaskRings ( void )
+{
+	
+	PRINT ( ( "SCSITaskDeviceClass : DestroyTaskRings\n" ) );
+	
+	fRingEntries = 0;
+	
+	require_nonzero_quiet ( fConnection, Error_Exit );
+	
+	if ( fSubmissionRing != NULL )
+	{
+		
+		IOConnectUnmapMemory ( fConnection,
+							   kSCSITaskUserClientSubmissionRing,
+							   mach_task_self ( ),
+							   ( vm_address_t ) fSubmissionRing );
+		
+	}
+	
+	if ( fCompletionRing != NULL )
+	{
+		
+		IOConnectUnmapMemory ( fConnection,
+							   kSCSITaskUserClientCompletionRing,
+							   mach_task_self ( ),
+							   ( vm_address_t ) fCompletionRing );
+		
+	}
+	
+	
+Error_Exit:
+	
+	
+	fSubmissionRing = NULL;
+	fCompletionRing = NULL;
+	
+}
+
+
 #if 0
 #pragma mark -
 #pragma mark Static C->C++ Glue Functions
@@ -1043,4 +1609,121 @@ SCSITaskDeviceClass::sCreateSCSITask ( void * self )
 	check ( self );
 	return getThis ( self )->CreateSCSITask ( );
 	
+}
+
+
+//
+//	 sCreateTaskRings - Static function for C->C++ glue
+//																	[PROTECTED]
+//
+
+IOReturn
+SCSITaskDeviceClass::sCreateTaskRings ( void * self, UInt32 ringEntries )
+{
+	
+	check ( self );
+	return getThis ( self )->CreateTaskRings ( ringEntries );
+	
+}
+
+
+//
+//	 sSubmitPostedTasks - Static function for C->C++ glue
+//																	[PROTECTED]
+//
+
+IOReturn
+SCSITaskDeviceClass::sSubmitPostedTasks ( void * self )
+{
+	
+	check ( self );
+	return getThis ( self )->SubmitPostedTasks ( );
+	
+}
+
+
+//
+//	 sRingCompletion - Static function for C->C++ glue
+//																	[PROTECTED]
+//
+
+void
+SCSITaskDeviceClass::sRingCompletion ( 	void *		refcon,
+										IOReturn	result,
+										void **		args,
+										int			numArgs )
+{
+	
+	check ( refcon != NULL );
+	( ( SCSITaskDeviceClass * ) refcon )->RingCompletion ( result );
+	
+}
+
+
+//
+//	 sRegisterBuffer - Static function for C->C++ glue
+//																	[PROTECTED]
+//
+
+IOReturn
+SCSITaskDeviceClass::sRegisterBuffer ( 	void *		self,
+										void *		buffer,
+										UInt32		bufferSize,
+										UInt8		transferDirection,
+										UInt32 *	bufferHandle )
+{
+	
+	check ( self );
+	return getThis ( self )->RegisterBuffer ( buffer, bufferSize, transferDirection, bufferHandle );
+	
+}
+
+
+//
+//	 sUnregisterBuffer - Static function for C->C++ glue
+//																	[PROTECTED]
+//
+
+IOReturn
+SCSITaskDeviceClass::sUnregisterBuffer ( void * self, UInt32 bufferHandle )
+{
+	
+	check ( self );
+	return getThis ( self )->UnregisterBuffer ( bufferHandle );
+	
+}
+
+
+//
+//	 sExecuteTasks - Static function for C->C++ glue
+//																	[PROTECTED]
+//
+
+IOReturn
+SCSITaskDeviceClass::sExecuteTasks ( void *					self,
+									 SCSITaskInterface **	tasks[],
+									 UInt32					taskCount,
+									 IOReturn				results[] )
+{
+	
+	check ( self );
+	return getThis ( self )->ExecuteTasks ( tasks, taskCount, results );
+	
+}
+
+
+//
+//	 sSetCompletionCoalescing - Static function for C->C++ glue
+//																	[PROTECTED]
+//
+
+IOReturn
+SCSITaskDeviceClass::sSetCompletionCoalescing ( void *	self,
+												UInt32	maxCompletions,
+												UInt32	maxDelay )
+{
+	
+	check ( self );
+	return getThis ( self )->SetCompletionCoalescing ( maxCompletions, maxDelay );
+	
 }
\ No newline at end of file
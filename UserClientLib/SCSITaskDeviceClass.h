@@ -49,6 +49,9 @@ struct MyConnectionAndPortContext
 };
 typedef struct MyConnectionAndPortContext MyConnectionAndPortContext;
 
+// Forward class declaration
+class SCSITaskClass;
+
 
 //
 //	Class Declarations
@@ -69,6 +72,12 @@ class SCSITaskDeviceClass : public SCSITaskIUnknown
 		// when it is released to remove it from the device's taskSet
 		virtual void RemoveTaskFromTaskSet ( SCSITaskInterface ** task );
 		
+		// This is an internal method which SCSITaskInterface calls to post
+		// an asynchronous task to the submission ring, if there is one.
+		virtual IOReturn PostTaskToRing ( SCSITaskClass *	task,
+										  SCSITaskData *	args,
+										  IOVirtualRange *	sgList );
+		
 		// Static allocation methods
 		static IOCFPlugInInterface ** 		alloc ( void );
 		static SCSITaskDeviceInterface ** 	alloc ( io_service_t service,
@@ -83,7 +92,9 @@ class SCSITaskDeviceClass : public SCSITaskIUnknown
 		
 		static IOCFPlugInInterface				sIOCFPlugInInterface;
 		static SCSITaskDeviceInterface			sSCSITaskDeviceInterface;
+		static SCSITaskDeviceInterface2			sSCSITaskDeviceInterface2;
 		struct InterfaceMap						fSCSITaskDeviceInterfaceMap;
+		struct InterfaceMap						fSCSITaskDeviceInterface2Map;
 		
 		io_service_t 			fService;
 		io_connect_t 			fConnection;
@@ -95,6 +106,10 @@ class SCSITaskDeviceClass : public SCSITaskIUnknown
 		CFRunLoopSourceRef		fCFRunLoopSource;
 		CFRunLoopRef			fCFRunLoop;
 		
+		SCSITaskRingHeader *	fSubmissionRing;
+		SCSITaskRingHeader *	fCompletionRing;
+		UInt32					fRingEntries;
+		
 		// utility function to get "this" pointer from interface
 		static inline SCSITaskDeviceClass * getThis ( void * self )
 			{ return ( SCSITaskDeviceClass * ) ( ( InterfaceMap * ) self )->obj; };
@@ -120,6 +135,27 @@ class SCSITaskDeviceClass : public SCSITaskIUnknown
 		
 		virtual SCSITaskInterface ** 	CreateSCSITask ( void );
 		
+		virtual IOReturn	CreateTaskRings ( UInt32 ringEntries );
+		
+		virtual IOReturn	SubmitPostedTasks ( void );
+		
+		virtual void		DestroyTaskRings ( void );
+		
+		virtual void		RingCompletion ( IOReturn result );
+		
+		virtual IOReturn	SetCompletionCoalescing ( UInt32 maxCompletions, UInt32 maxDelay );
+		
+		virtual IOReturn	RegisterBuffer ( void * buffer,
+											 UInt32 bufferSize,
+											 UInt8 transferDirection,
+											 UInt32 * bufferHandle );
+		
+		virtual IOReturn	UnregisterBuffer ( UInt32 bufferHandle );
+		
+		virtual IOReturn	ExecuteTasks ( SCSITaskInterface ** tasks[],
+										   UInt32 taskCount,
+										   IOReturn results[] );
+		
 		// New functions we havent exported yet...
 		virtual IOReturn			CreateDeviceAsyncEventSource ( CFRunLoopSourceRef * source );
 		
@@ -143,6 +179,13 @@ class SCSITaskDeviceClass : public SCSITaskIUnknown
 		static IOReturn				sObtainExclusiveAccess ( void * self );
 		static IOReturn				sReleaseExclusiveAccess ( void * self );
 		static SCSITaskInterface **	sCreateSCSITask ( void * self );
+		static IOReturn				sCreateTaskRings ( void * self, UInt32 ringEntries );
+		static IOReturn				sSubmitPostedTasks ( void * self );
+		static void					sRingCompletion ( void * refcon, IOReturn result, void ** args, int numArgs );
+		static IOReturn				sRegisterBuffer ( void * self, void * buffer, UInt32 bufferSize, UInt8 transferDirection, UInt32 * bufferHandle );
+		static IOReturn				sUnregisterBuffer ( void * self, UInt32 bufferHandle );
+		static IOReturn				sExecuteTasks ( void * self, SCSITaskInterface ** tasks[], UInt32 taskCount, IOReturn results[] );
+		static IOReturn				sSetCompletionCoalescing ( void * self, UInt32 maxCompletions, UInt32 maxDelay );
 
 	private:
 		
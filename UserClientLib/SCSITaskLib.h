@@ -93,6 +93,25 @@ devices such as CD-R/W and DVD-R/W drives.
 										0x1B, 0xBC, 0x41, 0x32, 0x08, 0xA5, 0x11, 0xD5,		\
 										0x90, 0xED, 0x00, 0x30, 0x65, 0x7D, 0x05, 0x2A)
 
+
+// 834D6B63-2858-4A63-BE95-0C57D5152076
+/*! @defined kIOSCSITaskInterfaceID2
+    @discussion InterfaceID for SCSITaskInterface2. */
+#define kIOSCSITaskInterfaceID2 															\
+                                        CFUUIDGetConstantUUIDWithBytes(NULL,				\
+										0x83, 0x4D, 0x6B, 0x63, 0x28, 0x58, 0x4A, 0x63,		\
+										0xBE, 0x95, 0x0C, 0x57, 0xD5, 0x15, 0x20, 0x76)
+
+
+// C311DB2E-367D-4CBB-BDAD-94C62321E89B
+/*! @defined kIOSCSITaskDeviceInterfaceID2
+    @discussion InterfaceID for SCSITaskDeviceInterface2. */
+#define kIOSCSITaskDeviceInterfaceID2 														\
+                                        CFUUIDGetConstantUUIDWithBytes(NULL,				\
+										0xC3, 0x11, 0xDB, 0x2E, 0x36, 0x7D, 0x4C, 0xBB,		\
+										0xBD, 0xAD, 0x94, 0xC6, 0x23, 0x21, 0xE8, 0x9B)
+
+
 // 1F651106-23CC-11D5-BBDB-003065704866
 /*! @defined kIOMMCDeviceInterfaceID
     @discussion InterfaceID for MMCDeviceInterface. */
@@ -441,6 +460,102 @@ typedef struct SCSITaskInterface
 } SCSITaskInterface;
 
 
+/*! 
+	@struct SCSITaskInterface2
+    @abstract Version 2 of the interface for sending raw SCSITasks.
+    @discussion SCSITaskInterface with the methods for transferring into buffers
+    registered with SCSITaskDeviceInterface2 added at the end. Obtain it by calling
+    QueryInterface on a SCSITaskInterface with kIOSCSITaskInterfaceID2. The methods
+    shared with SCSITaskInterface are declared in the same order and behave the same.
+*/
+
+typedef struct SCSITaskInterface2
+{
+	IUNKNOWN_C_GUTS;
+	
+	UInt16	version;
+	UInt16	revision;
+	
+	// Same as SCSITaskInterface.
+	
+	Boolean	( *IsTaskActive ) ( void * task );
+	
+	IOReturn	( *SetTaskAttribute ) ( void * task, SCSITaskAttribute inAttribute );
+	
+	IOReturn	( *GetTaskAttribute ) ( void * task, SCSITaskAttribute * outAttribute );
+	
+	IOReturn	( *SetCommandDescriptorBlock ) ( void * task, UInt8 * inCDB, UInt8 inSize );
+	
+	UInt8	( *GetCommandDescriptorBlockSize ) ( void * task );
+	
+	IOReturn	( *GetCommandDescriptorBlock ) ( void * task, UInt8 * outCDB );
+	
+	IOReturn	( *SetScatterGatherEntries ) ( void * 			task,
+											   IOVirtualRange * inScatterGatherList,
+											   UInt8 			inScatterGatherEntries,
+											   UInt64			inTransferCount,
+											   UInt8			inTransferDirection );
+	
+	IOReturn	( *SetTimeoutDuration ) ( void * task, UInt32 inTimeoutDurationMS );
+	
+	UInt32	( *GetTimeoutDuration ) ( void * task );
+	
+	IOReturn	( *SetTaskCompletionCallback ) ( void *						task,
+												 SCSITaskCallbackFunction	callback,
+												 void *						refCon );
+	
+	IOReturn	( *ExecuteTaskAsync ) ( void * task );
+	
+	IOReturn	( *ExecuteTaskSync ) ( void *				task,
+									   SCSI_Sense_Data *	senseDataBuffer,
+									   SCSITaskStatus *		outStatus,
+									   UInt64 *				realizedTransferCount );
+	
+	IOReturn	( *AbortTask ) ( void * task );
+	
+	IOReturn	( *GetSCSIServiceResponse ) ( void * 				task,
+											  SCSIServiceResponse * outServiceResponse );
+	
+	IOReturn	( *GetTaskState ) ( void * task, SCSITaskState * outState );
+	
+	IOReturn	( *GetTaskStatus ) ( void * task, SCSITaskStatus * outStatus );
+	
+	UInt64	( *GetRealizedDataTransferCount ) ( void * task );
+	
+	IOReturn	( *GetAutoSenseData ) ( void * task, SCSI_Sense_Data * senseDataBuffer );
+	
+	/* Added in 10.2 */
+	IOReturn	( *SetAutoSenseDataBuffer ) ( void *			task,
+											  SCSI_Sense_Data * senseDataBuffer,
+											  UInt8				senseDataLength );
+	
+	/*! @function SetRegisteredBuffer
+    @abstract Method to set the task's data buffer to part of a registered buffer.
+    @discussion This method can be used instead of SetScatterGatherEntries to have the
+    SCSITask transfer into a buffer registered with the RegisterBuffer method of the
+    SCSITaskDeviceInterface2. The buffer is already wired, so executing the task does not
+    need to wire it again. Calling SetScatterGatherEntries afterwards replaces the
+    registered buffer.
+    @param task Pointer to an instance of an SCSITaskInterface2.
+	@param inBufferHandle Handle returned by RegisterBuffer.
+	@param inBufferOffset Offset in bytes into the registered buffer at which the
+	transfer starts.
+	@param inTransferCount The amount of data to transfer. inBufferOffset plus
+	inTransferCount must not exceed the length of the registered buffer.
+	@param inTransferDirection The transfer direction as defined in SCSITask.h. It must
+	match the direction the buffer was registered with.
+    @result Returns kIOReturnSuccess or kIOReturnBadArgument.
+	*/
+	
+	IOReturn	( *SetRegisteredBuffer ) ( void *	task,
+										   UInt32	inBufferHandle,
+										   UInt64	inBufferOffset,
+										   UInt64	inTransferCount,
+										   UInt8	inTransferDirection );
+	
+} SCSITaskInterface2;
+
+
 // Interface for talking to a device which allows raw
 // SCSITask access. Use this interface to create tasks, release tasks,
 // get exclusive access to the device, create ports for async notifications, etc.
@@ -543,6 +658,146 @@ typedef struct SCSITaskDeviceInterface
 } SCSITaskDeviceInterface;
 
 
+/*! 
+	@struct SCSITaskDeviceInterface2
+    @abstract Version 2 of the basic interface for a SCSITask Device.
+    @discussion SCSITaskDeviceInterface with the methods for shared task rings,
+    registered buffers and batched execution added at the end. Obtain it by calling
+    QueryInterface on a SCSITaskDeviceInterface with kIOSCSITaskDeviceInterfaceID2. The
+    methods shared with SCSITaskDeviceInterface are declared in the same order and
+    behave the same.
+*/
+
+typedef struct SCSITaskDeviceInterface2
+{
+	IUNKNOWN_C_GUTS;
+
+	UInt16	version;
+	UInt16	revision;
+	
+	// Same as SCSITaskDeviceInterface.
+	
+	Boolean ( *IsExclusiveAccessAvailable ) ( void * self );
+	
+	IOReturn ( *AddCallbackDispatcherToRunLoop ) ( void * self, CFRunLoopRef cfRunLoopRef );
+	
+	void ( *RemoveCallbackDispatcherFromRunLoop ) ( void * self );
+	
+	IOReturn ( *ObtainExclusiveAccess ) ( void * self );
+	
+	IOReturn ( *ReleaseExclusiveAccess ) ( void * self );
+	
+	SCSITaskInterface ** ( *CreateSCSITask )( void * self );
+	
+	/*! @function CreateTaskRings
+    @abstract Method to set up shared submission and completion rings for
+    asynchronous SCSITasks.
+    @discussion Once a client has exclusive access and has called
+    AddCallbackDispatcherToRunLoop, it may ask for a submission ring and a completion
+    ring shared with the kernel. From then on, ExecuteTaskAsync posts tasks created by
+    this interface to the submission ring instead of sending each one to the kernel.
+    Posted tasks are sent to the device by SubmitPostedTasks. Their completions are
+    posted to the completion ring, and one notification on the CFRunLoop covers every
+    completion posted since the last one. Tasks with more than one scatter-gather entry,
+    or executed while the submission ring is full, are sent to the device right away.
+    Tasks must be posted from the thread running the CFRunLoop.
+	@param self Pointer to a SCSITaskDeviceInterface2 instance.
+	@param ringEntries Number of entries in each ring. Must be a power of two from 2
+	to 1024.
+	@result Returns kIOReturnSuccess if the rings were created, kIOReturnNotReady if
+	AddCallbackDispatcherToRunLoop has not been called, kIOReturnBusy if the rings
+	already exist, or kIOReturnBadArgument if ringEntries is invalid.
+	*/
+	
+	IOReturn ( *CreateTaskRings )( void * self, UInt32 ringEntries );
+	
+	/*! @function SubmitPostedTasks
+    @abstract Method to send every task posted to the submission ring to the device.
+    @discussion Rings the doorbell for all tasks posted by ExecuteTaskAsync since the
+    last call, with a single transition into the kernel.
+	@param self Pointer to a SCSITaskDeviceInterface2 instance.
+	@result Returns kIOReturnSuccess if successful, or kIOReturnNotReady if
+	CreateTaskRings has not been called.
+	*/
+	
+	IOReturn ( *SubmitPostedTasks )( void * self );
+	
+	/*! @function RegisterBuffer
+    @abstract Method to wire a buffer once for use by many SCSITasks.
+    @discussion Wires the buffer into memory and returns a handle for it. SCSITasks
+    given the handle with SetRegisteredBuffer transfer into the buffer without wiring
+    it on each execution, which saves most of the cost of repeated I/O into the same
+    memory. The buffer stays wired until it is unregistered or the device interface
+    is closed. The memory a client may keep wired this way is limited.
+	@param self Pointer to a SCSITaskDeviceInterface2 instance.
+	@param buffer Pointer to the buffer.
+	@param bufferSize Length of the buffer in bytes.
+	@param transferDirection Direction of the transfers the buffer is used for, either
+	kSCSIDataTransfer_FromTargetToInitiator or kSCSIDataTransfer_FromInitiatorToTarget.
+	@param outBufferHandle Pointer to the handle for the buffer.
+	@result Returns kIOReturnSuccess if the buffer was registered, kIOReturnNoResources
+	if the client has too many buffers registered or too much memory wired, or
+	kIOReturnBadArgument.
+	*/
+	
+	IOReturn ( *RegisterBuffer )( void *		self,
+								   void *		buffer,
+								   UInt32		bufferSize,
+								   UInt8		transferDirection,
+								   UInt32 *		outBufferHandle );
+	
+	/*! @function UnregisterBuffer
+    @abstract Method to unwire a buffer registered with RegisterBuffer.
+	@param self Pointer to a SCSITaskDeviceInterface2 instance.
+	@param bufferHandle Handle returned by RegisterBuffer.
+	@result Returns kIOReturnSuccess if the buffer was unregistered, kIOReturnBusy if a
+	SCSITask using it has not completed, or kIOReturnBadArgument.
+	*/
+	
+	IOReturn ( *UnregisterBuffer )( void * self, UInt32 bufferHandle );
+	
+	/*! @function ExecuteTasks
+    @abstract Method to execute several SCSITasks asynchronously at once.
+    @discussion Sends a set of SCSITasks created by this interface to the device with
+    as few transitions into the kernel as their size allows. Each task is executed as
+    if ExecuteTaskAsync had been called on it, and calls its completion callback when
+    it completes. A task which could not be sent has its status set in the results
+    array and does not call its callback.
+	@param self Pointer to a SCSITaskDeviceInterface2 instance.
+	@param tasks Array of taskCount pointers to SCSITaskInterface instances.
+	@param taskCount Number of tasks in the array.
+	@param results Array of taskCount IOReturn values, one for each task.
+	@result Returns kIOReturnSuccess if every task was sent to the device, or the
+	status of the first task which was not.
+	*/
+	
+	IOReturn ( *ExecuteTasks )( void *					self,
+								 SCSITaskInterface **	tasks[],
+								 UInt32					taskCount,
+								 IOReturn				results[] );
+	
+	/*! @function SetCompletionCoalescing
+    @abstract Method to let several task completions share one notification.
+    @discussion Once CreateTaskRings has been called, each completion posted to the
+    completion ring normally notifies the CFRunLoop right away. With coalescing on, the
+    notification is held back until maxCompletions completions are waiting or the first
+    of them has waited maxDelay microseconds, whichever comes first. It is never held
+    back when no other task posted to the ring is still in flight, so a client issuing
+    one task at a time sees no added latency.
+	@param self Pointer to a SCSITaskDeviceInterface2 instance.
+	@param maxCompletions Most completions to deliver with one notification. 0 or 1
+	turns coalescing off.
+	@param maxDelay Longest a completion may wait, in microseconds. Must be no more
+	than 1000.
+	@result Returns kIOReturnSuccess if successful, kIOReturnNotReady if
+	CreateTaskRings has not been called, or kIOReturnBadArgument.
+	*/
+	
+	IOReturn ( *SetCompletionCoalescing )( void * self, UInt32 maxCompletions, UInt32 maxDelay );
+	
+} SCSITaskDeviceInterface2;
+
+
 /*! 
 	@struct MMCDeviceInterface
     @abstract Basic interface for an MMC-2 Compliant Device.  
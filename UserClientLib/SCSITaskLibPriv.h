@@ -44,6 +44,11 @@ extern "C" {
 
 #define	kSCSITaskUserClientIniterKey	"SCSITaskUserClientIniter"
 
+// Most tasks one client may have created at once. The user client publishes
+// the limit it enforces under this key, and takes its value from the same
+// key on its provider if the provider has one.
+#define	kSCSITaskUserClientMaximumTasksKey	"SCSITaskUserClientMaximumTasks"
+
 enum
 {
 	kIOSCSITaskUserClientAccessBit		= 16,
@@ -81,6 +86,17 @@ enum
 	kMMCDeviceReadDVDStructure						= 19,	// kIOUCStructIStructO, sizeof ( AppleReadDVDStructureStruct ), sizeof ( SCSITaskStatus )
 	kMMCDeviceSetCDSpeed							= 20,	// kIOUCStructIStructO, sizeof ( AppleSetCDSpeedStruct ), sizeof ( SCSITaskStatus )
 	kMMCDeviceReadFormatCapacities					= 21,	// kIOUCStructIStructO, sizeof ( AppleReadFormatCapacitiesStruct ), sizeof ( SCSITaskStatus )
+	// Task rings
+	kSCSITaskUserClientRingDoorbell					= 22,	// kIOUCScalarIScalarO, 0, 1
+	// Registered buffers
+	kSCSITaskUserClientRegisterBuffer				= 23,	// kIOUCScalarIScalarO, 3, 1
+	kSCSITaskUserClientUnregisterBuffer				= 24,	// kIOUCScalarIScalarO, 1, 0
+	// Batched submission
+	kSCSITaskUserClientExecuteTasks					= 25,	// kIOUCStructIStructO, 0xFFFFFFFF, 0xFFFFFFFF
+	// Completion coalescing
+	kSCSITaskUserClientSetCompletionCoalescing		= 26,	// kIOUCScalarIScalarO, 2, 0
+	// Task rings
+	kSCSITaskUserClientDestroyTaskRings				= 27,	// kIOUCScalarIScalarO, 0, 0
 	
 	kSCSITaskUserClientMethodCount
 };
@@ -88,9 +104,50 @@ enum
 enum
 {
 	kSCSITaskUserClientSetAsyncCallback				= 0,	// kIOUCScalarIScalarO, 2, 0
+	kSCSITaskUserClientCreateTaskRings				= 1,	// kIOUCScalarIScalarO, 3, 0
 	kSCSITaskUserClientAsyncMethodCount
 };
 
+// Memory types for IOConnectMapMemory ( ). Both rings are created by
+// kSCSITaskUserClientCreateTaskRings and shared between the library and
+// the user client until kSCSITaskUserClientDestroyTaskRings or until the
+// connection is closed.
+enum
+{
+	kSCSITaskUserClientSubmissionRing				= 0,
+	kSCSITaskUserClientCompletionRing				= 1
+};
+
+// Ring sizes are a power of two so indices can be masked. A ring never
+// needs more entries than the user client can have tasks.
+enum
+{
+	kSCSITaskRingMinimumEntries						= 2,
+	kSCSITaskRingMaximumEntries						= 1024
+};
+
+// Longest a completion may wait on the completion ring for others to
+// share its notification, in microseconds.
+enum
+{
+	kSCSITaskCoalescingMaximumDelay					= 1000
+};
+
+// Handle returned by kSCSITaskUserClientRegisterBuffer. A task whose
+// bufferHandle is kSCSITaskNullBufferHandle uses its scatter-gather list.
+enum
+{
+	kSCSITaskNullBufferHandle						= 0
+};
+
+// A kSCSITaskUserClientExecuteTasks batch is passed inband, so it is
+// limited to one structure's worth of tasks.
+enum
+{
+	kSCSITaskBatchMaximumSize						= 4096,
+	kSCSITaskBatchMaximumTasks						= 32
+};
+
 
 #pragma mark -
 #pragma mark Exclusive Command Structures
@@ -111,6 +168,8 @@ struct SCSITaskData
 	UInt64							requestedTransferCount;
 	UInt8							transferDirection;
 	UInt32							timeoutDuration;
+	UInt32							bufferHandle;
+	UInt64							bufferOffset;
 	UInt32							scatterGatherEntries;
 	IOVirtualRange					scatterGatherList[1];
 };
@@ -126,6 +185,90 @@ struct SCSITaskResults
 typedef struct SCSITaskResults SCSITaskResults;
 
 
+// kSCSITaskUserClientExecuteTasks takes a SCSITaskBatchHeader followed by
+// taskCount SCSITaskData records packed back to back. Each record is
+// SCSITaskBatchRecordSize ( scatterGatherEntries ) bytes long, so the next
+// one starts 8-byte aligned. The output is one IOReturn per task, in the
+// order the tasks appear in the batch.
+struct SCSITaskBatchHeader
+{
+	UInt32							taskCount;
+	UInt32							reserved;
+};
+typedef struct SCSITaskBatchHeader SCSITaskBatchHeader;
+
+
+#define SCSITaskDataSize(entries)			( sizeof ( SCSITaskData ) - sizeof ( IOVirtualRange ) + ( entries ) * sizeof ( IOVirtualRange ) )
+#define SCSITaskBatchRecordSize(entries)	( ( SCSITaskDataSize ( entries ) + 7 ) & ~7 )
+
+
+#pragma mark -
+#pragma mark Task Ring Structures
+#pragma mark -
+
+
+//
+//	Task Ring Structures
+//
+
+// Each ring is a header followed by ringEntries fixed-size entries. The
+// producer writes an entry, then advances tail; the consumer reads an entry,
+// then advances head. Both counters run free and are masked with
+// ( entries - 1 ) to index the ring. The library produces submissions and
+// consumes completions; the user client does the opposite.
+//
+// notificationPending is set by the user client when it sends a completion
+// notification and cleared by the library before it drains the completion
+// ring, so one notification covers every completion posted in between.
+
+struct SCSITaskRingHeader
+{
+	volatile UInt32					head;
+	volatile UInt32					tail;
+	UInt32							entries;
+	volatile UInt32					notificationPending;
+};
+typedef struct SCSITaskRingHeader SCSITaskRingHeader;
+
+
+// Tasks with more than one scatter-gather entry can't be posted to the
+// ring and go through kSCSITaskUserClientExecuteTask instead. A task using
+// a registered buffer describes it with bufferHandle and bufferOffset, and
+// leaves buffer empty. The userReference is returned untouched in the
+// task's completion.
+struct SCSITaskRingSubmission
+{
+	UInt64							userReference;
+	UInt32							taskReference;
+	SCSITaskAttribute				taskAttribute;
+	SCSICommandDescriptorBlock		cdbData;
+	UInt8							cdbSize;
+	UInt8							transferDirection;
+	UInt32							timeoutDuration;
+	UInt64							requestedTransferCount;
+	IOVirtualRange					buffer;
+	UInt32							bufferHandle;
+	UInt64							bufferOffset;
+};
+typedef struct SCSITaskRingSubmission SCSITaskRingSubmission;
+
+
+struct SCSITaskRingCompletion
+{
+	UInt64							userReference;
+	UInt32							taskReference;
+	IOReturn						status;
+	SCSIServiceResponse				serviceResponse;
+	SCSITaskStatus					taskStatus;
+	UInt64							realizedTransferCount;
+};
+typedef struct SCSITaskRingCompletion SCSITaskRingCompletion;
+
+
+#define SCSITaskRingSubmissionEntries(ring)		( ( SCSITaskRingSubmission * ) ( ( SCSITaskRingHeader * ) ( ring ) + 1 ) )
+#define SCSITaskRingCompletionEntries(ring)		( ( SCSITaskRingCompletion * ) ( ( SCSITaskRingHeader * ) ( ring ) + 1 ) )
+
+
 #pragma mark -
 #pragma mark Non-Exclusive Command Structures
 #pragma mark -